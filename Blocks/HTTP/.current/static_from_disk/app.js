@@ -0,0 +1 @@
+var x = 42;
\ No newline at end of file
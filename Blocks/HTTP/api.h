@@ -27,6 +27,7 @@ SOFTWARE.
 //
 // HTTP server has a POSIX implementation.
 // HTTP client has POSIX, MacOS/iOS and Android/Java implementations (the Java one is untested for a while).
+// The asynchronous HTTP client, `AsyncHTTP()`, has a POSIX implementation.
 //
 // The user does not have to select the implementation, a suitable one will be selected at compile time.
 
@@ -45,6 +46,7 @@ SOFTWARE.
 
 #if defined(CURRENT_POSIX) || defined(CURRENT_WINDOWS) || defined(CURRENT_APPLE_HTTP_CLIENT_POSIX)
 #include "impl/posix_client.h"
+#include "impl/posix_async_client.h"
 #include "impl/posix_server.h"
 #include "chunked_response_parser.h"
 using HTTP_CLIENT = current::http::HTTPClientPOSIX;
@@ -0,0 +1,437 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The asynchronous HTTP client: `AsyncHTTP(GET(url))` returns a `current::Future<HTTPResponseWithBuffer>`,
+// and `AsyncHTTP(GET(url), on_response, on_error)` calls back once the response has been received.
+// Many requests can be in flight at once, without a thread per request.
+//
+// The request is sent by one of a few sending threads, over an idle keep-alive connection to the same host
+// and port if there is one, or over a new one. Then the single thread of the event loop waits for and reads
+// the responses to all the requests in flight. The callbacks are called from these threads, and should be
+// quick.
+//
+// Each request has its own timeout, which bounds connecting as well, after which it fails with
+// `HTTPTimeoutException`. Unlike the blocking client, the response is kept in memory only. The redirects and
+// the retries are sent by the sending threads too, so that a slow host never stalls the event loop.
+
+#ifndef BLOCKS_HTTP_IMPL_POSIX_ASYNC_CLIENT_H
+#define BLOCKS_HTTP_IMPL_POSIX_ASYNC_CLIENT_H
+
+#include "posix_client.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../../Bricks/util/future.h"
+#include "../../../Bricks/util/singleton.h"
+
+namespace current {
+namespace http {
+
+class HTTPAsyncClientPOSIX final {
+ public:
+  using response_callback_t = std::function<void(HTTPResponseWithBuffer&&)>;
+  using error_callback_t = std::function<void(std::exception_ptr)>;
+
+  HTTPAsyncClientPOSIX()
+      : pool_(current::Singleton<HTTPClientConnectionPool>()),
+        terminating_(false),
+        thread_(&HTTPAsyncClientPOSIX::Thread, this) {
+    for (int i = 0; i < kSendingThreadsCount; ++i) {
+      sending_threads_.emplace_back(&HTTPAsyncClientPOSIX::SendingThread, this);
+    }
+  }
+
+  // The requests still in flight fail with `HTTPClientTerminatedException`.
+  ~HTTPAsyncClientPOSIX() {
+    {
+      std::lock_guard<std::mutex> lock(sending_mutex_);
+      sending_terminating_ = true;
+    }
+    sending_condition_variable_.notify_all();
+    for (std::thread& thread : sending_threads_) {
+      thread.join();
+    }
+    terminating_ = true;
+    poller_.Wake();
+    thread_.join();
+  }
+
+  // Exactly one of `on_response` and `on_error` is called, from the threads of the client, or from within
+  // `Submit()` itself if the request could not be prepared.
+  template <typename REQUEST_PARAMS>
+  void Submit(const REQUEST_PARAMS& request_params,
+              std::chrono::milliseconds timeout,
+              response_callback_t on_response,
+              error_callback_t on_error) {
+    std::unique_ptr<InFlightRequest> request(new InFlightRequest(std::move(on_response), std::move(on_error)));
+    request->deadline = std::chrono::steady_clock::now() + timeout;
+    request->allow_redirects = request_params.allow_redirects;
+    request->url_after_redirects = request_params.url;
+    try {
+      ImplWrapper<HTTPClientPOSIX>::PrepareInput(request_params, request->request);
+      request->next_url = URL(request_params.url);
+    } catch (...) {
+      request->on_error(std::current_exception());
+      return;
+    }
+    Enqueue(std::move(request));
+  }
+
+ private:
+  struct InFlightRequest final {
+    // The method, the headers, and the body of the request, as prepared for the blocking client.
+    HTTPClientPOSIX request;
+    response_callback_t on_response;
+    error_callback_t on_error;
+    std::chrono::steady_clock::time_point deadline;
+    bool allow_redirects = false;
+    std::string url_after_redirects;
+    std::set<std::string> all_urls;
+    // The URL the sending thread is to send the request to.
+    URL next_url;
+
+    // The state of the current attempt.
+    URL url;
+    std::unique_ptr<current::net::Connection> connection;
+    bool reused = false;
+    std::string data;
+    std::multimap<std::chrono::steady_clock::time_point, SOCKET>::iterator deadline_entry;
+
+    InFlightRequest(response_callback_t on_response, error_callback_t on_error)
+        : request(impl::HTTPRedirectHelper::ConstructionParams()),
+          on_response(std::move(on_response)),
+          on_error(std::move(on_error)) {}
+  };
+
+  // Hands the request over to the sending threads, or fails it if the client is being destructed.
+  void Enqueue(std::unique_ptr<InFlightRequest> request) {
+    {
+      std::lock_guard<std::mutex> lock(sending_mutex_);
+      if (!sending_terminating_) {
+        sending_queue_.push_back(std::move(request));
+      }
+    }
+    if (request) {
+      Fail<current::net::HTTPClientTerminatedException>(*request);
+    } else {
+      sending_condition_variable_.notify_one();
+    }
+  }
+
+  template <typename EXCEPTION>
+  static void Fail(InFlightRequest& request) {
+    request.connection = nullptr;
+    try {
+      CURRENT_THROW(EXCEPTION());
+    } catch (...) {
+      request.on_error(std::current_exception());
+    }
+  }
+
+  // Sends the enqueued requests, and passes them on to the event loop. Once the client is being destructed,
+  // fails the requests which are yet to be sent.
+  void SendingThread() {
+    while (true) {
+      std::unique_ptr<InFlightRequest> request;
+      bool terminating;
+      {
+        std::unique_lock<std::mutex> lock(sending_mutex_);
+        sending_condition_variable_.wait(lock,
+                                         [this]() { return sending_terminating_ || !sending_queue_.empty(); });
+        if (sending_queue_.empty()) {
+          return;
+        }
+        request = std::move(sending_queue_.front());
+        sending_queue_.pop_front();
+        terminating = sending_terminating_;
+      }
+      if (terminating) {
+        Fail<current::net::HTTPClientTerminatedException>(*request);
+        continue;
+      }
+      try {
+        Send(*request);
+      } catch (...) {
+        request->connection = nullptr;
+        request->on_error(std::current_exception());
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(submitted_mutex_);
+        submitted_.push_back(std::move(request));
+      }
+      poller_.Wake();
+    }
+  }
+
+  // Sends the request to `next_url` over an idle or a new connection, in the blocking mode, and switches
+  // the connection into the non-blocking mode, for the event loop to read the response. Connecting to
+  // the host takes no longer than the time left until the deadline of the request.
+  void Send(InFlightRequest& request) {
+    const URL url = request.next_url;
+    const std::string composed_url = url.ComposeURL();
+    if (request.all_urls.count(composed_url)) {
+      CURRENT_THROW(current::net::HTTPRedirectLoopException());
+    }
+    request.all_urls.insert(composed_url);
+    request.url = url;
+    request.data.clear();
+    const std::string request_headers = request.request.ComposeRequestHeaders(url);
+    const auto connect = [&request, &url]() -> std::unique_ptr<current::net::Connection> {
+      const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          request.deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) {
+        CURRENT_THROW(current::net::HTTPTimeoutException());
+      }
+      try {
+        return std::make_unique<current::net::Connection>(
+            current::net::ClientSocket(url.host, url.port, remaining));
+      } catch (const current::net::SocketConnectTimeoutException&) {
+        CURRENT_THROW(current::net::HTTPTimeoutException());
+      }
+    };
+    request.connection = pool_.Acquire(url.host, url.port);
+    request.reused = static_cast<bool>(request.connection);
+    try {
+      if (!request.connection) {
+        request.connection = connect();
+      }
+      request.connection->BlockingWriteBuffers({request_headers, request.request.request_body_contents_});
+    } catch (const current::net::SocketException&) {
+      // Same as the blocking client, retry once if the idle connection has been closed by the server.
+      if (!request.reused || !impl::IsIdempotentMethod(request.request.request_method_)) {
+        throw;
+      }
+      request.reused = false;
+      request.connection = connect();
+      request.connection->BlockingWriteBuffers({request_headers, request.request.request_body_contents_});
+    }
+    request.connection->SetNonBlocking(true);
+  }
+
+  // Parses the response received in full, or handles the connection closed before that. Returns the request
+  // if it is to be sent again, to follow the redirect, or to retry over a new connection.
+  std::unique_ptr<InFlightRequest> Complete(std::unique_ptr<InFlightRequest> request, size_t length) {
+    InFlightRequest& r = *request;
+    HTTPResponseWithBuffer output;
+    try {
+      if (!length) {
+        if (r.reused && r.data.empty() && impl::IsIdempotentMethod(r.request.request_method_)) {
+          r.all_urls.erase(r.url.ComposeURL());
+          r.connection = nullptr;
+          r.next_url = r.url;
+          return request;
+        }
+        CURRENT_THROW(current::net::ConnectionResetByPeer());
+      }
+      // The response has been received in full, so the parser does not read from the socket.
+      current::net::Connection& connection = *r.connection;
+      connection.PushBackInput(r.data.data(), length);
+      const current::net::GenericHTTPRequestData<impl::HTTPRedirectHelper> response(connection);
+      if (r.data.length() == length && !connection.HasPendingInput() &&
+          impl::ResponseAllowsKeepAlive(r.request.request_method_, response)) {
+        connection.SetNonBlocking(false);
+        pool_.Release(r.url.host, r.url.port, std::move(r.connection));
+      }
+      r.connection = nullptr;
+      const int response_code_as_int = atoi(response.RawPath().c_str());
+      if (response_code_as_int >= 300 && response_code_as_int <= 399 && !response.location.empty()) {
+        if (!r.allow_redirects) {
+          CURRENT_THROW(current::net::HTTPRedirectNotAllowedException());
+        }
+        const URL redirect_url(response.location, r.url);
+        r.url_after_redirects = redirect_url.ComposeURL();
+        r.next_url = redirect_url;
+        return request;
+      }
+      output.url = r.url_after_redirects;
+      output.code = HTTPResponseCode(response_code_as_int);
+      output.headers = response.headers();
+      output.body = response.Body();
+    } catch (...) {
+      r.connection = nullptr;
+      r.on_error(std::current_exception());
+      return nullptr;
+    }
+    r.on_response(std::move(output));
+    return nullptr;
+  }
+
+  void Thread() {
+    std::unordered_map<SOCKET, std::unique_ptr<InFlightRequest>> in_flight;
+    std::multimap<std::chrono::steady_clock::time_point, SOCKET> deadlines;
+    std::vector<SOCKET> ready;
+    std::vector<char> buffer(kReadBufferSize);
+
+    const auto start_waiting = [this, &in_flight, &deadlines](std::unique_ptr<InFlightRequest> request) {
+      const SOCKET socket = request->connection->socket;
+      poller_.Add(socket);
+      request->deadline_entry = deadlines.emplace(request->deadline, socket);
+      in_flight[socket] = std::move(request);
+    };
+    const auto stop_waiting = [this, &in_flight, &deadlines](SOCKET socket) {
+      const auto it = in_flight.find(socket);
+      std::unique_ptr<InFlightRequest> request = std::move(it->second);
+      in_flight.erase(it);
+      deadlines.erase(request->deadline_entry);
+      poller_.Remove(socket);
+      return request;
+    };
+
+    while (!terminating_) {
+      auto timeout = std::chrono::milliseconds(-1);
+      if (!deadlines.empty()) {
+        const auto remaining = deadlines.begin()->first - std::chrono::steady_clock::now();
+        // Rounded up, not to wake up just before the deadline.
+        timeout = std::max(std::chrono::milliseconds(0),
+                           std::chrono::duration_cast<std::chrono::milliseconds>(remaining) +
+                               std::chrono::milliseconds(1));
+      }
+      try {
+        poller_.Wait(ready, timeout);
+      } catch (const current::Exception& e) {                     // LCOV_EXCL_LINE
+        std::cerr << "HTTP client poll failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
+        break;                                                     // LCOV_EXCL_LINE
+      }
+      if (terminating_) {
+        break;
+      }
+
+      std::vector<std::unique_ptr<InFlightRequest>> submitted;
+      {
+        std::lock_guard<std::mutex> lock(submitted_mutex_);
+        submitted.swap(submitted_);
+      }
+      for (auto& request : submitted) {
+        start_waiting(std::move(request));
+      }
+
+      for (const SOCKET ready_socket : ready) {
+        const auto it = in_flight.find(ready_socket);
+        if (it == in_flight.end()) {
+          continue;  // LCOV_EXCL_LINE
+        }
+        InFlightRequest& request = *it->second;
+        bool closed = false;
+        try {
+          const size_t read_count = request.connection->NonBlockingRead(&buffer[0], buffer.size());
+          request.data.append(&buffer[0], read_count);
+        } catch (const current::net::SocketException&) {
+          closed = true;
+        }
+        // The framing of the responses is the same as that of the requests, by `Content-Length` or chunked.
+        const size_t length =
+            current::net::CompleteHTTPRequestLength(request.data.data(), request.data.length());
+        if (length || closed) {
+          std::unique_ptr<InFlightRequest> next = Complete(stop_waiting(ready_socket), length);
+          if (next) {
+            Enqueue(std::move(next));
+          }
+        }
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      while (!deadlines.empty() && deadlines.begin()->first <= now) {
+        Fail<current::net::HTTPTimeoutException>(*stop_waiting(deadlines.begin()->second));
+      }
+    }
+
+    // Terminating. Fail the requests which have not been completed. The sending threads are joined by now.
+    {
+      std::lock_guard<std::mutex> lock(submitted_mutex_);
+      for (auto& request : submitted_) {
+        const SOCKET socket = request->connection->socket;
+        in_flight[socket] = std::move(request);
+      }
+      submitted_.clear();
+    }
+    for (auto& request : in_flight) {
+      Fail<current::net::HTTPClientTerminatedException>(*request.second);
+    }
+  }
+
+  enum { kReadBufferSize = 16 * 1024 };
+  // The requests are sent, and the connections are established, by several threads, for a slow host
+  // to delay the other requests being sent as little as possible.
+  enum { kSendingThreadsCount = 4 };
+
+  // Initialized first, for the connection pool to outlive this client.
+  HTTPClientConnectionPool& pool_;
+  std::atomic_bool terminating_;
+  current::net::SocketReadinessPoller poller_;
+  std::mutex submitted_mutex_;
+  std::vector<std::unique_ptr<InFlightRequest>> submitted_;
+  std::mutex sending_mutex_;
+  std::condition_variable sending_condition_variable_;
+  std::deque<std::unique_ptr<InFlightRequest>> sending_queue_;
+  bool sending_terminating_ = false;
+  std::thread thread_;
+  std::vector<std::thread> sending_threads_;
+};
+
+// Sends the request, and calls `on_response(HTTPResponseWithBuffer&&)` or `on_error(std::exception_ptr)`.
+template <typename REQUEST_PARAMS, typename ON_RESPONSE, typename ON_ERROR>
+inline void AsyncHTTP(const REQUEST_PARAMS& request_params,
+                      ON_RESPONSE&& on_response,
+                      ON_ERROR&& on_error,
+                      std::chrono::milliseconds timeout = std::chrono::seconds(30)) {
+  current::Singleton<HTTPAsyncClientPOSIX>().Submit(
+      request_params, timeout, std::forward<ON_RESPONSE>(on_response), std::forward<ON_ERROR>(on_error));
+}
+
+// Sends the request, and returns the future response. `Go()` on it rethrows the error, if any.
+template <typename REQUEST_PARAMS>
+inline Future<HTTPResponseWithBuffer> AsyncHTTP(const REQUEST_PARAMS& request_params,
+                                                std::chrono::milliseconds timeout = std::chrono::seconds(30)) {
+  const auto promise = std::make_shared<std::promise<HTTPResponseWithBuffer>>();
+  Future<HTTPResponseWithBuffer> result(promise->get_future());
+  AsyncHTTP(request_params,
+            [promise](HTTPResponseWithBuffer&& response) { promise->set_value(std::move(response)); },
+            [promise](std::exception_ptr error) { promise->set_exception(error); },
+            timeout);
+  return result;
+}
+
+}  // namespace http
+}  // namespace current
+
+using current::http::AsyncHTTP;
+
+#endif  // BLOCKS_HTTP_IMPL_POSIX_ASYNC_CLIENT_H
@@ -30,14 +30,20 @@ SOFTWARE.
 
 #include "../types.h"
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <set>
+#include <vector>
 
 #include "../../URL/url.h"
 
 #include "../../../Bricks/net/http/http.h"
 #include "../../../Bricks/file/file.h"
+#include "../../../Bricks/strings/util.h"
+#include "../../../Bricks/util/singleton.h"
 
 namespace current {
 namespace http {
@@ -57,8 +63,113 @@ struct HTTPRedirectHelper : current::net::HTTPDefaultHelper {
     current::net::HTTPDefaultHelper::OnHeader(key, value);
   }
 };
+
+// The requests which can be sent again if the connection fails, as repeating them has the same effect on
+// the server as sending them once, RFC 7231, section 4.2.2.
+inline bool IsIdempotentMethod(const std::string& method) {
+  return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS";
+}
+
+// The connection can only be reused if the response has been read in full, and the server keeps it open.
+// The body is read in full only if its length is known in advance, and the response to `HEAD` has no body,
+// whatever its `Content-Length` says.
+template <typename RESPONSE>
+bool ResponseAllowsKeepAlive(const std::string& request_method, const RESPONSE& response) {
+  const auto& headers = response.headers();
+  if (request_method == "HEAD" || !headers.Has("Content-Length") || headers.Has("Transfer-Encoding")) {
+    return false;
+  }
+  if (headers.Has("Connection")) {
+    const std::string connection = current::strings::ToLower(headers.Get("Connection"));
+    if (connection.find("close") != std::string::npos) {
+      return false;
+    } else if (connection.find("keep-alive") != std::string::npos) {
+      return true;
+    }
+  }
+  return response.HTTPVersion() == "HTTP/1.1";
+}
+
 }  // namespace current::http::impl
 
+// The idle keep-alive connections of the HTTP client, to be reused by the subsequent requests to the same
+// host and port, so that those do not pay for establishing a new TCP connection each time.
+// A connection is only reused if it has been idle for less than `max_idle_time`, and if it is still open
+// and has no unexpected data to read. At most `max_idle_connections_per_host` connections are kept per host.
+class HTTPClientConnectionPool final {
+ public:
+  void SetKeepAliveParameters(std::chrono::milliseconds max_idle_time, size_t max_idle_connections_per_host) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_idle_time_ = max_idle_time;
+    max_idle_connections_per_host_ = max_idle_connections_per_host;
+    for (auto& host : idle_) {
+      if (host.second.size() > max_idle_connections_per_host_) {
+        host.second.erase(host.second.begin(), host.second.end() - max_idle_connections_per_host_);
+      }
+    }
+  }
+
+  // Returns the most recently used idle connection to `host:port`, or `nullptr` if there is none.
+  std::unique_ptr<current::net::Connection> Acquire(const std::string& host, int port) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = idle_.find(Key(host, port));
+    if (it == idle_.end()) {
+      return nullptr;
+    }
+    std::vector<IdleConnection>& connections = it->second;
+    while (!connections.empty()) {
+      IdleConnection candidate = std::move(connections.back());
+      connections.pop_back();
+      if (now - candidate.since < max_idle_time_ && candidate.connection->IsIdle()) {
+        return std::move(candidate.connection);
+      }
+    }
+    return nullptr;
+  }
+
+  void Release(const std::string& host, int port, std::unique_ptr<current::net::Connection> connection) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_idle_connections_per_host_) {
+      std::vector<IdleConnection>& connections = idle_[Key(host, port)];
+      if (connections.size() >= max_idle_connections_per_host_) {
+        connections.erase(connections.begin());
+      }
+      connections.push_back(IdleConnection(std::move(connection)));
+    }
+  }
+
+  size_t IdleConnectionsCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t result = 0u;
+    for (const auto& host : idle_) {
+      result += host.second.size();
+    }
+    return result;
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+  }
+
+ private:
+  struct IdleConnection final {
+    std::unique_ptr<current::net::Connection> connection;
+    std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now();
+    explicit IdleConnection(std::unique_ptr<current::net::Connection> connection)
+        : connection(std::move(connection)) {}
+  };
+
+  static std::string Key(const std::string& host, int port) { return host + ':' + current::ToString(port); }
+
+  mutable std::mutex mutex_;
+  // Shorter than the default idle timeout of `HTTPServerPOSIX`, so that the server rarely closes them first.
+  std::chrono::milliseconds max_idle_time_ = std::chrono::seconds(15);
+  size_t max_idle_connections_per_host_ = 8u;
+  std::map<std::string, std::vector<IdleConnection>> idle_;
+};
+
 template <class HTTP_HELPER>
 class GenericHTTPClientPOSIX final {
  private:
@@ -83,32 +194,34 @@ class GenericHTTPClientPOSIX final {
         CURRENT_THROW(current::net::HTTPRedirectLoopException());
       }
       all_urls.insert(composed_url);
-      current::net::Connection connection(
-          current::net::Connection(current::net::ClientSocket(parsed_url.host, parsed_url.port)));
-      connection.BlockingWrite(
-          request_method_ + ' ' + parsed_url.path + parsed_url.ComposeParameters() + " HTTP/1.1\r\n", true);
-      connection.BlockingWrite("Host: " + parsed_url.host + "\r\n", true);
-      if (!request_user_agent_.empty()) {
-        connection.BlockingWrite("User-Agent: " + request_user_agent_ + "\r\n", true);
-      }
-      for (const auto& h : request_headers_) {
-        connection.BlockingWrite(h.header + ": " + h.value + "\r\n", true);
-      }
-      if (!request_headers_.cookies.empty()) {
-        connection.BlockingWrite("Cookie: " + request_headers_.CookiesAsString() + "\r\n", true);
-      }
-      if (!request_body_content_type_.empty()) {
-        connection.BlockingWrite("Content-Type: " + request_body_content_type_ + "\r\n", true);
+      const std::string request_headers = ComposeRequestHeaders(parsed_url);
+      auto& pool = current::Singleton<HTTPClientConnectionPool>();
+      std::unique_ptr<current::net::Connection> connection = pool.Acquire(parsed_url.host, parsed_url.port);
+      const bool reused = static_cast<bool>(connection);
+      const auto connect = [&parsed_url]() {
+        return std::make_unique<current::net::Connection>(
+            current::net::ClientSocket(parsed_url.host, parsed_url.port));
+      };
+      try {
+        if (!connection) {
+          connection = connect();
+        }
+        SendRequestAndAwaitResponse(*connection, request_headers);
+      } catch (const current::net::SocketException&) {
+        // The idle connection may have been closed by the server just as the request was being sent.
+        // Retry once, over a new connection, if no byte of the response has been received. The server may
+        // still have acted on the request, so only the idempotent requests are retried.
+        if (!reused || !impl::IsIdempotentMethod(request_method_)) {
+          throw;
+        }
+        connection = connect();
+        SendRequestAndAwaitResponse(*connection, request_headers);
       }
-      if (!request_body_contents_.empty()) {
-        connection.BlockingWrite("Content-Length: " + std::to_string(request_body_contents_.length()) + "\r\n",
-                                 true);
-        connection.BlockingWrite("\r\n", true);
-        connection.BlockingWrite(request_body_contents_, false);
-      } else {
-        connection.BlockingWrite("\r\n", false);
+      // Once the response has started, its errors are not retried, as it may have been partially received.
+      http_request_.reset(new CustomHTTPRequestData(*connection, request_data_construction_params_));
+      if (impl::ResponseAllowsKeepAlive(request_method_, *http_request_)) {
+        pool.Release(parsed_url.host, parsed_url.port, std::move(connection));
       }
-      http_request_.reset(new CustomHTTPRequestData(connection, request_data_construction_params_));
       // TODO(dkorolev): Rename `Path()`, it's only called so now because of HTTP request/response format.
       // Elaboration:
       // HTTP request  message is: `GET /path HTTP/1.1`, "/path" is the second component of it.
@@ -129,6 +242,39 @@ class GenericHTTPClientPOSIX final {
 
   const CustomHTTPRequestData& HTTPRequest() const { return *http_request_.get(); }
 
+  // Everything up to and including the blank line after the headers, so that the request is sent
+  // with a single `sendmsg()` call, along with its body.
+  std::string ComposeRequestHeaders(const URL& url) const {
+    std::string result = request_method_ + ' ' + url.path + url.ComposeParameters() + " HTTP/1.1\r\n";
+    result += "Host: " + url.host + "\r\n";
+    if (!request_user_agent_.empty()) {
+      result += "User-Agent: " + request_user_agent_ + "\r\n";
+    }
+    for (const auto& h : request_headers_) {
+      result += h.header + ": " + h.value + "\r\n";
+    }
+    if (!request_headers_.cookies.empty()) {
+      result += "Cookie: " + request_headers_.CookiesAsString() + "\r\n";
+    }
+    if (!request_body_content_type_.empty()) {
+      result += "Content-Type: " + request_body_content_type_ + "\r\n";
+    }
+    if (!request_body_contents_.empty()) {
+      result += "Content-Length: " + std::to_string(request_body_contents_.length()) + "\r\n";
+    }
+    result += "\r\n";
+    return result;
+  }
+
+ private:
+  // Sends the request, and waits for the first byte of the response, which is put back for it to be parsed.
+  void SendRequestAndAwaitResponse(current::net::Connection& connection, const std::string& request_headers) {
+    connection.BlockingWriteBuffers({request_headers, request_body_contents_});
+    char first_byte;
+    connection.BlockingRead(&first_byte, 1u);
+    connection.PushBackInput(&first_byte, 1u);
+  }
+
  public:
   // Request parameters.
   std::string request_method_ = "";
@@ -28,22 +28,40 @@ SOFTWARE.
 #ifndef BLOCKS_HTTP_IMPL_POSIX_SERVER_H
 #define BLOCKS_HTTP_IMPL_POSIX_SERVER_H
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <string>
 #include <map>
 #include <memory>
+#include <set>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 #include <iostream>  // TODO(dkorolev): More robust logging here.
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef CURRENT_WINDOWS
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
 #include "../types.h"
 #include "../request.h"
 
+#include "routes.h"
+
 #include "../../URL/url.h"
 
 #include "../../../Bricks/net/exceptions.h"
 #include "../../../Bricks/net/http/http.h"
 #include "../../../Bricks/time/chrono.h"
 #include "../../../Bricks/strings/printf.h"
+#include "../../../Bricks/strings/strings.h"
 #include "../../../Bricks/util/accumulative_scoped_deleter.h"
 
 namespace current {
@@ -75,31 +93,233 @@ struct HandlerDoesNotExistException : current::net::HTTPException {
   using current::net::HTTPException::HTTPException;
 };
 
-// Helper to serve a static file.
+// Helper to serve a static file from disk.
+//
+// The file is opened on every request, and its contents are sent with `sendfile()`, so that it is neither
+// kept in memory nor copied through the user space. The `ETag` and the `Last-Modified` of the response are
+// derived from the size and the modification time of the file. The requests with the matching `If-None-Match`,
+// or, if there is none, with the `If-Modified-Since` not earlier than the modification time, get `304`.
+// A single `Range: bytes=...` is served as `206 Partial Content`, unless `If-Range` does not match the `ETag`.
+// If `gzip_file_name` is set, and the client accepts gzip, the precompressed file is sent instead, with
+// `Content-Encoding: gzip`; the range then applies to the compressed contents, as it should.
 // TODO(dkorolev): Expose it externally under a better name, and add a comment/example.
 struct StaticFileServer {
-  std::string body;
+  std::string file_name;
+  std::string gzip_file_name;  // Empty if there is no gzip-precompressed version of the file.
   std::string content_type;
-  explicit StaticFileServer(const std::string& body, const std::string& content_type)
-      : body(body), content_type(content_type) {}
+  StaticFileServer(const std::string& file_name,
+                   const std::string& gzip_file_name,
+                   const std::string& content_type)
+      : file_name(file_name), gzip_file_name(gzip_file_name), content_type(content_type) {}
+
   void operator()(Request r) {
-    if (r.method == "GET") {
-      r.connection.SendHTTPResponse(body, HTTPResponseCode.OK, content_type);
-    } else {
+    if (r.method != "GET") {
       r.connection.SendHTTPResponse(
           current::net::DefaultMethodNotAllowedMessage(), HTTPResponseCode.MethodNotAllowed, "text/html");
+      return;
+    }
+    const bool gzip = !gzip_file_name.empty() && r.connection.RequestAcceptsEncoding("gzip");
+    const File file(gzip ? gzip_file_name : file_name);
+    if (!file) {
+      r.connection.SendHTTPResponse(
+          current::net::DefaultFourOhFourMessage(), HTTPResponseCode.NotFound, "text/html");
+      return;
+    }
+    const std::string etag =
+        current::strings::Printf("\"%llx-%llx%s\"",
+                                 static_cast<unsigned long long>(file.size),
+                                 static_cast<unsigned long long>(file.last_modified.count()),
+                                 gzip ? "-gz" : "");
+    current::net::http::Headers headers;
+    headers.Set("ETag", etag);
+    headers.Set("Last-Modified", FormatDateTimeAsIMFFix(file.last_modified));
+    headers.Set("Accept-Ranges", "bytes");
+    if (!gzip_file_name.empty()) {
+      headers.Set("Vary", "Accept-Encoding");
+    }
+    if (gzip) {
+      headers.Set("Content-Encoding", "gzip");
+    }
+    if (current::net::http::NotModified(r.headers, etag, file.last_modified)) {
+      r.connection.SendHTTPResponse("", HTTPResponseCode.NotModified, content_type, headers);
+      return;
+    }
+    uint64_t begin = 0u;
+    uint64_t end = file.size;
+    if (r.headers.Has("Range") && (!r.headers.Has("If-Range") || r.headers.Get("If-Range") == etag)) {
+      const RangeParseResult range = ParseRange(r.headers.Get("Range"), file.size, begin, end);
+      if (range == RangeParseResult::Unsatisfiable) {
+        headers.Set("Content-Range",
+                    current::strings::Printf("bytes */%llu", static_cast<unsigned long long>(file.size)));
+        r.connection.SendHTTPResponse("", HTTPResponseCode.RequestedRangeNotSatisfiable, content_type, headers);
+        return;
+      } else if (range == RangeParseResult::Range) {
+        headers.Set("Content-Range",
+                    current::strings::Printf("bytes %llu-%llu/%llu",
+                                             static_cast<unsigned long long>(begin),
+                                             static_cast<unsigned long long>(end - 1u),
+                                             static_cast<unsigned long long>(file.size)));
+        r.connection.SendHTTPResponseFromFile(
+            file.fd, begin, end - begin, HTTPResponseCode.PartialContent, content_type, headers);
+        return;
+      }
+    }
+    r.connection.SendHTTPResponseFromFile(file.fd, 0u, file.size, HTTPResponseCode.OK, content_type, headers);
+  }
+
+ private:
+  // The file opened for reading, along with its size and modification time. Closed in the destructor.
+  struct File final {
+    int fd = -1;
+    uint64_t size = 0u;
+    std::chrono::microseconds last_modified = std::chrono::microseconds(0);
+
+    explicit File(const std::string& file_name) {
+#ifndef CURRENT_WINDOWS
+      fd = ::open(file_name.c_str(), O_RDONLY);
+#else
+      fd = ::_open(file_name.c_str(), _O_RDONLY | _O_BINARY);
+#endif
+      struct stat info;
+      if (fd >= 0 && (::fstat(fd, &info) || (info.st_mode & S_IFMT) != S_IFREG)) {
+        Close();
+      }
+      if (fd >= 0) {
+        size = static_cast<uint64_t>(info.st_size);
+        // HTTP dates have no subseconds, so the modification time is in whole seconds.
+        last_modified = std::chrono::microseconds(static_cast<int64_t>(info.st_mtime) * 1000000ll);
+      }
+    }
+    ~File() { Close(); }
+    operator bool() const { return fd >= 0; }
+
+   private:
+    void Close() {
+      if (fd >= 0) {
+#ifndef CURRENT_WINDOWS
+        ::close(fd);
+#else
+        ::_close(fd);
+#endif
+        fd = -1;
+      }
+    }
+    File(const File&) = delete;
+    void operator=(const File&) = delete;
+  };
+
+  // Parses the value of the `Range` header into the half-open `[begin, end)` within the file of `size` bytes.
+  // Only a single range is supported: for multiple ranges, as well as for an invalid header, the whole file
+  // is served, which the RFC 7233 allows.
+  enum class RangeParseResult { Ignored, Range, Unsatisfiable };
+  static RangeParseResult ParseRange(const std::string& value, uint64_t size, uint64_t& begin, uint64_t& end) {
+    const std::string prefix = "bytes=";
+    if (value.compare(0u, prefix.length(), prefix) || value.find(',') != std::string::npos) {
+      return RangeParseResult::Ignored;
+    }
+    const std::string range = current::strings::Trim(value.substr(prefix.length()));
+    const size_t dash = range.find('-');
+    if (dash == std::string::npos || range.find_first_not_of("0123456789-") != std::string::npos ||
+        range.find('-', dash + 1u) != std::string::npos) {
+      return RangeParseResult::Ignored;
     }
+    const std::string first = range.substr(0u, dash);
+    const std::string last = range.substr(dash + 1u);
+    if (first.empty()) {
+      // The suffix range, `bytes=-N`, is the last N bytes of the file.
+      if (last.empty()) {
+        return RangeParseResult::Ignored;
+      }
+      const uint64_t suffix_length = current::FromString<uint64_t>(last);
+      if (!suffix_length || !size) {
+        return RangeParseResult::Unsatisfiable;
+      }
+      begin = size - std::min(suffix_length, size);
+      end = size;
+    } else {
+      begin = current::FromString<uint64_t>(first);
+      if (!last.empty() && current::FromString<uint64_t>(last) < begin) {
+        return RangeParseResult::Ignored;
+      }
+      if (begin >= size) {
+        return RangeParseResult::Unsatisfiable;
+      }
+      end = last.empty() ? size : std::min(current::FromString<uint64_t>(last) + 1u, size);
+    }
+    return RangeParseResult::Range;
   }
 };
 
 // HTTP server bound to a specific port.
+//
+// The listening thread runs the event loop: it accepts the connections, and reads the requests from them
+// in the non-blocking mode, as the data arrives, so that slow clients do not hold up the others.
+// Once a request has been received in full, its connection is switched back to the blocking mode,
+// and is handed over to the pool of worker threads, which parse the request and run the handlers.
+//
+// The connections are kept alive, as HTTP/1.1 has it. Once the response has been sent, the connection
+// returns to the event loop, to wait for the next request, up to `max_requests_per_connection` requests,
+// and for no longer than `keep_alive_timeout` in between. The pipelined requests, those sent before
+// the response to the previous one has been received, are served one after another, in order.
 class HTTPServerPOSIX final {
+  // The handler of the route, and whether it reads the request body as it arrives, see `RegisterStreaming()`.
+  struct Handler final {
+    std::function<void(Request)> f;
+    bool streamed_body = false;
+    size_t max_body_length = static_cast<size_t>(-1);
+    Handler() = default;
+    explicit Handler(std::function<void(Request)> f) : f(std::move(f)) {}
+    Handler(std::function<void(Request)> f, size_t max_body_length)
+        : f(std::move(f)), streamed_body(true), max_body_length(max_body_length) {}
+  };
+  using handler_t = Handler;
+  using routes_t = RoutesRadixTree<handler_t>;
+
  public:
   // The constructor starts listening on the specified port.
   // Since instances of `HTTPServerPOSIX` are created via a singleton,
   // a listening thread will only be created once per port, on the first access to that port.
-  explicit HTTPServerPOSIX(int port)
-      : terminating_(false), port_(port), thread_(&HTTPServerPOSIX::Thread, this, current::net::Socket(port)) {}
+  explicit HTTPServerPOSIX(int port, size_t worker_threads = DefaultWorkerThreadsCount())
+      : terminating_(false), port_(port), thread_(&HTTPServerPOSIX::Thread, this, current::net::Socket(port)) {
+    for (size_t i = 0; i < std::max(worker_threads, static_cast<size_t>(1u)); ++i) {
+      workers_.emplace_back(&HTTPServerPOSIX::Worker, this);
+    }
+  }
+
+  // The handlers may block on writing the responses to slow clients, so there are more workers than cores.
+  static size_t DefaultWorkerThreadsCount() {
+    return std::max(static_cast<size_t>(8u), static_cast<size_t>(std::thread::hardware_concurrency()) * 2u);
+  }
+
+  // The limits for the keep-alive connections. A connection which has sent no data for `keep_alive_timeout`,
+  // while waiting for its first or next request, is closed. Setting `max_requests_per_connection` to one
+  // disables keep-alive.
+  void SetKeepAliveParameters(std::chrono::milliseconds keep_alive_timeout,
+                              size_t max_requests_per_connection) {
+    keep_alive_timeout_ms_ = keep_alive_timeout.count();
+    max_requests_per_connection_ = max_requests_per_connection;
+    // Have the event loop apply the new timeout to the connections already idle.
+    poller_.Wake();
+  }
+
+  // The compression of the responses, for the clients which accept gzip or deflate. When enabled, the responses
+  // of the content types which compress well, such as JSON, are compressed if their bodies are at least
+  // `min_length` bytes long, and the chunked ones always are, chunk by chunk, as they are being sent.
+  void SetResponseCompressionParameters(bool enabled,
+                                        size_t min_length = kDefaultResponseCompressionMinLength) {
+    response_compression_enabled_ = enabled;
+    response_compression_min_length_ = min_length;
+  }
+
+  // The limits on the requests buffered by the event loop before they are handed over to the workers.
+  // The requests with more than `max_headers_size` bytes of headers are responded to with `431`, and those
+  // with more than `max_body_size` bytes of body with `413`, and their connections are closed. The bodies
+  // of the routes registered via `RegisterStreaming()` are not buffered, and have limits of their own.
+  void SetRequestSizeLimits(size_t max_headers_size = kDefaultMaxRequestHeadersSize,
+                            size_t max_body_size = kDefaultMaxRequestBodySize) {
+    max_request_headers_size_ = max_headers_size;
+    max_request_body_size_ = max_body_size;
+  }
 
   // The destructor closes the socket.
   // Note that the destructor will only be run on the shutdown of the binary,
@@ -107,23 +327,20 @@ class HTTPServerPOSIX final {
   ~HTTPServerPOSIX() {
     terminating_ = true;
     // Notify the server thread that it should terminate.
-    // Effectively, call `HTTP(GET("/healthz"))`, but in a way that avoids client <=> server dependency.
-    // LCOV_EXCL_START
-    try {
-      // TODO(dkorolev): This should always use the POSIX implemenation of the client, nothing fancier.
-      // It is a safe call, since the server itself is POSIX, so the architecture we are on is POSIX-friendly.
-      current::net::Connection(current::net::ClientSocket("localhost", port_))
-          .BlockingWrite("GET /healthz HTTP/1.1\r\n\r\n", true);
-    } catch (const current::Exception&) {
-      // It is guaranteed that after `terminated_` is set the server will be terminated on the next request,
-      // but it might so happen that that terminating request will happen between `terminating_ = true`
-      // and the consecutive request. Which is perfectly fine, since it implies that the server has terminated.
-    }
-    // LCOV_EXCL_STOP
+    poller_.Wake();
     // Wait for the thread to terminate.
     if (thread_.joinable()) {
       thread_.join();
     }
+    // Then stop the workers. The requests still in the queue are dropped, along with their connections.
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      workers_terminating_ = true;
+    }
+    queue_condition_variable_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
   }
 
   // The bare `Join()` method is only used by small scripts to run the server indefinitely,
@@ -154,7 +371,7 @@ class HTTPServerPOSIX final {
                                 F& handler) {
     std::lock_guard<std::mutex> lock(mutex_);
     return DoRegisterHandler(
-        path, [&handler](Request r) { handler(std::move(r)); }, path_args_count_mask, POLICY);
+        path, handler_t([&handler](Request r) { handler(std::move(r)); }), path_args_count_mask, POLICY);
   }
 
   template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt>
@@ -162,20 +379,47 @@ class HTTPServerPOSIX final {
                                 const URLPathArgs::CountMask path_args_count_mask,
                                 std::function<void(Request)> handler) {
     std::lock_guard<std::mutex> lock(mutex_);
-    return DoRegisterHandler(path, handler, path_args_count_mask, POLICY);
+    return DoRegisterHandler(path, handler_t(handler), path_args_count_mask, POLICY);
   }
 
   // Two argument version registers handler with no URL path arguments.
   template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt, typename F>
   HTTPRoutesScopeEntry Register(const std::string& path, F& handler) {
     std::lock_guard<std::mutex> lock(mutex_);
-    return DoRegisterHandler(
-        path, [&handler](Request r) { handler(std::move(r)); }, URLPathArgs::CountMask::None, POLICY);
+    return DoRegisterHandler(path,
+                             handler_t([&handler](Request r) { handler(std::move(r)); }),
+                             URLPathArgs::CountMask::None,
+                             POLICY);
   }
   template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt>
   HTTPRoutesScopeEntry Register(const std::string& path, std::function<void(Request)> handler) {
     std::lock_guard<std::mutex> lock(mutex_);
-    return DoRegisterHandler(path, handler, URLPathArgs::CountMask::None, POLICY);
+    return DoRegisterHandler(path, handler_t(handler), URLPathArgs::CountMask::None, POLICY);
+  }
+
+  // Registers the handler which reads the request body piece by piece, via `r.BodyStream()`, instead of
+  // `r.body`. For the uploads which should not be held in memory in full.
+  //
+  // Unless the request has been received in full right away, it is handed over to the handler as soon as its
+  // headers are, and the rest of the body is only received as the handler reads it. Then the handler
+  // occupies a worker thread for as long as the client takes to send the body, and the connection
+  // is not kept alive. The bodies longer than `max_body_length` bytes fail `Read()`, and, unless
+  // the handler has responded otherwise, get `413 Request Entity Too Large`.
+  template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt>
+  HTTPRoutesScopeEntry RegisterStreaming(const std::string& path,
+                                         const URLPathArgs::CountMask path_args_count_mask,
+                                         size_t max_body_length,
+                                         std::function<void(Request)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return DoRegisterHandler(path, handler_t(handler, max_body_length), path_args_count_mask, POLICY);
+  }
+  template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt>
+  HTTPRoutesScopeEntry RegisterStreaming(const std::string& path,
+                                         size_t max_body_length,
+                                         std::function<void(Request)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return DoRegisterHandler(
+        path, handler_t(handler, max_body_length), URLPathArgs::CountMask::None, POLICY);
   }
 
   void UnRegister(const std::string& path,
@@ -200,25 +444,34 @@ class HTTPServerPOSIX final {
         }
       }
     }
+    RebuildRoutes();
   }
 
+  // Serves the files from `dir` from disk, see `StaticFileServer`. The files `X.gz` next to the files `X` are
+  // not served on their own, but are the gzip-precompressed versions of `X`, for the clients that accept gzip.
   HTTPRoutesScope ServeStaticFilesFrom(const std::string& dir, const std::string& route_prefix = "/") {
+    std::set<std::string> files;
+    current::FileSystem::ScanDir(dir, [&files](const std::string& file) { files.insert(file); });
     HTTPRoutesScope scope;
-    current::FileSystem::ScanDir(
-        dir,
-        [this, &dir, &route_prefix, &scope](const std::string& file) {
-          const std::string content_type(current::net::GetFileMimeType(file, ""));
-          if (!content_type.empty()) {
-            // TODO(dkorolev): Wrap keeping file contents into a singleton
-            // that keeps a map from a (SHA256) hash to the contents.
-            auto static_file_server = std::make_unique<StaticFileServer>(
-                current::FileSystem::ReadFileAsString(current::FileSystem::JoinPath(dir, file)), content_type);
-            scope += Register(route_prefix + file, *static_file_server);
-            static_file_servers_.push_back(std::move(static_file_server));
-          } else {
-            CURRENT_THROW(current::net::CannotServeStaticFilesOfUnknownMIMEType(file));
-          }
-        });
+    for (const auto& file : files) {
+      const std::string gzip_suffix = ".gz";
+      if (file.length() > gzip_suffix.length() &&
+          file.compare(file.length() - gzip_suffix.length(), gzip_suffix.length(), gzip_suffix) == 0 &&
+          files.count(file.substr(0u, file.length() - gzip_suffix.length()))) {
+        continue;
+      }
+      const std::string content_type(current::net::GetFileMimeType(file, ""));
+      if (!content_type.empty()) {
+        auto static_file_server = std::make_unique<StaticFileServer>(
+            current::FileSystem::JoinPath(dir, file),
+            files.count(file + gzip_suffix) ? current::FileSystem::JoinPath(dir, file + gzip_suffix) : "",
+            content_type);
+        scope += Register(route_prefix + file, *static_file_server);
+        static_file_servers_.push_back(std::move(static_file_server));
+      } else {
+        CURRENT_THROW(current::net::CannotServeStaticFilesOfUnknownMIMEType(file));
+      }
+    }
     return scope;
   }
 
@@ -230,113 +483,365 @@ class HTTPServerPOSIX final {
   }
 
  private:
-  void FindHandler(const std::string& path,
-                   std::function<void(Request)>& output_handler,
-                   URLPathArgs& output_url_args) {
-    // Just `return` is safe. Uninitialized `output_handler` would be interpreted as "no handler found".
+  // Returns the handler for `path` from the current routes table, or `nullptr` if there is none.
+  // The returned handler belongs to `routes`, which the caller must keep for as long as it uses the handler.
+  static const handler_t* FindHandler(const routes_t& routes,
+                                      const std::string& path,
+                                      URLPathArgs& output_url_args) {
     // LCOV_EXCL_START
     if (path.empty()) {
       std::cerr << "HTTP: path is empty.\n";
-      return;
+      return nullptr;
     }
     if (path[0] != '/') {
       std::cerr << "HTTP: path does not start with a slash.\n";
-      return;
+      return nullptr;
     }
     // LCOV_EXCL_STOP
 
-    // Work with the path by trying to match the full one, then the one with the last component removed,
-    // then the one with two last components removed, etc.
-    // As a component is removed, it's removed from `base_path` and is added to `url_args`.
-    std::string& remaining_path = output_url_args.base_path;
-    remaining_path = path;
-
-    // Friendly reminder: `remaining_path[0]` is guaranteed to be '/'.
-    while (true) {
-      while (remaining_path.length() > 1 && remaining_path.back() == '/') {
-        remaining_path.resize(remaining_path.length() - 1);
+    size_t base_path_length;
+    size_t args_count;
+    const handler_t* handler = routes.Find(path, base_path_length, args_count);
+    if (handler && !handler->f) {
+      // The route registered with an empty handler is served as if it does not exist.
+      handler = nullptr;
+    }
+    if (handler) {
+      // The URL path args are the trailing non-empty components of the path, added last to first.
+      output_url_args.base_path.assign(path, 0u, base_path_length);
+      size_t end = path.length();
+      for (size_t i = 0u; i < args_count; ++i) {
+        while (path[end - 1] == '/') {
+          --end;
+        }
+        size_t begin = end;
+        while (path[begin - 1] != '/') {
+          --begin;
+        }
+        output_url_args.add(path.substr(begin, end - begin));
+        end = begin;
       }
+    }
+    return handler;
+  }
 
-      const auto cit = handlers_.find(remaining_path);
-      if (cit != handlers_.end()) {
-        const auto cit2 = cit->second.find(output_url_args.size());
-        if (cit2 != cit->second.end()) {
-          output_handler = cit2->second;
-          return;
+  // The connection from which the request is being read by the event loop.
+  struct IncomingConnection final {
+    current::net::Connection connection;
+    // The data received and not yet handed over: the beginning of the request, or the pipelined requests.
+    std::string data;
+    size_t requests_served = 0u;
+    std::chrono::steady_clock::time_point last_activity = std::chrono::steady_clock::now();
+    // Whether the route of the request has been checked for `RegisterStreaming()`, once its headers have been
+    // received, and whether it has been, so that the request is handed over with the body yet to be received.
+    bool route_checked = false;
+    bool body_streamed = false;
+    explicit IncomingConnection(current::net::Connection&& connection) : connection(std::move(connection)) {}
+  };
+
+  void Thread(current::net::Socket socket) {
+    socket.SetNonBlocking(true);
+    const SOCKET listening_socket = socket.socket;
+    poller_.Add(listening_socket);
+
+    std::unordered_map<SOCKET, std::unique_ptr<IncomingConnection>> incoming;
+    std::vector<SOCKET> ready;
+    std::vector<char> buffer(kReadBufferSize);
+    auto last_idle_check = std::chrono::steady_clock::now();
+
+    // Hands over the request to the workers if it is ready to be served, or starts waiting for more data.
+    const auto dispatch_or_wait = [this, &incoming](std::unique_ptr<IncomingConnection> connection) {
+      const size_t length = ReadyToServeLength(*connection);
+      if (length) {
+        // Only this request is passed on to the parser, the pipelined ones remain in `data`.
+        connection->connection.SetNonBlocking(false);
+        connection->connection.PushBackInput(connection->data.data(), length);
+        connection->data.erase(0u, length);
+        {
+          std::lock_guard<std::mutex> lock(queue_mutex_);
+          queue_.push_back(std::move(connection));
         }
+        queue_condition_variable_.notify_one();
+      } else {
+        connection->connection.SetNonBlocking(true);
+        const SOCKET connection_socket = connection->connection.socket;
+        poller_.Add(connection_socket);
+        incoming[connection_socket] = std::move(connection);
       }
+    };
 
-      if (remaining_path == "/") {
+    while (!terminating_) {
+      try {
+        poller_.Wait(ready, incoming.empty() ? std::chrono::milliseconds(-1) : IdleCheckPeriod());
+      } catch (const current::Exception& e) {                   // LCOV_EXCL_LINE
+        std::cerr << "HTTP server poll failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
+        break;                                                   // LCOV_EXCL_LINE
+      }
+      if (terminating_) {
+        // Already terminating. The connections being read are closed without a response.
         break;
       }
+      const auto now = std::chrono::steady_clock::now();
+
+      // The kept alive connections, back from the workers after their responses have been sent.
+      std::vector<std::unique_ptr<IncomingConnection>> returned;
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        returned.swap(returned_);
+      }
+      for (auto& connection : returned) {
+        connection->last_activity = now;
+        try {
+          dispatch_or_wait(std::move(connection));
+        } catch (const current::net::SocketException&) {  // LCOV_EXCL_LINE
+        }
+      }
 
-      const size_t arg_begin_index = remaining_path.rfind('/') + 1;
-      output_url_args.add(remaining_path.substr(arg_begin_index));
-      remaining_path.resize(arg_begin_index);
+      for (const SOCKET ready_socket : ready) {
+        if (ready_socket == listening_socket) {
+          try {
+            dispatch_or_wait(std::make_unique<IncomingConnection>(socket.Accept()));
+          } catch (const current::net::SocketException&) {  // LCOV_EXCL_LINE
+            // The client may have gone away before the connection was accepted.
+          }
+        } else {
+          const auto it = incoming.find(ready_socket);
+          if (it == incoming.end()) {
+            continue;  // LCOV_EXCL_LINE
+          }
+          IncomingConnection& connection = *it->second;
+          bool done;
+          try {
+            const size_t read_count = connection.connection.NonBlockingRead(&buffer[0], buffer.size());
+            connection.data.append(&buffer[0], read_count);
+            connection.last_activity = now;
+            done = read_count && ReadyToServeLength(connection);
+            if (!done) {
+              const current::net::HTTPResponseCodeValue rejection = RequestSizeLimitExceeded(connection);
+              if (rejection != HTTPResponseCode.InvalidCode) {
+                RespondWithError(connection, rejection);
+                poller_.Remove(ready_socket);
+                incoming.erase(it);
+                continue;
+              }
+            }
+          } catch (const current::net::SocketException&) {
+            // Silently discard the connections closed before the request has been received in full,
+            // which is also how the clients close the kept alive connections.
+            poller_.Remove(ready_socket);
+            incoming.erase(it);
+            continue;
+          }
+          if (done) {
+            poller_.Remove(ready_socket);
+            std::unique_ptr<IncomingConnection> complete = std::move(it->second);
+            incoming.erase(it);
+            try {
+              dispatch_or_wait(std::move(complete));
+            } catch (const current::net::SocketException& e) {              // LCOV_EXCL_LINE
+              std::cerr << "HTTP connection setup failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
+            }
+          }
+        }
+      }
+
+      if (now - last_idle_check >= IdleCheckPeriod()) {
+        last_idle_check = now;
+        const auto timeout = std::chrono::milliseconds(keep_alive_timeout_ms_.load());
+        for (auto it = incoming.begin(); it != incoming.end();) {
+          if (now - it->second->last_activity > timeout) {
+            poller_.Remove(it->first);
+            it = incoming.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
     }
   }
 
-  void Thread(current::net::Socket socket) {
-    // TODO(dkorolev): Benchmark QPS.
-    while (!terminating_) {
-      try {
-        std::unique_ptr<current::net::HTTPServerConnection> connection(
-            new current::net::HTTPServerConnection(socket.Accept()));
-        if (terminating_) {
-          // Already terminating. Will not send the response, and this
-          // lack of response should not result in an exception.
-          connection->DoNotSendAnyResponse();
-          break;
+  // Returns the number of bytes of `connection.data` to hand over to the worker, or zero to wait for more data.
+  // The request is handed over once it has been received in full. Or, if it is for a route registered via
+  // `RegisterStreaming()`, as soon as its headers have been received, along with all the data received so far.
+  size_t ReadyToServeLength(IncomingConnection& connection) const {
+    const std::string& data = connection.data;
+    if (connection.body_streamed) {
+      return data.length();
+    }
+    const size_t length = current::net::CompleteHTTPRequestLength(data.data(), data.length());
+    if (length || connection.route_checked) {
+      return length;
+    }
+    if (!current::net::CompleteHTTPHeadersLength(data.data(), data.length())) {
+      return 0u;
+    }
+    connection.route_checked = true;
+    // The path is the second token of the first non-blank line.
+    const size_t line_begin = data.find_first_not_of("\r\n");
+    const size_t method_end = data.find(' ', line_begin);
+    const size_t path_begin = data.find_first_not_of(' ', method_end);
+    const size_t path_end = data.find_first_of(" \r", path_begin);
+    if (path_begin == std::string::npos || path_end == std::string::npos) {
+      return 0u;  // LCOV_EXCL_LINE
+    }
+    try {
+      URLPathArgs unused_url_path_args;
+      const handler_t* handler =
+          FindHandler(*std::atomic_load(&routes_),
+                      URL(data.substr(path_begin, path_end - path_begin)).path,
+                      unused_url_path_args);
+      if (handler && handler->streamed_body) {
+        connection.body_streamed = true;
+        return data.length();
+      }
+    } catch (const current::Exception&) {  // LCOV_EXCL_LINE
+      // The invalid URL is reported once the request has been received in full.
+    }
+    return 0u;
+  }
+
+  // Returns the error code to respond with if the request being received exceeds the size limits, or
+  // `InvalidCode` if it does not. Only scans the data once it is large enough to possibly exceed them.
+  current::net::HTTPResponseCodeValue RequestSizeLimitExceeded(const IncomingConnection& connection) const {
+    const std::string& data = connection.data;
+    const size_t max_headers_size = max_request_headers_size_;
+    const size_t max_body_size = max_request_body_size_;
+    if (connection.body_streamed || data.length() <= std::min(max_headers_size, max_body_size)) {
+      return HTTPResponseCode.InvalidCode;
+    }
+    const size_t headers_length = current::net::CompleteHTTPHeadersLength(data.data(), data.length());
+    if (headers_length ? headers_length > max_headers_size : data.length() > max_headers_size) {
+      return HTTPResponseCode.RequestHeaderFieldsTooLarge;
+    } else if (headers_length && data.length() - headers_length > max_body_size) {
+      return HTTPResponseCode.RequestEntityTooLarge;
+    } else {
+      return HTTPResponseCode.InvalidCode;
+    }
+  }
+
+  // Responds to the request which can not be served, before closing its connection. The response is small,
+  // so writing it does not block the event loop.
+  static void RespondWithError(IncomingConnection& connection, current::net::HTTPResponseCodeValue code) {
+    const std::string body = (code == HTTPResponseCode.RequestEntityTooLarge)
+                                 ? current::net::DefaultRequestEntityTooLargeMessage()
+                                 : current::net::DefaultRequestHeaderFieldsTooLargeMessage();
+    connection.connection.SetNonBlocking(false);
+    const std::string status_line = current::strings::Printf(
+        "HTTP/1.1 %d %s\r\n", static_cast<int>(code), current::net::HTTPResponseCodeAsString(code).c_str());
+    connection.connection.BlockingWrite(status_line + "Content-Type: text/html\r\nConnection: close\r\n" +
+                                            "Content-Length: " + current::ToString(body.length()) + "\r\n\r\n" +
+                                            body,
+                                        false);
+  }
+
+  // The idle connections are closed within one period after their timeout has expired.
+  std::chrono::milliseconds IdleCheckPeriod() const {
+    const int64_t timeout_ms = keep_alive_timeout_ms_;
+    return std::chrono::milliseconds(std::max(std::min(timeout_ms, static_cast<int64_t>(kIdleCheckPeriodMs)),
+                                              static_cast<int64_t>(1)));
+  }
+
+  void Worker() {
+    while (true) {
+      std::unique_ptr<IncomingConnection> next;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_condition_variable_.wait(lock, [this]() { return workers_terminating_ || !queue_.empty(); });
+        if (workers_terminating_) {
+          return;
         }
-        std::function<void(Request)> handler;
-        URLPathArgs url_path_args;
-        {
-          // TODO(dkorolev): Read-write lock for performance?
-          std::lock_guard<std::mutex> lock(mutex_);
-          FindHandler(connection->HTTPRequest().URL().path, handler, url_path_args);
+        next = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      Serve(std::move(next));
+    }
+  }
+
+  // Returns the connection to the event loop once the response has been sent. Called from the workers,
+  // or from any other thread, in which the user code has destructed the `Request`.
+  void KeepAlive(current::net::Connection&& connection, std::string&& pipelined_data, size_t requests_served) {
+    auto returned = std::make_unique<IncomingConnection>(std::move(connection));
+    returned->data = std::move(pipelined_data);
+    returned->requests_served = requests_served;
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      returned_.push_back(std::move(returned));
+    }
+    poller_.Wake();
+  }
+
+  void Serve(std::unique_ptr<IncomingConnection> incoming) {
+    try {
+      using current::net::HTTPRequestBody;
+      const auto body_policy = incoming->body_streamed ? HTTPRequestBody::Streamed : HTTPRequestBody::Buffered;
+      std::unique_ptr<current::net::HTTPServerConnection> connection(
+          new current::net::HTTPServerConnection(std::move(incoming->connection), body_policy));
+      if (terminating_) {
+        // Already terminating. Will not send the response, and this
+        // lack of response should not result in an exception.
+        connection->DoNotSendAnyResponse();
+        return;
+      }
+      const size_t requests_served = incoming->requests_served + 1u;
+      // The body streamed to the handler may be left unread, so that connection can not serve the next request.
+      if (!incoming->body_streamed && requests_served < max_requests_per_connection_) {
+        // `std::function<>` requires a copyable functor, hence the `shared_ptr<>` around the pipelined data.
+        const auto pipelined_data = std::make_shared<std::string>(std::move(incoming->data));
+        connection->EnableKeepAlive([this, pipelined_data, requests_served](current::net::Connection&& c) {
+          KeepAlive(std::move(c), std::move(*pipelined_data), requests_served);
+        });
+      }
+      if (response_compression_enabled_) {
+        connection->EnableResponseCompression(response_compression_min_length_);
+      }
+      // No locking: the routes table is immutable, and this thread keeps the one it got alive while serving.
+      const std::shared_ptr<const routes_t> routes = std::atomic_load(&routes_);
+      URLPathArgs url_path_args;
+      const handler_t* handler = FindHandler(*routes, connection->HTTPRequest().URL().path, url_path_args);
+      if (handler) {
+        if (handler->streamed_body) {
+          connection->BodyStream().SetMaxLength(handler->max_body_length);
         }
-        if (handler) {
-          // OK, here's the tricky part with error handling and exceptions in this multithreaded world.
-          // * On the one hand, connection should be std::move-d into the request,
-          //   since it might end up being served in another thread, via a message queue, etc..
-          //   Thus, the user code is responsible for closing the connection.
-          //   Not to mention that the std::move-d away connection can easily outlive this scope.
-          // * On the other hand, if an exception occurs in user code, we need to return a 500,
-          //   which should obviously happen before the connection object is destructed.
-          //   This seems like a good reason to not std::move it away, or move it away with some flag,
-          //   but I thought hard of it, and don't think it's a good choice -- D.K.
-          //
-          // Solution: Do nothing here. No matter how tempting it is, it won't work across threads. Period.
-          //
-          // The implementation of HTTP connection will return an "INTERNAL SERVER ERROR"
-          // if no response was sent. That's what the user gets. In debugger, they can put a breakpoint there
-          // and see what caused the error.
-          //
-          // It is the job of the user of this library to ensure no exceptions leave their code.
-          // In practice, a top-level try-catch for `const current::Exception& e` is good enough.
-          try {
-            handler(Request(std::move(connection), url_path_args));
-          } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
-            // WARNING: This `catch` is really not sufficient, it just logs a message
-            // if a user exception occurred in the same thread that ran the handler.
-            // DO NOT COUNT ON IT.
-            std::cerr << "HTTP route failed in user code: " << e.what() << '\n';  // LCOV_EXCL_LINE
-          }
-        } else {
-          connection->SendHTTPResponse(
-              current::net::DefaultFourOhFourMessage(), HTTPResponseCode.NotFound, "text/html");
+        // OK, here's the tricky part with error handling and exceptions in this multithreaded world.
+        // * On the one hand, connection should be std::move-d into the request,
+        //   since it might end up being served in another thread, via a message queue, etc..
+        //   Thus, the user code is responsible for closing the connection.
+        //   Not to mention that the std::move-d away connection can easily outlive this scope.
+        // * On the other hand, if an exception occurs in user code, we need to return a 500,
+        //   which should obviously happen before the connection object is destructed.
+        //   This seems like a good reason to not std::move it away, or move it away with some flag,
+        //   but I thought hard of it, and don't think it's a good choice -- D.K.
+        //
+        // Solution: Do nothing here. No matter how tempting it is, it won't work across threads. Period.
+        //
+        // The implementation of HTTP connection will return an "INTERNAL SERVER ERROR"
+        // if no response was sent. That's what the user gets. In debugger, they can put a breakpoint there
+        // and see what caused the error.
+        //
+        // It is the job of the user of this library to ensure no exceptions leave their code.
+        // In practice, a top-level try-catch for `const current::Exception& e` is good enough.
+        try {
+          handler->f(Request(std::move(connection), url_path_args));
+        } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
+          // WARNING: This `catch` is really not sufficient, it just logs a message
+          // if a user exception occurred in the same thread that ran the handler.
+          // DO NOT COUNT ON IT.
+          std::cerr << "HTTP route failed in user code: " << e.what() << '\n';  // LCOV_EXCL_LINE
         }
-      } catch (const current::net::EmptySocketException&) {  // LCOV_EXCL_LINE
-        // Silently discard errors if no data was sent in.
-      } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
-        // TODO(dkorolev): More reliable logging.
-        std::cerr << "HTTP route failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
+      } else {
+        connection->SendHTTPResponse(
+            current::net::DefaultFourOhFourMessage(), HTTPResponseCode.NotFound, "text/html");
       }
+    } catch (const current::net::EmptySocketException&) {  // LCOV_EXCL_LINE
+      // Silently discard errors if no data was sent in.
+    } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
+      // TODO(dkorolev): More reliable logging.
+      std::cerr << "HTTP route failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
     }
   }
 
   HTTPRoutesScopeEntry DoRegisterHandler(const std::string& path,
-                                         std::function<void(Request)> handler,
+                                         handler_t handler,
                                          const URLPathArgs::CountMask path_args_count_mask,
                                          const ReRegisterRoute policy) {
     // LCOV_EXCL_START
@@ -386,6 +891,7 @@ class HTTPServerPOSIX final {
           handlers_per_path[i] = handler;
         }
       }
+      RebuildRoutes();
     }
 
     if (policy == ReRegisterRoute::SilentlyUpdateExisting) {
@@ -396,17 +902,48 @@ class HTTPServerPOSIX final {
     }
   }
 
+  // Publishes the routes table of the current `handlers_`. Must be called with `mutex_` locked.
+  // Registering routes is rare, so the table is rebuilt from scratch, for the lookups to stay simple and fast.
+  void RebuildRoutes() {
+    std::atomic_store(&routes_, std::shared_ptr<const routes_t>(std::make_shared<const routes_t>(handlers_)));
+  }
+
   HTTPServerPOSIX() = delete;
 
+  enum { kReadBufferSize = 16 * 1024, kIdleCheckPeriodMs = 1000 };
+  // Smaller responses are not worth the CPU, as they fit into a single packet anyway.
+  enum { kDefaultResponseCompressionMinLength = 1024 };
+  enum { kDefaultMaxRequestHeadersSize = 64 * 1024, kDefaultMaxRequestBodySize = 16 * 1024 * 1024 };
+
   std::atomic_bool terminating_;
   const int port_;
-  std::thread thread_;
-
-  // TODO(dkorolev): Look into read-write mutexes here.
+  std::atomic<int64_t> keep_alive_timeout_ms_{30 * 1000};
+  std::atomic<size_t> max_requests_per_connection_{1000u};
+  std::atomic_bool response_compression_enabled_{true};
+  std::atomic<size_t> response_compression_min_length_{kDefaultResponseCompressionMinLength};
+  std::atomic<size_t> max_request_headers_size_{kDefaultMaxRequestHeadersSize};
+  std::atomic<size_t> max_request_body_size_{kDefaultMaxRequestBodySize};
+
+  // Declared before `thread_`, which uses them.
+  current::net::SocketReadinessPoller poller_;
+  std::mutex queue_mutex_;
+  std::condition_variable queue_condition_variable_;
+  // The requests received in full, for the workers to serve.
+  std::deque<std::unique_ptr<IncomingConnection>> queue_;
+  // The kept alive connections, for the event loop to wait for their next requests.
+  std::vector<std::unique_ptr<IncomingConnection>> returned_;
+  bool workers_terminating_ = false;
+
+  // Guards `handlers_`, the registered routes, from which `routes_` is rebuilt on each change.
   mutable std::mutex mutex_;
-
-  std::map<std::string, std::map<size_t, std::function<void(Request)>>> handlers_;
+  routes_t::handlers_t handlers_;
+  // The routes table to look up the handlers in. Replaced as a whole via `std::atomic_store()`.
+  std::shared_ptr<const routes_t> routes_ = std::make_shared<const routes_t>(routes_t::handlers_t());
   std::vector<std::unique_ptr<StaticFileServer>> static_file_servers_;
+
+  // Started in the constructor, so declared after all the members above, which it uses.
+  std::thread thread_;
+  std::vector<std::thread> workers_;
 };
 
 }  // namespace http
@@ -0,0 +1,177 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The immutable radix tree of the registered HTTP routes, for the server to look up the handler per request.
+//
+// The tree is built once per change of the set of routes, and is never modified afterwards. Thus, it can be
+// shared between the threads serving the requests with no locking, and replaced as a whole on each change.
+// The lookup walks the path once, character by character, and allocates no memory.
+
+#ifndef BLOCKS_HTTP_IMPL_ROUTES_H
+#define BLOCKS_HTTP_IMPL_ROUTES_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../URL/url.h"
+
+namespace current {
+namespace http {
+
+template <typename HANDLER>
+class RoutesRadixTree final {
+ public:
+  using handler_t = HANDLER;
+  // The handlers per path, per the number of URL path args.
+  using handlers_t = std::map<std::string, std::map<size_t, handler_t>>;
+
+  explicit RoutesRadixTree(const handlers_t& handlers) {
+    std::vector<const typename handlers_t::value_type*> routes;
+    routes.reserve(handlers.size());
+    for (const auto& route : handlers) {
+      routes.push_back(&route);
+    }
+    nodes_.emplace_back();  // The root, with the empty label.
+    Build(0u, routes.begin(), routes.end(), 0u);
+  }
+
+  // Returns the handler to serve `path` with, or `nullptr` if there is none.
+  //
+  // As with the per-component matching, the longest registered path which is a prefix of `path`, and
+  // which has a handler for the number of the remaining non-empty components of `path`, wins. On success,
+  // `output_base_path_length` is the length of that registered path, and `output_args_count` is the number
+  // of the URL path args.
+  const handler_t* Find(const std::string& path,
+                        size_t& output_base_path_length,
+                        size_t& output_args_count) const {
+    const size_t length = path.length();
+    const char* s = path.data();
+
+    // A component begins at each character which is not a slash, yet follows a slash.
+    const auto begins_component = [s](size_t i) { return s[i] != '/' && (i == 0u || s[i - 1] == '/'); };
+    size_t total_components = 0u;
+    for (size_t i = 0u; i < length; ++i) {
+      if (begins_component(i)) {
+        ++total_components;
+      }
+    }
+
+    const handler_t* result = nullptr;
+    const Node* node = &nodes_[0];
+    size_t i = 0u;
+    size_t components = 0u;
+    while (true) {
+      // Registered paths do not end with a slash, except for "/" itself. Therefore, the matched part
+      // of `path` must be followed by a slash or by nothing, unless it is "/".
+      if (node->args_count_mask && (i == length || s[i] == '/' || s[i - 1] == '/')) {
+        const size_t args_count = total_components - components;
+        if (args_count <= URLPathArgs::MaxArgsCount && (node->args_count_mask & (1u << args_count))) {
+          result = &handlers_[node->handlers_begin + args_count];
+          output_base_path_length = i;
+          output_args_count = args_count;
+        }
+      }
+      if (i == length) {
+        return result;
+      }
+      const size_t child = node->children_first_chars.find(s[i]);
+      if (child == std::string::npos) {
+        return result;
+      }
+      node = &nodes_[node->children[child]];
+      for (const char c : node->label) {
+        if (i == length || s[i] != c) {
+          return result;
+        }
+        if (begins_component(i)) {
+          ++components;
+        }
+        ++i;
+      }
+    }
+  }
+
+ private:
+  using iterator_t = typename std::vector<const typename handlers_t::value_type*>::const_iterator;
+
+  struct Node final {
+    // The characters on the edge from the parent node.
+    std::string label;
+    // The first characters of the labels of the children, to find the one to descend into with one scan.
+    std::string children_first_chars;
+    std::vector<size_t> children;
+    // The bit `i` is set if this node is a registered path with a handler for `i` URL path args,
+    // which is then `handlers_[handlers_begin + i]`.
+    uint32_t args_count_mask = 0u;
+    size_t handlers_begin = 0u;
+  };
+
+  // Builds the subtree of `nodes_[index]` from the sorted `[begin, end)` range of the paths, all of which
+  // begin with the same `depth` characters, which the path from the root to this node spells.
+  void Build(size_t index, iterator_t begin, iterator_t end, size_t depth) {
+    if (begin != end && (*begin)->first.length() == depth) {
+      nodes_[index].handlers_begin = handlers_.size();
+      handlers_.resize(handlers_.size() + URLPathArgs::MaxArgsCount + 1u);
+      for (const auto& handler : (*begin)->second) {
+        if (handler.first <= URLPathArgs::MaxArgsCount) {
+          nodes_[index].args_count_mask |= (1u << handler.first);
+          handlers_[nodes_[index].handlers_begin + handler.first] = handler.second;
+        }
+      }
+      ++begin;
+    }
+    while (begin != end) {
+      // The paths are sorted, so the ones which continue with the same character form a contiguous range,
+      // and their longest common prefix is that of the first and the last one of this range.
+      const char c = (*begin)->first[depth];
+      iterator_t group_end = begin + 1;
+      while (group_end != end && (*group_end)->first[depth] == c) {
+        ++group_end;
+      }
+      const std::string& first = (*begin)->first;
+      const std::string& last = (*(group_end - 1))->first;
+      size_t common = depth + 1u;
+      while (common < first.length() && common < last.length() && first[common] == last[common]) {
+        ++common;
+      }
+      const size_t child = nodes_.size();
+      nodes_.emplace_back();
+      nodes_[child].label = first.substr(depth, common - depth);
+      nodes_[index].children_first_chars += c;
+      nodes_[index].children.push_back(child);
+      Build(child, begin, group_end, common);
+      begin = group_end;
+    }
+  }
+
+  std::vector<Node> nodes_;
+  std::vector<handler_t> handlers_;
+};
+
+}  // namespace http
+}  // namespace current
+
+#endif  // BLOCKS_HTTP_IMPL_ROUTES_H
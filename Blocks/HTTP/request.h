@@ -107,6 +107,16 @@ struct Request final {
     connection.SendHTTPResponse(std::forward<TS>(params)...);
   }
 
+  // The body of the request, to be read piece by piece. For the handlers registered via `RegisterStreaming()`,
+  // the body may not have been received yet, and `body` is then empty.
+  current::net::HTTPRequestBodyStream& BodyStream() { return connection.BodyStream(); }
+
+  // Looks a single header up in the receive buffer of the request, without going through `headers`.
+  // The repeated headers are joined with ", ", as in `headers`. Returns `false` if there is no such header.
+  bool FindHeader(const std::string& header, std::string& value) const {
+    return http_data.FindHeader(header, value);
+  }
+
   current::net::HTTPServerConnection::ChunkedResponseSender SendChunkedResponse(
       net::HTTPResponseCodeValue code = HTTPResponseCode.OK,
       const std::string& content_type = net::constants::kDefaultJSONContentType,
@@ -44,6 +44,7 @@ SOFTWARE.
 #include "../../Bricks/dflags/dflags.h"
 #include "../../Bricks/strings/join.h"
 #include "../../Bricks/strings/printf.h"
+#include "../../Bricks/util/deflate.h"
 #include "../../Bricks/util/singleton.h"
 #include "../../Bricks/file/file.h"
 
@@ -76,6 +77,9 @@ DEFINE_int32(net_api_test_port,
              "Local port to use for the test API-based HTTP server. NOTE: This port should be different from "
              "ports in other network-based tests, since API-driven HTTP server will hold it open for the whole "
              "lifetime of the binary.");
+DEFINE_int32(net_api_test_raw_server_port,
+             PickPortForUnitTest(),
+             "Local port to use for the test server which talks raw TCP to the HTTP client.");
 DEFINE_string(net_api_test_tmpdir, ".current", "Local path for the test to create temporary files in.");
 
 CURRENT_STRUCT(HTTPAPITestObject) {
@@ -166,6 +170,42 @@ TEST(HTTPAPI, RegisterWithURLPathParams) {
   EXPECT_EQ("/ (user, a, 1, blah)", run("/user/a/1/blah/"));
 }
 
+TEST(HTTPAPI, RoutesWithCommonPrefixes) {
+  const auto handler =
+      [](Request r) { r(r.url_path_args.base_path + ' ' + current::ToString(r.url_path_args.size())); };
+
+  auto us_scope = HTTP(FLAGS_net_api_test_port).Register("/us", URLPathArgs::CountMask::Any, handler);
+  auto scope = HTTP(FLAGS_net_api_test_port).Register("/user", handler) +
+               HTTP(FLAGS_net_api_test_port).Register("/users", URLPathArgs::CountMask::One, handler) +
+               HTTP(FLAGS_net_api_test_port).Register("/users/all", handler);
+
+  const auto run = [](const std::string& path) -> std::string {
+    const auto response = HTTP(GET(Printf("http://localhost:%d", FLAGS_net_api_test_port) + path));
+    return response.code == HTTPResponseCode.OK ? response.body : "404";
+  };
+
+  EXPECT_EQ("/us 0", run("/us"));
+  EXPECT_EQ("/us 1", run("/us/er"));
+  EXPECT_EQ("/user 0", run("/user"));
+  EXPECT_EQ("/us 2", run("/us/er/x"));
+  EXPECT_EQ("404", run("/user/x"));
+  EXPECT_EQ("/users 1", run("/users/x"));
+  EXPECT_EQ("/users/all 0", run("/users/all/"));
+  EXPECT_EQ("/users 1", run("/users/alls"));
+  EXPECT_EQ("404", run("/users/all/x"));
+  EXPECT_EQ("404", run("/use"));
+  EXPECT_EQ("404", run("/userss"));
+  EXPECT_EQ("404", run("/users"));
+
+  // The routes table is rebuilt as the routes are added and removed.
+  us_scope = nullptr;
+  EXPECT_EQ("404", run("/us"));
+  EXPECT_EQ("/user 0", run("/user"));
+  scope += HTTP(FLAGS_net_api_test_port).Register("/use", handler);
+  EXPECT_EQ("/use 0", run("/use"));
+  EXPECT_EQ("/users/all 0", run("/users/all"));
+}
+
 TEST(HTTPAPI, ScopeLeftHangingThrowsAnException) {
   const string url = Printf("http://localhost:%d/foo", FLAGS_net_api_test_port);
 
@@ -228,6 +268,11 @@ TEST(HTTPAPI, HeadersAndCookies) {
                                      EXPECT_EQ("foo", r.headers["Header1"].value);
                                      EXPECT_EQ("bar", r.headers["Header2"].value);
                                      EXPECT_EQ("x=1; y=2", r.headers.CookiesAsString());
+                                     EXPECT_EQ("1", r.headers.cookies.at("x").value);
+                                     std::string value;
+                                     EXPECT_TRUE(r.FindHeader("header1", value));
+                                     EXPECT_EQ("foo", value);
+                                     EXPECT_FALSE(r.FindHeader("Header3", value));
                                      Response response("OK");
                                      response.headers.Set("X-Current-H1", "header1");
                                      response.SetCookie("cookie1", "value1");
@@ -468,6 +513,85 @@ TEST(HTTPAPI, ChunkedResponseWithHeaders) {
   EXPECT_EQ("yeah", response.headers.Get("header"));
 }
 
+TEST(HTTPAPI, ResponseCompression) {
+  using current::deflate::Decompress;
+  using current::deflate::Format;
+  std::string json;
+  for (int i = 0; i < 100; ++i) {
+    json += Printf("{\"index\":%d,\"text\":\"Compressible JSON\"}\n", i);
+  }
+  const auto scope =
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/json", [json](Request r) { r(json, HTTPResponseCode.OK, "application/json"); }) +
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/small", [](Request r) { r("{}", HTTPResponseCode.OK, "text/plain"); }) +
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/png", [json](Request r) { r(json, HTTPResponseCode.OK, "image/png"); }) +
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/etag",
+                    [json](Request r) {
+                      r(json, HTTPResponseCode.OK, "application/json", Headers({{"ETag", "\"v1\""}}));
+                    }) +
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/chunked_etag",
+                    [json](Request r) {
+                      r.connection.SendChunkedHTTPResponse(
+                                      HTTPResponseCode.OK, "application/json", Headers({{"ETag", "\"v1\""}}))
+                          .Send(json);
+                    }) +
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/chunked",
+                    [json](Request r) {
+                      auto response = r.connection.SendChunkedHTTPResponse();
+                      for (size_t i = 0u; i < json.length(); i += 100u) {
+                        response.Send(json.substr(i, 100u));
+                      }
+                    });
+  const std::string url = Printf("http://localhost:%d/", FLAGS_net_api_test_port);
+  {
+    const auto response = HTTP(GET(url + "json").SetHeader("Accept-Encoding", "gzip, deflate"));
+    EXPECT_EQ("gzip", response.headers.Get("Content-Encoding"));
+    EXPECT_EQ("Accept-Encoding", response.headers.Get("Vary"));
+    EXPECT_LT(response.body.length() * 4u, json.length());
+    EXPECT_EQ(json, Decompress(response.body));
+  }
+  {
+    const auto response = HTTP(GET(url + "json").SetHeader("Accept-Encoding", "deflate"));
+    EXPECT_EQ("deflate", response.headers.Get("Content-Encoding"));
+    EXPECT_EQ(json, Decompress(response.body, Format::ZLib));
+  }
+  {
+    const auto response = HTTP(GET(url + "json"));
+    EXPECT_FALSE(response.headers.Has("Content-Encoding"));
+    EXPECT_FALSE(response.headers.Has("Vary"));
+    EXPECT_EQ(json, response.body);
+  }
+  EXPECT_EQ(json, HTTP(GET(url + "json").SetHeader("Accept-Encoding", "gzip;q=0, identity")).body);
+  EXPECT_EQ("{}", HTTP(GET(url + "small").SetHeader("Accept-Encoding", "gzip")).body);
+  EXPECT_EQ(json, HTTP(GET(url + "png").SetHeader("Accept-Encoding", "gzip")).body);
+  {
+    // The chunks are compressed as they are sent, as parts of one compressed stream.
+    const auto response = HTTP(GET(url + "chunked").SetHeader("Accept-Encoding", "gzip"));
+    EXPECT_EQ("gzip", response.headers.Get("Content-Encoding"));
+    EXPECT_EQ(json, Decompress(response.body));
+    EXPECT_EQ(json, HTTP(GET(url + "chunked")).body);
+  }
+  {
+    // The strong `ETag` set by the handler is weakened for the compressed response, as its bytes differ.
+    EXPECT_EQ("\"v1\"", HTTP(GET(url + "etag")).headers.Get("ETag"));
+    EXPECT_EQ("W/\"v1\"", HTTP(GET(url + "etag").SetHeader("Accept-Encoding", "gzip")).headers.Get("ETag"));
+    EXPECT_EQ("\"v1\"", HTTP(GET(url + "chunked_etag")).headers.Get("ETag"));
+    const auto response = HTTP(GET(url + "chunked_etag").SetHeader("Accept-Encoding", "gzip"));
+    EXPECT_EQ("W/\"v1\"", response.headers.Get("ETag"));
+    EXPECT_EQ(json, Decompress(response.body));
+  }
+  HTTP(FLAGS_net_api_test_port).SetResponseCompressionParameters(false);
+  EXPECT_EQ(json, HTTP(GET(url + "json").SetHeader("Accept-Encoding", "gzip")).body);
+  HTTP(FLAGS_net_api_test_port).SetResponseCompressionParameters(true, 2u);
+  EXPECT_EQ("{}", Decompress(HTTP(GET(url + "small").SetHeader("Accept-Encoding", "gzip")).body));
+  HTTP(FLAGS_net_api_test_port).SetResponseCompressionParameters(true);
+}
+
 // A hacky way to get back the response chunk by chunk. TODO(dkorolev): `ChunkedGET`.
 TEST(HTTPAPI, GetByChunksPrototype) {
   // Handler returning the result chunk by chunk.
@@ -844,6 +968,99 @@ TEST(HTTPAPI, ServeDirOnlyServesFilesOfKnownMIMEType) {
   FileSystem::RmDir(dir, FileSystem::RmDirParameters::Silent);
 }
 
+TEST(HTTPAPI, ServeDirWithCachingHeadersRangesAndPrecompressedFiles) {
+  FileSystem::MkDir(FLAGS_net_api_test_tmpdir, FileSystem::MkDirParameters::Silent);
+  const std::string dir = FLAGS_net_api_test_tmpdir + "/static_from_disk";
+  FileSystem::MkDir(dir, FileSystem::MkDirParameters::Silent);
+  FileSystem::WriteStringToFile("0123456789", FileSystem::JoinPath(dir, "digits.txt").c_str());
+  FileSystem::WriteStringToFile("var x = 42;", FileSystem::JoinPath(dir, "app.js").c_str());
+  FileSystem::WriteStringToFile("Pretend gzip.", FileSystem::JoinPath(dir, "app.js.gz").c_str());
+  const auto scope = HTTP(FLAGS_net_api_test_port).ServeStaticFilesFrom(dir);
+  const std::string url = Printf("http://localhost:%d/", FLAGS_net_api_test_port);
+
+  // The file is read from disk on every request.
+  const auto full = HTTP(GET(url + "digits.txt"));
+  EXPECT_EQ(200, static_cast<int>(full.code));
+  EXPECT_EQ("0123456789", full.body);
+  ASSERT_TRUE(full.headers.Has("ETag"));
+  ASSERT_TRUE(full.headers.Has("Last-Modified"));
+  EXPECT_EQ("bytes", full.headers.Get("Accept-Ranges"));
+  EXPECT_FALSE(full.headers.Has("Vary"));
+  FileSystem::WriteStringToFile("9876543210", FileSystem::JoinPath(dir, "digits.txt").c_str());
+  EXPECT_EQ("9876543210", HTTP(GET(url + "digits.txt")).body);
+
+  // Conditional GET-s.
+  const auto current = HTTP(GET(url + "digits.txt"));
+  const std::string current_etag = current.headers.Get("ETag");
+  EXPECT_EQ(304,
+            static_cast<int>(HTTP(GET(url + "digits.txt").SetHeader("If-None-Match", current_etag)).code));
+  EXPECT_EQ(304, static_cast<int>(HTTP(GET(url + "digits.txt").SetHeader("If-None-Match", "\"x\", *")).code));
+  EXPECT_EQ(200, static_cast<int>(HTTP(GET(url + "digits.txt").SetHeader("If-None-Match", "\"x\"")).code));
+  EXPECT_EQ(304,
+            static_cast<int>(
+                HTTP(GET(url + "digits.txt")
+                         .SetHeader("If-Modified-Since", current.headers.Get("Last-Modified"))).code));
+  EXPECT_EQ(200,
+            static_cast<int>(
+                HTTP(GET(url + "digits.txt").SetHeader("If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT"))
+                    .code));
+
+  // Range requests.
+  {
+    const auto response = HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=2-4"));
+    EXPECT_EQ(206, static_cast<int>(response.code));
+    EXPECT_EQ("765", response.body);
+    EXPECT_EQ("bytes 2-4/10", response.headers.Get("Content-Range"));
+  }
+  EXPECT_EQ("3210", HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=6-")).body);
+  EXPECT_EQ("10", HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=-2")).body);
+  EXPECT_EQ("9876543210", HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=-100")).body);
+  EXPECT_EQ("543210", HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=4-100")).body);
+  {
+    const auto response = HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=10-"));
+    EXPECT_EQ(416, static_cast<int>(response.code));
+    EXPECT_EQ("bytes */10", response.headers.Get("Content-Range"));
+  }
+  {
+    // Multiple ranges and malformed ranges are ignored, and the whole file is returned.
+    const auto response = HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=0-1,3-4"));
+    EXPECT_EQ(200, static_cast<int>(response.code));
+    EXPECT_EQ("9876543210", response.body);
+    EXPECT_EQ("9876543210", HTTP(GET(url + "digits.txt").SetHeader("Range", "lines=1-2")).body);
+    EXPECT_EQ("9876543210", HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=4-2")).body);
+  }
+  EXPECT_EQ(
+      "9876543210",
+      HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=2-4").SetHeader("If-Range", "\"stale\"")).body);
+  EXPECT_EQ(
+      "765",
+      HTTP(GET(url + "digits.txt").SetHeader("Range", "bytes=2-4").SetHeader("If-Range", current_etag)).body);
+
+  // The precompressed version is sent to the clients that accept gzip, and is not served on its own.
+  {
+    const auto response = HTTP(GET(url + "app.js"));
+    EXPECT_EQ("var x = 42;", response.body);
+    EXPECT_FALSE(response.headers.Has("Content-Encoding"));
+    EXPECT_EQ("Accept-Encoding", response.headers.Get("Vary"));
+  }
+  {
+    const auto response = HTTP(GET(url + "app.js").SetHeader("Accept-Encoding", "deflate, gzip"));
+    EXPECT_EQ("Pretend gzip.", response.body);
+    EXPECT_EQ("gzip", response.headers.Get("Content-Encoding"));
+    EXPECT_EQ("application/javascript", response.headers.Get("Content-Type"));
+    EXPECT_NE(HTTP(GET(url + "app.js")).headers.Get("ETag"), response.headers.Get("ETag"));
+  }
+  EXPECT_EQ("var x = 42;", HTTP(GET(url + "app.js").SetHeader("Accept-Encoding", "gzip;q=0, *")).body);
+  EXPECT_EQ("Pretend gzip.", HTTP(GET(url + "app.js").SetHeader("Accept-Encoding", "*")).body);
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(url + "app.js.gz")).code));
+
+  // The files removed after the registration are no longer found.
+  FileSystem::RmFile(FileSystem::JoinPath(dir, "digits.txt"));
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(url + "digits.txt")).code));
+
+  FileSystem::RmDir(dir, FileSystem::RmDirParameters::Silent);
+}
+
 TEST(HTTPAPI, ResponseSmokeTest) {
   const auto send_response = [](const Response& response, Request request) { request(response); };
 
@@ -936,3 +1153,404 @@ TEST(HTTPAPI, ResponseSmokeTest) {
     static_cast<void>(response);
   }
 }
+
+TEST(HTTPAPI, SlowClientDoesNotBlockOtherRequests) {
+  const auto scope =
+      HTTP(FLAGS_net_api_test_port).Register("/fast", [](Request r) { r("fast\n"); }) +
+      HTTP(FLAGS_net_api_test_port).Register("/slow", [](Request r) { r("slow: " + r.body + '\n'); });
+
+  // The slow client sends the headers and only a part of the body.
+  Connection slow_connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+  slow_connection.BlockingWrite("POST /slow HTTP/1.1\r\nContent-Length: 10\r\n\r\nhello", false);
+
+  // Meanwhile, the requests from other clients are served.
+  EXPECT_EQ("fast\n", HTTP(GET(Printf("http://localhost:%d/fast", FLAGS_net_api_test_port))).body);
+  EXPECT_EQ("fast\n", HTTP(GET(Printf("http://localhost:%d/fast", FLAGS_net_api_test_port))).body);
+
+  // Once the slow client completes its request, it is served too.
+  slow_connection.BlockingWrite("world", false);
+  std::string response;
+  char buffer[1024];
+  while (response.find("slow: helloworld\n") == std::string::npos) {
+    response.append(buffer, slow_connection.BlockingRead(buffer, sizeof(buffer)));
+  }
+  EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+}
+
+TEST(HTTPAPI, HandlersRunConcurrently) {
+  std::atomic_bool released(false);
+  const auto scope = HTTP(FLAGS_net_api_test_port)
+                         .Register("/wait",
+                                   [&released](Request r) {
+                                     while (!released) {
+                                       std::this_thread::yield();
+                                     }
+                                     r("released\n");
+                                   }) +
+                     HTTP(FLAGS_net_api_test_port).Register("/release", [&released](Request r) {
+                       released = true;
+                       r("releasing\n");
+                     });
+
+  std::string wait_result;
+  std::thread waiting_client([&wait_result]() {
+    wait_result = HTTP(GET(Printf("http://localhost:%d/wait", FLAGS_net_api_test_port))).body;
+  });
+  // The handler of `/wait` blocks its worker thread, and `/release` is served by another one.
+  EXPECT_EQ("releasing\n", HTTP(GET(Printf("http://localhost:%d/release", FLAGS_net_api_test_port))).body);
+  waiting_client.join();
+  EXPECT_EQ("released\n", wait_result);
+}
+
+namespace http_server_test {
+// Reads from the connection until `count` full responses, each with a `Content-Length`, have been received.
+inline std::vector<std::string> ReadResponses(Connection& connection, size_t count) {
+  std::vector<std::string> responses;
+  std::string data;
+  char buffer[1024];
+  while (responses.size() < count) {
+    const size_t headers_end = data.find("\r\n\r\n");
+    const size_t content_length = data.find("Content-Length: ");
+    if (headers_end != std::string::npos && content_length != std::string::npos) {
+      const size_t length = headers_end + 4 + static_cast<size_t>(atoi(data.c_str() + content_length + 16));
+      if (data.length() >= length) {
+        responses.push_back(data.substr(0, length));
+        data.erase(0, length);
+        continue;
+      }
+    }
+    data.append(buffer, connection.BlockingRead(buffer, sizeof(buffer)));
+  }
+  return responses;
+}
+}  // namespace http_server_test
+
+TEST(HTTPAPI, KeepAliveAndPipelining) {
+  const auto scope = HTTP(FLAGS_net_api_test_port).Register("/echo", [](Request r) {
+    r(r.url.query.get("x", "") + r.body);
+  });
+
+  Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+
+  // Two requests sent back to back are served in order, over the same connection.
+  connection.BlockingWrite(
+      "GET /echo?x=1 HTTP/1.1\r\n\r\n"
+      "POST /echo?x=2 HTTP/1.1\r\nContent-Length: 3\r\n\r\nfoo",
+      false);
+  const auto first = http_server_test::ReadResponses(connection, 2u);
+  EXPECT_EQ(0u, first[0].find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_NE(std::string::npos, first[0].find("Connection: keep-alive\r\n"));
+  EXPECT_EQ("1", first[0].substr(first[0].length() - 1));
+  EXPECT_NE(std::string::npos, first[1].find("Connection: keep-alive\r\n"));
+  EXPECT_EQ("2foo", first[1].substr(first[1].length() - 4));
+
+  // The connection is still open for further requests.
+  connection.BlockingWrite("GET /echo?x=3 HTTP/1.1\r\n\r\n", false);
+  const auto second = http_server_test::ReadResponses(connection, 1u);
+  EXPECT_EQ("3", second[0].substr(second[0].length() - 1));
+
+  // The client asks to close the connection.
+  connection.BlockingWrite("GET /echo?x=4 HTTP/1.1\r\nConnection: close\r\n\r\n", false);
+  const auto third = http_server_test::ReadResponses(connection, 1u);
+  EXPECT_NE(std::string::npos, third[0].find("Connection: close\r\n"));
+  char c;
+  ASSERT_THROW(connection.BlockingRead(&c, 1u), current::net::SocketException);
+}
+
+TEST(HTTPAPI, KeepAliveLimits) {
+  const auto scope = HTTP(FLAGS_net_api_test_port).Register("/ok", [](Request r) { r("OK"); });
+  HTTP(FLAGS_net_api_test_port).SetKeepAliveParameters(std::chrono::milliseconds(100), 2u);
+
+  {
+    // The second request on the connection is its last one.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("GET /ok HTTP/1.1\r\n\r\nGET /ok HTTP/1.1\r\n\r\n", false);
+    const auto responses = http_server_test::ReadResponses(connection, 2u);
+    EXPECT_NE(std::string::npos, responses[0].find("Connection: keep-alive\r\n"));
+    EXPECT_NE(std::string::npos, responses[1].find("Connection: close\r\n"));
+    char c;
+    ASSERT_THROW(connection.BlockingRead(&c, 1u), current::net::SocketException);
+  }
+
+  {
+    // The idle connection is closed by the server.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("GET /ok HTTP/1.1\r\n\r\n", false);
+    EXPECT_NE(std::string::npos,
+              http_server_test::ReadResponses(connection, 1u)[0].find("Connection: keep-alive\r\n"));
+    char c;
+    ASSERT_THROW(connection.BlockingRead(&c, 1u), current::net::SocketException);
+  }
+
+  HTTP(FLAGS_net_api_test_port).SetKeepAliveParameters(std::chrono::seconds(30), 1000u);
+}
+
+TEST(HTTPAPI, RequestSizeLimits) {
+  const auto scope = HTTP(FLAGS_net_api_test_port).Register("/echo", [](Request r) { r(r.body); });
+  HTTP(FLAGS_net_api_test_port).SetRequestSizeLimits(1000u, 100u);
+
+  const auto read_all = [](Connection& connection) {
+    std::string response;
+    char buffer[1024];
+    try {
+      while (true) {
+        const size_t read_count = connection.BlockingRead(buffer, sizeof(buffer));
+        if (!read_count) {
+          break;
+        }
+        response.append(buffer, read_count);
+      }
+    } catch (const current::net::SocketException&) {
+    }
+    return response;
+  };
+
+  {
+    // The request within the limits is served.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("POST /echo HTTP/1.1\r\nContent-Length: 100\r\n\r\n" + std::string(100u, 'x'),
+                             false);
+    const auto response = http_server_test::ReadResponses(connection, 1u)[0];
+    EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+    EXPECT_EQ(std::string(100u, 'x'), response.substr(response.length() - 100u));
+  }
+
+  {
+    // The headers which never end.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("GET /echo HTTP/1.1\r\nX-Large: " + std::string(1000u, 'x'), false);
+    const auto response = read_all(connection);
+    EXPECT_EQ(0u, response.find("HTTP/1.1 431 Request Header Fields Too Large\r\n")) << response;
+    EXPECT_NE(std::string::npos, response.find("Connection: close\r\n"));
+  }
+
+  {
+    // The body larger than the limit, before it has been received in full.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("POST /echo HTTP/1.1\r\nContent-Length: 1000000\r\n\r\n" + std::string(101u, 'x'),
+                             false);
+    const auto response = read_all(connection);
+    EXPECT_EQ(0u, response.find("HTTP/1.1 413 Request Entity Too Large\r\n")) << response;
+    EXPECT_NE(std::string::npos, response.find("<h1>REQUEST ENTITY TOO LARGE</h1>\n"));
+  }
+
+  HTTP(FLAGS_net_api_test_port).SetRequestSizeLimits();
+}
+
+TEST(HTTPAPI, StreamedRequestBody) {
+  std::atomic_bool handler_started(false);
+  const auto scope = HTTP(FLAGS_net_api_test_port).RegisterStreaming("/upload", 1000000u, [&](Request r) {
+    handler_started = true;
+    EXPECT_TRUE(r.body.empty() || r.body == "small");
+    size_t total = 0u;
+    size_t checksum = 0u;
+    char buffer[10000];
+    try {
+      while (const size_t length = r.BodyStream().Read(buffer, sizeof(buffer))) {
+        for (size_t i = 0; i < length; ++i) {
+          checksum = checksum * 17u + static_cast<unsigned char>(buffer[i]);
+        }
+        total += length;
+      }
+    } catch (const current::net::HTTPRequestBodyTooLargeException&) {
+      return;  // The `413` is sent as the request is destructed.
+    }
+    r(current::ToString(total) + ' ' + current::ToString(checksum));
+  });
+
+  {
+    // The handler starts before the body has been sent, and reads it as it arrives.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("POST /upload HTTP/1.1\r\nContent-Length: 500000\r\n\r\n", false);
+    while (!handler_started) {
+      std::this_thread::yield();
+    }
+    std::string body(500000u, '.');
+    size_t checksum = 0u;
+    for (size_t i = 0; i < body.length(); ++i) {
+      body[i] = 'a' + (i % 26);
+      checksum = checksum * 17u + static_cast<unsigned char>(body[i]);
+    }
+    connection.BlockingWrite(body, false);
+    const auto response = http_server_test::ReadResponses(connection, 1u)[0];
+    EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+    EXPECT_NE(std::string::npos, response.find("Connection: close\r\n"));
+    const std::string expected = "500000 " + current::ToString(checksum);
+    EXPECT_EQ(expected, response.substr(response.length() - expected.length()));
+  }
+
+  {
+    // The body received along with the headers is read from memory.
+    const auto response = HTTP(POST(Printf("http://localhost:%d/upload", FLAGS_net_api_test_port), "small"));
+    EXPECT_EQ(200, static_cast<int>(response.code));
+    EXPECT_EQ(0u, response.body.find("5 "));
+  }
+
+  {
+    // The body over the limit is not even sent.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite(
+        "POST /upload HTTP/1.1\r\nContent-Length: 2000000\r\nExpect: 100-continue\r\n\r\n", false);
+    const auto response = http_server_test::ReadResponses(connection, 1u)[0];
+    EXPECT_EQ(0u, response.find("HTTP/1.1 413 Request Entity Too Large\r\n"));
+  }
+}
+
+TEST(HTTPAPI, ClientReusesKeepAliveConnections) {
+  auto& pool = current::Singleton<current::http::HTTPClientConnectionPool>();
+  pool.Clear();
+  const auto scope = HTTP(FLAGS_net_api_test_port).Register("/port", [](Request r) {
+    r(current::ToString(r.connection.RemoteIPAndPort().port) + ' ' + r.body);
+  });
+  const std::string url = Printf("http://localhost:%d/port", FLAGS_net_api_test_port);
+
+  // The subsequent requests come from the same client port, as they are sent over the same connection.
+  const std::string first = HTTP(GET(url)).body;
+  EXPECT_EQ(1u, pool.IdleConnectionsCount());
+  EXPECT_EQ(first, HTTP(GET(url)).body);
+  const std::string port = first.substr(0, first.find(' '));
+  EXPECT_EQ(port + " body", HTTP(POST(url, "body")).body);
+  EXPECT_EQ(1u, pool.IdleConnectionsCount());
+
+  // The connection closed by the server is not reused.
+  HTTP(FLAGS_net_api_test_port).SetKeepAliveParameters(std::chrono::seconds(30), 1u);
+  EXPECT_EQ(port + " ", HTTP(GET(url)).body);
+  EXPECT_EQ(0u, pool.IdleConnectionsCount());
+  const std::string another = HTTP(GET(url)).body;
+  EXPECT_NE(port + " ", another);
+  EXPECT_EQ(0u, pool.IdleConnectionsCount());
+  HTTP(FLAGS_net_api_test_port).SetKeepAliveParameters(std::chrono::seconds(30), 1000u);
+
+  // Neither is the connection which has been closed by the server while idle.
+  const std::string third = HTTP(GET(url)).body;
+  EXPECT_EQ(1u, pool.IdleConnectionsCount());
+  HTTP(FLAGS_net_api_test_port).SetKeepAliveParameters(std::chrono::milliseconds(1), 1000u);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_NE(third, HTTP(GET(url)).body);
+  HTTP(FLAGS_net_api_test_port).SetKeepAliveParameters(std::chrono::seconds(30), 1000u);
+
+  pool.Clear();
+}
+
+TEST(HTTPAPI, ClientRetriesOnlyIdempotentRequests) {
+  auto& pool = current::Singleton<current::http::HTTPClientConnectionPool>();
+  pool.Clear();
+  const int port = FLAGS_net_api_test_raw_server_port;
+  const std::string url = Printf("http://localhost:%d/", port);
+
+  // The server which answers the first request over each connection, and drops the connection upon the second
+  // one, as if it has closed the idle connection just as the request was being sent. The last connection is
+  // dropped halfway through the second response.
+  current::net::Socket socket(port);
+  std::thread server([&socket]() {
+    for (const std::string body : {"first", "retry", "third"}) {
+      Connection connection(socket.Accept());
+      char buffer[1024];
+      connection.BlockingRead(buffer, sizeof(buffer));
+      connection.BlockingWrite(
+          Printf("HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: keep-alive\r\n\r\n",
+                 static_cast<int>(body.length())) +
+              body,
+          false);
+      connection.BlockingRead(buffer, sizeof(buffer));
+      if (body == "third") {
+        connection.BlockingWrite("HTTP/1.1 200 OK\r\n", false);
+      }
+    }
+  });
+
+  EXPECT_EQ("first", HTTP(GET(url)).body);
+  EXPECT_EQ(1u, pool.IdleConnectionsCount());
+  // The GET sent over the dropped connection is sent again, over a new one.
+  EXPECT_EQ("retry", HTTP(GET(url)).body);
+  EXPECT_EQ(1u, pool.IdleConnectionsCount());
+  // The POST is not, as the server may have acted on it.
+  EXPECT_THROW(HTTP(POST(url, "body")), current::net::SocketException);
+  EXPECT_EQ(0u, pool.IdleConnectionsCount());
+  // Neither is the GET the response to which has been partially received.
+  EXPECT_EQ("third", HTTP(GET(url)).body);
+  EXPECT_THROW(HTTP(GET(url)), current::net::SocketException);
+
+  server.join();
+  pool.Clear();
+}
+
+TEST(HTTPAPI, AsyncClient) {
+  // Shared with the handler, which may still be running once this test is over.
+  const auto released = std::make_shared<std::atomic_bool>(false);
+  const auto scope =
+      HTTP(FLAGS_net_api_test_port).Register("/async", [](Request r) { r("async " + r.body); }) +
+      HTTP(FLAGS_net_api_test_port).Register("/hang", [released](Request r) {
+        while (!*released) {
+          std::this_thread::yield();
+        }
+        r("hang");
+      });
+  const std::string url = Printf("http://localhost:%d/async", FLAGS_net_api_test_port);
+
+  // Many requests in flight at once, the responses arriving in any order.
+  std::vector<current::Future<current::http::HTTPResponseWithBuffer>> responses;
+  for (int i = 0; i < 50; ++i) {
+    responses.push_back(AsyncHTTP(POST(url, current::ToString(i))));
+  }
+  for (int i = 0; i < 50; ++i) {
+    const auto response = responses[i].Go();
+    EXPECT_EQ(200, static_cast<int>(response.code));
+    EXPECT_EQ("async " + current::ToString(i), response.body);
+  }
+
+  // The callback flavor.
+  std::promise<std::string> callback_result;
+  AsyncHTTP(GET(url),
+            [&callback_result](current::http::HTTPResponseWithBuffer&& response) {
+              callback_result.set_value(response.body);
+            },
+            [&callback_result](std::exception_ptr) { callback_result.set_value("error"); });
+  EXPECT_EQ("async ", callback_result.get_future().get());
+
+  // The request with no response within its timeout fails, while the others are not affected.
+  auto hanging = AsyncHTTP(GET(Printf("http://localhost:%d/hang", FLAGS_net_api_test_port)),
+                           std::chrono::milliseconds(50));
+  EXPECT_EQ("async x", AsyncHTTP(POST(url, "x")).Go().body);
+  ASSERT_THROW(hanging.Go(), current::net::HTTPTimeoutException);
+  *released = true;
+
+  // The request which could not be sent fails right away.
+  ASSERT_THROW(AsyncHTTP(GET("http://nonexistent.localhost:1/")).Go(), current::net::SocketException);
+
+  // The timeout counts from the submission of the request, connecting and sending it included.
+  ASSERT_THROW(AsyncHTTP(GET(url), std::chrono::milliseconds(0)).Go(), current::net::HTTPTimeoutException);
+}
+
+TEST(HTTPAPI, AsyncClientRetriesOnlyIdempotentRequests) {
+  auto& pool = current::Singleton<current::http::HTTPClientConnectionPool>();
+  pool.Clear();
+  const int port = FLAGS_net_api_test_raw_server_port;
+  const std::string url = Printf("http://localhost:%d/", port);
+
+  // The server which answers the first request over each connection, and drops the connection upon the second
+  // one, as if it has closed the idle connection just as the request was being sent.
+  current::net::Socket socket(port);
+  std::thread server([&socket]() {
+    for (const std::string body : {"first", "retry"}) {
+      Connection connection(socket.Accept());
+      char buffer[1024];
+      connection.BlockingRead(buffer, sizeof(buffer));
+      connection.BlockingWrite(
+          Printf("HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: keep-alive\r\n\r\n",
+                 static_cast<int>(body.length())) +
+              body,
+          false);
+      connection.BlockingRead(buffer, sizeof(buffer));
+    }
+  });
+
+  EXPECT_EQ("first", AsyncHTTP(GET(url)).Go().body);
+  // The GET sent over the dropped connection is sent again, over a new one.
+  EXPECT_EQ("retry", AsyncHTTP(GET(url)).Go().body);
+  // The POST is not, as the server may have acted on it.
+  EXPECT_THROW(AsyncHTTP(POST(url, "body")).Go(), current::net::SocketException);
+
+  server.join();
+  pool.Clear();
+}
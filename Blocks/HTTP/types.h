@@ -28,6 +28,7 @@ SOFTWARE.
 #ifndef BLOCKS_HTTP_TYPES_H
 #define BLOCKS_HTTP_TYPES_H
 
+#include <functional>
 #include <mutex>
 #include <memory>
 #include <map>
@@ -74,6 +74,11 @@ struct PersistenceMemoryBlockNoLongerAvailable : InGracefulShutdownException {
   using InGracefulShutdownException::InGracefulShutdownException;
 };
 
+struct PersistenceFileNotReadable : PersistenceException {
+  explicit PersistenceFileNotReadable(const std::string& filename)
+      : PersistenceException("Persistence file not readable: `" + filename + "`.") {}
+};
+
 struct PersistenceFileNoLongerAvailable : InGracefulShutdownException {
   explicit PersistenceFileNoLongerAvailable(const std::string& filename)
       : InGracefulShutdownException("Persistence file no longer available: `" + filename + "`.") {}
@@ -27,18 +27,27 @@ SOFTWARE.
 // The file is replayed at startup to check its integriry and to extract the most recent index/timestamp.
 // Each iterator opens the same file again, to read its first N lines.
 // Iterators never outlive the persister.
+//
+// Two formats of the file are supported. `File` is the text one: one entry per line, its `idxts_t` and
+// the entry itself, both as JSON, separated by a tab. `BinaryFile` stores the entries in the binary format
+// of `TypeSystem/Serialization/binary.h`, each prefixed by its `idxts_t` and its size in bytes. The binary
+// file is more compact and faster to replay, while the text one can be inspected and edited by hand.
+// `ConvertPersistedFile()` converts the files between the formats.
 
 #ifndef BLOCKS_PERSISTENCE_FILE_H
 #define BLOCKS_PERSISTENCE_FILE_H
 
+#include <algorithm>
 #include <atomic>
 #include <functional>
 #include <fstream>
+#include <sstream>
 
 #include "exceptions.h"
 
 #include "../SS/persister.h"
 
+#include "../../TypeSystem/Serialization/binary.h"
 #include "../../TypeSystem/Serialization/json.h"
 
 #include "../../Bricks/time/chrono.h"
@@ -48,10 +57,102 @@ SOFTWARE.
 namespace current {
 namespace persistence {
 
+// The text format of the persisted file: `idxts_t` and the entry, as JSON, tab-separated, one entry per line.
+struct JSONFileFormat {
+  static std::ios_base::openmode OpenMode() { return std::ios_base::openmode(); }
+
+  // Reads the next record into `buffer`. Sets `idx_ts`, and `data` and `size` to the serialized entry.
+  static bool ReadRecord(
+      std::istream& fi, std::string& buffer, idxts_t& idx_ts, const char*& data, size_t& size) {
+    if (std::getline(fi, buffer)) {
+      const size_t tab_pos = buffer.find('\t');
+      if (tab_pos == std::string::npos) {
+        CURRENT_THROW(MalformedEntryException(buffer));
+      }
+      idx_ts = ParseJSON<idxts_t>(buffer.substr(0, tab_pos));
+      data = buffer.c_str() + tab_pos + 1;
+      size = buffer.length() - tab_pos - 1;
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  template <typename ENTRY>
+  static ENTRY ParseEntry(const char* data, size_t) {
+    return ParseJSON<ENTRY>(data);
+  }
+
+  template <typename ENTRY>
+  static void WriteRecord(std::ostream& fo, const idxts_t& idx_ts, const ENTRY& entry) {
+    fo << JSON(idx_ts) << '\t' << JSON(entry) << std::endl;
+  }
+};
+
+// The binary format of the persisted file: `idxts_t`, the size of the entry in bytes, and the entry itself.
+struct BinaryFileFormat {
+  static std::ios_base::openmode OpenMode() { return std::ios_base::binary; }
+
+  static bool ReadRecord(
+      std::istream& fi, std::string& buffer, idxts_t& idx_ts, const char*& data, size_t& size) {
+    if (fi.peek() == std::char_traits<char>::eof()) {
+      return false;
+    }
+    try {
+      idx_ts = LoadFromBinary<idxts_t>(fi);
+      size = static_cast<size_t>(serialization::binary::load::LoadSizeFromBinary(fi));
+    } catch (const BinaryLoadFromStreamException&) {
+      CURRENT_THROW(MalformedEntryException("Truncated binary record header."));
+    }
+    // The size comes from the file, and may be corrupted. The buffer grows only as the bytes are actually read,
+    // for such a size to be reported as a truncated record, not to allocate however much memory it says.
+    constexpr size_t kReadChunkSize = 1024 * 1024;
+    buffer.clear();
+    while (buffer.length() < size) {
+      const size_t offset = buffer.length();
+      const size_t chunk = std::min(size - offset, kReadChunkSize);
+      buffer.resize(offset + chunk);
+      if (static_cast<size_t>(fi.rdbuf()->sgetn(&buffer[offset], chunk)) != chunk) {
+        CURRENT_THROW(MalformedEntryException("Truncated binary record."));
+      }
+    }
+    data = buffer.data();
+    return true;
+  }
+
+  template <typename ENTRY>
+  static ENTRY ParseEntry(const char* data, size_t size) {
+    InputBuffer input_buffer(data, size);
+    std::istream is(&input_buffer);
+    return LoadFromBinary<ENTRY>(is);
+  }
+
+  template <typename ENTRY>
+  static void WriteRecord(std::ostream& fo, const idxts_t& idx_ts, const ENTRY& entry) {
+    // The entry is serialized first, as its size goes before it.
+    std::ostringstream os;
+    SaveIntoBinary(os, entry);
+    const std::string serialized_entry = os.str();
+    SaveIntoBinary(fo, idx_ts);
+    serialization::binary::save::SaveSizeIntoBinary(fo, serialized_entry.size());
+    fo.write(serialized_entry.data(), serialized_entry.size());
+    fo.flush();
+  }
+
+ private:
+  // Reads from the buffer of the record in place, not copying it into an `std::istringstream`.
+  struct InputBuffer : std::streambuf {
+    InputBuffer(const char* data, size_t size) {
+      char* begin = const_cast<char*>(data);
+      setg(begin, begin, begin + size);
+    }
+  };
+};
+
 namespace impl {
-// An iterator to read a file line by line, extracting tab-separated `idxts_t index` and `const char* data`.
+// An iterator to read a file record by record, extracting `idxts_t index` and the serialized entry.
 // Validates the entries come in the right order of 0-based indexes, and with strictly increasing timestamps.
-template <typename ENTRY>
+template <typename FORMAT>
 class IteratorOverFileOfPersistedEntries {
  public:
   explicit IteratorOverFileOfPersistedEntries(std::istream& fi, std::streampos offset, uint64_t index_at_offset)
@@ -62,14 +163,13 @@ class IteratorOverFileOfPersistedEntries {
     }
   }
 
+  // Calls `f(idxts_t, const char* data, size_t size)`.
   template <typename F>
   bool ProcessNextEntry(F&& f) {
-    if (std::getline(fi_, line_)) {
-      const size_t tab_pos = line_.find('\t');
-      if (tab_pos == std::string::npos) {
-        CURRENT_THROW(MalformedEntryException(line_));
-      }
-      const auto current = ParseJSON<idxts_t>(line_.substr(0, tab_pos));
+    idxts_t current;
+    const char* data;
+    size_t size;
+    if (FORMAT::ReadRecord(fi_, buffer_, current, data, size)) {
       if (current.index != next_.index) {
         // Indexes must be strictly continuous.
         CURRENT_THROW(InconsistentIndexException(next_.index, current.index));
@@ -78,7 +178,7 @@ class IteratorOverFileOfPersistedEntries {
         // Timestamps must monotonically increase.
         CURRENT_THROW(InconsistentTimestampException(next_.us, current.us));
       }
-      f(current, line_.c_str() + tab_pos + 1);
+      f(current, data, size);
       next_ = current;
       ++next_.index;
       ++next_.us;
@@ -93,12 +193,12 @@ class IteratorOverFileOfPersistedEntries {
 
  private:
   std::istream& fi_;
-  std::string line_;
+  std::string buffer_;
   idxts_t next_;
 };
 
-// The implementation of a persister based exclusively on appending to and reading one text flie.
-template <typename ENTRY>
+// The implementation of a persister based exclusively on appending to and reading one flie.
+template <typename ENTRY, typename FORMAT>
 class FilePersister {
  protected:
   // { last_published_index + 1, last_published_us + 1us }, or { 0, 0us } for an empty persister.
@@ -127,7 +227,7 @@ class FilePersister {
     FilePersisterImpl() = delete;
     explicit FilePersisterImpl(const std::string& filename)
         : filename(filename),
-          appender(filename, std::ofstream::app),
+          appender(filename, std::ofstream::app | FORMAT::OpenMode()),
           end(ValidateFileAndInitializeNext(filename, offset, timestamp)) {
       if (!appender.good()) {
         CURRENT_THROW(PersistenceFileNotWritable(filename));
@@ -138,15 +238,15 @@ class FilePersister {
     static end_t ValidateFileAndInitializeNext(const std::string& filename,
                                                std::vector<std::streampos>& offset,
                                                std::vector<std::chrono::microseconds>& timestamp) {
-      std::ifstream fi(filename);
+      std::ifstream fi(filename, FORMAT::OpenMode());
       if (fi.good()) {
         // Read through all the lines.
         // Let `IteratorOverFileOfPersistedEntries` maintain its own `next_`, which later becomes `this->end`.
         // While reading the file, record the offset of each record and store it in `offset`.
-        IteratorOverFileOfPersistedEntries<ENTRY> cit(fi, 0, 0);
+        IteratorOverFileOfPersistedEntries<FORMAT> cit(fi, 0, 0);
         std::streampos current_offset(0);
         while (cit.ProcessNextEntry(
-            [&fi, &offset, &timestamp, &current_offset](const idxts_t& current, const char*) {
+            [&fi, &offset, &timestamp, &current_offset](const idxts_t& current, const char*, size_t) {
               assert(current.index == offset.size());
               assert(current.index == timestamp.size());
               offset.push_back(current_offset);
@@ -191,15 +291,15 @@ class FilePersister {
                uint64_t index_at_offset)
           : file_persister_impl_(file_persister_impl, [this]() { valid_ = false; }), i_(i) {
         if (!filename.empty()) {
-          fi_ = std::make_unique<std::ifstream>(filename);
+          fi_ = std::make_unique<std::ifstream>(filename, FORMAT::OpenMode());
           // This `if` condition is only here to test performance with vs. without the `seekg`.
           // The high performance version jumps to the desired entry right away,
           // The poor performance one scans the file from the very beginning for each new iterator created.
           if (true) {
-            cit_ = std::make_unique<IteratorOverFileOfPersistedEntries<ENTRY>>(*fi_, offset, index_at_offset);
+            cit_ = std::make_unique<IteratorOverFileOfPersistedEntries<FORMAT>>(*fi_, offset, index_at_offset);
           } else {
             // Inefficient, scan the file from the very beginning.
-            cit_ = std::make_unique<IteratorOverFileOfPersistedEntries<ENTRY>>(*fi_, 0, 0);
+            cit_ = std::make_unique<IteratorOverFileOfPersistedEntries<FORMAT>>(*fi_, 0, 0);
           }
         }
       }
@@ -214,11 +314,12 @@ class FilePersister {
         Entry result;
         bool found = false;
         while (!found) {
-          if (!(cit_->ProcessNextEntry([this, &found, &result](const idxts_t& cursor, const char* json) {
+          if (!(cit_->ProcessNextEntry([this, &found, &result](
+                  const idxts_t& cursor, const char* data, size_t size) {
                 if (cursor.index == i_) {
                   found = true;
                   result.idx_ts = cursor;
-                  result.entry = ParseJSON<ENTRY>(json);
+                  result.entry = FORMAT::template ParseEntry<ENTRY>(data, size);
                 } else if (cursor.index > i_) {                                 // LCOV_EXCL_LINE
                   CURRENT_THROW(InconsistentIndexException(i_, cursor.index));  // LCOV_EXCL_LINE
                 }
@@ -245,7 +346,7 @@ class FilePersister {
       ScopeOwnedBySomeoneElse<FilePersisterImpl> file_persister_impl_;
       bool valid_ = true;
       std::unique_ptr<std::ifstream> fi_;
-      std::unique_ptr<IteratorOverFileOfPersistedEntries<ENTRY>> cit_;
+      std::unique_ptr<IteratorOverFileOfPersistedEntries<FORMAT>> cit_;
       uint64_t i_;
     };
 
@@ -299,7 +400,7 @@ class FilePersister {
       file_persister_impl_->offset.push_back(file_persister_impl_->appender.tellp());
       file_persister_impl_->timestamp.push_back(timestamp);
     }
-    file_persister_impl_->appender << JSON(current) << '\t' << JSON(std::forward<E>(entry)) << std::endl;
+    FORMAT::WriteRecord(file_persister_impl_->appender, current, std::forward<E>(entry));
     ++iterator.index;
     iterator.us += std::chrono::microseconds(1);
     file_persister_impl_->end.store(iterator);
@@ -384,7 +485,35 @@ class FilePersister {
 }  // namespace current::persistence::impl
 
 template <typename ENTRY>
-using File = ss::EntryPersister<impl::FilePersister<ENTRY>, ENTRY>;
+using File = ss::EntryPersister<impl::FilePersister<ENTRY, JSONFileFormat>, ENTRY>;
+
+template <typename ENTRY>
+using BinaryFile = ss::EntryPersister<impl::FilePersister<ENTRY, BinaryFileFormat>, ENTRY>;
+
+// Rewrites the persisted file in another format, keeping the indexes and the timestamps of the entries.
+// For example, `ConvertPersistedFile<ENTRY, JSONFileFormat, BinaryFileFormat>("data.json", "data.bin")`.
+// Returns the number of entries converted.
+// Throws before creating the target file if the source one can not be read.
+template <typename ENTRY, typename FROM_FORMAT, typename TO_FORMAT>
+uint64_t ConvertPersistedFile(const std::string& from_filename, const std::string& to_filename) {
+  std::ifstream fi(from_filename, FROM_FORMAT::OpenMode());
+  if (!fi.good()) {
+    CURRENT_THROW(PersistenceFileNotReadable(from_filename));
+  }
+  std::ofstream fo(to_filename, std::ofstream::trunc | TO_FORMAT::OpenMode());
+  if (!fo.good()) {
+    CURRENT_THROW(PersistenceFileNotWritable(to_filename));
+  }
+  uint64_t count = 0u;
+  impl::IteratorOverFileOfPersistedEntries<FROM_FORMAT> cit(fi, 0, 0);
+  while (cit.ProcessNextEntry([&fo, &count](const idxts_t& current, const char* data, size_t size) {
+    TO_FORMAT::WriteRecord(fo, current, FROM_FORMAT::template ParseEntry<ENTRY>(data, size));
+    ++count;
+  })) {
+    ;
+  }
+  return count;
+}
 
 }  // namespace current::persistence
 }  // namespace current
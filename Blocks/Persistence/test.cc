@@ -316,6 +316,111 @@ TEST(PersistenceLayer, File) {
   }
 }
 
+TEST(PersistenceLayer, BinaryFile) {
+  current::time::ResetToZero();
+
+  using namespace persistence_test;
+
+  using IMPL = current::persistence::BinaryFile<StorableString>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_persistence_test_tmpdir, "data.bin");
+  const auto file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  {
+    IMPL impl(persistence_file_name);
+    EXPECT_EQ(0u, impl.Size());
+    current::time::SetNow(std::chrono::microseconds(100));
+    impl.Publish(StorableString("foo"));
+    current::time::SetNow(std::chrono::microseconds(200));
+    impl.Publish(StorableString("bar\tbaz\n"));
+    current::time::SetNow(std::chrono::microseconds(500));
+    impl.Publish(StorableString("meh"));
+    EXPECT_EQ(3u, impl.Size());
+  }
+
+  {
+    // Confirm the data has been saved and can be replayed, including from the middle of the file.
+    IMPL impl(persistence_file_name);
+    EXPECT_EQ(3u, impl.Size());
+
+    current::time::SetNow(std::chrono::microseconds(999));
+    impl.Publish(StorableString("blah"));
+    EXPECT_EQ(4u, impl.Size());
+
+    std::vector<std::string> all_four;
+    for (const auto& e : impl.Iterate()) {
+      all_four.push_back(Printf("%s %d %d",
+                                e.entry.s.c_str(),
+                                static_cast<int>(e.idx_ts.index),
+                                static_cast<int>(e.idx_ts.us.count())));
+    }
+    EXPECT_EQ("foo 0 100,bar\tbaz\n 1 200,meh 2 500,blah 3 999", Join(all_four, ","));
+
+    std::vector<std::string> last_two;
+    for (const auto& e : impl.Iterate(2, 4)) {
+      last_two.push_back(e.entry.s);
+    }
+    EXPECT_EQ("meh,blah", Join(last_two, ","));
+  }
+
+  const std::string json_file_name = current::FileSystem::JoinPath(FLAGS_persistence_test_tmpdir, "data.json");
+  const std::string binary_file_name =
+      current::FileSystem::JoinPath(FLAGS_persistence_test_tmpdir, "data.bin2");
+  const auto json_file_remover = current::FileSystem::ScopedRmFile(json_file_name);
+  const auto binary_file_remover = current::FileSystem::ScopedRmFile(binary_file_name);
+
+  {
+    // Convert the binary file into text and back, and confirm nothing is lost in the conversion.
+    using current::persistence::ConvertPersistedFile;
+    using current::persistence::JSONFileFormat;
+    using current::persistence::BinaryFileFormat;
+    EXPECT_EQ(4u,
+              (ConvertPersistedFile<StorableString, BinaryFileFormat, JSONFileFormat>(persistence_file_name,
+                                                                                     json_file_name)));
+    EXPECT_EQ(
+        "{\"index\":0,\"us\":100}\t{\"s\":\"foo\"}\n"
+        "{\"index\":1,\"us\":200}\t{\"s\":\"bar\\tbaz\\n\"}\n"
+        "{\"index\":2,\"us\":500}\t{\"s\":\"meh\"}\n"
+        "{\"index\":3,\"us\":999}\t{\"s\":\"blah\"}\n",
+        current::FileSystem::ReadFileAsString(json_file_name));
+    EXPECT_EQ(4u,
+              (ConvertPersistedFile<StorableString, JSONFileFormat, BinaryFileFormat>(json_file_name,
+                                                                                     binary_file_name)));
+    EXPECT_EQ(current::FileSystem::ReadFileAsString(persistence_file_name),
+              current::FileSystem::ReadFileAsString(binary_file_name));
+
+    // A missing source file is an error, and the target file is not created.
+    const std::string missing_file_name =
+        current::FileSystem::JoinPath(FLAGS_persistence_test_tmpdir, "missing");
+    const std::string target_file_name =
+        current::FileSystem::JoinPath(FLAGS_persistence_test_tmpdir, "target");
+    current::FileSystem::RmFile(missing_file_name, current::FileSystem::RmFileParameters::Silent);
+    current::FileSystem::RmFile(target_file_name, current::FileSystem::RmFileParameters::Silent);
+    EXPECT_THROW((ConvertPersistedFile<StorableString, JSONFileFormat, BinaryFileFormat>(missing_file_name,
+                                                                                        target_file_name)),
+                 current::persistence::PersistenceFileNotReadable);
+    EXPECT_THROW(current::FileSystem::ReadFileAsString(target_file_name), current::CannotReadFileException);
+  }
+
+  {
+    // A truncated binary file is reported as malformed.
+    const std::string contents = current::FileSystem::ReadFileAsString(persistence_file_name);
+    current::FileSystem::WriteStringToFile(contents.substr(0, contents.length() - 1), binary_file_name.c_str());
+    EXPECT_THROW(IMPL impl(binary_file_name), current::persistence::MalformedEntryException);
+  }
+
+  {
+    // So is the one with a corrupted size of the record, without attempting to allocate that much memory.
+    std::ostringstream os;
+    SaveIntoBinary(os, idxts_t(0, std::chrono::microseconds(100)));
+    current::serialization::binary::save::SaveSizeIntoBinary(os, static_cast<size_t>(1ull << 60));
+    os << "foo";
+    current::FileSystem::WriteStringToFile(os.str(), binary_file_name.c_str());
+    EXPECT_THROW(IMPL impl(binary_file_name), current::persistence::MalformedEntryException);
+  }
+}
+
 TEST(PersistenceLayer, FileExceptions) {
   using namespace persistence_test;
 
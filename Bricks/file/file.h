@@ -39,9 +39,11 @@ SOFTWARE.
 
 #ifndef CURRENT_WINDOWS
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #else
 #include <direct.h>
+#include <io.h>
 #endif
 
 #include <sys/stat.h>
@@ -199,6 +201,34 @@ struct FileSystem {
     }
   }
 
+  // Flushes the contents of the file, or the entries of the directory, to the disk, to survive a crash.
+  // On Windows, where a directory can not be opened as a file, only the files are flushed.
+  static inline void SyncFile(const std::string& file_or_directory_name) {
+#ifndef CURRENT_WINDOWS
+    const int fd = ::open(file_or_directory_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      CURRENT_THROW(FileException());
+    }
+    const int result = ::fsync(fd);
+    ::close(fd);
+    if (result) {
+      CURRENT_THROW(FileException());  // LCOV_EXCL_LINE
+    }
+#else
+    if (!IsDir(file_or_directory_name)) {
+      const int fd = ::_open(file_or_directory_name.c_str(), _O_WRONLY | _O_BINARY);
+      if (fd < 0) {
+        CURRENT_THROW(FileException());
+      }
+      const int result = ::_commit(fd);
+      ::_close(fd);
+      if (result) {
+        CURRENT_THROW(FileException());  // LCOV_EXCL_LINE
+      }
+    }
+#endif
+  }
+
   // TODO(dkorolev): Make OutputFile not as tightly coupled with std::ofstream as it is now.
   typedef std::ofstream OutputFile;
 
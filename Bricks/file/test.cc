@@ -166,6 +166,21 @@ TEST(File, RenameFile) {
   ASSERT_THROW(FileSystem::RenameFile(fn1, fn2), FileException);
 }
 
+TEST(File, SyncFile) {
+  FileSystem::MkDir(FLAGS_file_test_tmpdir, FileSystem::MkDirParameters::Silent);
+
+  const std::string fn = FileSystem::JoinPath(FLAGS_file_test_tmpdir, "synced");
+  FileSystem::RmFile(fn, FileSystem::RmFileParameters::Silent);
+  ASSERT_THROW(FileSystem::SyncFile(fn), FileException);
+
+  FileSystem::WriteStringToFile("data", fn.c_str());
+  FileSystem::SyncFile(fn);
+  FileSystem::SyncFile(FLAGS_file_test_tmpdir);
+  EXPECT_EQ("data", FileSystem::ReadFileAsString(fn));
+
+  FileSystem::RmFile(fn);
+}
+
 TEST(File, DirOperations) {
   // Required for Windows tests.
   FileSystem::MkDir(FLAGS_file_test_tmpdir, FileSystem::MkDirParameters::Silent);
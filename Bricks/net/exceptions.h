@@ -64,11 +64,13 @@ struct ClientSocketException : SocketException {
   using SocketException::SocketException;
 };
 struct SocketConnectException : ClientSocketException {};  // LCOV_EXCL_LINE -- not covered by unit tests.
+struct SocketConnectTimeoutException : SocketConnectException {};  // LCOV_EXCL_LINE
 struct SocketResolveAddressException : ClientSocketException {
   using ClientSocketException::ClientSocketException;
 };
 
 struct SocketFcntlException : SocketException {};
+struct SocketPollException : SocketException {};  // LCOV_EXCL_LINE -- not covered by unit tests.
 struct SocketReadException : SocketException {};  // LCOV_EXCL_LINE -- TODO(dkorolev): We might want to test it.
 struct SocketWriteException : SocketException {};
 struct SocketCouldNotWriteEverythingException : SocketWriteException {};
@@ -90,6 +92,10 @@ struct HTTPException : NetworkException {
 
 struct HTTPRedirectNotAllowedException : HTTPException {};
 struct HTTPRedirectLoopException : HTTPException {};
+struct HTTPTimeoutException : HTTPException {};
+struct HTTPClientTerminatedException : HTTPException {};
+struct HTTPRequestBodyTooLargeException : HTTPException {};
+struct HTTPMalformedChunkedBodyException : HTTPException {};
 struct CannotServeStaticFilesOfUnknownMIMEType : HTTPException {
   CannotServeStaticFilesOfUnknownMIMEType(const std::string& what) : HTTPException(what) {}
 };
@@ -71,6 +71,7 @@ enum class HTTPResponseCodeValue : int {
   UnsupportedMediaType = 415,
   RequestedRangeNotSatisfiable = 416,
   ExpectationFailed = 417,
+  RequestHeaderFieldsTooLarge = 431,
   InternalServerError = 500,
   NotImplemented = 501,
   BadGateway = 502,
@@ -117,6 +118,7 @@ struct HTTPResponseCodeDotNotation {
   const HTTPResponseCodeValue RequestedRangeNotSatisfiable =
       HTTPResponseCodeValue::RequestedRangeNotSatisfiable;
   const HTTPResponseCodeValue ExpectationFailed = HTTPResponseCodeValue::ExpectationFailed;
+  const HTTPResponseCodeValue RequestHeaderFieldsTooLarge = HTTPResponseCodeValue::RequestHeaderFieldsTooLarge;
   const HTTPResponseCodeValue InternalServerError = HTTPResponseCodeValue::InternalServerError;
   const HTTPResponseCodeValue NotImplemented = HTTPResponseCodeValue::NotImplemented;
   const HTTPResponseCodeValue BadGateway = HTTPResponseCodeValue::BadGateway;
@@ -164,6 +166,7 @@ inline std::string HTTPResponseCodeAsString(HTTPResponseCodeValue code) {
       {415, "Unsupported Media Type"},
       {416, "Requested range not satisfiable"},
       {417, "Expectation Failed"},
+      {431, "Request Header Fields Too Large"},
       {500, "Internal Server Error"},
       {501, "Not Implemented"},
       {502, "Bad Gateway"},
@@ -371,6 +371,47 @@ struct Headers final {
   cookies_map_t cookies;
 };
 
+// The conditional `GET` of RFC 7232: whether the `If-None-Match` and `If-Modified-Since` request `headers` make
+// the response for the resource with the `etag` and `last_modified` validators `304 Not Modified`.
+// `If-None-Match` takes precedence, and an unparsable `If-Modified-Since` is ignored, not treated as an error.
+namespace impl {
+inline bool NotModified(const Headers& headers,
+                        const std::string& etag,
+                        bool has_last_modified,
+                        std::chrono::microseconds last_modified) {
+  if (headers.Has("If-None-Match")) {
+    // The weak comparison, as it is only used to validate the cached responses to GET.
+    for (const auto& candidate : current::strings::Split(headers.Get("If-None-Match"), ',')) {
+      const std::string trimmed = current::strings::Trim(candidate);
+      if (trimmed == "*" || trimmed == etag || trimmed == "W/" + etag) {
+        return true;
+      }
+    }
+    return false;
+  } else if (has_last_modified && headers.Has("If-Modified-Since")) {
+    try {
+      // `ParseHTTPDate()` pads the date to the end of its second, as the HTTP dates have no subseconds.
+      return last_modified <= ParseHTTPDate(headers.Get("If-Modified-Since"));
+    } catch (const InvalidHTTPDateException&) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+}
+}  // namespace impl
+
+inline bool NotModified(const Headers& headers,
+                        const std::string& etag,
+                        std::chrono::microseconds last_modified) {
+  return impl::NotModified(headers, etag, true, last_modified);
+}
+
+// For the resources with no `Last-Modified`, only `If-None-Match` is taken into account.
+inline bool NotModified(const Headers& headers, const std::string& etag) {
+  return impl::NotModified(headers, etag, false, std::chrono::microseconds(0));
+}
+
 }  // namespace http
 }  // namespace net
 }  // namespace current
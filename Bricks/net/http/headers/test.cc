@@ -470,4 +470,27 @@ TEST(HTTPHeadersTest, ShouldNotAccessCookiesAsRegularHeader) {
   ASSERT_THROW(mutable_headers["set_cookie"], CookieIsNotYourRegularHeader);
 }
 
+TEST(HTTPHeadersTest, ConditionalGET) {
+  using current::net::http::Headers;
+  using current::net::http::NotModified;
+  const std::chrono::microseconds ten_seconds(10 * 1000 * 1000 + 42);
+
+  EXPECT_FALSE(NotModified(Headers(), "\"x\"", ten_seconds));
+  EXPECT_TRUE(NotModified(Headers({{"If-None-Match", "\"x\""}}), "\"x\"", ten_seconds));
+  EXPECT_TRUE(NotModified(Headers({{"If-None-Match", "\"y\", W/\"x\""}}), "\"x\"", ten_seconds));
+  EXPECT_TRUE(NotModified(Headers({{"If-None-Match", "*"}}), "\"x\"", ten_seconds));
+  EXPECT_FALSE(NotModified(Headers({{"If-None-Match", "\"y\""}}), "\"x\"", ten_seconds));
+
+  EXPECT_TRUE(NotModified(Headers({{"If-Modified-Since", "Thu, 01 Jan 1970 00:00:10 GMT"}}), "", ten_seconds));
+  EXPECT_FALSE(NotModified(Headers({{"If-Modified-Since", "Thu, 01 Jan 1970 00:00:09 GMT"}}), "", ten_seconds));
+  EXPECT_FALSE(NotModified(Headers({{"If-Modified-Since", "Not a date."}}), "", ten_seconds));
+  EXPECT_FALSE(NotModified(Headers({{"If-Modified-Since", "Thu, 01 Jan 1970 00:00:10 GMT"}}), ""));
+
+  // `If-None-Match` takes precedence over `If-Modified-Since`.
+  EXPECT_FALSE(NotModified(
+      Headers({{"If-None-Match", "\"y\""}, {"If-Modified-Since", "Thu, 01 Jan 1970 00:00:10 GMT"}}),
+      "\"x\"",
+      ten_seconds));
+}
+
 #endif  // BRICKS_NET_HTTP_HEADERS_TEST_CC
@@ -25,9 +25,15 @@ SOFTWARE.
 #ifndef BRICKS_NET_HTTP_IMPL_SERVER_H
 #define BRICKS_NET_HTTP_IMPL_SERVER_H
 
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <memory>
 
@@ -49,6 +55,8 @@ SOFTWARE.
 #include "../../../strings/util.h"
 #include "../../../strings/split.h"
 
+#include "../../../util/deflate.h"
+
 #include "../../../../Blocks/URL/url.h"
 
 namespace current {
@@ -83,17 +91,63 @@ inline static const http::Headers DefaultJSONHTTPHeaders() {
 // HTTPDefaultHelper handles headers and chunked transfers.
 // One can inject a custom implementaion of it to avoid keeping all HTTP body in memory.
 // TODO(dkorolev): This is not yet the case, but will be soon once I fix HTTP parse code.
+//
+// The headers are kept as the offsets of their keys and values, null-terminated in place by the parser, in the
+// receive buffer. They are only built into `http::Headers` once `headers()` is called, while `FindHeader()`
+// looks a header up in the receive buffer directly.
 class HTTPDefaultHelper {
  public:
   struct ConstructionParams {};
   HTTPDefaultHelper(const ConstructionParams&) {}
 
-  const http::Headers& headers() const { return headers_; }
+  const http::Headers& headers() const {
+    std::call_once(headers_built_, [this]() {
+      ForEachRawHeader([this](const char* key, const char* value) { headers_.SetHeaderOrCookie(key, value); });
+    });
+    return headers_;
+  }
+
+  // Sets `value` to the value of `header`, with the values of its repetitions joined by ", ",
+  // as `http::Headers` does. Returns `false` if there is no such header.
+  bool FindHeader(const std::string& header, std::string& value) const {
+    http::Header::ThrowIfHeaderIsCookie(header);
+    if (!receive_buffer_) {
+      if (!headers_.Has(header)) {
+        return false;
+      }
+      value = headers_.Get(header);
+      return true;
+    }
+    bool found = false;
+    value.clear();
+    ForEachRawHeader([&header, &value, &found](const char* key, const char* key_value) {
+      if (IsSameHeader(key, header)) {
+        found = true;
+        if (*key_value) {
+          if (!value.empty()) {
+            value += ", ";
+          }
+          value += key_value;
+        }
+      }
+    });
+    return found;
+  }
 
  protected:
   HTTPDefaultHelper() = default;
 
-  inline void OnHeader(const char* key, const char* value) { headers_.SetHeaderOrCookie(key, value); }
+  // Called by `GenericHTTPRequestData` before it starts parsing into `buffer`.
+  inline void OnReceiveBuffer(const std::vector<char>& buffer) { receive_buffer_ = &buffer; }
+
+  inline void OnHeader(const char* key, const char* value) {
+    if (receive_buffer_) {
+      const char* const base = receive_buffer_->data();
+      raw_headers_.emplace_back(static_cast<size_t>(key - base), static_cast<size_t>(value - base));
+    } else {
+      headers_.SetHeaderOrCookie(key, value);
+    }
+  }
 
   inline void OnChunk(const char* chunk, size_t length) { body_.append(chunk, length); }
 
@@ -103,10 +157,314 @@ class HTTPDefaultHelper {
   }
 
  private:
-  http::Headers headers_;
+  template <typename F>
+  void ForEachRawHeader(F&& f) const {
+    for (const auto& offsets : raw_headers_) {
+      f(&(*receive_buffer_)[offsets.first], &(*receive_buffer_)[offsets.second]);
+    }
+  }
+
+  // Case-insensitive and {'-'/'_'}-insensitive, as `http::Headers` compares the keys.
+  static bool IsSameHeader(const char* key, const std::string& header) {
+    const http::Header::KeyComparator comparator;
+    if (!*key) {
+      return false;
+    }
+    for (const char c : header) {
+      if (!*key || comparator.Canonical(*key) != comparator.Canonical(c)) {
+        return false;
+      }
+      ++key;
+    }
+    return !*key;
+  }
+
+  // The buffer of the `GenericHTTPRequestData`, which can not be moved, so this pointer stays valid,
+  // while the data in the buffer may be reallocated as more of it is received.
+  const std::vector<char>* receive_buffer_ = nullptr;
+  std::vector<std::pair<size_t, size_t>> raw_headers_;
+  mutable std::once_flag headers_built_;
+  mutable http::Headers headers_;
   std::string body_;
 };
 
+// Returns the first CRLF in `[begin, end)`, or `nullptr`. Scans with `memchr()`, which the C library
+// vectorizes, and, unlike `strstr()`, does not stop at zero bytes, nor require the data to be null-terminated.
+template <typename CHAR>
+inline CHAR* FindCRLF(CHAR* begin, CHAR* end) {
+  while (begin < end) {
+    CHAR* cr = static_cast<CHAR*>(memchr(begin, '\r', end - begin));
+    if (!cr || cr + 1 >= end) {
+      return nullptr;
+    }
+    if (cr[1] == '\n') {
+      return cr;
+    }
+    begin = cr + 1;
+  }
+  return nullptr;
+}
+
+// Splits the header line `[begin, end)` into the key and the value, in place, skipping the whitespace around
+// the value. Returns the pointer to the value, or `nullptr` if there is no colon in the line.
+// Both the key and the value are null-terminated, as the colon and the end of the line are overwritten.
+inline char* SplitHeaderLine(char* begin, char* end) {
+  char* colon = static_cast<char*>(memchr(begin, ':', end - begin));
+  if (!colon) {
+    return nullptr;
+  }
+  *colon = '\0';
+  char* value = colon + 1;
+  while (value < end && (*value == ' ' || *value == '\t')) {
+    ++value;
+  }
+  while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+    --end;
+  }
+  *end = '\0';
+  return value;
+}
+
+// Returns the length of the first HTTP request in `[data, data + length)` if it has been received in full,
+// or zero if more data is needed. Used by the event-driven server to accumulate the request from
+// a non-blocking socket, so that it is then parsed by `GenericHTTPRequestData` without waiting on the socket.
+// Mirrors the parser below: the body is either `Content-Length` bytes, or chunks up to the zero-length one.
+// Does not allocate, as it is called on every read from the socket.
+inline size_t CompleteHTTPRequestLength(const char* data, size_t length) {
+  const char* const end = data + length;
+  const auto equals = [](const char* begin, const char* end, const char* literal) {
+    const size_t literal_length = strlen(literal);
+    return static_cast<size_t>(end - begin) == literal_length && !memcmp(begin, literal, literal_length);
+  };
+  const char* p = data;
+  // Blank lines before the first line are ignored, as they are by the parser.
+  while (p + 1 < end && p[0] == '\r' && p[1] == '\n') {
+    p += constants::kCRLFLength;
+  }
+  size_t body_length = static_cast<size_t>(-1);
+  bool chunked_transfer_encoding = false;
+  bool first_line = true;
+  while (true) {
+    const char* crlf = FindCRLF(p, end);
+    if (!crlf) {
+      return 0u;
+    }
+    if (!first_line) {
+      if (crlf == p) {
+        p += constants::kCRLFLength;
+        break;
+      }
+      const char* colon = static_cast<const char*>(memchr(p, ':', crlf - p));
+      if (colon) {
+        const char* value = colon + 1;
+        const char* value_end = crlf;
+        while (value < value_end && (*value == ' ' || *value == '\t')) {
+          ++value;
+        }
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+          --value_end;
+        }
+        if (equals(p, colon, constants::kContentLengthHeaderKey)) {
+          body_length = static_cast<size_t>(strtoul(value, nullptr, 10));
+        } else if (equals(p, colon, constants::kTransferEncodingHeaderKey)) {
+          chunked_transfer_encoding = equals(value, value_end, constants::kTransferEncodingChunkedValue);
+        }
+      }
+    }
+    first_line = false;
+    p = crlf + constants::kCRLFLength;
+  }
+  if (!chunked_transfer_encoding) {
+    if (body_length == static_cast<size_t>(-1)) {
+      return p - data;
+    } else {
+      return (static_cast<size_t>(end - p) >= body_length) ? (p - data) + body_length : 0u;
+    }
+  }
+  while (true) {
+    const char* crlf = FindCRLF(p, end);
+    if (!crlf) {
+      return 0u;
+    }
+    if (crlf == p) {
+      // The CRLF after the previous chunk.
+      p += constants::kCRLFLength;
+      continue;
+    }
+    const size_t chunk_length = static_cast<size_t>(strtoul(p, nullptr, 16));
+    p = crlf + constants::kCRLFLength;
+    if (chunk_length == 0u) {
+      return p - data;
+    }
+    if (static_cast<size_t>(end - p) < chunk_length) {
+      return 0u;
+    }
+    p += chunk_length;
+  }
+}
+
+// Returns the length of the headers of the first HTTP request in `[data, data + length)`, including the blank
+// line after them, if they have been received in full, or zero if more data is needed.
+inline size_t CompleteHTTPHeadersLength(const char* data, size_t length) {
+  const char* const end = data + length;
+  const char* p = data;
+  // Blank lines before the first line are ignored, as they are by the parser.
+  while (p + 1 < end && p[0] == '\r' && p[1] == '\n') {
+    p += constants::kCRLFLength;
+  }
+  bool first_line = true;
+  while (const char* crlf = FindCRLF(p, end)) {
+    if (crlf == p && !first_line) {
+      return (p - data) + constants::kCRLFLength;
+    }
+    first_line = false;
+    p = crlf + constants::kCRLFLength;
+  }
+  return 0u;
+}
+
+// Whether `GenericHTTPRequestData` should read the body of the request into memory, or leave it in the
+// connection, for the handler to read it incrementally via `HTTPRequestBodyStream`.
+enum class HTTPRequestBody : bool { Buffered = false, Streamed = true };
+
+// Reads the body of an HTTP request piece by piece, as the user code asks for it.
+//
+// The body is either the one already received into memory, or the one left in the connection. In the latter
+// case, nothing is read from the socket until `Read()` is called, so the client can only send the body as fast
+// as it is consumed: once the socket buffers are full, TCP flow control stops it. The pieces of the body are
+// read straight into the buffer of the caller; only the chunk headers of a chunked body go through the small
+// internal buffer.
+//
+// The body longer than `SetMaxLength()` bytes makes `Read()` throw `HTTPRequestBodyTooLargeException`,
+// as soon as it is known, which is before reading anything if the request has the `Content-Length` header.
+class HTTPRequestBodyStream final {
+ public:
+  enum { kChunkHeaderBufferSize = 1024 };
+
+  // The body which has already been received.
+  HTTPRequestBodyStream(const char* begin, const char* end)
+      : pending_begin_(begin), pending_end_(end), remaining_(end - begin), done_(begin == end) {}
+
+  // The body yet to be received from `connection`: `content_length` bytes, or chunks, if `chunked`.
+  // With neither `Content-Length` nor chunked transfer encoding, the request has no body.
+  // If `expect_continue`, the client is told to send the body with `100 Continue` on the first `Read()`,
+  // unless the body is known to be too large by then.
+  HTTPRequestBodyStream(Connection& connection, size_t content_length, bool chunked, bool expect_continue)
+      : connection_(&connection),
+        chunked_(chunked),
+        expect_continue_(expect_continue),
+        remaining_(chunked || content_length == static_cast<size_t>(-1) ? 0u : content_length),
+        done_(!chunked && !remaining_) {
+    if (chunked_) {
+      buffer_.resize(kChunkHeaderBufferSize);
+      pending_begin_ = pending_end_ = &buffer_[0];
+    }
+  }
+
+  void SetMaxLength(size_t max_length) { max_length_ = max_length; }
+
+  // Reads up to `max_length` bytes of the body into `output`, blocking until at least one byte is available.
+  // Returns zero once the whole body has been read.
+  size_t Read(char* output, size_t max_length) {
+    if (!max_length || done_) {
+      return 0u;
+    }
+    CheckLength();
+    if (expect_continue_) {
+      expect_continue_ = false;
+      connection_->BlockingWrite("HTTP/1.1 100 Continue\r\n\r\n", false);
+    }
+    if (chunked_ && !remaining_) {
+      ReadChunkHeader();
+      if (done_) {
+        return 0u;
+      }
+      CheckLength();
+    }
+    size_t length = std::min(max_length, remaining_);
+    if (pending_begin_ < pending_end_) {
+      length = std::min(length, static_cast<size_t>(pending_end_ - pending_begin_));
+      std::memcpy(output, pending_begin_, length);
+      pending_begin_ += length;
+    } else {
+      length = connection_->BlockingRead(output, length);
+      if (!length) {
+        CURRENT_THROW(ConnectionResetByPeer());  // LCOV_EXCL_LINE
+      }
+    }
+    remaining_ -= length;
+    bytes_read_ += length;
+    if (!chunked_ && !remaining_) {
+      done_ = true;
+    }
+    return length;
+  }
+
+  // Whether the whole body has been read.
+  bool Done() const { return done_; }
+  size_t BytesRead() const { return bytes_read_; }
+  // Whether `Read()` has thrown `HTTPRequestBodyTooLargeException`, for the server to respond with `413`.
+  bool TooLarge() const { return too_large_; }
+
+ private:
+  void CheckLength() {
+    if (bytes_read_ + remaining_ > max_length_) {
+      too_large_ = true;
+      CURRENT_THROW(HTTPRequestBodyTooLargeException());
+    }
+  }
+
+  // Reads the next chunk header, skipping the CRLF after the previous chunk. Sets `remaining_` to the length
+  // of the chunk, or `done_` if it is the last, zero-length one.
+  void ReadChunkHeader() {
+    while (true) {
+      char* begin = &buffer_[pending_begin_ - &buffer_[0]];
+      char* const end = &buffer_[pending_end_ - &buffer_[0]];
+      char* const crlf = FindCRLF(begin, end);
+      if (crlf) {
+        pending_begin_ = crlf + constants::kCRLFLength;
+        if (crlf != begin) {
+          *crlf = '\0';
+          char* hex_end;
+          remaining_ = static_cast<size_t>(strtoull(begin, &hex_end, 16));
+          if (hex_end == begin) {
+            CURRENT_THROW(HTTPMalformedChunkedBodyException());
+          }
+          done_ = !remaining_;
+          return;
+        }
+      } else {
+        // Move the incomplete line to the beginning of the buffer, and receive more data after it.
+        const size_t length = end - begin;
+        if (length + 1u >= buffer_.size()) {
+          CURRENT_THROW(HTTPMalformedChunkedBodyException());
+        }
+        std::memmove(&buffer_[0], begin, length);
+        const size_t read_count = connection_->BlockingRead(&buffer_[length], buffer_.size() - length);
+        if (!read_count) {
+          CURRENT_THROW(ConnectionResetByPeer());  // LCOV_EXCL_LINE
+        }
+        pending_begin_ = &buffer_[0];
+        pending_end_ = pending_begin_ + length + read_count;
+      }
+    }
+  }
+
+  Connection* connection_ = nullptr;
+  const bool chunked_ = false;
+  bool expect_continue_ = false;
+  // The part of the body, or, for the chunked body, of the stream of chunks, which has been received already.
+  const char* pending_begin_ = nullptr;
+  const char* pending_end_ = nullptr;
+  std::vector<char> buffer_;
+  // The number of bytes left in the body, or in the current chunk.
+  size_t remaining_;
+  bool done_;
+  size_t bytes_read_ = 0u;
+  size_t max_length_ = static_cast<size_t>(-1);
+  bool too_large_ = false;
+};
+
 // In constructor, GenericHTTPRequestData parses HTTP response from `Connection&` is was provided with.
 // Extracts method, path (URL + parameters), and, if provided, the body.
 //
@@ -129,7 +487,23 @@ class GenericHTTPRequestData : public HELPER {
       const int intial_buffer_size = 1600,
       const double buffer_growth_k = 1.95,
       const size_t buffer_max_growth_due_to_content_length = 1024 * 1024)
+      : GenericHTTPRequestData(c,
+                               HTTPRequestBody::Buffered,
+                               params,
+                               intial_buffer_size,
+                               buffer_growth_k,
+                               buffer_max_growth_due_to_content_length) {}
+
+  // With `HTTPRequestBody::Streamed`, stops right after the headers, and leaves the body in the connection.
+  inline GenericHTTPRequestData(
+      Connection& c,
+      HTTPRequestBody body_policy,
+      const typename HELPER::ConstructionParams& params = typename HELPER::ConstructionParams(),
+      const int intial_buffer_size = 1600,
+      const double buffer_growth_k = 1.95,
+      const size_t buffer_max_growth_due_to_content_length = 1024 * 1024)
       : HELPER(params), buffer_(intial_buffer_size) {
+    AttachReceiveBuffer(std::is_base_of<HTTPDefaultHelper, HELPER>());
     // `offset` is the number of bytes read into `buffer_` so far.
     // `length_cap` is infinity first (size_t is unsigned), and it changes/ to the absolute offset
     // of the end of HTTP body in the buffer_, once `Content-Length` and two consecutive CRLS have been seen.
@@ -177,7 +551,7 @@ class GenericHTTPRequestData : public HELPER {
       buffer_[offset] = '\0';
       char* next_crlf_ptr;
       while ((body_offset == static_cast<size_t>(-1) || offset < body_offset) &&
-             (next_crlf_ptr = strstr(&buffer_[current_line_offset], constants::kCRLF))) {
+             (next_crlf_ptr = FindCRLF(&buffer_[current_line_offset], &buffer_[offset]))) {
         const bool line_is_blank = (next_crlf_ptr == &buffer_[current_line_offset]);
         *next_crlf_ptr = '\0';
         // `next_line_offset` is mutable since reading chunked body will change it.
@@ -185,14 +559,23 @@ class GenericHTTPRequestData : public HELPER {
         if (!first_line_parsed) {
           if (!line_is_blank) {
             // It's recommended by W3 to wait for the first line ignoring prior CRLF-s.
-            const std::vector<std::string> pieces =
-                strings::Split<strings::ByWhitespace>(&buffer_[current_line_offset]);
-            if (pieces.size() >= 1) {
-              method_ = pieces[0];
-            }
-            if (pieces.size() >= 2) {
-              raw_path_ = pieces[1];
+            // The method, the path, and the version are tokenized in place, with no intermediate strings.
+            const char* p = &buffer_[current_line_offset];
+            const char* const line_end = next_crlf_ptr;
+            const auto next_token = [&p, line_end](std::string& token) {
+              while (p < line_end && ::isspace(*p)) {
+                ++p;
+              }
+              const char* const token_begin = p;
+              while (p < line_end && !::isspace(*p)) {
+                ++p;
+              }
+              token.assign(token_begin, p);
+              return p != token_begin;
+            };
+            if (next_token(method_) && next_token(raw_path_)) {
               url_ = current::url::URL(raw_path_);
+              next_token(http_version_);
             }
             first_line_parsed = true;
           }
@@ -245,11 +628,9 @@ class GenericHTTPRequestData : public HELPER {
             }
           }
         } else if (!line_is_blank) {
-          char* p = strstr(&buffer_[current_line_offset], constants::kHeaderKeyValueSeparator);
-          if (p) {
-            *p = '\0';
+          const char* const value = SplitHeaderLine(&buffer_[current_line_offset], next_crlf_ptr);
+          if (value) {
             const char* const key = &buffer_[current_line_offset];
-            const char* const value = p + constants::kHeaderKeyValueSeparatorLength;
             HELPER::OnHeader(key, value);
             if (!strcmp(key, constants::kContentLengthHeaderKey)) {
               body_length = static_cast<size_t>(atoi(value));
@@ -259,6 +640,14 @@ class GenericHTTPRequestData : public HELPER {
               }
             }
           }
+        } else if (body_policy == HTTPRequestBody::Streamed) {
+          // Done with the headers. What has been read past them is returned to the connection, to be read
+          // along with the rest of the body.
+          body_streamed_ = true;
+          streamed_body_length_ = body_length;
+          streamed_body_chunked_ = chunked_transfer_encoding;
+          c.PushBackInput(&buffer_[next_line_offset], offset - next_line_offset);
+          return;
         } else {
           if (!chunked_transfer_encoding) {
             // HTTP body starts right after this last CRLF.
@@ -297,6 +686,7 @@ class GenericHTTPRequestData : public HELPER {
   inline const std::string& Method() const { return method_; }
   inline const current::url::URL& URL() const { return url_; }
   inline const std::string& RawPath() const { return raw_path_; }
+  inline const std::string& HTTPVersion() const { return http_version_; }
 
   // Note that `Body*()` methods assume that the body was fully read into memory.
   // If other means of reading the body, for example, event-based chunk parsing, is used,
@@ -326,11 +716,21 @@ class GenericHTTPRequestData : public HELPER {
     }
   }
 
+  // For `HTTPRequestBody::Streamed`: whether the body has been left in the connection, and how it is framed.
+  inline bool IsBodyStreamed() const { return body_streamed_; }
+  inline size_t StreamedBodyLength() const { return streamed_body_length_; }
+  inline bool IsStreamedBodyChunked() const { return streamed_body_chunked_; }
+
  private:
+  // The headers are only kept in the receive buffer by `HTTPDefaultHelper` and the helpers derived from it.
+  void AttachReceiveBuffer(std::true_type) { HTTPDefaultHelper::OnReceiveBuffer(buffer_); }
+  void AttachReceiveBuffer(std::false_type) {}
+
   // Fields available to the user via getters.
   std::string method_;
   current::url::URL url_;
   std::string raw_path_;
+  std::string http_version_;
 
   // HTTP parsing fields that have to be caried out of the parsing routine.
   std::vector<char> buffer_;  // The buffer into which data has been read, except for chunked case.
@@ -341,6 +741,10 @@ class GenericHTTPRequestData : public HELPER {
   // TODO(dkorolev): This pattern is worth revisiting. StringPiece?
   mutable std::unique_ptr<std::string> prepared_body_;
 
+  bool body_streamed_ = false;
+  size_t streamed_body_length_ = static_cast<size_t>(-1);
+  bool streamed_body_chunked_ = false;
+
   // Disable any copy/move support since this class uses pointers.
   GenericHTTPRequestData() = delete;
   GenericHTTPRequestData(const GenericHTTPRequestData&) = delete;
@@ -362,6 +766,11 @@ class GenericHTTPServerConnection final {
                               const typename HTTP_REQUEST_DATA::ConstructionParams& params =
                                   typename HTTP_REQUEST_DATA::ConstructionParams())
       : connection_(std::move(c)), message_(connection_, params) {}
+  GenericHTTPServerConnection(Connection&& c,
+                              HTTPRequestBody body_policy,
+                              const typename HTTP_REQUEST_DATA::ConstructionParams& params =
+                                  typename HTTP_REQUEST_DATA::ConstructionParams())
+      : connection_(std::move(c)), message_(connection_, body_policy, params) {}
   ~GenericHTTPServerConnection() {
     if (!responded_) {
       // If a user code throws an exception in a different thread, it will not be caught.
@@ -369,8 +778,13 @@ class GenericHTTPServerConnection final {
       // It's also a good place for a breakpoint to tell the source of that exception.
       // LCOV_EXCL_START
       try {
-        SendHTTPResponse(
-            DefaultInternalServerErrorMessage(), HTTPResponseCode.InternalServerError, "text/html");
+        if (body_stream_ && body_stream_->TooLarge()) {
+          SendHTTPResponse(
+              DefaultRequestEntityTooLargeMessage(), HTTPResponseCode.RequestEntityTooLarge, "text/html");
+        } else {
+          SendHTTPResponse(
+              DefaultInternalServerErrorMessage(), HTTPResponseCode.InternalServerError, "text/html");
+        }
       } catch (const Exception& e) {
         // No exception should ever leave the destructor.
         if (message_.RawPath() == "/healthz") {
@@ -386,20 +800,98 @@ class GenericHTTPServerConnection final {
       }
       // LCOV_EXCL_STOP
     }
+    if (keep_alive_) {
+      // The response has been sent in full, and the connection is handed back to serve the next request.
+      keep_alive_recycler_(std::move(connection_));
+    }
+  }
+
+  // Whether the client has asked for the connection to be kept open after the response:
+  // by default for HTTP/1.1, and with `Connection: keep-alive` for HTTP/1.0.
+  bool RequestAllowsKeepAlive() const {
+    std::string connection;
+    if (message_.FindHeader("Connection", connection)) {
+      connection = strings::ToLower(connection);
+    }
+    if (connection.find("close") != std::string::npos) {
+      return false;
+    } else if (message_.HTTPVersion() == "HTTP/1.1") {
+      return true;
+    } else {
+      return connection.find("keep-alive") != std::string::npos;
+    }
   }
 
+  // Whether the `Accept-Encoding` of the request allows the response to use the content coding `coding`,
+  // such as "gzip". The coding, or "*", should be listed, and not with `q=0`.
+  bool RequestAcceptsEncoding(const std::string& coding) const {
+    std::string accept_encoding;
+    if (!message_.FindHeader("Accept-Encoding", accept_encoding)) {
+      return false;
+    }
+    bool accepted = false;
+    for (const auto& element : strings::Split(accept_encoding, ',')) {
+      const auto params = strings::Split(element, ';');
+      const std::string name = params.empty() ? std::string() : strings::ToLower(strings::Trim(params[0]));
+      if (name == coding || name == "*") {
+        double q = 1.0;
+        for (size_t i = 1; i < params.size(); ++i) {
+          const std::string param = strings::Trim(params[i]);
+          if (param.length() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+            q = std::atof(param.c_str() + 2);
+          }
+        }
+        if (name == coding) {
+          // The coding listed explicitly takes precedence over "*".
+          return q > 0;
+        }
+        accepted = q > 0;
+      }
+    }
+    return accepted;
+  }
+
+  // Makes the response to this request say `Connection: keep-alive`, if the client allows it, and,
+  // once the response has been sent and this object is destructed, passes the connection to `recycler`.
+  // Only the responses with `Content-Length` keep the connection; the chunked ones still close it.
+  void EnableKeepAlive(std::function<void(Connection&&)> recycler) {
+    if (RequestAllowsKeepAlive()) {
+      keep_alive_recycler_ = std::move(recycler);
+    }
+  }
+
+  // Makes the response to this request compressed, if the client accepts gzip or deflate: the regular response
+  // if its body is at least `min_length` bytes, and the chunked one regardless of its length. Only the content
+  // types which compress well are compressed, and the responses which set `Content-Encoding` are left as is.
+  void EnableResponseCompression(size_t min_length) {
+    compression_min_length_ = min_length;
+    if (RequestAcceptsEncoding("gzip")) {
+      response_encoding_ = ResponseEncoding::GZip;
+    } else if (RequestAcceptsEncoding("deflate")) {
+      response_encoding_ = ResponseEncoding::Deflate;
+    }
+  }
+
+  // A strong `ETag` set by the handler promises the bodies identical byte for byte, which no longer holds once
+  // the body is compressed. Thus, for the `compressed` response it is weakened, which still matches the weak
+  // comparison of `If-None-Match`.
   inline static void PrepareHTTPResponseHeader(std::ostream& os,
                                                ConnectionType connection_type,
                                                HTTPResponseCodeValue code = HTTPResponseCode.OK,
                                                const std::string& content_type = constants::kDefaultContentType,
-                                               const http::Headers& extra_headers = http::Headers()) {
+                                               const http::Headers& extra_headers = http::Headers(),
+                                               bool compressed = false) {
     os << "HTTP/1.1 " << static_cast<int>(code);
     os << " " << HTTPResponseCodeAsString(code) << constants::kCRLF;
     os << "Content-Type: " << content_type << constants::kCRLF;
     os << "Connection: " << (connection_type == ConnectionKeepAlive ? "keep-alive" : "close")
        << constants::kCRLF;
     for (const auto& cit : extra_headers) {
-      os << cit.header << ": " << cit.value << constants::kCRLF;
+      if (compressed && strings::ToLower(cit.header) == "etag" && cit.value.compare(0u, 2u, "W/")) {
+        os << cit.header << ": W/" << cit.value << constants::kCRLF;
+      } else {
+        os << cit.header << ": " << cit.value << constants::kCRLF;
+      }
     }
     for (const auto& cit : extra_headers.cookies) {
       os << "Set-Cookie: " << cit.first << '=' << cit.second.value;
@@ -424,11 +916,26 @@ class GenericHTTPServerConnection final {
       CURRENT_THROW(AttemptedToSendHTTPResponseMoreThanOnce());
     } else {
       responded_ = true;
+      const bool keep_alive = static_cast<bool>(keep_alive_recycler_);
+      const size_t length = (end - begin) * sizeof(typename std::iterator_traits<T>::value_type);
+      const bool compress =
+          length && length >= compression_min_length_ && ShouldCompress(code, content_type, extra_headers);
       std::ostringstream os;
-      PrepareHTTPResponseHeader(os, ConnectionClose, code, content_type, extra_headers);
-      os << "Content-Length: " << (end - begin) << constants::kCRLF << constants::kCRLF;
-      connection_.BlockingWrite(os.str(), true);
-      connection_.BlockingWrite(begin, end, false);
+      PrepareHTTPResponseHeader(
+          os, keep_alive ? ConnectionKeepAlive : ConnectionClose, code, content_type, extra_headers, compress);
+      if (compress) {
+        deflate::Compressor compressor(CompressionFormat());
+        std::string compressed = compressor.Compress(reinterpret_cast<const char*>(&(*begin)), length);
+        compressed += compressor.Finish();
+        WriteContentEncodingHeaders(os, extra_headers);
+        os << "Content-Length: " << compressed.length() << constants::kCRLF << constants::kCRLF;
+        connection_.BlockingWriteBuffers({os.str(), compressed});
+      } else {
+        os << "Content-Length: " << (end - begin) << constants::kCRLF << constants::kCRLF;
+        // The header and the body go out with a single system call, without copying the body.
+        connection_.BlockingWriteBuffers({os.str(), WriteBuffer(length ? &(*begin) : nullptr, length)});
+      }
+      keep_alive_ = keep_alive;
     }
   }
 
@@ -485,19 +992,55 @@ class GenericHTTPServerConnection final {
     SendHTTPResponseImpl(s.begin(), s.end(), code, content_type, extra_headers);
   }
 
+  // Sends `length` bytes of the file `fd`, starting from `offset`, as the body of the response.
+  // The contents of the file are copied to the socket by the kernel, see `Connection::BlockingSendFile()`.
+  // Does not close `fd`.
+  inline void SendHTTPResponseFromFile(int fd,
+                                       uint64_t offset,
+                                       uint64_t length,
+                                       HTTPResponseCodeValue code = HTTPResponseCode.OK,
+                                       const std::string& content_type = constants::kDefaultContentType,
+                                       const http::Headers& extra_headers = http::Headers()) {
+    if (responded_) {
+      CURRENT_THROW(AttemptedToSendHTTPResponseMoreThanOnce());
+    } else {
+      responded_ = true;
+      const bool keep_alive = static_cast<bool>(keep_alive_recycler_);
+      std::ostringstream os;
+      PrepareHTTPResponseHeader(
+          os, keep_alive ? ConnectionKeepAlive : ConnectionClose, code, content_type, extra_headers);
+      os << "Content-Length: " << length << constants::kCRLF << constants::kCRLF;
+      connection_.BlockingWrite(os.str(), length != 0u);
+      connection_.BlockingSendFile(fd, offset, length);
+      keep_alive_ = keep_alive;
+    }
+  }
+
   // The wrapper to send HTTP response in chunks.
+  //
+  // Each chunk goes out with a single system call. Optionally, see `SetBuffering()`, the small chunks are
+  // coalesced in user space, so that streaming many small entries does not cost a system call each.
   struct ChunkedResponseSender final {
     // `struct Impl` is the logic wrapped into an `std::unique_ptr<>` to call the destructor only once.
     struct Impl final {
-      explicit Impl(Connection& connection) : connection_(connection) {}
+      Impl(Connection& connection, std::unique_ptr<deflate::Compressor>&& compressor)
+          : connection_(connection), compressor_(std::move(compressor)) {}
 
       ~Impl() {
         if (!can_no_longer_write_) {
           try {
-            connection_.BlockingWrite("0", true);
-            // Should send CRLF twice.
-            connection_.BlockingWrite(constants::kCRLF, true);
-            connection_.BlockingWrite(constants::kCRLF, false);
+            // The buffered data, the compression trailer, and the final "zero" chunk, all in one go.
+            std::string last_chunk = compressor_ ? compressor_->Compress(buffer_) : std::move(buffer_);
+            if (compressor_) {
+              last_chunk += compressor_->Finish();
+            }
+            if (!last_chunk.empty()) {
+              const std::string size =
+                  strings::Printf("%X\r\n", static_cast<unsigned int>(last_chunk.length()));
+              connection_.BlockingWriteBuffers({size, last_chunk, WriteBuffer("\r\n0\r\n\r\n", 7u)});
+            } else {
+              connection_.BlockingWrite("0\r\n\r\n", false);
+            }
           } catch (const SocketException& e) {                                          // LCOV_EXCL_LINE
             std::cerr << "Chunked response closure failed: " << e.what() << std::endl;  // LCOV_EXCL_LINE
           }                                                                             // LCOV_EXCL_LINE
@@ -505,21 +1048,65 @@ class GenericHTTPServerConnection final {
       }
 
       // The actual implementation of sending HTTP chunk data.
+      // With compression, each chunk is compressed and flushed, for the client to get it without delay.
+      // With buffering, the data is compressed once it is flushed from the buffer, not once per `Send()`.
       template <typename T>
       void SendImpl(T&& data) {
         if (!data.empty()) {
-          try {
-            connection_.BlockingWrite(strings::Printf("%X", data.size()), true);
-            connection_.BlockingWrite(constants::kCRLF, true);
-            connection_.BlockingWrite(std::forward<T>(data), true);
-            // Force every chunk to be sent out by passing `false` as the second argument.
-            connection_.BlockingWrite(constants::kCRLF, false);
-          } catch (const SocketException&) {
-            // For chunked HTTP responses, if the receiving end has closed the connection,
-            // as detected during `Send`, surpass logging about the failure to send the final "zero" chunk.
-            can_no_longer_write_ = true;
-            throw;
+          const char* bytes = reinterpret_cast<const char*>(&(*data.begin()));
+          const size_t length = data.size() * sizeof(typename current::decay<T>::value_type);
+          if (!buffer_max_bytes_ || (buffer_.empty() && length >= buffer_max_bytes_)) {
+            SendData(bytes, length);
+          } else {
+            const auto now = std::chrono::steady_clock::now();
+            if (buffer_.empty()) {
+              buffer_oldest_ = now;
+            }
+            buffer_.append(bytes, length);
+            if (buffer_.length() >= buffer_max_bytes_ || now - buffer_oldest_ >= buffer_max_delay_) {
+              Flush();
+            }
+          }
+        }
+      }
+
+      void SetBuffering(size_t max_bytes, std::chrono::microseconds max_delay) {
+        buffer_max_bytes_ = max_bytes;
+        buffer_max_delay_ = max_delay;
+        if (!buffer_max_bytes_) {
+          Flush();
+        }
+      }
+
+      void Flush() {
+        if (!buffer_.empty()) {
+          SendData(buffer_.data(), buffer_.length());
+          buffer_.clear();
+        }
+      }
+
+      void SendData(const char* bytes, size_t length) {
+        try {
+          if (compressor_) {
+            const std::string compressed = compressor_->Compress(bytes, length);
+            SendChunk(compressed.data(), compressed.length());
+          } else {
+            SendChunk(bytes, length);
           }
+        } catch (const SocketException&) {
+          // For chunked HTTP responses, if the receiving end has closed the connection,
+          // as detected during `Send`, surpass logging about the failure to send the final "zero" chunk.
+          can_no_longer_write_ = true;
+          throw;
+        }
+      }
+
+      // The size, the data, and the CRLF, as a single `sendmsg()`, which also forces the chunk to be sent out.
+      void SendChunk(const char* data, size_t length) {
+        if (length) {
+          const std::string size = strings::Printf("%X\r\n", static_cast<unsigned int>(length));
+          connection_.BlockingWriteBuffers(
+              {size, WriteBuffer(data, length), WriteBuffer(constants::kCRLF, constants::kCRLFLength)});
         }
       }
 
@@ -543,8 +1130,15 @@ class GenericHTTPServerConnection final {
       }
 
       Connection& connection_;
+      std::unique_ptr<deflate::Compressor> compressor_;
       bool can_no_longer_write_ = false;
 
+      // The data sent but not yet written, and when the oldest of it was sent. Unused unless buffering is on.
+      std::string buffer_;
+      size_t buffer_max_bytes_ = 0u;
+      std::chrono::microseconds buffer_max_delay_ = std::chrono::microseconds(0);
+      std::chrono::steady_clock::time_point buffer_oldest_;
+
       Impl() = delete;
       Impl(const Impl&) = delete;
       Impl(Impl&&) = delete;
@@ -552,7 +1146,9 @@ class GenericHTTPServerConnection final {
       void operator=(Impl&&) = delete;
     };
 
-    explicit ChunkedResponseSender(Connection& connection) : impl_(new Impl(connection)) {}
+    explicit ChunkedResponseSender(Connection& connection,
+                                   std::unique_ptr<deflate::Compressor>&& compressor = nullptr)
+        : impl_(new Impl(connection, std::move(compressor))) {}
 
     template <typename T>
     inline ChunkedResponseSender& Send(T&& data) {
@@ -578,6 +1174,25 @@ class GenericHTTPServerConnection final {
       return *this;
     }
 
+    // Coalesces the data passed to `Send()` into chunks of up to about `max_bytes`, holding it back for no
+    // longer than `max_delay` since the oldest of it was sent. There is no timer: the delay is checked on
+    // every `Send()`, so the code which may go idle with data buffered should call `Flush()` first.
+    // The data of `max_bytes` or more is sent right away. `SetBuffering(0, ...)` turns buffering off.
+    inline ChunkedResponseSender& SetBuffering(size_t max_bytes, std::chrono::microseconds max_delay) {
+      impl_->SetBuffering(max_bytes, max_delay);
+      return *this;
+    }
+
+    // Sends out the buffered data, if any. Also done automatically, as the response is complete.
+    inline ChunkedResponseSender& Flush() {
+      impl_->Flush();
+      return *this;
+    }
+
+    // Gives up on the response: drops the buffered data, and does not send the final "zero" chunk, so that
+    // the client, as the connection is closed, can tell the response is incomplete.
+    inline void Abort() { impl_->can_no_longer_write_ = true; }
+
     std::unique_ptr<Impl> impl_;
   };
 
@@ -589,11 +1204,16 @@ class GenericHTTPServerConnection final {
       CURRENT_THROW(AttemptedToSendHTTPResponseMoreThanOnce());
     } else {
       responded_ = true;
+      const bool compress = ShouldCompress(code, content_type, extra_headers);
       std::ostringstream os;
-      PrepareHTTPResponseHeader(os, ConnectionKeepAlive, code, content_type, extra_headers);
+      PrepareHTTPResponseHeader(os, ConnectionKeepAlive, code, content_type, extra_headers, compress);
+      if (compress) {
+        WriteContentEncodingHeaders(os, extra_headers);
+      }
       os << "Transfer-Encoding: chunked" << constants::kCRLF << constants::kCRLF;
       connection_.BlockingWrite(os.str(), true);
-      return ChunkedResponseSender(connection_);
+      return ChunkedResponseSender(
+          connection_, compress ? std::make_unique<deflate::Compressor>(CompressionFormat()) : nullptr);
     }
   }
 
@@ -608,6 +1228,24 @@ class GenericHTTPServerConnection final {
 
   const GenericHTTPRequestData<HTTP_REQUEST_DATA>& HTTPRequest() const { return message_; }
 
+  // The body of the request, to be read piece by piece. Works for any request: the body which has been received
+  // in full is read from memory, and the one left in the connection by `HTTPRequestBody::Streamed` is received
+  // as it is being read.
+  HTTPRequestBodyStream& BodyStream() {
+    if (!body_stream_) {
+      if (message_.IsBodyStreamed()) {
+        std::string expect;
+        const bool expect_continue =
+            message_.FindHeader("Expect", expect) && strings::ToLower(expect) == "100-continue";
+        body_stream_ = std::make_unique<HTTPRequestBodyStream>(
+            connection_, message_.StreamedBodyLength(), message_.IsStreamedBodyChunked(), expect_continue);
+      } else {
+        body_stream_ = std::make_unique<HTTPRequestBodyStream>(message_.BodyBegin(), message_.BodyEnd());
+      }
+    }
+    return *body_stream_;
+  }
+
   const IPAndPort& LocalIPAndPort() const { return connection_.LocalIPAndPort(); }
   const IPAndPort& RemoteIPAndPort() const { return connection_.RemoteIPAndPort(); }
 
@@ -615,8 +1253,44 @@ class GenericHTTPServerConnection final {
 
  private:
   bool responded_ = false;
+  bool keep_alive_ = false;
+  std::function<void(Connection&&)> keep_alive_recycler_;
   Connection connection_;
   GenericHTTPRequestData<HTTP_REQUEST_DATA> message_;
+  std::unique_ptr<HTTPRequestBodyStream> body_stream_;
+  size_t compression_min_length_ = 0u;
+  enum class ResponseEncoding : int { Identity, GZip, Deflate };
+  ResponseEncoding response_encoding_ = ResponseEncoding::Identity;
+
+  // Whether the response is to be compressed: the client should accept it, the body should be allowed,
+  // and the content type should compress well.
+  bool ShouldCompress(HTTPResponseCodeValue code,
+                      const std::string& content_type,
+                      const http::Headers& extra_headers) const {
+    const int status = static_cast<int>(code);
+    if (response_encoding_ == ResponseEncoding::Identity || status < 200 || status == 204 || status == 304 ||
+        extra_headers.Has("Content-Encoding")) {
+      return false;
+    }
+    const std::string type = strings::ToLower(content_type);
+    return !type.compare(0u, 5u, "text/") || type.find("json") != std::string::npos ||
+           type.find("javascript") != std::string::npos || type.find("xml") != std::string::npos;
+  }
+
+  // The uncompressed responses go without `Vary`, which is safe for the caches: they only ever give out
+  // the compressed response, which has `Vary`, to the clients which accept its encoding.
+  void WriteContentEncodingHeaders(std::ostream& os, const http::Headers& extra_headers) const {
+    os << "Content-Encoding: " << (response_encoding_ == ResponseEncoding::GZip ? "gzip" : "deflate")
+       << constants::kCRLF;
+    if (!extra_headers.Has("Vary")) {
+      os << "Vary: Accept-Encoding" << constants::kCRLF;
+    }
+  }
+
+  deflate::Format CompressionFormat() const {
+    // The "deflate" content coding is the zlib format, RFC 7230, section 4.2.2.
+    return response_encoding_ == ResponseEncoding::GZip ? deflate::Format::GZip : deflate::Format::ZLib;
+  }
 
   // Disable any copy/move support for extra safety.
   GenericHTTPServerConnection(const GenericHTTPServerConnection&) = delete;
@@ -213,6 +213,50 @@ TEST(PosixHTTPServerTest, SmokeChunkedResponse) {
   t.join();
 }
 
+TEST(PosixHTTPServerTest, SmokeBufferedChunkedResponse) {
+  thread t([](Socket s) {
+    HTTPServerConnection c(s.Accept());
+    auto r = c.SendChunkedHTTPResponse();
+    r.SetBuffering(16u, std::chrono::hours(1));
+    r.Send("one");
+    r.Send("two");
+    r.Send("three");
+    r.Send("four");
+    r.Send("five");  // Over 16 bytes buffered, flushed.
+    r.Send("six");
+    r.Flush();
+    r.Send("abcdefghijklmnopqrstuvwxyz");  // Over 16 bytes, sent right away.
+    r.SetBuffering(1000u, std::chrono::microseconds(0));
+    r.Send("seven");  // Has been buffered for no shorter than zero microseconds, flushed.
+    r.SetBuffering(1000u, std::chrono::hours(1));
+    r.Send("eight");  // Flushed with the final chunk.
+  }, Socket(FLAGS_net_http_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_http_test_port));
+  connection.BlockingWrite("GET /chunked HTTP/1.1\r\n", true);
+  connection.BlockingWrite("Host: localhost\r\n", true);
+  connection.BlockingWrite("\r\n", false);
+  ExpectToReceive(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: application/json; charset=utf-8\r\n"
+      "Connection: keep-alive\r\n"
+      "Access-Control-Allow-Origin: *\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\n"
+      "13\r\n"
+      "onetwothreefourfive\r\n"
+      "3\r\n"
+      "six\r\n"
+      "1A\r\n"
+      "abcdefghijklmnopqrstuvwxyz\r\n"
+      "5\r\n"
+      "seven\r\n"
+      "5\r\n"
+      "eight\r\n"
+      "0\r\n",
+      connection);
+  t.join();
+}
+
 TEST(PosixHTTPServerTest, SmokeWithHeaders) {
   thread t([](Socket s) {
     HTTPServerConnection c(s.Accept());
@@ -240,6 +284,82 @@ TEST(PosixHTTPServerTest, SmokeWithHeaders) {
   t.join();
 }
 
+TEST(PosixHTTPServerTest, HeadersWithIrregularWhitespace) {
+  thread t([](Socket s) {
+    HTTPServerConnection c(s.Accept());
+    EXPECT_EQ("POST", c.HTTPRequest().Method());
+    EXPECT_EQ("/path?x=1", c.HTTPRequest().RawPath());
+    EXPECT_EQ("HTTP/1.1", c.HTTPRequest().HTTPVersion());
+    EXPECT_EQ("localhost", c.HTTPRequest().headers().Get("Host"));
+    EXPECT_EQ("bar baz", c.HTTPRequest().headers().Get("X-Foo"));
+    c.SendHTTPResponse("Data: " + c.HTTPRequest().Body());
+  }, Socket(FLAGS_net_http_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_http_test_port));
+  connection.BlockingWrite("POST  /path?x=1 \tHTTP/1.1\r\n", true);
+  connection.BlockingWrite("Host:localhost\r\n", true);
+  connection.BlockingWrite("X-Foo: \t bar baz \r\n", true);
+  connection.BlockingWrite("Content-Length:4\r\n", true);
+  connection.BlockingWrite("\r\n", true);
+  connection.BlockingWrite("BODY", false);
+  ExpectToReceive(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain\r\n"
+      "Connection: close\r\n"
+      "Content-Length: 10\r\n"
+      "\r\n"
+      "Data: BODY",
+      connection);
+  t.join();
+}
+
+TEST(PosixHTTPServerTest, HeadersLookedUpInTheReceiveBuffer) {
+  // The long header makes the receive buffer grow, and move, after the first headers have been parsed.
+  const std::string long_value(5000, 'x');
+  thread t([&long_value](Socket s) {
+    HTTPServerConnection c(s.Accept());
+    const auto& request = c.HTTPRequest();
+    std::string value;
+    EXPECT_TRUE(request.FindHeader("x-first", value));
+    EXPECT_EQ("1", value);
+    EXPECT_TRUE(request.FindHeader("X_Repeated", value));
+    EXPECT_EQ("a, b", value);
+    EXPECT_TRUE(request.FindHeader("X-Long", value));
+    EXPECT_EQ(long_value, value);
+    EXPECT_TRUE(request.FindHeader("X-Empty", value));
+    EXPECT_EQ("", value);
+    EXPECT_FALSE(request.FindHeader("X-Missing", value));
+    EXPECT_FALSE(request.FindHeader("X-Firs", value));
+    EXPECT_THROW(request.FindHeader("Cookie", value), current::net::http::CookieIsNotYourRegularHeader);
+    // The headers built on request are the same.
+    const auto& headers = request.headers();
+    EXPECT_EQ(5u, headers.size());
+    EXPECT_EQ("1", headers.Get("X-First"));
+    EXPECT_EQ("a, b", headers.Get("X-Repeated"));
+    EXPECT_EQ(long_value, headers.Get("X-Long"));
+    EXPECT_EQ("x=1", headers.CookiesAsString());
+    c.SendHTTPResponse("OK");
+  }, Socket(FLAGS_net_http_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_http_test_port));
+  connection.BlockingWrite("GET / HTTP/1.1\r\n", true);
+  connection.BlockingWrite("Host: localhost\r\n", true);
+  connection.BlockingWrite("X-First: 1\r\n", true);
+  connection.BlockingWrite("X-Repeated: a\r\n", true);
+  connection.BlockingWrite("X-Long: " + long_value + "\r\n", true);
+  connection.BlockingWrite("x-repeated: b\r\n", true);
+  connection.BlockingWrite("X-Empty:\r\n", true);
+  connection.BlockingWrite("Cookie: x=1\r\n", true);
+  connection.BlockingWrite("\r\n", false);
+  ExpectToReceive(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain\r\n"
+      "Connection: close\r\n"
+      "Content-Length: 2\r\n"
+      "\r\n"
+      "OK",
+      connection);
+  t.join();
+}
+
 TEST(PosixHTTPServerTest, LargeBody) {
   thread t([](Socket s) {
     HTTPServerConnection c(s.Accept());
@@ -341,6 +461,110 @@ TEST(PosixHTTPServerTest, ChunkedBodyLargeFirstChunk) {
   t.join();
 }
 
+TEST(PosixHTTPServerTest, StreamedBody) {
+  thread t([](Socket s) {
+    HTTPServerConnection c(s.Accept(), current::net::HTTPRequestBody::Streamed);
+    EXPECT_EQ("POST", c.HTTPRequest().Method());
+    EXPECT_EQ(0u, c.HTTPRequest().BodyLength());
+    auto& stream = c.BodyStream();
+    std::string body;
+    char buffer[1000];
+    while (const size_t length = stream.Read(buffer, sizeof(buffer))) {
+      EXPECT_LE(length, sizeof(buffer));
+      body.append(buffer, length);
+    }
+    EXPECT_TRUE(stream.Done());
+    EXPECT_EQ(body.length(), stream.BytesRead());
+    c.SendHTTPResponse(body);
+  }, Socket(FLAGS_net_http_test_port));
+  string body(1000000, '.');
+  for (size_t i = 0; i < body.length(); ++i) {
+    body[i] = 'A' + (i % 26);
+  }
+  Connection connection(ClientSocket("localhost", FLAGS_net_http_test_port));
+  connection.BlockingWrite("POST / HTTP/1.1\r\n", true);
+  connection.BlockingWrite("Host: localhost\r\n", true);
+  connection.BlockingWrite(strings::Printf("Content-Length: %d\r\n", static_cast<int>(body.length())), true);
+  connection.BlockingWrite("\r\n", true);
+  connection.BlockingWrite(body, false);
+  ExpectToReceive(
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain\r\n"
+      "Connection: close\r\n"
+      "Content-Length: 1000000\r\n"
+      "\r\n" +
+          body,
+      connection);
+  t.join();
+}
+
+TEST(PosixHTTPServerTest, StreamedChunkedBody) {
+  thread t([](Socket s) {
+    HTTPServerConnection c(s.Accept(), current::net::HTTPRequestBody::Streamed);
+    auto& stream = c.BodyStream();
+    stream.SetMaxLength(100000);
+    std::string body;
+    char buffer[7];
+    while (const size_t length = stream.Read(buffer, sizeof(buffer))) {
+      body.append(buffer, length);
+    }
+    c.SendHTTPResponse(body);
+  }, Socket(FLAGS_net_http_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_http_test_port));
+  connection.BlockingWrite("POST / HTTP/1.1\r\n", true);
+  connection.BlockingWrite("Transfer-Encoding: chunked\r\n", true);
+  connection.BlockingWrite("Expect: 100-continue\r\n", true);
+  connection.BlockingWrite("\r\n", false);
+  ExpectToReceive("HTTP/1.1 100 Continue\r\n\r\n", connection);
+  string body;
+  for (size_t i = 1; i <= 300; ++i) {
+    const string chunk(i, 'a' + (i % 26));
+    connection.BlockingWrite(strings::Printf("%X\r\n", static_cast<int>(i)) + chunk + "\r\n", true);
+    body += chunk;
+  }
+  connection.BlockingWrite("0\r\n\r\n", false);
+  ExpectToReceive(strings::Printf(
+                      "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: text/plain\r\n"
+                      "Connection: close\r\n"
+                      "Content-Length: %d\r\n"
+                      "\r\n",
+                      static_cast<int>(body.length())) +
+                      body,
+                  connection);
+  t.join();
+}
+
+TEST(PosixHTTPServerTest, StreamedBodyTooLarge) {
+  thread t([](Socket s) {
+    HTTPServerConnection c(s.Accept(), current::net::HTTPRequestBody::Streamed);
+    auto& stream = c.BodyStream();
+    stream.SetMaxLength(1000);
+    char buffer[100];
+    // The `Content-Length` is known to be over the limit before the body is sent.
+    ASSERT_THROW(stream.Read(buffer, sizeof(buffer)), current::net::HTTPRequestBodyTooLargeException);
+    EXPECT_TRUE(stream.TooLarge());
+    EXPECT_EQ(0u, stream.BytesRead());
+    // Not responding explicitly results in `413`.
+  }, Socket(FLAGS_net_http_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_http_test_port));
+  connection.BlockingWrite("POST / HTTP/1.1\r\n", true);
+  connection.BlockingWrite("Content-Length: 1000000\r\n", true);
+  connection.BlockingWrite("Expect: 100-continue\r\n", true);
+  connection.BlockingWrite("\r\n", false);
+  const std::string message = current::net::DefaultRequestEntityTooLargeMessage();
+  ExpectToReceive(strings::Printf(
+                      "HTTP/1.1 413 Request Entity Too Large\r\n"
+                      "Content-Type: text/html\r\n"
+                      "Connection: close\r\n"
+                      "Content-Length: %d\r\n"
+                      "\r\n",
+                      static_cast<int>(message.length())) +
+                      message,
+                  connection);
+  t.join();
+}
+
 #ifndef CURRENT_WINDOWS
 struct HTTPClientImplCURL {
   static string Syscall(const string& cmdline) {
@@ -491,6 +715,34 @@ TEST(HTTPMimeTypeTest, SmokeTest) {
   EXPECT_EQ("image/png", GetFileMimeType("file.PNG"));
 }
 
+TEST(HTTPRequestFramingTest, CompleteHTTPRequestLength) {
+  using current::net::CompleteHTTPRequestLength;
+  const auto length = [](const std::string& s) { return CompleteHTTPRequestLength(s.data(), s.length()); };
+  EXPECT_EQ(0u, length(""));
+  EXPECT_EQ(0u, length("GET / HTTP/1.1\r\nHost: x\r\n"));
+  EXPECT_EQ(27u, length("GET / HTTP/1.1\r\nHost: x\r\n\r\n"));
+  EXPECT_EQ(29u, length("\r\nGET / HTTP/1.1\r\nHost: x\r\n\r\nGET /next"));
+  EXPECT_EQ(0u, length("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nfoo"));
+  EXPECT_EQ(43u, length("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nfoobar"));
+  EXPECT_EQ(42u, length("POST / HTTP/1.1\r\nContent-Length:5\r\n\r\nfoobar"));
+  const std::string chunked =
+      "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nfoo\r\n2\r\nba\r\n0\r\n";
+  for (size_t i = 0; i < chunked.length(); ++i) {
+    EXPECT_EQ(0u, length(chunked.substr(0, i))) << i;
+  }
+  EXPECT_EQ(chunked.length(), length(chunked + "\r\n"));
+}
+
+TEST(HTTPRequestFramingTest, CompleteHTTPHeadersLength) {
+  using current::net::CompleteHTTPHeadersLength;
+  const auto length = [](const std::string& s) { return CompleteHTTPHeadersLength(s.data(), s.length()); };
+  EXPECT_EQ(0u, length(""));
+  EXPECT_EQ(0u, length("POST / HTTP/1.1\r\nContent-Length: 5\r\n"));
+  EXPECT_EQ(38u, length("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n"));
+  EXPECT_EQ(38u, length("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nfoo"));
+  EXPECT_EQ(22u, length("\r\n\r\nGET / HTTP/1.1\r\n\r\n"));
+}
+
 // TODO(dkorolev): Figure out a way to test ConnectionResetByPeer exceptions.
 
 #if 0
@@ -0,0 +1,216 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `SocketReadinessPoller` waits for any of the many sockets to have data to read, or connections to accept.
+// It is `epoll` on Linux, and `poll` elsewhere. Level-triggered: a socket keeps being reported as ready
+// while it has unread data. Not thread-safe, meant to be used from the single thread of an event loop,
+// except for `Wake()`, which other threads call to have `Wait()` return early.
+
+#ifndef BRICKS_NET_TCP_IMPL_POLLER_H
+#define BRICKS_NET_TCP_IMPL_POLLER_H
+
+#include "posix.h"
+
+#include <chrono>
+#include <vector>
+
+#if defined(CURRENT_POSIX)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(CURRENT_WINDOWS)
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+namespace current {
+namespace net {
+
+class SocketReadinessPoller final {
+ public:
+#if defined(CURRENT_POSIX)
+  SocketReadinessPoller()
+      : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)), wake_fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+      CURRENT_THROW(SocketPollException());  // LCOV_EXCL_LINE
+    }
+    Add(wake_fd_);
+  }
+  ~SocketReadinessPoller() {
+    ::close(wake_fd_);
+    ::close(epoll_fd_);
+  }
+
+  void Wake() {
+    const uint64_t one = 1u;
+    static_cast<void>(::write(wake_fd_, &one, sizeof(one)));
+  }
+
+  void Add(SOCKET socket) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = socket;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket, &event)) {
+      CURRENT_THROW(SocketPollException());  // LCOV_EXCL_LINE
+    }
+  }
+
+  // Must be called before the socket is closed.
+  void Remove(SOCKET socket) {
+    struct epoll_event unused;  // Pre-2.6.9 kernels require a non-null pointer.
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket, &unused);
+  }
+
+  // Fills `ready` with the sockets which are ready to be read from. Waits forever if `timeout` is negative.
+  void Wait(std::vector<SOCKET>& ready, std::chrono::milliseconds timeout) {
+    ready.clear();
+    struct epoll_event events[kMaxEventsPerWait];
+    const int n = ::epoll_wait(epoll_fd_, events, kMaxEventsPerWait, static_cast<int>(timeout.count()));
+    if (n < 0 && errno != EINTR) {
+      CURRENT_THROW(SocketPollException());  // LCOV_EXCL_LINE
+    }
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.fd == wake_fd_) {
+        uint64_t unused;
+        static_cast<void>(::read(wake_fd_, &unused, sizeof(unused)));
+      } else {
+        ready.push_back(events[i].data.fd);
+      }
+    }
+  }
+
+ private:
+  enum { kMaxEventsPerWait = 256 };
+  const int epoll_fd_;
+  const int wake_fd_;
+#elif !defined(CURRENT_WINDOWS)
+  SocketReadinessPoller() {
+    if (::pipe(wake_pipe_) || ::fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK) ||
+        ::fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK)) {
+      CURRENT_THROW(SocketPollException());  // LCOV_EXCL_LINE
+    }
+    Add(wake_pipe_[0]);
+  }
+  ~SocketReadinessPoller() {
+    ::close(wake_pipe_[0]);
+    ::close(wake_pipe_[1]);
+  }
+
+  void Wake() {
+    const char c = 0;
+    static_cast<void>(::write(wake_pipe_[1], &c, 1));
+  }
+
+  void Add(SOCKET socket) {
+    struct pollfd entry;
+    entry.fd = socket;
+    entry.events = POLLIN;
+    entry.revents = 0;
+    sockets_.push_back(entry);
+  }
+
+  void Remove(SOCKET socket) {
+    for (auto it = sockets_.begin(); it != sockets_.end(); ++it) {
+      if (it->fd == socket) {
+        sockets_.erase(it);
+        return;
+      }
+    }
+  }
+
+  void Wait(std::vector<SOCKET>& ready, std::chrono::milliseconds timeout) {
+    ready.clear();
+    const int n = ::poll(sockets_.data(), sockets_.size(), static_cast<int>(timeout.count()));
+    if (n < 0 && errno != EINTR) {
+      CURRENT_THROW(SocketPollException());  // LCOV_EXCL_LINE
+    }
+    for (const auto& entry : sockets_) {
+      if (entry.revents & (POLLIN | POLLHUP | POLLERR)) {
+        if (entry.fd == wake_pipe_[0]) {
+          char buffer[64];
+          while (::read(wake_pipe_[0], buffer, sizeof(buffer)) > 0) {
+          }
+        } else {
+          ready.push_back(entry.fd);
+        }
+      }
+    }
+  }
+
+ private:
+  std::vector<struct pollfd> sockets_;
+  int wake_pipe_[2];
+#else
+  // `WSAPoll` can not wait on a pipe, so, instead of being woken up, the waits are capped in time.
+  SocketReadinessPoller() = default;
+
+  void Wake() {}
+
+  void Add(SOCKET socket) {
+    WSAPOLLFD entry;
+    entry.fd = socket;
+    entry.events = POLLRDNORM;
+    entry.revents = 0;
+    sockets_.push_back(entry);
+  }
+
+  void Remove(SOCKET socket) {
+    for (auto it = sockets_.begin(); it != sockets_.end(); ++it) {
+      if (it->fd == socket) {
+        sockets_.erase(it);
+        return;
+      }
+    }
+  }
+
+  void Wait(std::vector<SOCKET>& ready, std::chrono::milliseconds timeout) {
+    ready.clear();
+    const auto capped_timeout = (timeout.count() < 0 || timeout.count() > kMaxWaitMilliseconds)
+                                    ? static_cast<INT>(kMaxWaitMilliseconds)
+                                    : static_cast<INT>(timeout.count());
+    if (::WSAPoll(sockets_.data(), static_cast<ULONG>(sockets_.size()), capped_timeout) < 0) {
+      CURRENT_THROW(SocketPollException());  // LCOV_EXCL_LINE
+    }
+    for (const auto& entry : sockets_) {
+      if (entry.revents & (POLLRDNORM | POLLHUP | POLLERR)) {
+        ready.push_back(entry.fd);
+      }
+    }
+  }
+
+ private:
+  enum { kMaxWaitMilliseconds = 10 };
+  std::vector<WSAPOLLFD> sockets_;
+#endif
+
+  SocketReadinessPoller(const SocketReadinessPoller&) = delete;
+  SocketReadinessPoller(SocketReadinessPoller&&) = delete;
+  void operator=(const SocketReadinessPoller&) = delete;
+  void operator=(SocketReadinessPoller&&) = delete;
+};
+
+}  // namespace net
+}  // namespace current
+
+#endif  // BRICKS_NET_TCP_IMPL_POLLER_H
@@ -34,8 +34,11 @@ SOFTWARE.
 #include "../../../util/singleton.h"
 #include "../../../template/enable_if.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <initializer_list>
 #include <string>
 #include <utility>
 #include <vector>
@@ -43,12 +46,19 @@ SOFTWARE.
 #ifndef CURRENT_WINDOWS
 
 #include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#ifndef CURRENT_APPLE
+#include <sys/sendfile.h>
+#endif
+
 // Bricks uses `SOCKET` for socket handles in *nix.
 // Makes it easier to have the code run on both Windows and *nix.
 typedef int SOCKET;
@@ -125,6 +135,23 @@ class SocketHandle : private SocketSystemInitializer {
 
   // SocketHandle does not expose copy constructor and assignment operator. It should only be moved.
 
+  // In the non-blocking mode, reads and writes return immediately instead of waiting for the socket.
+  // Used by the event loop of the HTTP server, which switches the connections back before handing them over.
+  inline void SetNonBlocking(bool non_blocking) {
+#ifndef CURRENT_WINDOWS
+    const int flags = ::fcntl(socket_, F_GETFL, 0);
+    if (flags < 0 ||
+        ::fcntl(socket_, F_SETFL, non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) < 0) {
+      CURRENT_THROW(SocketFcntlException());  // LCOV_EXCL_LINE
+    }
+#else
+    u_long mode = non_blocking ? 1 : 0;
+    if (::ioctlsocket(socket_, FIONBIO, &mode) != NO_ERROR) {
+      CURRENT_THROW(SocketFcntlException());  // LCOV_EXCL_LINE
+    }
+#endif
+  }
+
  private:
 #ifndef CURRENT_WINDOWS
   SOCKET socket_;
@@ -198,6 +225,14 @@ inline std::string InetAddrToString(const struct in_addr* in) {
   }
 }
 
+// A piece of the data to be written by `Connection::BlockingWriteBuffers()`. Does not own the data.
+struct WriteBuffer final {
+  const void* data;
+  size_t length;
+  WriteBuffer(const void* data, size_t length) : data(data), length(length) {}
+  WriteBuffer(const std::string& s) : data(s.data()), length(s.length()) {}
+};
+
 class Connection : public SocketHandle {
  public:
   Connection(SocketHandle&& rhs, IPAndPort&& local_ip_and_port, IPAndPort&& remote_ip_and_port)
@@ -211,6 +246,34 @@ class Connection : public SocketHandle {
 
   const IPAndPort& RemoteIPAndPort() const { return remote_ip_and_port_; }
 
+  // Makes `BlockingRead()` return `data` first, before reading anything from the socket.
+  // Used when the data has already been read from the socket by the caller, e.g., by an event loop.
+  void PushBackInput(const char* data, size_t length) { pending_input_.insert(0u, data, length); }
+  bool HasPendingInput() const { return !pending_input_.empty(); }
+
+  // Reads the data available in the socket in the non-blocking mode, returns zero if there is none yet.
+  // Throws if the connection has been closed by the peer, or on an error.
+  inline size_t NonBlockingRead(char* output_buffer, size_t max_length) {
+#ifndef CURRENT_WINDOWS
+    const ssize_t retval = ::recv(socket, output_buffer, max_length, 0);
+    if (retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return 0u;
+    }
+#else
+    const int retval = ::recv(socket, output_buffer, static_cast<int>(max_length), 0);
+    if (retval < 0 && ::WSAGetLastError() == WSAEWOULDBLOCK) {
+      return 0u;
+    }
+#endif
+    if (retval > 0) {
+      return static_cast<size_t>(retval);
+    } else if (retval == 0) {
+      CURRENT_THROW(EmptyConnectionResetByPeer());
+    } else {
+      CURRENT_THROW(SocketReadException());  // LCOV_EXCL_LINE
+    }
+  }
+
   // By default, BlockingRead() will return as soon as some data has been read,
   // with the exception being multibyte records (sizeof(T) > 1), where it will keep reading
   // until the boundary of the records, or max_length of them, has been read.
@@ -222,6 +285,17 @@ class Connection : public SocketHandle {
       T* output_buffer, size_t max_length, BlockingReadPolicy policy = BlockingReadPolicy::ReturnASAP) {
     if (max_length == 0) {
       return 0;  // LCOV_EXCL_LINE
+    } else if (!pending_input_.empty()) {
+      // The pending input is counted in bytes, which are the records here, so no record is ever split.
+      static_assert(sizeof(T) == 1, "The pending input can only be returned byte by byte.");
+      const size_t length = std::min(max_length, pending_input_.length());
+      std::memcpy(output_buffer, pending_input_.data(), length);
+      pending_input_.erase(0u, length);
+      if (length == max_length || policy == BlockingReadPolicy::ReturnASAP) {
+        return length;
+      } else {
+        return length + BlockingRead(output_buffer + length, max_length - length, policy);
+      }
     } else {
       uint8_t* buffer = reinterpret_cast<uint8_t*>(output_buffer);
       uint8_t* ptr = buffer;
@@ -354,6 +428,144 @@ class Connection : public SocketHandle {
     return *this;
   }
 
+  // Writes several buffers as one piece of data, with a single `sendmsg()` call for up to `kMaxWriteBuffers`
+  // of them, as `writev()` does, instead of copying them together first or making a system call per buffer.
+  inline Connection& BlockingWriteBuffers(std::initializer_list<WriteBuffer> buffers) {
+    return BlockingWriteBuffers(buffers.begin(), buffers.end());
+  }
+
+  inline Connection& BlockingWriteBuffers(const WriteBuffer* begin, const WriteBuffer* end) {
+#ifndef CURRENT_WINDOWS
+    // The buffer being written, and the number of bytes of it already written.
+    const WriteBuffer* current = begin;
+    size_t offset = 0u;
+    while (true) {
+      while (current != end && offset == current->length) {
+        ++current;
+        offset = 0u;
+      }
+      if (current == end) {
+        break;
+      }
+      struct iovec iov[kMaxWriteBuffers];
+      size_t count = 0u;
+      for (const WriteBuffer* b = current; b != end && count < kMaxWriteBuffers; ++b) {
+        const size_t skip = (b == current) ? offset : 0u;
+        if (b->length > skip) {
+          iov[count].iov_base = const_cast<char*>(static_cast<const char*>(b->data) + skip);
+          iov[count].iov_len = b->length - skip;
+          ++count;
+        }
+      }
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = iov;
+      message.msg_iovlen = count;
+      BRICKS_NET_LOG(
+          "S%05d BlockingWriteBuffers(%d buffers) ...\n", static_cast<SOCKET>(socket), static_cast<int>(count));
+#ifndef CURRENT_APPLE
+      const ssize_t result = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+#else
+      const ssize_t result = ::sendmsg(socket, &message, 0);
+#endif
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;  // LCOV_EXCL_LINE
+        }
+        CURRENT_THROW(SocketWriteException());  // LCOV_EXCL_LINE -- Not covered by the unit tests.
+      }
+      // A blocking `sendmsg()` may still write less than requested, if interrupted by a signal.
+      size_t written = static_cast<size_t>(result);
+      while (written) {
+        const size_t remaining = current->length - offset;
+        if (written >= remaining) {
+          written -= remaining;
+          ++current;
+          offset = 0u;
+        } else {
+          offset += written;
+          written = 0u;
+        }
+      }
+    }
+#else
+    for (const WriteBuffer* b = begin; b != end; ++b) {
+      if (b->length) {
+        BlockingWrite(b->data, b->length, b + 1 != end);
+      }
+    }
+#endif
+    return *this;
+  }
+
+  // Writes `length` bytes of the file `fd`, starting from `offset`, with `sendfile()`, so that the contents
+  // of the file go from the page cache to the socket within the kernel. Does not move the offset of `fd`.
+  // Where there is no `sendfile()` of this kind, falls back to reading the file and writing it piece by piece.
+  inline Connection& BlockingSendFile(int fd, uint64_t offset, uint64_t length) {
+    BRICKS_NET_LOG(
+        "S%05d BlockingSendFile(%d bytes) ...\n", static_cast<SOCKET>(socket), static_cast<int>(length));
+#if !defined(CURRENT_WINDOWS) && !defined(CURRENT_APPLE)
+    off_t position = static_cast<off_t>(offset);
+    while (length) {
+      const size_t chunk = static_cast<size_t>(std::min(length, static_cast<uint64_t>(kMaxSendFileChunk)));
+      const ssize_t result = ::sendfile(socket, fd, &position, chunk);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;  // LCOV_EXCL_LINE
+        }
+        CURRENT_THROW(SocketWriteException());  // LCOV_EXCL_LINE
+      } else if (result == 0) {
+        // The file is shorter than it was said to be, most likely it has been truncated meanwhile.
+        CURRENT_THROW(SocketCouldNotWriteEverythingException());  // LCOV_EXCL_LINE
+      }
+      length -= static_cast<uint64_t>(result);
+    }
+#else
+    std::vector<char> buffer(static_cast<size_t>(std::min(length, static_cast<uint64_t>(kSendFileBufferSize))));
+    while (length) {
+      const size_t size = static_cast<size_t>(std::min(length, static_cast<uint64_t>(buffer.size())));
+#ifndef CURRENT_WINDOWS
+      const ssize_t result = ::pread(fd, &buffer[0], size, static_cast<off_t>(offset));
+#else
+      const int result = (::_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0)
+                             ? -1
+                             : ::_read(fd, &buffer[0], static_cast<unsigned int>(size));
+#endif
+      if (result <= 0) {
+        CURRENT_THROW(SocketCouldNotWriteEverythingException());  // LCOV_EXCL_LINE
+      }
+      BlockingWrite(&buffer[0], static_cast<size_t>(result), static_cast<uint64_t>(result) != length);
+      offset += static_cast<uint64_t>(result);
+      length -= static_cast<uint64_t>(result);
+    }
+#endif
+    BRICKS_NET_LOG("S%05d BlockingSendFile() : OK\n", static_cast<SOCKET>(socket));
+    return *this;
+  }
+
+  // Returns true if the connection is open and has no data to read, so that it can be reused
+  // to send the next request. Does not block.
+  inline bool IsIdle() {
+    if (!pending_input_.empty()) {
+      return false;
+    }
+#ifndef CURRENT_WINDOWS
+    struct pollfd fd;
+    fd.events = POLLIN;
+#else
+    WSAPOLLFD fd;
+    fd.events = POLLRDNORM;
+#endif
+    fd.fd = socket;
+    fd.revents = 0;
+    // The connection closed by the peer is readable, as is the one with the data to read.
+#ifndef CURRENT_WINDOWS
+    return ::poll(&fd, 1, 0) == 0;
+#else
+    return ::WSAPoll(&fd, 1, 0) == 0;
+#endif
+  }
+
   inline Connection& BlockingWrite(const char* s, bool more) {
     assert(s);
     return BlockingWrite(s, strlen(s), more);
@@ -376,8 +588,13 @@ class Connection : public SocketHandle {
   }
 
  private:
+  enum { kMaxWriteBuffers = 16 };
+  enum { kSendFileBufferSize = 1024 * 64 };
+  enum { kMaxSendFileChunk = 1024 * 1024 * 1024 };  // Linux `sendfile()` transfers at most about 2GB per call.
+
   const IPAndPort local_ip_and_port_;
   const IPAndPort remote_ip_and_port_;
+  std::string pending_input_;
 
   Connection() = delete;
   Connection(const Connection&) = delete;
@@ -534,11 +751,17 @@ inline std::string ResolveIPFromHostname(const std::string& hostname) {
 }
 
 // POSIX allows numeric ports, as well as strings like "http".
+// With a non-negative `connect_timeout`, gives up connecting after it, with `SocketConnectTimeoutException`.
+// Resolving the name of the host is not bounded by the timeout.
 template <typename T>
-inline Connection ClientSocket(const std::string& host, T port_or_serv) {
+inline Connection ClientSocket(const std::string& host,
+                               T port_or_serv,
+                               std::chrono::milliseconds connect_timeout = std::chrono::milliseconds(-1)) {
   class ClientSocket final : public SocketHandle {
    public:
-    inline explicit ClientSocket(const std::string& host, const std::string& serv)
+    inline explicit ClientSocket(const std::string& host,
+                                 const std::string& serv,
+                                 std::chrono::milliseconds connect_timeout)
         : SocketHandle(SocketHandle::NewHandle()) {
       BRICKS_NET_LOG("S%05d ", static_cast<SOCKET>(socket));
       // Deliberately left non-const because of possible Windows issues. -- M.Z.
@@ -553,9 +776,13 @@ inline Connection ClientSocket(const std::string& host, T port_or_serv) {
       remote_ip_and_port.port = htons(p_addr_in->sin_port);
 
       BRICKS_NET_LOG("S%05d connect() ...\n", static_cast<SOCKET>(socket));
-      const int retval2 = ::connect(socket, p_addr, sizeof(*p_addr));
-      if (retval2) {
-        CURRENT_THROW(SocketConnectException());  // LCOV_EXCL_LINE -- Not covered by the unit tests.
+      if (connect_timeout.count() < 0) {
+        const int retval2 = ::connect(socket, p_addr, sizeof(*p_addr));
+        if (retval2) {
+          CURRENT_THROW(SocketConnectException());  // LCOV_EXCL_LINE -- Not covered by the unit tests.
+        }
+      } else {
+        ConnectWithTimeout(p_addr, connect_timeout);
       }
 
 #ifndef CURRENT_WINDOWS
@@ -574,8 +801,50 @@ inline Connection ClientSocket(const std::string& host, T port_or_serv) {
     }
     IPAndPort local_ip_and_port;
     IPAndPort remote_ip_and_port;
+
+   private:
+    // Connects in the non-blocking mode, to only wait for the connection to be established up to `timeout`.
+    void ConnectWithTimeout(struct sockaddr* p_addr, std::chrono::milliseconds timeout) {
+      SetNonBlocking(true);
+      if (::connect(socket, p_addr, sizeof(*p_addr))) {
+#ifndef CURRENT_WINDOWS
+        if (errno != EINPROGRESS) {
+          CURRENT_THROW(SocketConnectException());
+        }
+        struct pollfd entry;
+        entry.fd = socket;
+        entry.events = POLLOUT;
+        entry.revents = 0;
+        const int n = ::poll(&entry, 1, static_cast<int>(timeout.count()));
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        const int retval = n > 0 ? ::getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &error_length) : 0;
+#else
+        if (::WSAGetLastError() != WSAEWOULDBLOCK) {
+          CURRENT_THROW(SocketConnectException());
+        }
+        WSAPOLLFD entry;
+        entry.fd = socket;
+        entry.events = POLLWRNORM;
+        entry.revents = 0;
+        const int n = ::WSAPoll(&entry, 1, static_cast<INT>(timeout.count()));
+        int error = 0;
+        int error_length = sizeof(error);
+        const int retval =
+            n > 0 ? ::getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &error_length)
+                  : 0;
+#endif
+        if (!n) {
+          CURRENT_THROW(SocketConnectTimeoutException());
+        }
+        if (n < 0 || retval || error) {
+          CURRENT_THROW(SocketConnectException());
+        }
+      }
+      SetNonBlocking(false);
+    }
   };
-  auto client_socket = ClientSocket(host, std::to_string(port_or_serv));
+  auto client_socket = ClientSocket(host, std::to_string(port_or_serv), connect_timeout);
   IPAndPort local_ip_and_port(std::move(client_socket.local_ip_and_port));
   IPAndPort remote_ip_and_port(std::move(client_socket.remote_ip_and_port));
   return Connection(std::move(client_socket), std::move(local_ip_and_port), std::move(remote_ip_and_port));
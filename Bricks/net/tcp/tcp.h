@@ -29,6 +29,7 @@ SOFTWARE.
 
 #if defined(CURRENT_POSIX) || defined(CURRENT_APPLE) || defined(CURRENT_JAVA) || defined(CURRENT_WINDOWS)
 #include "impl/posix.h"
+#include "impl/poller.h"
 #elif defined(CURRENT_ANDROID)
 #error "tcp.h should not be included in ANDROID builds."
 #else
@@ -56,6 +56,7 @@ using current::net::ResolveIPFromHostname;
 
 using current::net::AttemptedToUseMovedAwayConnection;
 using current::net::SocketBindException;
+using current::net::SocketConnectException;
 using current::net::SocketCouldNotWriteEverythingException;
 using current::net::SocketResolveAddressException;
 
@@ -246,6 +247,69 @@ struct RunResolveAddressTestOnlyOnceSingleton {
 };
 
 // NOTE: This test should pass without active internet connection.
+TEST(TCPTest, EchoMessageOfManyBuffers) {
+  thread server_thread([](Socket socket) {
+    Connection connection(socket.Accept());
+    std::vector<char> s(49);
+    ASSERT_EQ(s.size(), connection.BlockingRead(&s[0], s.size(), Connection::FillFullBuffer));
+    const std::string prefix = "ECHO: ";
+    connection.BlockingWriteBuffers({prefix, current::net::WriteBuffer(&s[0], s.size())});
+  }, Socket(FLAGS_net_tcp_test_port));
+  ExpectFromSocket("ECHO: 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19",
+                   server_thread,
+                   [](Connection& connection) {
+                     // More buffers than a single `sendmsg()` call takes, including the empty ones.
+                     std::vector<std::string> pieces;
+                     for (int i = 0; i < 20; ++i) {
+                       pieces.push_back((i ? "," : "") + to_string(i));
+                       pieces.push_back("");
+                     }
+                     const std::vector<current::net::WriteBuffer> buffers(pieces.begin(), pieces.end());
+                     connection.BlockingWriteBuffers(&buffers[0], &buffers[0] + buffers.size());
+                   });
+}
+
+TEST(TCPTest, IsIdle) {
+  thread server_thread([](Socket socket) {
+    Connection connection(socket.Accept());
+    char c;
+    connection.BlockingRead(&c, 1u);
+    connection.BlockingWrite("!", false);
+    connection.BlockingRead(&c, 1u);
+  }, Socket(FLAGS_net_tcp_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_tcp_test_port));
+  EXPECT_TRUE(connection.IsIdle());
+  connection.BlockingWrite("?", false);
+  while (connection.IsIdle()) {
+    std::this_thread::yield();
+  }
+  char c;
+  connection.BlockingRead(&c, 1u);
+  EXPECT_TRUE(connection.IsIdle());
+  // Once the peer has closed the connection, it is no longer idle.
+  connection.BlockingWrite("?", false);
+  server_thread.join();
+  while (connection.IsIdle()) {
+    std::this_thread::yield();
+  }
+}
+
+TEST(TCPTest, ConnectWithTimeout) {
+  thread server_thread([](Socket socket) {
+    Connection connection(socket.Accept());
+    connection.BlockingWrite("!", false);
+  }, Socket(FLAGS_net_tcp_test_port));
+  Connection connection(ClientSocket("localhost", FLAGS_net_tcp_test_port, milliseconds(1000)));
+  // Once connected, the connection is back in the blocking mode.
+  char c;
+  ASSERT_EQ(1u, connection.BlockingRead(&c, 1u, Connection::FillFullBuffer));
+  EXPECT_EQ('!', c);
+  server_thread.join();
+  // Nothing listens on the port anymore.
+  ASSERT_THROW(Connection(ClientSocket("localhost", FLAGS_net_tcp_test_port, milliseconds(1000))),
+               SocketConnectException);
+}
+
 TEST(TCPTest, ResolveAddress) {
   bool& done = Singleton<RunResolveAddressTestOnlyOnceSingleton>().done;
   if (!done) {
@@ -0,0 +1,637 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The DEFLATE compression, RFC 1951, in the gzip, RFC 1952, and the zlib, RFC 1950, containers,
+// to compress the HTTP responses without depending on an external library.
+//
+// The compressor is built for speed and for streaming, not for the best ratio: it finds the LZ77 matches
+// via a hash chain of limited length, and encodes them with the fixed Huffman codes. On JSON, where most of
+// the savings come from the repeated field names and values, this gets most of what `gzip -1` does. The data
+// which does not compress is written as is, in the stored blocks.
+// `Compressor::Compress()` flushes its output to a byte boundary, as zlib's `Z_SYNC_FLUSH` does, so that
+// every piece of it can be sent and decompressed right away, while the matches still span the pieces.
+//
+// The decompressor supports all the block types, and is mostly used to test the compressor.
+
+#ifndef BRICKS_UTIL_DEFLATE_H
+#define BRICKS_UTIL_DEFLATE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "crc32.h"
+
+#include "../exception.h"
+
+namespace current {
+
+struct InvalidCompressedDataException : Exception {
+  using Exception::Exception;
+};
+
+namespace deflate {
+
+enum class Format : int { GZip, ZLib };
+
+namespace impl {
+
+// The base values and the numbers of extra bits of the length codes 257..285 and the distance codes 0..29.
+constexpr static uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                             31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr static uint8_t kLengthExtraBits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr static uint16_t kDistanceBase[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,    25,
+                                               33,   49,   65,   97,   129,  193,   257,   385,   513,   769,
+                                               1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+constexpr static uint8_t kDistanceExtraBits[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                                   6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+inline uint32_t Adler32(uint32_t adler, const char* data, size_t size) {
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (size) {
+    // 5552 is the largest number of bytes for which `b` does not overflow before the modulo.
+    const size_t block = std::min(size, static_cast<size_t>(5552u));
+    for (size_t i = 0; i < block; ++i) {
+      a += static_cast<uint8_t>(data[i]);
+      b += a;
+    }
+    a %= 65521u;
+    b %= 65521u;
+    data += block;
+    size -= block;
+  }
+  return (b << 16) | a;
+}
+
+}  // namespace impl
+
+// The streaming compressor. Each call returns the compressed data which can be sent right away.
+class Compressor final {
+ public:
+  explicit Compressor(Format format)
+      : format_(format),
+        checksum_(format == Format::ZLib ? 1u : 0u),
+        head_(kHashSize, 0u),
+        prev_(kWindowSize, 0u) {}
+
+  // Compresses `data`. The returned output, together with all the previous ones, is enough to decompress
+  // everything passed in so far.
+  std::string Compress(const char* data, size_t size) {
+    if (!finished_ && size) {
+      WriteHeaderIfNeeded();
+      UpdateChecksum(data, size);
+      // Appends the input in pieces, for the window buffer to stay small even if the input is large.
+      while (size) {
+        const size_t piece = std::min(size, static_cast<size_t>(kWindowSize));
+        const size_t begin = window_.size();
+        window_.append(data, piece);
+        CompressPiece(begin);
+        if (window_.size() > 2u * kWindowSize) {
+          const size_t erase = window_.size() - kWindowSize;
+          window_.erase(0u, erase);
+          window_offset_ += static_cast<uint32_t>(erase);
+        }
+        data += piece;
+        size -= piece;
+      }
+      // The empty stored block, to align the output to a byte boundary.
+      WriteBits(0u, 3);
+      FlushBits();
+      output_.append("\x00\x00\xff\xff", 4u);
+    }
+    return TakeOutput();
+  }
+  std::string Compress(const std::string& data) { return Compress(data.data(), data.length()); }
+
+  // Completes the compressed stream. Nothing can be compressed after this call.
+  std::string Finish() {
+    if (!finished_) {
+      finished_ = true;
+      WriteHeaderIfNeeded();
+      // The final empty block compressed with the fixed Huffman codes.
+      WriteBits(3u, 3);
+      WriteLiteralOrLength(256u);
+      FlushBits();
+      if (format_ == Format::GZip) {
+        WriteLittleEndian32(checksum_);
+        WriteLittleEndian32(static_cast<uint32_t>(input_size_));
+      } else {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+          output_.push_back(static_cast<char>((checksum_ >> shift) & 0xff));
+        }
+      }
+    }
+    return TakeOutput();
+  }
+
+ private:
+  enum { kWindowSize = 32768, kHashBits = 15, kHashSize = 1 << kHashBits };
+  enum { kMinMatch = 3, kMaxMatch = 258, kMaxChainLength = 32 };
+
+  void WriteHeaderIfNeeded() {
+    if (!header_written_) {
+      header_written_ = true;
+      if (format_ == Format::GZip) {
+        // Magic, the DEFLATE method, no flags, no modification time, no extra flags, unknown OS.
+        output_.append("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10u);
+      } else {
+        // The DEFLATE method with the 32KB window, the fast compression level, and the header checksum.
+        output_.append("\x78\x5e", 2u);
+      }
+    }
+  }
+
+  void UpdateChecksum(const char* data, size_t size) {
+    if (format_ == Format::GZip) {
+      checksum_ = CRC32(checksum_, data, size);
+    } else {
+      checksum_ = impl::Adler32(checksum_, data, size);
+    }
+    input_size_ += size;
+  }
+
+  static uint32_t Hash(const char* p) {
+    const uint32_t a = static_cast<uint8_t>(p[0]);
+    const uint32_t b = static_cast<uint8_t>(p[1]);
+    const uint32_t c = static_cast<uint8_t>(p[2]);
+    return ((a << 10) ^ (b << 5) ^ c) & (kHashSize - 1);
+  }
+
+  // Remembers the string of `kMinMatch` bytes starting at `window_[i]`, for the further matches to find it.
+  // The positions are kept modulo 2^32, which is safe, as every candidate match is verified.
+  void Insert(size_t i) {
+    const uint32_t position = window_offset_ + static_cast<uint32_t>(i);
+    const uint32_t hash = Hash(&window_[i]);
+    prev_[position & (kWindowSize - 1)] = head_[hash];
+    head_[hash] = position;
+  }
+
+  // Writes `window_[begin..]` as a non-final block compressed with the fixed Huffman codes or, if it would not
+  // be smaller, as a stored one, for the data which does not compress, random or already compressed, to grow
+  // by a few bytes per piece, not by the ~5% the fixed codes of the bytes above 143 cost.
+  void CompressPiece(size_t begin) {
+    const size_t saved_output_size = output_.size();
+    const uint64_t saved_bit_buffer = bit_buffer_;
+    const int saved_bit_count = bit_count_;
+    WriteBits(2u, 3);
+    CompressWindow(begin);
+    WriteLiteralOrLength(256u);
+    const size_t compressed_bits = (output_.size() - saved_output_size) * 8u + bit_count_ - saved_bit_count;
+    const size_t length = window_.size() - begin;
+    // The block header, the padding to the byte boundary, `LEN` and `NLEN`, and the bytes themselves.
+    const size_t stored_bits = 3u + (8u - (saved_bit_count + 3u) % 8u) % 8u + 32u + length * 8u;
+    if (compressed_bits > stored_bits) {
+      // The hash chains remain valid, as they refer to the window, not to the output.
+      output_.resize(saved_output_size);
+      bit_buffer_ = saved_bit_buffer;
+      bit_count_ = saved_bit_count;
+      WriteBits(0u, 3);
+      FlushBits();
+      output_.push_back(static_cast<char>(length & 0xff));
+      output_.push_back(static_cast<char>(length >> 8));
+      output_.push_back(static_cast<char>(~length & 0xff));
+      output_.push_back(static_cast<char>((~length >> 8) & 0xff));
+      output_.append(window_, begin, length);
+    }
+  }
+
+  // Compresses `window_[begin..]`, finding the matches within the previous `kWindowSize` bytes.
+  void CompressWindow(size_t begin) {
+    const size_t end = window_.size();
+    size_t i = begin;
+    while (i < end) {
+      size_t best_length = 0u;
+      size_t best_distance = 0u;
+      if (end - i >= kMinMatch) {
+        const size_t max_length = std::min(end - i, static_cast<size_t>(kMaxMatch));
+        const uint32_t position = window_offset_ + static_cast<uint32_t>(i);
+        uint32_t candidate = head_[Hash(&window_[i])];
+        for (size_t chain = 0u; chain < kMaxChainLength; ++chain) {
+          const size_t distance = static_cast<uint32_t>(position - candidate);
+          if (distance == 0u || distance > kWindowSize || distance > i) {
+            break;
+          }
+          const char* a = &window_[i];
+          const char* b = &window_[i - distance];
+          if (b[best_length] == a[best_length]) {
+            size_t length = 0u;
+            while (length < max_length && a[length] == b[length]) {
+              ++length;
+            }
+            if (length > best_length) {
+              best_length = length;
+              best_distance = distance;
+              if (length == max_length) {
+                break;
+              }
+            }
+          }
+          const uint32_t next = prev_[candidate & (kWindowSize - 1)];
+          if (static_cast<uint32_t>(position - next) <= static_cast<uint32_t>(position - candidate)) {
+            break;  // The chain has been overwritten by the newer positions.
+          }
+          candidate = next;
+        }
+        Insert(i);
+      }
+      if (best_length >= kMinMatch) {
+        WriteMatch(best_length, best_distance);
+        for (size_t j = i + 1u; j < i + best_length && end - j >= kMinMatch; ++j) {
+          Insert(j);
+        }
+        i += best_length;
+      } else {
+        WriteLiteralOrLength(static_cast<uint8_t>(window_[i]));
+        ++i;
+      }
+    }
+  }
+
+  void WriteMatch(size_t length, size_t distance) {
+    size_t l = 28u;
+    while (impl::kLengthBase[l] > length) {
+      --l;
+    }
+    WriteLiteralOrLength(257u + static_cast<uint32_t>(l));
+    WriteBits(static_cast<uint32_t>(length - impl::kLengthBase[l]), impl::kLengthExtraBits[l]);
+    size_t d = 29u;
+    while (impl::kDistanceBase[d] > distance) {
+      --d;
+    }
+    WriteHuffmanCode(static_cast<uint32_t>(d), 5);
+    WriteBits(static_cast<uint32_t>(distance - impl::kDistanceBase[d]), impl::kDistanceExtraBits[d]);
+  }
+
+  // The fixed Huffman codes, RFC 1951, section 3.2.6.
+  void WriteLiteralOrLength(uint32_t symbol) {
+    if (symbol < 144u) {
+      WriteHuffmanCode(0x30u + symbol, 8);
+    } else if (symbol < 256u) {
+      WriteHuffmanCode(0x190u + symbol - 144u, 9);
+    } else if (symbol < 280u) {
+      WriteHuffmanCode(symbol - 256u, 7);
+    } else {
+      WriteHuffmanCode(0xc0u + symbol - 280u, 8);
+    }
+  }
+
+  // The Huffman codes are packed starting from their most significant bit, unlike all the other values.
+  void WriteHuffmanCode(uint32_t code, int length) {
+    uint32_t reversed = 0u;
+    for (int i = 0; i < length; ++i) {
+      reversed = (reversed << 1) | ((code >> i) & 1u);
+    }
+    WriteBits(reversed, length);
+  }
+
+  void WriteBits(uint32_t bits, int count) {
+    bit_buffer_ |= static_cast<uint64_t>(bits) << bit_count_;
+    bit_count_ += count;
+    while (bit_count_ >= 8) {
+      output_.push_back(static_cast<char>(bit_buffer_ & 0xff));
+      bit_buffer_ >>= 8;
+      bit_count_ -= 8;
+    }
+  }
+
+  void FlushBits() {
+    if (bit_count_) {
+      WriteBits(0u, 8 - bit_count_);
+    }
+  }
+
+  void WriteLittleEndian32(uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      output_.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+  }
+
+  std::string TakeOutput() {
+    std::string result;
+    result.swap(output_);
+    return result;
+  }
+
+  const Format format_;
+  bool header_written_ = false;
+  bool finished_ = false;
+  uint32_t checksum_;  // CRC32 for gzip, Adler-32 for zlib.
+  uint64_t input_size_ = 0u;
+
+  // The input seen so far, the last `kWindowSize` bytes of it at least, and the absolute position of its start.
+  std::string window_;
+  uint32_t window_offset_ = 0u;
+  // The most recent position of each hash of `kMinMatch` bytes, and the previous position with the same hash.
+  std::vector<uint32_t> head_;
+  std::vector<uint32_t> prev_;
+
+  std::string output_;
+  uint64_t bit_buffer_ = 0u;
+  int bit_count_ = 0;
+};
+
+namespace impl {
+
+class Decompressor final {
+ public:
+  Decompressor(const std::string& input, size_t offset) : input_(input), position_(offset) {}
+
+  std::string Decompress() {
+    bool last;
+    do {
+      last = Bits(1);
+      const uint32_t type = Bits(2);
+      if (type == 0u) {
+        Stored();
+      } else if (type == 1u) {
+        Fixed();
+      } else if (type == 2u) {
+        Dynamic();
+      } else {
+        CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE block type."));
+      }
+    } while (!last);
+    return std::move(output_);
+  }
+
+  // The position of the first byte after the compressed data, where the trailer of the container starts.
+  size_t Position() const { return position_; }
+
+ private:
+  struct Huffman final {
+    uint16_t count[16];
+    uint16_t symbol[288];
+  };
+
+  uint32_t Bits(int need) {
+    uint32_t value = bit_buffer_;
+    while (bit_count_ < need) {
+      if (position_ >= input_.length()) {
+        CURRENT_THROW(InvalidCompressedDataException("Unexpected end of DEFLATE data."));
+      }
+      value |= static_cast<uint32_t>(static_cast<uint8_t>(input_[position_++])) << bit_count_;
+      bit_count_ += 8;
+    }
+    bit_buffer_ = value >> need;
+    bit_count_ -= need;
+    return value & ((1u << need) - 1u);
+  }
+
+  void Stored() {
+    bit_buffer_ = 0u;
+    bit_count_ = 0;
+    if (position_ + 4u > input_.length()) {
+      CURRENT_THROW(InvalidCompressedDataException("Unexpected end of DEFLATE data."));
+    }
+    const auto byte = [this](size_t i) { return static_cast<uint32_t>(static_cast<uint8_t>(input_[i])); };
+    const uint32_t length = byte(position_) | (byte(position_ + 1u) << 8);
+    const uint32_t complement = byte(position_ + 2u) | (byte(position_ + 3u) << 8);
+    if (length != (~complement & 0xffffu)) {
+      CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE stored block length."));
+    }
+    position_ += 4u;
+    if (position_ + length > input_.length()) {
+      CURRENT_THROW(InvalidCompressedDataException("Unexpected end of DEFLATE data."));
+    }
+    output_.append(input_, position_, length);
+    position_ += length;
+  }
+
+  static void Build(Huffman& h, const uint8_t* lengths, size_t n) {
+    std::fill(std::begin(h.count), std::end(h.count), 0u);
+    for (size_t i = 0; i < n; ++i) {
+      ++h.count[lengths[i]];
+    }
+    int left = 1;
+    for (int length = 1; length < 16; ++length) {
+      left = (left << 1) - h.count[length];
+      if (left < 0) {
+        CURRENT_THROW(InvalidCompressedDataException("Over-subscribed DEFLATE Huffman code."));
+      }
+    }
+    uint16_t offsets[16];
+    offsets[1] = 0u;
+    for (int length = 1; length < 15; ++length) {
+      offsets[length + 1] = offsets[length] + h.count[length];
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (lengths[i]) {
+        h.symbol[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+      }
+    }
+  }
+
+  uint32_t Decode(const Huffman& h) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length < 16; ++length) {
+      code |= static_cast<int>(Bits(1));
+      const int count = h.count[length];
+      if (code - count < first) {
+        return h.symbol[index + (code - first)];
+      }
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE Huffman code."));
+  }
+
+  void Codes(const Huffman& literals_and_lengths, const Huffman& distances) {
+    while (true) {
+      const uint32_t symbol = Decode(literals_and_lengths);
+      if (symbol < 256u) {
+        output_.push_back(static_cast<char>(symbol));
+      } else if (symbol == 256u) {
+        return;
+      } else {
+        const uint32_t l = symbol - 257u;
+        if (l >= 29u) {
+          CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE length code."));
+        }
+        const size_t length = kLengthBase[l] + Bits(kLengthExtraBits[l]);
+        const uint32_t d = Decode(distances);
+        if (d >= 30u) {
+          CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE distance code."));
+        }
+        const size_t distance = kDistanceBase[d] + Bits(kDistanceExtraBits[d]);
+        if (distance > output_.length()) {
+          CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE distance."));
+        }
+        // Byte by byte, as the copied string may overlap with itself.
+        for (size_t i = 0; i < length; ++i) {
+          output_.push_back(output_[output_.length() - distance]);
+        }
+      }
+    }
+  }
+
+  void Fixed() {
+    uint8_t lengths[288 + 30];
+    std::fill(lengths, lengths + 144, 8u);
+    std::fill(lengths + 144, lengths + 256, 9u);
+    std::fill(lengths + 256, lengths + 280, 7u);
+    std::fill(lengths + 280, lengths + 288, 8u);
+    std::fill(lengths + 288, lengths + 288 + 30, 5u);
+    Huffman literals_and_lengths;
+    Huffman distances;
+    Build(literals_and_lengths, lengths, 288u);
+    Build(distances, lengths + 288, 30u);
+    Codes(literals_and_lengths, distances);
+  }
+
+  void Dynamic() {
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    const size_t literals_count = Bits(5) + 257u;
+    const size_t distances_count = Bits(5) + 1u;
+    const size_t code_lengths_count = Bits(4) + 4u;
+    if (literals_count > 286u || distances_count > 30u) {
+      CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE dynamic block header."));
+    }
+    uint8_t lengths[286 + 30] = {0};
+    for (size_t i = 0; i < code_lengths_count; ++i) {
+      lengths[order[i]] = static_cast<uint8_t>(Bits(3));
+    }
+    Huffman code_lengths;
+    Build(code_lengths, lengths, 19u);
+    std::fill(lengths, lengths + 19, 0u);
+    size_t index = 0u;
+    while (index < literals_count + distances_count) {
+      uint32_t symbol = Decode(code_lengths);
+      if (symbol < 16u) {
+        lengths[index++] = static_cast<uint8_t>(symbol);
+      } else {
+        uint8_t length = 0u;
+        if (symbol == 16u) {
+          if (!index) {
+            CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE code lengths."));
+          }
+          length = lengths[index - 1u];
+          symbol = 3u + Bits(2);
+        } else if (symbol == 17u) {
+          symbol = 3u + Bits(3);
+        } else {
+          symbol = 11u + Bits(7);
+        }
+        if (index + symbol > literals_count + distances_count) {
+          CURRENT_THROW(InvalidCompressedDataException("Invalid DEFLATE code lengths."));
+        }
+        while (symbol--) {
+          lengths[index++] = length;
+        }
+      }
+    }
+    if (!lengths[256]) {
+      CURRENT_THROW(InvalidCompressedDataException("No end-of-block code in DEFLATE block."));
+    }
+    Huffman literals_and_lengths;
+    Huffman distances;
+    Build(literals_and_lengths, lengths, literals_count);
+    Build(distances, lengths + literals_count, distances_count);
+    Codes(literals_and_lengths, distances);
+  }
+
+  const std::string& input_;
+  size_t position_;
+  uint32_t bit_buffer_ = 0u;
+  int bit_count_ = 0;
+  std::string output_;
+};
+
+}  // namespace impl
+
+inline std::string Compress(const std::string& data, Format format = Format::GZip) {
+  Compressor compressor(format);
+  std::string result = compressor.Compress(data);
+  result += compressor.Finish();
+  return result;
+}
+
+inline std::string Decompress(const std::string& data, Format format = Format::GZip) {
+  const auto byte = [&data](size_t i) {
+    if (i >= data.length()) {
+      CURRENT_THROW(InvalidCompressedDataException("Unexpected end of compressed data."));
+    }
+    return static_cast<uint32_t>(static_cast<uint8_t>(data[i]));
+  };
+  size_t offset = 0u;
+  if (format == Format::GZip) {
+    if (byte(0u) != 0x1fu || byte(1u) != 0x8bu || byte(2u) != 8u) {
+      CURRENT_THROW(InvalidCompressedDataException("Invalid gzip header."));
+    }
+    const uint32_t flags = byte(3u);
+    offset = 10u;
+    if (flags & 4u) {  // `FEXTRA`.
+      offset += 2u + (byte(offset) | (byte(offset + 1u) << 8));
+    }
+    for (uint32_t flag : {8u, 16u}) {  // `FNAME` and `FCOMMENT`, zero-terminated.
+      if (flags & flag) {
+        while (byte(offset++)) {
+        }
+      }
+    }
+    if (flags & 2u) {  // `FHCRC`.
+      offset += 2u;
+    }
+  } else {
+    if ((byte(0u) & 0x0fu) != 8u || ((byte(0u) << 8) | byte(1u)) % 31u || (byte(1u) & 0x20u)) {
+      CURRENT_THROW(InvalidCompressedDataException("Invalid zlib header."));
+    }
+    offset = 2u;
+  }
+  impl::Decompressor decompressor(data, offset);
+  std::string result = decompressor.Decompress();
+  const size_t trailer = decompressor.Position();
+  const auto little_endian_32 = [&byte](size_t i) {
+    return byte(i) | (byte(i + 1u) << 8) | (byte(i + 2u) << 16) | (byte(i + 3u) << 24);
+  };
+  uint32_t expected = 0u;
+  uint32_t actual = 0u;
+  if (format == Format::GZip) {
+    expected = little_endian_32(trailer);
+    actual = CRC32(0u, result.data(), result.length());
+    if (little_endian_32(trailer + 4u) != static_cast<uint32_t>(result.length())) {
+      CURRENT_THROW(InvalidCompressedDataException("Invalid gzip uncompressed size."));
+    }
+  } else {
+    expected =
+        (byte(trailer) << 24) | (byte(trailer + 1u) << 16) | (byte(trailer + 2u) << 8) | byte(trailer + 3u);
+    actual = impl::Adler32(1u, result.data(), result.length());
+  }
+  if (expected != actual) {
+    CURRENT_THROW(InvalidCompressedDataException("Checksum mismatch in compressed data."));
+  }
+  return result;
+}
+
+}  // namespace deflate
+}  // namespace current
+
+#endif  // BRICKS_UTIL_DEFLATE_H
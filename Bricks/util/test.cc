@@ -28,6 +28,7 @@ SOFTWARE.
 #include "base64.h"
 #include "comparators.h"
 #include "crc32.h"
+#include "deflate.h"
 #include "iterator.h"
 #include "lazy_instantiation.h"
 #include "make_scope_guard.h"
@@ -285,6 +286,75 @@ TEST(Util, CRC32) {
   EXPECT_EQ(2514197138u, current::CRC32(test_string.c_str()));
 }
 
+TEST(Util, Deflate) {
+  using current::deflate::Compress;
+  using current::deflate::Compressor;
+  using current::deflate::Decompress;
+  using current::deflate::Format;
+
+  EXPECT_EQ("", Decompress(Compress("")));
+  EXPECT_EQ("", Decompress(Compress("", Format::ZLib), Format::ZLib));
+  std::string json;
+  for (int i = 0; i < 1000; ++i) {
+    json += current::strings::Printf(
+        "{\"key\":\"k%d\",\"value\":%d,\"flag\":%s}\n", i, i * i, (i % 3) ? "true" : "false");
+  }
+  const std::string gzip = Compress(json);
+  EXPECT_EQ("\x1f\x8b", gzip.substr(0u, 2u));
+  EXPECT_LT(gzip.length() * 4u, json.length());
+  EXPECT_EQ(json, Decompress(gzip));
+  EXPECT_EQ(json, Decompress(Compress(json, Format::ZLib), Format::ZLib));
+  std::string all_chars;
+  for (int c = 0; c < 256; ++c) {
+    all_chars += static_cast<char>(c);
+  }
+  EXPECT_EQ(all_chars + all_chars, Decompress(Compress(all_chars + all_chars)));
+
+  // The data which does not compress goes in the stored blocks, and barely grows.
+  std::string random;
+  uint32_t seed = 42u;
+  for (int i = 0; i < 100000; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    random += static_cast<char>(seed >> 24);
+  }
+  const std::string random_gzip = Compress(random);
+  EXPECT_LT(random_gzip.length(), random.length() + 64u);
+  EXPECT_EQ(random, Decompress(random_gzip));
+  EXPECT_EQ(random, Decompress(Compress(random, Format::ZLib), Format::ZLib));
+
+  // Each piece of the streamed output is flushed, to be decompressed as soon as it has been received.
+  Compressor compressor(Format::GZip);
+  std::string stream;
+  for (size_t i = 0u; i < json.length(); i += 100u) {
+    const std::string piece = compressor.Compress(json.substr(i, 100u));
+    ASSERT_LT(4u, piece.length());
+    EXPECT_EQ(std::string("\x00\x00\xff\xff", 4u), piece.substr(piece.length() - 4u));
+    stream += piece;
+  }
+  stream += compressor.Finish();
+  EXPECT_EQ(json, Decompress(stream));
+
+  // The dynamic Huffman codes, as produced by zlib at its best compression level.
+  const std::string zlib(
+      "\x78\xda\xb5\xcb\xc7\x01\x80\x20\x10\x05\xd1\x56\x7e\x05\xd4\xe2\xc1\x06\x40\x49\x06\x56\xb2\x50"
+      "\xbd\xdb\x84\xe7\x79\xb3\x3a\x8d\x58\xfd\x76\x42\x25\xea\x01\x86\x5e\x1c\xf5\x7e\x32\xa8\xe9\x84"
+      "\xc2\xf9\x92\x73\x60\x27\x2b\xb0\xfe\x86\x17\xc9\xee\x1e\x50\x8c\xba\x2f\x0e\xc6\x37\xcd\x69\xea"
+      "\x80\xcb\xc7\x4a\x89\x5f\x9b\xc5\x07\xb2\xfb\x3f\x0d",
+      85u);
+  std::string fox;
+  for (int i = 0; i < 3; ++i) {
+    fox += "The quick brown fox jumps over the lazy dog. ";
+  }
+  fox += "Pack my box with five dozen liquor jugs.";
+  EXPECT_EQ(fox, Decompress(zlib, Format::ZLib));
+
+  EXPECT_THROW(Decompress("not compressed"), current::InvalidCompressedDataException);
+  EXPECT_THROW(Decompress(gzip.substr(0u, gzip.length() / 2u)), current::InvalidCompressedDataException);
+  std::string corrupted = gzip;
+  corrupted[corrupted.length() - 5u] ^= 1;
+  EXPECT_THROW(Decompress(corrupted), current::InvalidCompressedDataException);
+}
+
 TEST(Util, SHA256) {
   EXPECT_EQ("a591a6d40bf420404a011733cfb7b190d62c65bf0bcda32b57b277d9ad9f146e",
             static_cast<std::string>(current::SHA256("Hello World")));
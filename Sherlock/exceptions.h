@@ -47,6 +47,10 @@ struct PublisherAlreadyOwnedException : SherlockException {
   using SherlockException::SherlockException;
 };
 
+struct InvalidNumberOfPartitionsException : SherlockException {
+  using SherlockException::SherlockException;
+};
+
 struct StreamInGracefulShutdownException : InGracefulShutdownException {
   using InGracefulShutdownException::InGracefulShutdownException;
 };
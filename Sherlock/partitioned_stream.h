@@ -0,0 +1,344 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// A partitioned Sherlock stream: N independent sub-streams, each with its own persister and its own lock.
+//
+// A partitioned stream is constructed as `sherlock::PartitionedStream<ENTRY>(number_of_partitions)`.
+// To persist the partitions, pass in the function returning the construction parameter of each partition:
+// `sherlock::PartitionedStream<ENTRY, current::persistence::File>(4, [](size_t i) { return Printf(...); });`.
+//
+// Publishing is done via `my_stream.Publish(key, ENTRY{...});`. The partition is picked by `std::hash<>` of
+// the key, and publishers to different partitions never contend for the same mutex. The timestamp is assigned
+// by the partitioned stream itself, from within the partition's lock, which is what makes the merged view
+// below consistent. Publishing into `Partition(i)` directly voids this guarantee.
+//
+// Subscription to a partition is done via `my_stream.Partition(i).Subscribe(my_subscriber)`, as usual.
+// Subscription to all the partitions at once is done via `auto scope = my_stream.Subscribe(my_subscriber)`.
+// The entries are then passed to the subscriber in the order of their timestamps, merged across partitions,
+// with `current.index` being the 0-based index of the entry in this merged view.
+
+#ifndef CURRENT_SHERLOCK_PARTITIONED_STREAM_H
+#define CURRENT_SHERLOCK_PARTITIONED_STREAM_H
+
+#include "../port.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sherlock.h"
+
+namespace current {
+namespace sherlock {
+
+template <typename ENTRY, template <typename> class PERSISTENCE_LAYER = DEFAULT_PERSISTENCE_LAYER>
+class PartitionedStreamImpl {
+ public:
+  using entry_t = ENTRY;
+  using stream_t = StreamImpl<entry_t, PERSISTENCE_LAYER>;
+
+  // The maximum number of entries per partition read ahead by each merged subscriber.
+  constexpr static size_t kMergedSubscriberReadAheadEntries = 1024u;
+
+  struct PartitionData {
+    std::mutex publish_mutex;
+    stream_t stream;
+
+    template <typename... ARGS>
+    PartitionData(ARGS&&... args)
+        : stream(std::forward<ARGS>(args)...) {}
+  };
+
+  struct PartitionsData {
+    std::vector<std::unique_ptr<PartitionData>> partitions;
+  };
+
+  explicit PartitionedStreamImpl(size_t number_of_partitions) {
+    ValidateNumberOfPartitions(number_of_partitions);
+    for (size_t i = 0; i < number_of_partitions; ++i) {
+      own_data_->partitions.push_back(std::make_unique<PartitionData>());
+    }
+  }
+
+  template <typename F>
+  PartitionedStreamImpl(size_t number_of_partitions, F&& per_partition_construction_parameter) {
+    ValidateNumberOfPartitions(number_of_partitions);
+    for (size_t i = 0; i < number_of_partitions; ++i) {
+      own_data_->partitions.push_back(std::make_unique<PartitionData>(per_partition_construction_parameter(i)));
+    }
+  }
+
+  size_t NumberOfPartitions() const {
+    return own_data_.ObjectAccessorDespitePossiblyDestructing().partitions.size();
+  }
+
+  template <typename KEY>
+  size_t PartitionIndex(const KEY& key) const {
+    return std::hash<KEY>()(key) % NumberOfPartitions();
+  }
+
+  stream_t& Partition(size_t partition_index) {
+    return own_data_.ObjectAccessorDespitePossiblyDestructing().partitions.at(partition_index)->stream;
+  }
+
+  // Returns the index and the timestamp of the entry within its partition.
+  template <typename KEY>
+  idxts_t Publish(const KEY& key, const entry_t& entry) {
+    return DoPublish(PartitionIndex(key), entry);
+  }
+
+  template <typename KEY>
+  idxts_t Publish(const KEY& key, entry_t&& entry) {
+    return DoPublish(PartitionIndex(key), std::move(entry));
+  }
+
+  // The subscriber thread, merging the entries of all the partitions into one timestamp-ordered sequence.
+  // Each partition is subscribed to with its own "feeder", which reads ahead into the per-partition queue.
+  // The earliest entry among the queues is passed on as soon as every partition with nothing queued is known
+  // to have nothing more to feed, which is confirmed from within that partition's publish lock.
+  template <typename F>
+  class MergedSubscriberThreadInstance final : public current::sherlock::SubscriberScope::SubscriberThread {
+   private:
+    class PartitionFeederImpl {
+     public:
+      PartitionFeederImpl(MergedSubscriberThreadInstance& self, size_t partition_index)
+          : self_(self), partition_index_(partition_index) {}
+
+      ss::EntryResponse operator()(const entry_t& entry, idxts_t current, idxts_t) {
+        return self_.Feed(partition_index_, entry, current);
+      }
+      ss::EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return ss::EntryResponse::More; }
+      ss::TerminationResponse Terminate() const { return ss::TerminationResponse::Terminate; }
+
+     private:
+      MergedSubscriberThreadInstance& self_;
+      const size_t partition_index_;
+    };
+    using feeder_t = ss::StreamSubscriber<PartitionFeederImpl, entry_t>;
+
+    struct PerPartition {
+      std::deque<std::pair<std::chrono::microseconds, entry_t>> queue;
+      uint64_t fed = 0u;  // The total number of entries fed from this partition, including the queued ones.
+    };
+
+   public:
+    MergedSubscriberThreadInstance(ScopeOwned<PartitionsData>& data, F& subscriber)
+        : data_(data,
+                [this]() {
+                  {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    terminate_signal_ = true;
+                  }
+                  condition_variable_.notify_all();
+                }),
+          subscriber_(subscriber),
+          per_partition_(data_.ObjectAccessorDespitePossiblyDestructing().partitions.size()) {
+      auto& partitions = data_.ObjectAccessorDespitePossiblyDestructing().partitions;
+      for (size_t i = 0; i < partitions.size(); ++i) {
+        feeders_.push_back(std::make_unique<feeder_t>(*this, i));
+      }
+      for (size_t i = 0; i < partitions.size(); ++i) {
+        feeder_scopes_.push_back(partitions[i]->stream.Subscribe(*feeders_[i]));
+      }
+      thread_ = std::thread(&MergedSubscriberThreadInstance::Thread, this);
+    }
+
+    ~MergedSubscriberThreadInstance() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        terminate_signal_ = true;
+      }
+      condition_variable_.notify_all();
+      thread_.join();
+      StopFeeding();
+      // Order of destruction does matter: the scopes, which join the feeder threads, should be deleted first.
+      feeder_scopes_.clear();
+      feeders_.clear();
+    }
+
+   private:
+    ss::EntryResponse Feed(size_t partition_index, const entry_t& entry, idxts_t current) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto& partition = per_partition_[partition_index];
+        condition_variable_.wait(lock,
+                                 [this, &partition]() {
+                                   return stop_feeding_ ||
+                                          partition.queue.size() < kMergedSubscriberReadAheadEntries;
+                                 });
+        if (stop_feeding_) {
+          return ss::EntryResponse::Done;
+        }
+        partition.queue.emplace_back(current.us, entry);
+        ++partition.fed;
+      }
+      condition_variable_.notify_all();
+      return ss::EntryResponse::More;
+    }
+
+    void StopFeeding() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_feeding_ = true;
+      }
+      condition_variable_.notify_all();
+    }
+
+    void Thread() {
+      ThreadImpl();
+      subscriber_thread_done_ = true;
+      StopFeeding();
+    }
+
+    void ThreadImpl() {
+      PartitionsData& bare_data = data_.ObjectAccessorDespitePossiblyDestructing();
+      const size_t n = per_partition_.size();
+      uint64_t index = 0u;
+      bool terminate_sent = false;
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true) {
+        if (!terminate_sent && terminate_signal_) {
+          terminate_sent = true;
+          lock.unlock();
+          if (subscriber_.Terminate() != ss::TerminationResponse::Wait) {
+            return;
+          }
+          lock.lock();
+        }
+        size_t earliest = n;
+        for (size_t i = 0; i < n; ++i) {
+          const auto& queue = per_partition_[i].queue;
+          if (!queue.empty() &&
+              (earliest == n || queue.front().first < per_partition_[earliest].queue.front().first)) {
+            earliest = i;
+          }
+        }
+        bool ready = (earliest != n);
+        uint64_t total_published = 0u;
+        std::chrono::microseconds last_us = std::chrono::microseconds(0);
+        if (ready) {
+          for (size_t i = 0; i < n; ++i) {
+            auto& partition = *bare_data.partitions[i];
+            std::lock_guard<std::mutex> partition_lock(partition.publish_mutex);
+            const auto& persister = partition.stream.InternalExposePersister();
+            const uint64_t size = persister.Size();
+            if (size) {
+              last_us = std::max(last_us, persister.LastPublishedIndexAndTimestamp().us);
+            }
+            total_published += size;
+            // The partition with nothing queued must have nothing yet to be fed. As timestamps are assigned
+            // from within the partition's lock, whatever it publishes next is timestamped later than `us`.
+            if (per_partition_[i].queue.empty() && size > per_partition_[i].fed) {
+              ready = false;
+              break;
+            }
+          }
+        }
+        if (!ready) {
+          condition_variable_.wait(lock);
+          continue;
+        }
+        auto& queue = per_partition_[earliest].queue;
+        std::pair<std::chrono::microseconds, entry_t> entry = std::move(queue.front());
+        queue.pop_front();
+        uint64_t total_consumed = 0u;
+        for (const auto& partition : per_partition_) {
+          total_consumed += partition.fed - partition.queue.size();
+        }
+        lock.unlock();
+        condition_variable_.notify_all();
+        const idxts_t current(index, entry.first);
+        const idxts_t last(index + (total_published - total_consumed), last_us);
+        if (subscriber_(std::move(entry.second), current, last) == ss::EntryResponse::Done) {
+          return;
+        }
+        ++index;
+        lock.lock();
+      }
+    }
+
+    ScopeOwnedBySomeoneElse<PartitionsData> data_;
+    F& subscriber_;
+    std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    bool terminate_signal_ = false;
+    bool stop_feeding_ = false;
+    std::vector<PerPartition> per_partition_;
+    std::vector<std::unique_ptr<feeder_t>> feeders_;
+    std::vector<current::sherlock::SubscriberScope> feeder_scopes_;
+    std::thread thread_;
+
+    MergedSubscriberThreadInstance() = delete;
+    MergedSubscriberThreadInstance(const MergedSubscriberThreadInstance&) = delete;
+    MergedSubscriberThreadInstance(MergedSubscriberThreadInstance&&) = delete;
+    void operator=(const MergedSubscriberThreadInstance&) = delete;
+    void operator=(MergedSubscriberThreadInstance&&) = delete;
+  };
+
+  template <typename F>
+  current::sherlock::SubscriberScope Subscribe(F& subscriber) {
+    static_assert(current::ss::IsStreamSubscriber<F, entry_t>::value, "");
+    try {
+      return current::sherlock::SubscriberScope(
+          std::make_unique<MergedSubscriberThreadInstance<F>>(own_data_, subscriber));
+    } catch (const current::sync::InDestructingModeException&) {
+      CURRENT_THROW(StreamInGracefulShutdownException());
+    }
+  }
+
+ private:
+  static void ValidateNumberOfPartitions(size_t number_of_partitions) {
+    if (!number_of_partitions) {
+      CURRENT_THROW(InvalidNumberOfPartitionsException());
+    }
+  }
+
+  template <typename E>
+  idxts_t DoPublish(size_t partition_index, E&& entry) {
+    try {
+      auto& partition = *own_data_->partitions[partition_index];
+      std::lock_guard<std::mutex> lock(partition.publish_mutex);
+      return partition.stream.Publish(std::forward<E>(entry), current::time::Now());
+    } catch (const current::sync::InDestructingModeException&) {
+      CURRENT_THROW(StreamInGracefulShutdownException());
+    }
+  }
+
+  ScopeOwnedByMe<PartitionsData> own_data_;
+
+  PartitionedStreamImpl(const PartitionedStreamImpl&) = delete;
+  void operator=(const PartitionedStreamImpl&) = delete;
+};
+
+template <typename ENTRY, template <typename> class PERSISTENCE_LAYER = DEFAULT_PERSISTENCE_LAYER>
+using PartitionedStream = PartitionedStreamImpl<ENTRY, PERSISTENCE_LAYER>;
+
+}  // namespace sherlock
+}  // namespace current
+
+#endif  // CURRENT_SHERLOCK_PARTITIONED_STREAM_H
@@ -220,12 +220,19 @@ class StreamImpl {
   }
 
   ~StreamImpl() {
-    // TODO(dkorolev): These should be erased in an ongoing fashion.
+    // Completed and terminated HTTP subscriptions are erased in an ongoing fashion by the reaper thread,
+    // see `StreamData::ScheduleHTTPSubscriptionCleanup()`. Clean up the ones still active.
     // Order of destruction in `http_subscriptions` does matter - scopes should be deleted first -- M.Z.
-    for (auto& it : own_data_.ObjectAccessorDespitePossiblyDestructing().http_subscriptions) {
+    auto& data = own_data_.ObjectAccessorDespitePossiblyDestructing();
+    typename stream_data_t::http_subscriptions_t active_subscriptions;
+    {
+      std::lock_guard<std::mutex> lock(data.http_subscriptions_mutex);
+      active_subscriptions.swap(data.http_subscriptions);
+    }
+    for (auto& it : active_subscriptions) {
       it.second.first = nullptr;
     }
-    own_data_.ObjectAccessorDespitePossiblyDestructing().http_subscriptions.clear();
+    active_subscriptions.clear();
   }
 
   void operator=(StreamImpl&& rhs) {
@@ -436,20 +443,15 @@ class StreamImpl {
       const auto request_params = ParsePubSubHTTPRequest(r);
 
       if (request_params.terminate_requested) {
-        typename stream_data_t::http_subscriptions_t::iterator it;
+        bool found;
         {
-          // NOTE: This is not thread-safe!!!
-          // The iterator may get invalidated in between the next few lines.
-          // However, during the call to `= nullptr` the mutex will be locked again from within the
-          // thread terminating callback. Need to clean this up. TODO(dkorolev).
           std::lock_guard<std::mutex> lock(data.http_subscriptions_mutex);
-          it = data.http_subscriptions.find(request_params.terminate_id);
+          found = data.http_subscriptions.count(request_params.terminate_id);
         }
-        if (it != data.http_subscriptions.end()) {
-          // Subscription found. Delete the scope, triggering the thread to shut down.
-          // TODO(dkorolev): This should certainly not happen synchronously.
-          it->second.first = nullptr;
-          // Subscription terminated.
+        if (found) {
+          // Subscription found. Have the reaper thread delete its scope, triggering the thread to shut down.
+          // The termination itself happens asynchronously, so that this request is never blocked by it.
+          data.ScheduleHTTPSubscriptionCleanup(request_params.terminate_id);
           r("", HTTPResponseCode.OK);
         } else {
           // Subscription not found.
@@ -520,22 +522,21 @@ class StreamImpl {
         auto http_chunked_subscriber = std::make_unique<PubSubHTTPEndpoint<entry_t, PERSISTENCE_LAYER, J>>(
             subscription_id, scoped_data, std::move(r), std::move(request_params));
 
-        current::sherlock::SubscriberScope http_chunked_subscriber_scope =
-            Subscribe(*http_chunked_subscriber,
-                      begin_idx,
-                      [this, &data, subscription_id]() {
-                        // NOTE: Need to figure out when and where to lock.
-                        // Chat w/ Max about the logic to clean up completed listeners.
-                        // std::lock_guard<std::mutex> lock(inner_data.http_subscriptions_mutex);
-                        data.http_subscriptions[subscription_id].second = nullptr;
-                      });
+        // The completed subscription is erased from `http_subscriptions` by the reaper thread.
+        current::sherlock::SubscriberScope http_chunked_subscriber_scope = Subscribe(
+            *http_chunked_subscriber,
+            begin_idx,
+            [&data, subscription_id]() { data.ScheduleHTTPSubscriptionCleanup(subscription_id); });
 
         {
           std::lock_guard<std::mutex> lock(data.http_subscriptions_mutex);
-          // TODO(dkorolev): This condition is to be rewritten correctly.
-          if (!data.http_subscriptions.count(subscription_id)) {
-            data.http_subscriptions[subscription_id] =
-                std::make_pair(std::move(http_chunked_subscriber_scope), std::move(http_chunked_subscriber));
+          // The done callback is invoked with `http_subscriptions_mutex` locked, after the subscriber thread
+          // has been marked as done. Thus, if the subscription is still active here, its cleanup will be
+          // scheduled after it has been registered. Otherwise, it is cleaned up as this function returns.
+          if (http_chunked_subscriber_scope) {
+            data.http_subscriptions.emplace(
+                subscription_id,
+                std::make_pair(std::move(http_chunked_subscriber_scope), std::move(http_chunked_subscriber)));
           }
         }
       }
@@ -546,6 +547,13 @@ class StreamImpl {
 
   void operator()(Request r) { ServeDataViaHTTP(std::move(r)); }
 
+  // The number of HTTP subscriptions not yet cleaned up. For unit-testing purposes mostly.
+  size_t NumberOfHTTPSubscriptions() {
+    auto& data = own_data_.ObjectAccessorDespitePossiblyDestructing();
+    std::lock_guard<std::mutex> lock(data.http_subscriptions_mutex);
+    return data.http_subscriptions.size();
+  }
+
   persistence_layer_t& InternalExposePersister() {
     return own_data_.ObjectAccessorDespitePossiblyDestructing().persistence;
   }
@@ -27,8 +27,12 @@ SOFTWARE.
 
 #include "../port.h"
 
+#include <condition_variable>
 #include <map>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "../Blocks/Persistence/persistence.h"
 #include "../Bricks/util/random.h"
@@ -114,10 +118,79 @@ struct StreamData {
   StreamData(ARGS&&... args)
       : persistence(std::forward<ARGS>(args)...) {}
 
+  ~StreamData() {
+    {
+      std::lock_guard<std::mutex> lock(http_subscriptions_reaper_mutex_);
+      http_subscriptions_reaper_stop_ = true;
+    }
+    http_subscriptions_reaper_cv_.notify_one();
+    if (http_subscriptions_reaper_thread_.joinable()) {
+      http_subscriptions_reaper_thread_.join();
+    }
+  }
+
+  // Schedule the HTTP subscription, which is either done or is requested to be terminated, to be cleaned up.
+  // Terminating the subscription joins its thread, which should never happen in the thread serving the request,
+  // so the actual cleanup happens in the dedicated "reaper" thread, started lazily upon the first call.
+  // Unknown subscription IDs are ignored by the reaper. Thread-safe, and never blocks for long.
+  void ScheduleHTTPSubscriptionCleanup(const std::string& subscription_id) {
+    {
+      std::lock_guard<std::mutex> lock(http_subscriptions_reaper_mutex_);
+      if (http_subscriptions_reaper_stop_) {
+        return;
+      }
+      http_subscriptions_to_clean_up_.push_back(subscription_id);
+      if (!http_subscriptions_reaper_thread_.joinable()) {
+        http_subscriptions_reaper_thread_ = std::thread([this]() { HTTPSubscriptionsReaperThread(); });
+      }
+    }
+    http_subscriptions_reaper_cv_.notify_one();
+  }
+
   static std::string GenerateRandomHTTPSubscriptionID() {
     return current::SHA256("sherlock_http_subscription_" +
                            current::ToString(current::random::CSRandomUInt64(0ull, ~0ull)));
   }
+
+ private:
+  void HTTPSubscriptionsReaperThread() {
+    std::unique_lock<std::mutex> lock(http_subscriptions_reaper_mutex_);
+    while (true) {
+      http_subscriptions_reaper_cv_.wait(lock, [this]() {
+        return http_subscriptions_reaper_stop_ || !http_subscriptions_to_clean_up_.empty();
+      });
+      if (http_subscriptions_reaper_stop_) {
+        // The remaining subscriptions, if any, are taken care of by the destructor of the stream.
+        return;
+      }
+      std::vector<std::string> ids;
+      ids.swap(http_subscriptions_to_clean_up_);
+      lock.unlock();
+      std::vector<typename http_subscriptions_t::mapped_type> extracted;
+      {
+        std::lock_guard<std::mutex> subscriptions_lock(http_subscriptions_mutex);
+        for (const auto& id : ids) {
+          auto it = http_subscriptions.find(id);
+          if (it != http_subscriptions.end()) {
+            extracted.push_back(std::move(it->second));
+            http_subscriptions.erase(it);
+          }
+        }
+      }
+      // Order of destruction does matter: the scope must be released, and the thread joined, first.
+      for (auto& e : extracted) {
+        e.first = nullptr;
+        e.second = nullptr;
+      }
+      lock.lock();
+    }
+  }
+
+  std::vector<std::string> http_subscriptions_to_clean_up_;
+  std::mutex http_subscriptions_reaper_mutex_;
+  std::condition_variable http_subscriptions_reaper_cv_;
+  bool http_subscriptions_reaper_stop_ = false;
+  std::thread http_subscriptions_reaper_thread_;
 };
 
 }  // namespace sherlock
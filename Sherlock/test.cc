@@ -26,6 +26,7 @@ SOFTWARE.
 #define CURRENT_MOCK_TIME
 
 #include "sherlock.h"
+#include "partitioned_stream.h"
 
 #include <string>
 #include <atomic>
@@ -659,6 +660,61 @@ TEST(Sherlock, SubscribeToStreamViaHTTP) {
   // TODO(dkorolev): Add tests that the endpoint is not unregistered until its last client is done. (?)
 }
 
+TEST(Sherlock, HTTPSubscriptionBuffersOnlyIfAsked) {
+  current::time::ResetToZero();
+
+  using namespace sherlock_unittest;
+
+  auto exposed_stream = current::sherlock::Stream<Record>();
+  const std::string base_url = Printf("http://localhost:%d/exposed", FLAGS_sherlock_http_test_port);
+
+  const auto scope = HTTP(FLAGS_sherlock_http_test_port).Register("/exposed", exposed_stream);
+
+  std::string expected;
+  for (int i = 0; i < 100; ++i) {
+    exposed_stream.Publish(Record(i), std::chrono::microseconds(i + 1));
+    expected += Printf("{\"index\":%d,\"us\":%d}\t{\"x\":%d}\n", i, i + 1, i);
+  }
+
+  const auto chunked_get = [&base_url](const std::string& query, std::vector<std::string>& chunks) {
+    const auto result = HTTP(ChunkedGET(base_url + query,
+                                        [](const std::string&, const std::string&) {},
+                                        [&chunks](const std::string& chunk) { chunks.push_back(chunk); },
+                                        []() {}));
+    EXPECT_EQ(200, static_cast<int>(result));
+  };
+
+  // By default, each entry is a chunk of its own.
+  std::vector<std::string> chunks;
+  chunked_get("?nowait", chunks);
+  ASSERT_EQ(100u, chunks.size());
+  EXPECT_EQ("{\"index\":0,\"us\":1}\t{\"x\":0}\n", chunks[0]);
+
+  // With `buffer`, the entries are coalesced into larger chunks.
+  std::vector<std::string> buffered_chunks;
+  chunked_get("?nowait&buffer", buffered_chunks);
+  EXPECT_LT(buffered_chunks.size(), 10u);
+  EXPECT_EQ(expected, Join(buffered_chunks, ""));
+}
+
+namespace sherlock_unittest {
+
+// The HTTP subscriptions are erased by the reaper thread of the stream. Returns `false` if it has not done so
+// within ten seconds.
+template <typename STREAM>
+bool WaitUntilHTTPSubscriptionsAreCleanedUp(STREAM& stream) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (stream.NumberOfHTTPSubscriptions()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+}  // namespace sherlock_unittest
+
 TEST(Sherlock, HTTPSubscriptionCanBeTerminated) {
   current::time::ResetToZero();
 
@@ -717,11 +773,138 @@ TEST(Sherlock, HTTPSubscriptionCanBeTerminated) {
   keep_publishing = false;
   slow_publisher.join();
 
+  // The subscription is terminated asynchronously, so `chunks_done` is only guaranteed
+  // once the request is over.
+  slow_subscriber.join();
+
   EXPECT_TRUE(chunks_done);
 
   EXPECT_GE(chunks_count, 100u);
 
-  slow_subscriber.join();
+  // The terminated subscription is erased by the reaper thread.
+  ASSERT_TRUE(WaitUntilHTTPSubscriptionsAreCleanedUp(exposed_stream));
+}
+
+TEST(Sherlock, CompletedHTTPSubscriptionsAreCleanedUp) {
+  current::time::ResetToZero();
+
+  using namespace sherlock_unittest;
+
+  auto exposed_stream = current::sherlock::Stream<Record>();
+  const std::string base_url = Printf("http://localhost:%d/exposed", FLAGS_sherlock_http_test_port);
+
+  const auto scope = HTTP(FLAGS_sherlock_http_test_port).Register("/exposed", exposed_stream);
+
+  exposed_stream.Publish(Record(1), std::chrono::microseconds(100));
+  exposed_stream.Publish(Record(2), std::chrono::microseconds(200));
+
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(
+        "{\"index\":0,\"us\":100}\t{\"x\":1}\n"
+        "{\"index\":1,\"us\":200}\t{\"x\":2}\n",
+        HTTP(GET(base_url + "?nowait")).body);
+  }
+
+  // Completed subscriptions do not stay around once their subscriber threads are done.
+  ASSERT_TRUE(WaitUntilHTTPSubscriptionsAreCleanedUp(exposed_stream));
+
+  // Terminating a subscription that has already been cleaned up reports it as not found.
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(base_url + "?terminate=nonexistent_id")).code));
+}
+
+TEST(Sherlock, PartitionedStream) {
+  current::time::ResetToZero();
+
+  using namespace sherlock_unittest;
+
+  current::sherlock::PartitionedStream<Record> stream(3u);
+  EXPECT_EQ(3u, stream.NumberOfPartitions());
+
+  for (int i = 1; i <= 12; ++i) {
+    current::time::SetNow(std::chrono::microseconds(i * 10));
+    const auto idx_ts = stream.Publish(i, Record(i));
+    EXPECT_EQ(i * 10, idx_ts.us.count());
+  }
+
+  uint64_t total = 0u;
+  for (size_t i = 0; i < stream.NumberOfPartitions(); ++i) {
+    total += stream.Partition(i).InternalExposePersister().Size();
+  }
+  EXPECT_EQ(12u, total);
+  EXPECT_EQ(4u, stream.Partition(stream.PartitionIndex(7)).InternalExposePersister().Size());
+
+  Data d;
+  {
+    SherlockTestProcessor p(d, false, true);
+    p.SetMax(12u);
+    const auto scope = stream.Subscribe(p);
+    while (d.seen_ < 12u) {
+      ;  // Spin lock.
+    }
+  }
+
+  std::vector<std::string> expected_values;
+  for (int i = 1; i <= 12; ++i) {
+    expected_values.push_back(Printf("[%d:%d,11:120] %d", i - 1, i * 10, i));
+  }
+  EXPECT_TRUE(
+      CompareValuesMixedWithTerminate(d.results_, expected_values, SherlockTestProcessor::kTerminateStr))
+      << Join(expected_values, ',') << " != " << d.results_;
+}
+
+namespace sherlock_unittest {
+
+struct MergedOrderCheckerImpl {
+  std::atomic_size_t seen{0u};
+  std::atomic_bool ordered{true};
+  uint64_t expected_index = 0u;
+  std::chrono::microseconds last_us = std::chrono::microseconds(0);
+
+  EntryResponse operator()(const Record&, idxts_t current, idxts_t last) {
+    if (current.index != expected_index || (current.index && !(current.us > last_us)) ||
+        last.index < current.index) {
+      ordered = false;
+    }
+    ++expected_index;
+    last_us = current.us;
+    ++seen;
+    return EntryResponse::More;
+  }
+
+  EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return EntryResponse::More; }
+  TerminationResponse Terminate() const { return TerminationResponse::Terminate; }
+};
+
+using MergedOrderChecker = current::ss::StreamSubscriber<MergedOrderCheckerImpl, Record>;
+
+}  // namespace sherlock_unittest
+
+TEST(Sherlock, PartitionedStreamMergesConcurrentPublishersInTimestampOrder) {
+  current::time::ResetToZero();
+
+  using namespace sherlock_unittest;
+
+  current::sherlock::PartitionedStream<Record> stream(4u);
+
+  MergedOrderChecker checker;
+  const auto scope = stream.Subscribe(checker);
+
+  std::vector<std::thread> publishers;
+  for (int t = 0; t < 4; ++t) {
+    publishers.emplace_back([&stream, t]() {
+      for (int i = 0; i < 250; ++i) {
+        stream.Publish(t * 1000 + i, Record(i));
+      }
+    });
+  }
+  for (auto& thread : publishers) {
+    thread.join();
+  }
+
+  while (checker.seen < 1000u) {
+    std::this_thread::yield();
+  }
+  EXPECT_TRUE(checker.ordered);
 }
 
 const std::string sherlock_golden_data =
@@ -34,6 +34,8 @@ SOFTWARE.
 #include "api_base.h"
 
 #include "rest/basic.h"
+#include "rest/conditional_get.h"
+#include "rest/read_your_writes.h"
 
 #include "../TypeSystem/Schema/schema.h"
 #include "../Blocks/HTTP/api.h"
@@ -155,13 +157,32 @@ struct PerFieldRESTfulHandlerGenerator {
                 Request request) {
               auto generic_input = RESTfulGenericInput<STORAGE>(
                   storage, restful_url_prefix, data_url_component, schema_url_component);
-              if (request.method == "GET") {
+              if (request.method == "GET" && !WaitForRequestedStorageIndex<REST_IMPL>(storage, request)) {
+                // Responded to with an error.
+              } else if (request.method == "GET" && request.url.query.has("stream") &&
+                         !request.url.query.has("key") && request.url_path_args.empty()) {
                 GETHandler handler;
                 const bool export_requested = request.url.query.has("export");
+                handler.Enter(std::move(request),
+                              // Capture by reference since this lambda is supposed to run synchronously.
+                              [&storage, &handler, &generic_input, &field_name, export_requested](
+                                  Request request, const std::string&) {
+                                StreamCollection(storage,
+                                                 handler,
+                                                 generic_input,
+                                                 field_name,
+                                                 export_requested,
+                                                 std::move(request));
+                              });
+              } else if (request.method == "GET") {
+                GETHandler handler;
+                const bool export_requested = request.url.query.has("export");
+                RESTfulConditionalGET conditional_get;
+                conditional_get.ParseFromHeaders(request.headers);
                 handler.Enter(
                     std::move(request),
                     // Capture by reference since this lambda is supposed to run synchronously.
-                    [&storage, &handler, &generic_input, &field_name, export_requested](
+                    [&storage, &handler, &generic_input, &field_name, &conditional_get, export_requested](
                         Request request, const std::string& url_key) {
                       const specific_field_t& field =
                           generic_input.storage(::current::storage::ImmutableFieldByIndex<INDEX>());
@@ -173,6 +194,7 @@ struct PerFieldRESTfulHandlerGenerator {
                                                  &field,
                                                  url_key,
                                                  field_name,
+                                                 conditional_get,
                                                  export_requested](immutable_fields_t fields) -> Response {
                                                   using GETInput = RESTfulGETInput<STORAGE, specific_field_t>;
                                                   GETInput input(std::move(generic_input),
@@ -182,7 +204,18 @@ struct PerFieldRESTfulHandlerGenerator {
                                                                  url_key,
                                                                  storage.GetRole(),
                                                                  export_requested);
-                                                  return handler.Run(input);
+                                                  Response response = handler.Run(input);
+                                                  if (url_key.empty()) {
+                                                    conditional_get.Apply(
+                                                        response,
+                                                        RESTfulConditionalGET::CollectionETag(
+                                                            storage.DataVersion()),
+                                                        nullptr);
+                                                  } else {
+                                                    conditional_get.ApplyToEntry<key_t>(
+                                                        response, field, url_key);
+                                                  }
+                                                  return response;
                                                 },
                                                 std::move(request)).Detach();
                     });
@@ -206,7 +239,7 @@ struct PerFieldRESTfulHandlerGenerator {
                                        std::move(generic_input), fields, field, field_name, mutable_entry);
                                    return handler.Run(input);
                                  },
-                                 std::move(request))
+                                 RespondWithStorageIndex(generic_input.storage, std::move(request)))
                             .Detach();
                       } catch (const TypeSystemParseJSONException& e) {
                         request(handler.ErrorBadJSON(e.What()));
@@ -240,7 +273,7 @@ struct PerFieldRESTfulHandlerGenerator {
                                                   entry_key);
                                    return handler.Run(input);
                                  },
-                                 std::move(request))
+                                 RespondWithStorageIndex(generic_input.storage, std::move(request)))
                             .Detach();
                       } catch (const TypeSystemParseJSONException& e) {  // LCOV_EXCL_LINE
                         request(handler.ErrorBadJSON(e.What()));         // LCOV_EXCL_LINE
@@ -265,7 +298,8 @@ struct PerFieldRESTfulHandlerGenerator {
                                                       std::move(generic_input), fields, field, field_name, key);
                                                   return handler.Run(input);
                                                 },
-                                                std::move(request)).Detach();
+                                                RespondWithStorageIndex(generic_input.storage,
+                                                                        std::move(request))).Detach();
                     });
               } else {
                 request(REST_IMPL::ErrorMethodNotAllowed(request.method));  // LCOV_EXCL_LINE
@@ -281,6 +315,161 @@ struct PerFieldRESTfulHandlerGenerator {
               input_field_name,
               RESTfulRoute(schema_url_component, route_suffix, URLPathArgs::CountMask::None, handler)));
         });
+
+    // Secondary index handlers, `/data/$FIELD.$INDEX/$INDEX_KEY`, for the dictionaries with indexes.
+    IndexRoutesGenerator<void, ::current::storage::index::IndexesOf<specific_field_t>>::RegisterRoutes(
+        registerer, storage, restful_url_prefix, input_field_name, data_url_component, schema_url_component);
+  }
+
+  // Responds with all the entries of the field, one line per entry as formatted by `handler.CollectionLine()`,
+  // in chunks, each serialized within its own read-only transaction, and sent outside of it.
+  // See `rest/pagination.h`.
+  template <class HANDLER>
+  static void StreamCollection(STORAGE& storage,
+                               const HANDLER& handler,
+                               const RESTfulGenericInput<STORAGE>& generic_input,
+                               const std::string& field_name,
+                               bool export_requested,
+                               Request request) {
+    using GETInput = RESTfulGETInput<STORAGE, specific_field_t>;
+    const specific_field_t& field = storage(::current::storage::ImmutableFieldByIndex<INDEX>());
+    bool can_stream = true;
+    Response error;
+    const StorageRole role = storage.GetRole();
+    storage.ReadOnlyTransaction(
+                [&handler, &generic_input, &field, &field_name, role, export_requested, &can_stream, &error](
+                    immutable_fields_t fields) {
+                  const GETInput input(generic_input, fields, field, field_name, "", role, export_requested);
+                  can_stream = handler.CanStream(input, error);
+                }).Go();
+    if (!can_stream) {
+      request(std::move(error));
+      return;
+    }
+    try {
+      auto response = request.SendChunkedResponse(HTTPResponseCode.OK, net::constants::kDefaultContentType);
+      std::unique_ptr<typename specific_field_t::key_t> cursor;
+      PageResult page = PageResult::HasMore;
+      while (page == PageResult::HasMore) {
+        std::string chunk;
+        storage.ReadOnlyTransaction([&handler,
+                                     &generic_input,
+                                     &field,
+                                     &field_name,
+                                     role,
+                                     export_requested,
+                                     &cursor,
+                                     &page,
+                                     &chunk](immutable_fields_t fields) {
+          using entry_t = typename specific_entry_type_t::entry_t;
+          const GETInput input(generic_input, fields, field, field_name, "", role, export_requested);
+          const entry_t* last = nullptr;
+          page = ForEachAfter(field,
+                              cursor.get(),
+                              kRESTStreamChunkSize,
+                              [&handler, &input, &chunk, &last](const entry_t& entry) {
+                                chunk += handler.CollectionLine(input, entry);
+                                last = &entry;
+                              });
+          if (last) {
+            cursor = std::make_unique<typename specific_field_t::key_t>(
+                PerStorageFieldType<specific_field_t>::ExtractOrComposeKey(*last));
+          }
+        }).Go();
+        if (page == PageResult::InvalidCursor) {
+          // The entry the previous chunk has ended at is gone: the client must not take the stream as complete.
+          response.Abort();
+        } else {
+          response.Send(chunk);
+        }
+      }
+    } catch (const current::net::NetworkException&) {
+      // The client has disconnected.
+    }
+  }
+
+  // The `BLAH` template parameter is required to fight the "explicit specialization in class scope" error.
+  template <typename BLAH, typename INDEXES>
+  struct IndexRoutesGenerator;
+
+  template <typename BLAH>
+  struct IndexRoutesGenerator<BLAH, ::current::storage::index::Indexes<>> {
+    static void RegisterRoutes(registerer_t,
+                               STORAGE&,
+                               const std::string&,
+                               const std::string&,
+                               const std::string&,
+                               const std::string&) {}
+  };
+
+  template <typename BLAH, typename DECLARATION, typename... DECLARATIONS>
+  struct IndexRoutesGenerator<BLAH, ::current::storage::index::Indexes<DECLARATION, DECLARATIONS...>> {
+    using IndexHandler = typename REST_IMPL::template RESTfulIndexHandlerGenerator<
+        specific_field_t,
+        typename specific_entry_type_t::entry_t>;
+    using IndexGETInput = RESTfulIndexGETInput<STORAGE, specific_field_t>;
+
+    static void RegisterRoutes(registerer_t registerer,
+                               STORAGE& storage,
+                               const std::string& restful_url_prefix,
+                               const std::string& field_name,
+                               const std::string& data_url_component,
+                               const std::string& schema_url_component) {
+      registerer(storage_handlers_map_entry_t(
+          field_name,
+          RESTfulRoute(
+              data_url_component,
+              std::string(".") + DECLARATION::Name(),
+              URLPathArgs::CountMask::One,
+              [&storage, restful_url_prefix, field_name, data_url_component, schema_url_component](
+                  Request request) {
+                if (request.method != "GET") {
+                  request(REST_IMPL::ErrorMethodNotAllowed(request.method));
+                  return;
+                }
+                if (!WaitForRequestedStorageIndex<REST_IMPL>(storage, request)) {
+                  return;
+                }
+                auto generic_input = RESTfulGenericInput<STORAGE>(
+                    storage, restful_url_prefix, data_url_component, schema_url_component);
+                const std::string index_key = request.url_path_args[0];
+                const specific_field_t& field = storage(::current::storage::ImmutableFieldByIndex<INDEX>());
+                storage.ReadOnlyTransaction(
+                           // Capture local variables by value for safe async transactions.
+                           [generic_input, &field, field_name, index_key](
+                               immutable_fields_t fields) -> Response {
+                             IndexHandler handler;
+                             const IndexGETInput input(
+                                 generic_input, fields, field, field_name, DECLARATION::Name(), index_key);
+                             return IndexedGETResponse(
+                                 handler,
+                                 input,
+                                 field.template Index<DECLARATION>(),
+                                 current::FromString<typename DECLARATION::index_key_t>(index_key));
+                           },
+                           std::move(request)).Detach();
+              })));
+      IndexRoutesGenerator<BLAH, ::current::storage::index::Indexes<DECLARATIONS...>>::RegisterRoutes(
+          registerer, storage, restful_url_prefix, field_name, data_url_component, schema_url_component);
+    }
+  };
+
+  // Unique index: the entry, if any.
+  template <class HANDLER, class INPUT, typename DICTIONARY, typename DECLARATION>
+  static Response IndexedGETResponse(const HANDLER& handler,
+                                     const INPUT& input,
+                                     const container::IndexAccessor<DICTIONARY, DECLARATION, true>& index,
+                                     const typename DECLARATION::index_key_t& index_key) {
+    return handler.RunUnique(input, index[index_key]);
+  }
+
+  // Non-unique index: the entries, possibly none.
+  template <class HANDLER, class INPUT, typename DICTIONARY, typename DECLARATION>
+  static Response IndexedGETResponse(const HANDLER& handler,
+                                     const INPUT& input,
+                                     const container::IndexAccessor<DICTIONARY, DECLARATION, false>& index,
+                                     const typename DECLARATION::index_key_t& index_key) {
+    return handler.RunNonUnique(input, index[index_key]);
   }
 };
 
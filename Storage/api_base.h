@@ -143,6 +143,42 @@ struct RESTfulGETInput : RESTfulGenericInput<STORAGE> {
         export_requested(export_requested) {}
 };
 
+// For `GET /data/$FIELD.$INDEX/$INDEX_KEY`.
+template <typename STORAGE, typename FIELD>
+struct RESTfulIndexGETInput : RESTfulGenericInput<STORAGE> {
+  using immutable_fields_t = ImmutableFields<STORAGE>;
+  immutable_fields_t fields;
+  const FIELD& field;
+  const std::string field_name;
+  const std::string index_name;
+  const std::string index_key;
+
+  RESTfulIndexGETInput(const RESTfulGenericInput<STORAGE>& input,
+                       immutable_fields_t fields,
+                       const FIELD& field,
+                       const std::string& field_name,
+                       const std::string& index_name,
+                       const std::string& index_key)
+      : RESTfulGenericInput<STORAGE>(input),
+        fields(fields),
+        field(field),
+        field_name(field_name),
+        index_name(index_name),
+        index_key(index_key) {}
+  RESTfulIndexGETInput(RESTfulGenericInput<STORAGE>&& input,
+                       immutable_fields_t fields,
+                       const FIELD& field,
+                       const std::string& field_name,
+                       const std::string& index_name,
+                       const std::string& index_key)
+      : RESTfulGenericInput<STORAGE>(std::move(input)),
+        fields(fields),
+        field(field),
+        field_name(field_name),
+        index_name(index_name),
+        index_key(index_key) {}
+};
+
 template <typename STORAGE, typename FIELD, typename ENTRY>
 struct RESTfulPOSTInput : RESTfulGenericInput<STORAGE> {
   using mutable_fields_t = MutableFields<STORAGE>;
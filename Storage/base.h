@@ -29,7 +29,11 @@ SOFTWARE.
 #include "../port.h"
 
 #include <cassert>
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <new>
+#include <vector>
 
 #include "transaction.h"
 
@@ -158,16 +162,100 @@ template <typename FIELDS, int COUNT>
 using FieldsTypeList =
     typename TypeListMapperImpl<FIELDS, current::variadic_indexes::generate_indexes<COUNT>>::result;
 
+// The arena the rollback records of `MutationJournal` are allocated from. Its memory is reused by the
+// subsequent transactions, so that, once warmed up, logging a mutation allocates nothing for its rollback.
+class RollbackArena final {
+ public:
+  constexpr static size_t kBlockSize = 64 * 1024;
+  constexpr static size_t kAlignment = alignof(std::max_align_t);
+
+  void* Allocate(size_t size) {
+    size = (size + kAlignment - 1) / kAlignment * kAlignment;
+    while (block_ < blocks_.size() && offset_ + size > blocks_[block_].size) {
+      ++block_;
+      offset_ = 0u;
+    }
+    if (block_ == blocks_.size()) {
+      size_t block_size = kBlockSize;
+      if (size > block_size) {
+        block_size = size;
+      }
+      blocks_.push_back(Block{std::unique_ptr<char[]>(new char[block_size]), block_size});
+    }
+    void* result = blocks_[block_].data.get() + offset_;
+    offset_ += size;
+    return result;
+  }
+
+  // Makes all the memory available again. The objects allocated should be destructed by the caller beforehand.
+  void Reset() {
+    block_ = 0u;
+    offset_ = 0u;
+  }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+  std::vector<Block> blocks_;
+  size_t block_ = 0u;
+  size_t offset_ = 0u;
+};
+
+// A typed record of how to undo one mutation. Containers store the previous values in it by moving them,
+// not copying.
+struct RollbackRecord {
+  virtual ~RollbackRecord() = default;
+  virtual void Rollback() = 0;
+};
+
+template <typename F>
+struct TypedRollbackRecord final : RollbackRecord {
+  F f;
+  explicit TypedRollbackRecord(F&& f) : f(std::move(f)) {}
+  void Rollback() override { f(); }
+};
+
+template <typename V, typename F>
+struct TypedRollbackRecordWithValue final : RollbackRecord {
+  V value;
+  F f;
+  TypedRollbackRecordWithValue(V&& value, F&& f) : value(std::move(value)), f(std::move(f)) {}
+  void Rollback() override { f(std::move(value)); }
+};
+
 // `MutationJournal` keeps all the changes made during one transaction, as well as the way to rollback them.
+// The events are kept as `CurrentSuper`-s, as they end up in the `Variant`-s of the persisted transaction.
 struct MutationJournal {
   TransactionMeta transaction_meta;
   std::vector<std::unique_ptr<current::CurrentSuper>> commit_log;
-  std::vector<std::function<void()>> rollback_log;
+  // The records are allocated from, and owned by, `rollback_arena`.
+  std::vector<RollbackRecord*> rollback_log;
+  RollbackArena rollback_arena;
+  // Run once the transaction is over, committed or rolled back, for the containers to defer the maintenance
+  // which would invalidate the iterators obtained within the transaction.
+  std::vector<std::function<void()>> after_transaction;
+
+  MutationJournal() = default;
+  ~MutationJournal() { ClearRollbackLog(); }
+
+  // Logs the mutation, with `rollback()` to undo it.
+  template <typename T, typename F>
+  void LogMutation(T&& entry, F&& rollback) {
+    using record_t = TypedRollbackRecord<typename std::decay<F>::type>;
+    commit_log.push_back(std::make_unique<typename std::decay<T>::type>(std::move(entry)));
+    rollback_log.push_back(new (AllocateRollbackRecord<record_t>()) record_t(std::move(rollback)));
+  }
 
-  template <typename T>
-  void LogMutation(T&& entry, std::function<void()> rollback) {
-    commit_log.push_back(std::make_unique<T>(std::move(entry)));
-    rollback_log.push_back(rollback);
+  // Logs the mutation, with `rollback(std::move(previous_value))` to undo it.
+  // The previous value is moved into the journal, not copied.
+  template <typename T, typename V, typename F>
+  void LogMutation(T&& entry, V&& previous_value, F&& rollback) {
+    using record_t = TypedRollbackRecordWithValue<typename std::decay<V>::type, typename std::decay<F>::type>;
+    commit_log.push_back(std::make_unique<typename std::decay<T>::type>(std::move(entry)));
+    rollback_log.push_back(new (AllocateRollbackRecord<record_t>())
+                               record_t(std::move(previous_value), std::move(rollback)));
   }
 
   void BeforeTransaction() { transaction_meta.begin_us = current::time::Now(); }
@@ -176,7 +264,7 @@ struct MutationJournal {
 
   void Rollback() {
     for (auto rit = rollback_log.rbegin(); rit != rollback_log.rend(); ++rit) {
-      (*rit)();
+      (*rit)->Rollback();
     }
     Clear();
   }
@@ -186,7 +274,12 @@ struct MutationJournal {
     transaction_meta.end_us = std::chrono::microseconds(0);
     transaction_meta.fields.clear();
     commit_log.clear();
-    rollback_log.clear();
+    ClearRollbackLog();
+    std::vector<std::function<void()>> callbacks;
+    callbacks.swap(after_transaction);
+    for (const auto& f : callbacks) {
+      f();
+    }
   }
 
   void AssertEmpty() const {
@@ -195,7 +288,26 @@ struct MutationJournal {
     assert(transaction_meta.fields.empty());
     assert(commit_log.empty());
     assert(rollback_log.empty());
+    assert(after_transaction.empty());
+  }
+
+ private:
+  template <typename RECORD>
+  void* AllocateRollbackRecord() {
+    static_assert(alignof(RECORD) <= RollbackArena::kAlignment, "Over-aligned rollback records not supported.");
+    return rollback_arena.Allocate(sizeof(RECORD));
+  }
+
+  void ClearRollbackLog() {
+    for (RollbackRecord* record : rollback_log) {
+      record->~RollbackRecord();
+    }
+    rollback_log.clear();
+    rollback_arena.Reset();
   }
+
+  MutationJournal(const MutationJournal&) = delete;
+  MutationJournal& operator=(const MutationJournal&) = delete;
 };
 
 template <typename BASE>
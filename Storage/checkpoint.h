@@ -0,0 +1,207 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Storage checkpoints, to bound the time it takes a Sherlock-persisted storage to start.
+//
+// A checkpoint is the state of all the fields of the storage, saved in the binary format as the list of
+// the "updated" and "deleted" events which recreate it, along with the index of the first stream entry
+// not reflected by it. Being constructed as `Storage storage(StorageCheckpoints(dir), ...)`, the storage
+// loads the most recent checkpoint from `dir`, and only replays the stream starting from that index.
+// A checkpoint which fails to load is skipped in favor of the older one, and, if none loads, the whole stream
+// is replayed.
+//
+// Checkpoints are created by `storage.Checkpoint()`, by a POST to the endpoint registered via
+// `storage.ExposeCheckpointsViaHTTP(port, route)`, or periodically, by `ScheduledStorageCheckpoints`.
+
+#ifndef CURRENT_STORAGE_CHECKPOINT_H
+#define CURRENT_STORAGE_CHECKPOINT_H
+
+#include "../port.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "exceptions.h"
+
+#include "../TypeSystem/struct.h"
+#include "../TypeSystem/Serialization/binary.h"
+
+#include "../Bricks/file/file.h"
+#include "../Bricks/strings/printf.h"
+
+namespace current {
+namespace storage {
+
+// The configuration of checkpoints: the directory to keep them in, and how many most recent ones to keep.
+struct StorageCheckpoints final {
+  std::string directory;
+  size_t keep = 2u;
+
+  StorageCheckpoints() = default;
+  explicit StorageCheckpoints(const std::string& directory, size_t keep = 2u)
+      : directory(directory), keep(keep) {}
+
+  bool Enabled() const { return !directory.empty(); }
+};
+
+CURRENT_STRUCT_T(StorageCheckpoint) {
+  CURRENT_FIELD(next_index, uint64_t);
+  CURRENT_FIELD(mutations, std::vector<T>);
+};
+
+CURRENT_STRUCT(StorageCheckpointCreated) {
+  CURRENT_FIELD(next_index, uint64_t);
+  CURRENT_CONSTRUCTOR(StorageCheckpointCreated)(uint64_t next_index = 0u) : next_index(next_index) {}
+};
+
+namespace impl {
+
+// Checkpoint files are named `checkpoint.${next_index}.bin`, with the index zero-padded to twenty digits.
+inline std::string StorageCheckpointFileName(uint64_t next_index) {
+  return current::strings::Printf("checkpoint.%020llu.bin", static_cast<unsigned long long>(next_index));
+}
+
+// Returns the indexes of the checkpoints in `directory`, in the increasing order.
+inline std::vector<uint64_t> ListStorageCheckpoints(const std::string& directory) {
+  std::vector<uint64_t> result;
+  try {
+    current::FileSystem::ScanDir(directory, [&result](const std::string& file_name) {
+      if (file_name.length() == 35u && file_name.compare(0u, 11u, "checkpoint.") == 0 &&
+          file_name.compare(31u, 4u, ".bin") == 0 &&
+          std::all_of(
+              file_name.begin() + 11, file_name.begin() + 31, [](char c) { return c >= '0' && c <= '9'; })) {
+        result.push_back(static_cast<uint64_t>(std::stoull(file_name.substr(11u, 20u))));
+      }
+    });
+  } catch (const current::DirDoesNotExistException&) {
+    // No checkpoints have been created yet.
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+}  // namespace impl
+
+// Writes the checkpoint into a temporary file and renames it, so that a checkpoint file is always complete.
+// The file is synced before the rename, and the directory after it, so that a crash can not leave a renamed,
+// yet not fully written checkpoint, nor lose the checkpoint after the older ones have been removed.
+template <typename T>
+void SaveStorageCheckpoint(const StorageCheckpoints& config, const StorageCheckpoint<T>& checkpoint) {
+  current::FileSystem::MkDir(config.directory, current::FileSystem::MkDirParameters::Silent);
+  const std::string file_name =
+      current::FileSystem::JoinPath(config.directory, impl::StorageCheckpointFileName(checkpoint.next_index));
+  const std::string tmp_file_name = file_name + ".tmp";
+  {
+    std::ofstream os(tmp_file_name, std::ofstream::binary);
+    SaveIntoBinary(os, checkpoint);
+    if (!os.good()) {
+      CURRENT_THROW(StorageCannotAppendToFileException(tmp_file_name));  // LCOV_EXCL_LINE
+    }
+  }
+  current::FileSystem::SyncFile(tmp_file_name);
+  current::FileSystem::RenameFile(tmp_file_name, file_name);
+  current::FileSystem::SyncFile(config.directory);
+
+  const std::vector<uint64_t> checkpoints = impl::ListStorageCheckpoints(config.directory);
+  for (size_t i = 0u; i + config.keep < checkpoints.size(); ++i) {
+    current::FileSystem::RmFile(
+        current::FileSystem::JoinPath(config.directory, impl::StorageCheckpointFileName(checkpoints[i])),
+        current::FileSystem::RmFileParameters::Silent);
+  }
+}
+
+// Loads the most recent checkpoint which loads successfully, reporting the ones which do not, if any.
+// Returns `false` if there are no checkpoints to load.
+template <typename T>
+bool LoadLatestStorageCheckpoint(const StorageCheckpoints& config, StorageCheckpoint<T>& checkpoint) {
+  const std::vector<uint64_t> checkpoints = impl::ListStorageCheckpoints(config.directory);
+  for (auto rit = checkpoints.rbegin(); rit != checkpoints.rend(); ++rit) {
+    const std::string file_name =
+        current::FileSystem::JoinPath(config.directory, impl::StorageCheckpointFileName(*rit));
+    try {
+      std::ifstream is(file_name, std::ifstream::binary);
+      checkpoint = LoadFromBinary<StorageCheckpoint<T>>(is);
+      if (checkpoint.next_index != *rit) {
+        CURRENT_THROW(StorageCheckpointIsCorruptedException(file_name));
+      }
+      return true;
+    } catch (const std::exception& e) {
+      // Corrupted size fields may also result in `std::bad_alloc` or `std::length_error`.
+      std::cerr << "Skipping the storage checkpoint " << file_name << ": " << e.what() << std::endl;
+    }
+  }
+  return false;
+}
+
+// Calls `storage.Checkpoint()` every `period`, until destructed.
+template <typename STORAGE>
+class ScheduledStorageCheckpoints final {
+ public:
+  ScheduledStorageCheckpoints(STORAGE& storage, std::chrono::milliseconds period)
+      : storage_(storage), period_(period), thread_([this]() { Thread(); }) {}
+
+  ~ScheduledStorageCheckpoints() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_variable_.notify_one();
+    thread_.join();
+  }
+
+ private:
+  void Thread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!condition_variable_.wait_for(lock, period_, [this]() { return stop_; })) {
+      try {
+        storage_.Checkpoint();
+      } catch (const std::exception& e) {  // LCOV_EXCL_LINE
+        std::cerr << "Scheduled storage checkpoint failed: " << e.what() << std::endl;  // LCOV_EXCL_LINE
+      }
+    }
+  }
+
+  STORAGE& storage_;
+  const std::chrono::milliseconds period_;
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+  bool stop_ = false;
+  std::thread thread_;
+
+  ScheduledStorageCheckpoints(const ScheduledStorageCheckpoints&) = delete;
+  ScheduledStorageCheckpoints& operator=(const ScheduledStorageCheckpoints&) = delete;
+};
+
+}  // namespace storage
+}  // namespace current
+
+using current::storage::StorageCheckpoints;
+using current::storage::ScheduledStorageCheckpoints;
+
+#endif  // CURRENT_STORAGE_CHECKPOINT_H
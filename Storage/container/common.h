@@ -25,6 +25,8 @@ SOFTWARE.
 #ifndef CURRENT_STORAGE_CONTAINER_COMMON_H
 #define CURRENT_STORAGE_CONTAINER_COMMON_H
 
+#include "flat_map.h"
+
 #include "../../Bricks/util/comparators.h"
 
 namespace current {
@@ -37,6 +39,12 @@ using Unordered = std::unordered_map<KEY, VALUE, CurrentHashFunction<KEY>>;
 template <typename KEY, typename VALUE>
 using Ordered = std::map<KEY, VALUE, CurrentComparator<KEY>>;
 
+template <typename KEY, typename VALUE>
+using FlatUnordered = FlatHashMap<KEY, VALUE, CurrentHashFunction<KEY>>;
+
+template <typename KEY, typename VALUE>
+using FlatOrdered = FlatOrderedMap<KEY, VALUE, CurrentComparator<KEY>>;
+
 }  // namespace container
 }  // namespace storage
 }  // namespace current
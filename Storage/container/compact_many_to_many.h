@@ -0,0 +1,882 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+// `CompactManyToMany` is a memory-efficient many-to-many matrix, for large relation tables.
+//
+// Most of the cells are kept "compacted", in one array sorted by `(row, col)`, much like the CSR format
+// of sparse matrices. The transposed view, as in the CSC format, is an array of 32-bit indexes into it.
+// This is one timestamp and four bytes of overhead per cell, compared to several heap allocations
+// and a few dozen bytes of pointers per cell of `GenericManyToMany`.
+//
+// The mutations go into the small, node-based "delta", which shadows the compacted cells, and which is
+// merged into them once it grows over a fraction of their number. `Rows()`, `Cols()`, `Row()` and `Col()`
+// iterate over the merged view, in the order of the keys, as `OrderedManyToOrderedMany` does.
+//
+// The merge does not hold the storage mutex for the time it takes: a copy of the compacted cells is merged
+// with a snapshot of the delta by a background thread. The result is swapped in once the transaction during
+// which it has completed is over, and only the delta cells mutated since the snapshot remain in the delta.
+// Thus, the iterators and the references obtained within a transaction stay valid until its end.
+
+#ifndef CURRENT_STORAGE_CONTAINER_COMPACT_MANY_TO_MANY_H
+#define CURRENT_STORAGE_CONTAINER_COMPACT_MANY_TO_MANY_H
+
+#include "../../port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "sfinae.h"
+
+#include "../base.h"
+#include "../exceptions.h"
+
+#include "../../TypeSystem/optional.h"
+#include "../../Bricks/util/comparators.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT>
+class CompactManyToMany {
+ public:
+  using row_t = sfinae::entry_row_t<T>;
+  using col_t = sfinae::entry_col_t<T>;
+  using key_t = std::pair<row_t, col_t>;
+  using rest_behavior_t = rest::behavior::Matrix;
+
+ private:
+  // The compacted cell. Only the existing cells are compacted, the deletion timestamps are kept in `erased_`.
+  struct Cell final {
+    std::chrono::microseconds last_modified;
+    T value;
+    Cell(std::chrono::microseconds last_modified, T&& value)
+        : last_modified(last_modified), value(std::move(value)) {}
+  };
+
+  // The cell of the delta: updated, erased, or, if a rollback has undone its very creation, forgotten.
+  enum class DeltaState : uint8_t { Updated, Erased, Forgotten };
+  struct DeltaCell final {
+    DeltaState state = DeltaState::Forgotten;
+    std::chrono::microseconds last_modified = std::chrono::microseconds(0);
+    T value;
+    uint64_t version = 0u;  // Of the last mutation, to tell whether the compaction in progress reflects it.
+  };
+
+  using delta_row_t = Ordered<col_t, DeltaCell>;
+  using delta_col_t = Ordered<row_t, const DeltaCell*>;
+  using delta_t = Ordered<row_t, delta_row_t>;
+  using delta_transposed_t = Ordered<col_t, delta_col_t>;
+
+  // The first compacted cell of each row, and the first element of `transposed_` of each col.
+  template <typename KEY>
+  using index_t = std::vector<std::pair<KEY, size_t>>;
+
+  // The delta is merged into the compacted cells once it has grown over `1 / kDeltaFraction` of them.
+  enum { kMinDeltaSize = 1024, kDeltaFraction = 8 };
+
+  // The delta of a line with no mutations.
+  template <typename DELTA_LINE>
+  static const DELTA_LINE& EmptyLine() {
+    static const DELTA_LINE empty_line;
+    return empty_line;
+  }
+
+  static const DeltaCell& Deref(const DeltaCell& cell) { return cell; }
+  static const DeltaCell& Deref(const DeltaCell* cell) { return *cell; }
+
+ public:
+  // A single row or col, with the delta merged into the compacted cells on the fly.
+  template <bool TRANSPOSED, typename OUTER_KEY, typename INNER_KEY, typename DELTA_LINE>
+  class Line final {
+   public:
+    class Iterator final {
+     public:
+      Iterator() = default;
+      Iterator(const Line& line, size_t base, typename DELTA_LINE::const_iterator delta)
+          : matrix_(line.matrix_),
+            base_(base),
+            base_end_(line.base_end_),
+            delta_(std::move(delta)),
+            delta_end_(line.delta_->cend()) {
+        Skip();
+      }
+      void operator++() {
+        if (from_delta_) {
+          ++delta_;
+          if (shadows_base_) {
+            ++base_;
+          }
+        } else {
+          ++base_;
+        }
+        Skip();
+      }
+      bool operator==(const Iterator& rhs) const { return base_ == rhs.base_ && delta_ == rhs.delta_; }
+      bool operator!=(const Iterator& rhs) const { return !operator==(rhs); }
+      // By value, as the key of the compacted cell is extracted from it.
+      INNER_KEY key() const { return from_delta_ ? delta_->first : InnerKey(BaseValue()); }
+      const T& operator*() const { return from_delta_ ? Deref(delta_->second).value : BaseValue(); }
+      const T* operator->() const { return &operator*(); }
+
+     private:
+      const T& BaseValue() const { return matrix_->template BaseCell<TRANSPOSED>(base_).value; }
+      static INNER_KEY InnerKey(const T& value) {
+        return CompactManyToMany::InnerKey(value, std::integral_constant<bool, TRANSPOSED>());
+      }
+
+      // Moves to the next existing cell: the compacted one, unless it is shadowed by the delta.
+      void Skip() {
+        from_delta_ = false;
+        shadows_base_ = false;
+        while (delta_ != delta_end_) {
+          const bool has_base = base_ != base_end_;
+          if (has_base && KeyLess(InnerKey(BaseValue()), delta_->first)) {
+            return;
+          }
+          shadows_base_ = has_base && !KeyLess(delta_->first, InnerKey(BaseValue()));
+          if (Deref(delta_->second).state == DeltaState::Updated) {
+            from_delta_ = true;
+            return;
+          }
+          ++delta_;
+          if (shadows_base_) {
+            ++base_;
+          }
+        }
+        shadows_base_ = false;
+      }
+
+      const CompactManyToMany* matrix_ = nullptr;
+      size_t base_ = 0u;
+      size_t base_end_ = 0u;
+      typename DELTA_LINE::const_iterator delta_;
+      typename DELTA_LINE::const_iterator delta_end_;
+      bool from_delta_ = false;
+      bool shadows_base_ = false;
+    };
+
+    Line() = default;
+    Line(const CompactManyToMany* matrix,
+         sfinae::CF<OUTER_KEY> key,
+         size_t base_begin,
+         size_t base_end,
+         const DELTA_LINE* delta)
+        : matrix_(matrix), key_(key), base_begin_(base_begin), base_end_(base_end), delta_(delta) {}
+
+    sfinae::CF<OUTER_KEY> key() const { return key_; }
+
+    bool Empty() const { return begin() == end(); }
+
+    // Linear in the length of the line.
+    size_t Size() const {
+      size_t size = 0u;
+      for (auto it = begin(); it != end(); ++it) {
+        ++size;
+      }
+      return size;
+    }
+
+    bool Has(sfinae::CF<INNER_KEY> inner_key) const {
+      const auto key = MakeKey(key_, inner_key, std::integral_constant<bool, TRANSPOSED>());
+      return matrix_->FindValue(key) != nullptr;
+    }
+
+    Iterator begin() const { return Iterator(*this, base_begin_, delta_->cbegin()); }
+    Iterator end() const { return Iterator(*this, base_end_, delta_->cend()); }
+
+    // The first cell with the inner key greater than `inner_key`, which does not have to be in the line.
+    Iterator UpperBound(sfinae::CF<INNER_KEY> inner_key) const {
+      size_t base = base_begin_;
+      size_t count = base_end_ - base_begin_;
+      while (count) {
+        const size_t step = count / 2u;
+        const T& value = matrix_->template BaseCell<TRANSPOSED>(base + step).value;
+        if (!KeyLess(inner_key, InnerKey(value, std::integral_constant<bool, TRANSPOSED>()))) {
+          base += step + 1u;
+          count -= step + 1u;
+        } else {
+          count = step;
+        }
+      }
+      return Iterator(*this, base, delta_->upper_bound(inner_key));
+    }
+
+   private:
+    const CompactManyToMany* matrix_ = nullptr;
+    OUTER_KEY key_;
+    size_t base_begin_ = 0u;
+    size_t base_end_ = 0u;
+    const DELTA_LINE* delta_ = nullptr;
+  };
+
+  using row_line_t = Line<false, row_t, col_t, delta_row_t>;
+  using col_line_t = Line<true, col_t, row_t, delta_col_t>;
+
+  // All the non-empty rows or cols.
+  template <typename LINE, typename OUTER_KEY, typename DELTA_LINES>
+  class Lines final {
+   public:
+    class Iterator final {
+     public:
+      Iterator() = default;
+      Iterator(const Lines& lines, size_t base, typename DELTA_LINES::const_iterator delta)
+          : matrix_(lines.matrix_),
+            index_(lines.index_),
+            delta_lines_(lines.delta_),
+            base_(base),
+            delta_(std::move(delta)) {
+        Skip();
+      }
+      void operator++() {
+        Advance();
+        Skip();
+      }
+      bool operator==(const Iterator& rhs) const { return base_ == rhs.base_ && delta_ == rhs.delta_; }
+      bool operator!=(const Iterator& rhs) const { return !operator==(rhs); }
+      sfinae::CF<OUTER_KEY> key() const { return line_.key(); }
+      const LINE& operator*() const { return line_; }
+      const LINE* operator->() const { return &line_; }
+
+     private:
+      void Advance() {
+        if (from_base_) {
+          ++base_;
+        }
+        if (from_delta_) {
+          ++delta_;
+        }
+      }
+
+      // Moves to the next line with at least one existing cell.
+      void Skip() {
+        const auto& index = *index_;
+        while (true) {
+          const bool has_base = base_ != index.size();
+          const bool has_delta = delta_ != delta_lines_->cend();
+          if (!has_base && !has_delta) {
+            from_base_ = from_delta_ = false;
+            return;
+          }
+          from_base_ = has_base && (!has_delta || !KeyLess(delta_->first, index[base_].first));
+          from_delta_ = has_delta && (!has_base || !KeyLess(index[base_].first, delta_->first));
+          line_ = LINE(matrix_,
+                       from_base_ ? index[base_].first : delta_->first,
+                       from_base_ ? index[base_].second : 0u,
+                       from_base_ ? matrix_->LineEnd(index, base_) : 0u,
+                       from_delta_ ? &delta_->second : &EmptyLine<typename DELTA_LINES::mapped_type>());
+          if (!line_.Empty()) {
+            return;
+          }
+          Advance();
+        }
+      }
+
+      const CompactManyToMany* matrix_ = nullptr;
+      const index_t<OUTER_KEY>* index_ = nullptr;
+      const DELTA_LINES* delta_lines_ = nullptr;
+      size_t base_ = 0u;
+      typename DELTA_LINES::const_iterator delta_;
+      bool from_base_ = false;
+      bool from_delta_ = false;
+      LINE line_;
+    };
+
+    Lines(const CompactManyToMany* matrix, const index_t<OUTER_KEY>* index, const DELTA_LINES* delta)
+        : matrix_(matrix), index_(index), delta_(delta) {}
+
+    bool Empty() const { return begin() == end(); }
+
+    // Linear in the number of lines.
+    size_t Size() const {
+      size_t size = 0u;
+      for (auto it = begin(); it != end(); ++it) {
+        ++size;
+      }
+      return size;
+    }
+
+    bool Has(sfinae::CF<OUTER_KEY> key) const { return !matrix_->MakeLine(*index_, *delta_, key).Empty(); }
+
+    ImmutableOptional<LINE> operator[](sfinae::CF<OUTER_KEY> key) const {
+      auto line = std::make_unique<LINE>(matrix_->MakeLine(*index_, *delta_, key));
+      if (!line->Empty()) {
+        return std::move(line);
+      } else {
+        return nullptr;
+      }
+    }
+
+    Iterator begin() const { return Iterator(*this, 0u, delta_->cbegin()); }
+    Iterator end() const { return Iterator(*this, index_->size(), delta_->cend()); }
+
+    // The first non-empty line with the key not less than `key`, which does not have to be there.
+    Iterator LowerBound(sfinae::CF<OUTER_KEY> key) const {
+      const auto it = std::lower_bound(index_->begin(),
+                                       index_->end(),
+                                       key,
+                                       [](const std::pair<OUTER_KEY, size_t>& lhs, const OUTER_KEY& rhs) {
+                                         return KeyLess(lhs.first, rhs);
+                                       });
+      return Iterator(*this, static_cast<size_t>(it - index_->begin()), delta_->lower_bound(key));
+    }
+
+   private:
+    const CompactManyToMany* matrix_;
+    const index_t<OUTER_KEY>* index_;
+    const DELTA_LINES* delta_;
+  };
+
+  using rows_t = Lines<row_line_t, row_t, delta_t>;
+  using cols_t = Lines<col_line_t, col_t, delta_transposed_t>;
+
+  // For REST, iterate over all the elements, row by row.
+  class Iterator final {
+   public:
+    Iterator(typename rows_t::Iterator row, typename rows_t::Iterator row_end)
+        : row_(std::move(row)), row_end_(std::move(row_end)) {
+      if (row_ != row_end_) {
+        cell_ = row_->begin();
+      }
+    }
+    Iterator(typename rows_t::Iterator row,
+             typename rows_t::Iterator row_end,
+             typename row_line_t::Iterator cell)
+        : row_(std::move(row)), row_end_(std::move(row_end)), cell_(std::move(cell)) {}
+    void operator++() {
+      ++cell_;
+      if (cell_ == row_->end()) {
+        ++row_;
+        if (row_ != row_end_) {
+          cell_ = row_->begin();
+        }
+      }
+    }
+    bool operator==(const Iterator& rhs) const {
+      return row_ == rhs.row_ && (row_ == row_end_ || cell_ == rhs.cell_);
+    }
+    bool operator!=(const Iterator& rhs) const { return !operator==(rhs); }
+    const T& operator*() const { return *cell_; }
+    const T* operator->() const { return &*cell_; }
+
+   private:
+    typename rows_t::Iterator row_;
+    typename rows_t::Iterator row_end_;
+    typename row_line_t::Iterator cell_;
+  };
+  using iterator_t = Iterator;
+
+  CompactManyToMany(MutationJournal& journal) : journal_(journal) {}
+  ~CompactManyToMany() {
+    if (compaction_) {
+      compaction_->thread.join();
+    }
+  }
+
+  bool Empty() const { return size_ == 0u; }
+  size_t Size() const { return size_; }
+
+  void Add(const T& object) {
+    const auto now = current::time::Now();
+    const auto key = std::make_pair(sfinae::GetRow(object), sfinae::GetCol(object));
+    const auto last_modified = LastModified(key);
+    if (FindValue(key)) {
+      const auto previous_timestamp = Value(last_modified);
+      journal_.LogMutation(UPDATE_EVENT(now, object),
+                           TakePreviousValue(key),
+                           [this, key, previous_timestamp](T&& previous_object) {
+                             DoUpdate(key, previous_timestamp, std::move(previous_object));
+                           });
+    } else if (Exists(last_modified)) {
+      const auto previous_timestamp = Value(last_modified);
+      journal_.LogMutation(
+          UPDATE_EVENT(now, object),
+          [this, key, previous_timestamp]() { DoErase(key, previous_timestamp, DeltaState::Erased); });
+    } else {
+      journal_.LogMutation(UPDATE_EVENT(now, object), [this, key]() {
+        DoErase(key, std::chrono::microseconds(0), DeltaState::Forgotten);
+      });
+    }
+    DoUpdate(key, now, object);
+    CompactAfterTransaction();
+  }
+
+  // Here and below pass the key by a const reference, as `key_t` is an `std::pair<row_t, col_t>`.
+  void Erase(const key_t& key) {
+    const auto now = current::time::Now();
+    const T* previous_object = FindValue(key);
+    if (previous_object) {
+      const auto previous_timestamp = Value(LastModified(key));
+      DELETE_EVENT event(now, *previous_object);
+      journal_.LogMutation(std::move(event),
+                           TakePreviousValue(key),
+                           [this, key, previous_timestamp](T&& previous_object) {
+                             DoUpdate(key, previous_timestamp, std::move(previous_object));
+                           });
+      DoErase(key, now, DeltaState::Erased);
+      CompactAfterTransaction();
+    }
+  }
+  void Erase(sfinae::CF<row_t> row, sfinae::CF<col_t> col) { Erase(std::make_pair(row, col)); }
+
+  ImmutableOptional<T> operator[](const key_t& key) const {
+    const T* value = FindValue(key);
+    if (value) {
+      return ImmutableOptional<T>(FromBarePointer(), value);
+    } else {
+      return nullptr;
+    }
+  }
+  ImmutableOptional<T> Get(sfinae::CF<row_t> row, sfinae::CF<col_t> col) const {
+    return operator[](std::make_pair(row, col));
+  }
+
+  ImmutableOptional<std::chrono::microseconds> LastModified(const key_t& key) const {
+    const DeltaCell* delta = FindDelta(key);
+    if (delta) {
+      if (delta->state != DeltaState::Forgotten) {
+        return delta->last_modified;
+      } else {
+        return nullptr;
+      }
+    }
+    const Cell* cell = FindBase(key);
+    if (cell) {
+      return cell->last_modified;
+    }
+    const auto cit = erased_.find(key);
+    if (cit != erased_.end()) {
+      return cit->second;
+    } else {
+      return nullptr;
+    }
+  }
+  ImmutableOptional<std::chrono::microseconds> LastModified(sfinae::CF<row_t> row,
+                                                            sfinae::CF<col_t> col) const {
+    return LastModified(std::make_pair(row, col));
+  }
+
+  // Calls `f` with the events which recreate the contents of this container, deletion timestamps included,
+  // if applied to an empty one. Used to save storage checkpoints.
+  template <typename F>
+  void ExportCheckpointEvents(F&& f) const {
+    for (const auto& element : *this) {
+      const auto key = std::make_pair(sfinae::GetRow(element), sfinae::GetCol(element));
+      f(UPDATE_EVENT(Value(LastModified(key)), element));
+    }
+    const auto export_erased = [&f](const key_t& key, std::chrono::microseconds us) {
+      DELETE_EVENT event;
+      event.us = us;
+      event.key = key;
+      f(event);
+    };
+    for (const auto& row : delta_) {
+      for (const auto& cell : row.second) {
+        if (cell.second.state == DeltaState::Erased) {
+          export_erased(std::make_pair(row.first, cell.first), cell.second.last_modified);
+        }
+      }
+    }
+    for (const auto& erased : erased_) {
+      if (!FindDelta(erased.first)) {
+        export_erased(erased.first, erased.second);
+      }
+    }
+  }
+
+  // The events are applied outside the user transactions, with no iterators to keep valid.
+  void operator()(const UPDATE_EVENT& e) {
+    DoUpdate(std::make_pair(sfinae::GetRow(e.data), sfinae::GetCol(e.data)), e.us, e.data);
+    MaybeCompact();
+  }
+  void operator()(const DELETE_EVENT& e) {
+    DoErase(std::make_pair(e.key.first, e.key.second), e.us, DeltaState::Erased);
+    MaybeCompact();
+  }
+
+  rows_t Rows() const { return rows_t(this, &row_index_, &delta_); }
+  cols_t Cols() const { return cols_t(this, &col_index_, &delta_transposed_); }
+
+  row_line_t Row(sfinae::CF<row_t> row) const { return MakeLine(row_index_, delta_, row); }
+  col_line_t Col(sfinae::CF<col_t> col) const { return MakeLine(col_index_, delta_transposed_, col); }
+
+  iterator_t begin() const {
+    const rows_t rows = Rows();
+    return iterator_t(rows.begin(), rows.end());
+  }
+  iterator_t end() const {
+    const rows_t rows = Rows();
+    return iterator_t(rows.end(), rows.end());
+  }
+
+  // For REST pagination, the iterator to the element following the one with the key `key`. The elements are
+  // ordered by `(row, col)`, so the key does not have to be there.
+  Optional<iterator_t> After(const key_t& key) const {
+    const rows_t rows = Rows();
+    auto row = rows.LowerBound(key.first);
+    if (row != rows.end() && !KeyLess(key.first, row.key())) {
+      auto cell = row->UpperBound(key.second);
+      if (cell != row->end()) {
+        return iterator_t(std::move(row), rows.end(), std::move(cell));
+      }
+      ++row;
+    }
+    return iterator_t(std::move(row), rows.end());
+  }
+
+ private:
+  template <typename KEY>
+  static bool KeyLess(const KEY& lhs, const KEY& rhs) {
+    return CurrentComparator<KEY>()(lhs, rhs);
+  }
+
+  static row_t InnerKey(const T& value, std::true_type) { return sfinae::GetRow(value); }
+  static col_t InnerKey(const T& value, std::false_type) { return sfinae::GetCol(value); }
+
+  static key_t MakeKey(sfinae::CF<row_t> row, sfinae::CF<col_t> col, std::false_type) {
+    return std::make_pair(row, col);
+  }
+  static key_t MakeKey(sfinae::CF<col_t> col, sfinae::CF<row_t> row, std::true_type) {
+    return std::make_pair(row, col);
+  }
+
+  template <bool TRANSPOSED>
+  const Cell& BaseCell(size_t i) const {
+    return TRANSPOSED ? cells_[transposed_[i]] : cells_[i];
+  }
+
+  template <typename KEY>
+  size_t LineEnd(const index_t<KEY>& index, size_t i) const {
+    return i + 1u < index.size() ? index[i + 1u].second : cells_.size();
+  }
+
+  template <typename DELTA_LINES>
+  using line_t =
+      typename std::conditional<std::is_same<DELTA_LINES, delta_t>::value, row_line_t, col_line_t>::type;
+
+  template <typename KEY, typename DELTA_LINES>
+  line_t<DELTA_LINES> MakeLine(const index_t<KEY>& index, const DELTA_LINES& delta, sfinae::CF<KEY> key) const {
+    const auto it = std::lower_bound(index.begin(),
+                                     index.end(),
+                                     key,
+                                     [](const std::pair<KEY, size_t>& lhs, const KEY& rhs) {
+                                       return KeyLess(lhs.first, rhs);
+                                     });
+    const bool in_base = it != index.end() && !KeyLess(key, it->first);
+    const auto delta_cit = delta.find(key);
+    return line_t<DELTA_LINES>(
+        this,
+        key,
+        in_base ? it->second : 0u,
+        in_base ? LineEnd(index, it - index.begin()) : 0u,
+        delta_cit != delta.end() ? &delta_cit->second
+                                 : &EmptyLine<typename DELTA_LINES::mapped_type>());
+  }
+
+  const DeltaCell* FindDelta(const key_t& key) const {
+    const auto row_cit = delta_.find(key.first);
+    if (row_cit != delta_.end()) {
+      const auto cell_cit = row_cit->second.find(key.second);
+      if (cell_cit != row_cit->second.end()) {
+        return &cell_cit->second;
+      }
+    }
+    return nullptr;
+  }
+
+  const Cell* FindBase(const key_t& key) const {
+    const auto row_it = std::lower_bound(row_index_.begin(),
+                                         row_index_.end(),
+                                         key.first,
+                                         [](const std::pair<row_t, size_t>& lhs, const row_t& rhs) {
+                                           return KeyLess(lhs.first, rhs);
+                                         });
+    if (row_it == row_index_.end() || KeyLess(key.first, row_it->first)) {
+      return nullptr;
+    }
+    const auto begin = cells_.begin() + row_it->second;
+    const auto end = cells_.begin() + LineEnd(row_index_, row_it - row_index_.begin());
+    const auto cell_it = std::lower_bound(begin, end, key.second, [](const Cell& lhs, const col_t& rhs) {
+      return KeyLess<col_t>(sfinae::GetCol(lhs.value), rhs);
+    });
+    if (cell_it == end || KeyLess<col_t>(key.second, sfinae::GetCol(cell_it->value))) {
+      return nullptr;
+    }
+    return &*cell_it;
+  }
+
+  // The delta shadows the compacted cells.
+  const T* FindValue(const key_t& key) const {
+    const DeltaCell* delta = FindDelta(key);
+    if (delta) {
+      return delta->state == DeltaState::Updated ? &delta->value : nullptr;
+    }
+    const Cell* cell = FindBase(key);
+    return cell ? &cell->value : nullptr;
+  }
+
+  // The value about to be overwritten, for the journal. The compacted cells are looked up by the keys within
+  // their values, so they are copied, while the delta cells, keyed by their maps, are moved from.
+  T TakePreviousValue(const key_t& key) {
+    DeltaCell* delta = const_cast<DeltaCell*>(FindDelta(key));
+    if (delta) {
+      return std::move(delta->value);
+    } else {
+      return FindBase(key)->value;
+    }
+  }
+
+  DeltaCell& MutableDeltaCell(const key_t& key) {
+    auto& row = delta_[key.first];
+    const auto it = row.find(key.second);
+    if (it != row.end()) {
+      return it->second;
+    }
+    DeltaCell& cell = row[key.second];
+    delta_transposed_[key.second][key.first] = &cell;
+    ++delta_size_;
+    return cell;
+  }
+
+  template <typename X>
+  void DoUpdate(const key_t& key, std::chrono::microseconds us, X&& object) {
+    if (!FindValue(key)) {
+      ++size_;
+    }
+    DeltaCell& cell = MutableDeltaCell(key);
+    cell.state = DeltaState::Updated;
+    cell.last_modified = us;
+    cell.value = std::forward<X>(object);
+    cell.version = ++delta_version_;
+  }
+
+  void DoErase(const key_t& key, std::chrono::microseconds us, DeltaState state) {
+    if (FindValue(key)) {
+      --size_;
+    }
+    DeltaCell& cell = MutableDeltaCell(key);
+    cell.state = state;
+    cell.last_modified = us;
+    cell.value = T();
+    cell.version = ++delta_version_;
+  }
+
+  // The result of merging the compacted cells with the snapshot of the delta, built by a background thread.
+  struct Compaction final {
+    std::vector<std::pair<key_t, DeltaCell>> delta;  // The snapshot, ordered by `(row, col)`.
+    uint64_t version;                                // The delta cells up to this version are in the snapshot.
+    std::vector<Cell> cells;
+    index_t<row_t> row_index;
+    std::vector<uint32_t> transposed;
+    index_t<col_t> col_index;
+    Unordered<key_t, std::chrono::microseconds> erased;
+    bool succeeded = false;
+    std::atomic_bool done{false};
+    std::thread thread;
+  };
+
+  void CompactAfterTransaction() {
+    if (!compaction_scheduled_) {
+      compaction_scheduled_ = true;
+      journal_.after_transaction.push_back([this]() {
+        compaction_scheduled_ = false;
+        MaybeCompact();
+      });
+    }
+  }
+
+  // Swaps in the completed compaction, and starts the next one if the delta has grown large enough.
+  // Must not be called while there are iterators or references to keep valid.
+  void MaybeCompact() {
+    if (compaction_ && compaction_->done) {
+      compaction_->thread.join();
+      if (compaction_->succeeded) {
+        ApplyCompaction(*compaction_);
+      }
+      compaction_ = nullptr;
+    }
+    if (!compaction_ && delta_size_ >= std::max<size_t>(kMinDeltaSize, cells_.size() / kDeltaFraction)) {
+      auto compaction = std::make_unique<Compaction>();
+      compaction->delta.reserve(delta_size_);
+      for (const auto& row : delta_) {
+        for (const auto& cell : row.second) {
+          compaction->delta.emplace_back(key_t(row.first, cell.first), cell.second);
+        }
+      }
+      compaction->version = delta_version_;
+      Compaction* raw_compaction = compaction.get();
+      compaction->thread = std::thread([this, raw_compaction]() {
+        try {
+          BuildCompaction(*raw_compaction);
+          raw_compaction->succeeded = true;
+        } catch (...) {  // The delta is kept as is, to be merged by the next compaction.
+        }
+        raw_compaction->done = true;
+      });
+      compaction_ = std::move(compaction);
+    }
+  }
+
+  // Merges the snapshot of the delta into a copy of the compacted cells, and builds the transposed view.
+  // Runs in a background thread. Only reads the compacted cells, which are not mutated until it completes.
+  void BuildCompaction(Compaction& result) const {
+    std::vector<Cell>& cells = result.cells;
+    result.erased = erased_;
+    size_t base_row = 0u;
+    auto delta = result.delta.begin();
+    const auto delta_end = result.delta.end();
+    while (base_row != row_index_.size() || delta != delta_end) {
+      const bool has_base = base_row != row_index_.size();
+      const bool has_delta = delta != delta_end;
+      const bool from_base =
+          has_base && (!has_delta || !KeyLess(delta->first.first, row_index_[base_row].first));
+      const bool from_delta =
+          has_delta && (!has_base || !KeyLess(row_index_[base_row].first, delta->first.first));
+      const row_t row = from_base ? row_index_[base_row].first : delta->first.first;
+      const size_t first_cell = cells.size();
+      size_t base = from_base ? row_index_[base_row].second : 0u;
+      const size_t base_end = from_base ? LineEnd(row_index_, base_row) : 0u;
+      if (from_delta) {
+        for (; delta != delta_end && !KeyLess(row, delta->first.first); ++delta) {
+          const col_t& col = delta->first.second;
+          while (base != base_end && KeyLess<col_t>(sfinae::GetCol(cells_[base].value), col)) {
+            const Cell& cell = cells_[base++];
+            cells.emplace_back(cell.last_modified, T(cell.value));
+          }
+          if (base != base_end && !KeyLess<col_t>(col, sfinae::GetCol(cells_[base].value))) {
+            ++base;  // Shadowed by the delta.
+          }
+          DeltaCell& cell = delta->second;
+          if (cell.state == DeltaState::Updated) {
+            cells.emplace_back(cell.last_modified, std::move(cell.value));
+            result.erased.erase(delta->first);
+          } else if (cell.state == DeltaState::Erased) {
+            result.erased[delta->first] = cell.last_modified;
+          } else {
+            result.erased.erase(delta->first);
+          }
+        }
+      }
+      while (base != base_end) {
+        const Cell& cell = cells_[base++];
+        cells.emplace_back(cell.last_modified, T(cell.value));
+      }
+      if (cells.size() != first_cell) {
+        result.row_index.emplace_back(row, first_cell);
+      }
+      if (from_base) {
+        ++base_row;
+      }
+    }
+    // The transposed view indexes the cells with 32 bits. The delta stays unmerged if there are more of them.
+    if (cells.size() > static_cast<size_t>(std::numeric_limits<uint32_t>::max())) {
+      CURRENT_THROW(StorageCompactMatrixOverflowException());
+    }
+    result.delta.clear();
+
+    // The cells are sorted by `(row, col)`, so the stable sort by `col` sorts them by `(col, row)`.
+    std::vector<uint32_t>& transposed = result.transposed;
+    transposed.resize(cells.size());
+    std::iota(transposed.begin(), transposed.end(), 0u);
+    std::stable_sort(transposed.begin(), transposed.end(), [&cells](uint32_t lhs, uint32_t rhs) {
+      return KeyLess<col_t>(sfinae::GetCol(cells[lhs].value), sfinae::GetCol(cells[rhs].value));
+    });
+    for (size_t i = 0u; i < transposed.size(); ++i) {
+      const auto col = sfinae::GetCol(cells[transposed[i]].value);
+      if (result.col_index.empty() || KeyLess(result.col_index.back().first, col)) {
+        result.col_index.emplace_back(col, i);
+      }
+    }
+  }
+
+  // Swaps in the compacted cells, and drops from the delta the cells which have not been mutated since
+  // the snapshot, as they are now reflected by the compacted cells.
+  void ApplyCompaction(Compaction& compaction) {
+    cells_.swap(compaction.cells);
+    row_index_.swap(compaction.row_index);
+    transposed_.swap(compaction.transposed);
+    col_index_.swap(compaction.col_index);
+    erased_.swap(compaction.erased);
+    for (auto row = delta_.begin(); row != delta_.end();) {
+      for (auto cell = row->second.begin(); cell != row->second.end();) {
+        if (cell->second.version <= compaction.version) {
+          const auto col = delta_transposed_.find(cell->first);
+          col->second.erase(row->first);
+          if (col->second.empty()) {
+            delta_transposed_.erase(col);
+          }
+          cell = row->second.erase(cell);
+          --delta_size_;
+        } else {
+          ++cell;
+        }
+      }
+      if (row->second.empty()) {
+        row = delta_.erase(row);
+      } else {
+        ++row;
+      }
+    }
+  }
+
+  std::vector<Cell> cells_;
+  index_t<row_t> row_index_;
+  std::vector<uint32_t> transposed_;
+  index_t<col_t> col_index_;
+  Unordered<key_t, std::chrono::microseconds> erased_;
+
+  delta_t delta_;
+  delta_transposed_t delta_transposed_;
+  size_t delta_size_ = 0u;
+  uint64_t delta_version_ = 0u;
+
+  std::unique_ptr<Compaction> compaction_;
+  bool compaction_scheduled_ = false;
+
+  size_t size_ = 0u;
+  MutationJournal& journal_;
+};
+
+}  // namespace container
+
+template <typename T, typename E1, typename E2>  // Entry, update event, delete event.
+struct StorageFieldTypeSelector<container::CompactManyToMany<T, E1, E2>> {
+  static const char* HumanReadableName() { return "CompactManyToMany"; }
+};
+
+}  // namespace storage
+}  // namespace current
+
+using current::storage::container::CompactManyToMany;
+
+#endif  // CURRENT_STORAGE_CONTAINER_COMPACT_MANY_TO_MANY_H
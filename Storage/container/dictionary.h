@@ -27,6 +27,7 @@ SOFTWARE.
 #define CURRENT_STORAGE_CONTAINER_DICTIONARY_H
 
 #include "common.h"
+#include "index.h"
 #include "sfinae.h"
 
 #include "../base.h"
@@ -37,141 +38,274 @@ namespace current {
 namespace storage {
 namespace container {
 
-template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, template <typename...> class MAP>
+template <typename T,
+          typename UPDATE_EVENT,
+          typename DELETE_EVENT,
+          template <typename...> class MAP,
+          typename INDEXES = index::Indexes<>>
 class GenericDictionary {
  public:
+  using entry_t = T;
   using key_t = sfinae::ENTRY_KEY_TYPE<T>;
-  using map_t = MAP<key_t, T>;
   using rest_behavior_t = rest::behavior::Dictionary;
+  using indexes_t = INDEXES;
+  template <typename INDEX>
+  using index_t = SecondaryIndex<T, key_t, MAP, INDEX>;
+
+  // The entry and the timestamp of its last modification share the same node, so that each mutation
+  // is one lookup. The deleted entries are kept as "tombstones", to keep their deletion timestamps.
+  struct Node final {
+    std::chrono::microseconds last_modified = std::chrono::microseconds(0);
+    bool exists = false;
+    T value;
+
+    Node() = default;
+    Node(std::chrono::microseconds last_modified, const T& value)
+        : last_modified(last_modified), exists(true), value(value) {}
+  };
+  using map_t = MAP<key_t, Node>;
 
   GenericDictionary(MutationJournal& journal) : journal_(journal) {}
 
-  bool Empty() const { return map_.empty(); }
-  size_t Size() const { return map_.size(); }
+  bool Empty() const { return size_ == 0u; }
+  size_t Size() const { return size_; }
 
+  // The returned entry refers into the dictionary. With the node-based maps it stays valid until its key is
+  // overwritten or erased. With the flat ones, `FlatUnorderedDictionary` and `FlatOrderedDictionary`, it is
+  // invalidated by any `Add()` of a new key, as that may move the entries, so, within a read-write transaction,
+  // copy it before adding. Within a read-only transaction it stays valid until the transaction ends.
   ImmutableOptional<T> operator[](sfinae::CF<key_t> key) const {
     const auto iterator = map_.find(key);
-    if (iterator != map_.end()) {
-      return ImmutableOptional<T>(FromBarePointer(), &iterator->second);
+    if (iterator != map_.end() && iterator->second.exists) {
+      return ImmutableOptional<T>(FromBarePointer(), &iterator->second.value);
     } else {
       return nullptr;
     }
   }
 
   ImmutableOptional<std::chrono::microseconds> LastModified(sfinae::CF<key_t> key) const {
-    const auto iterator = last_modified_.find(key);
-    if (iterator != last_modified_.end()) {
-      return ImmutableOptional<std::chrono::microseconds>(iterator->second);
+    const auto iterator = map_.find(key);
+    if (iterator != map_.end()) {
+      return ImmutableOptional<std::chrono::microseconds>(iterator->second.last_modified);
     } else {
       return nullptr;
     }
   }
 
+  // The accessor to the secondary index declared as `INDEX`, see `index.h`.
+  template <typename INDEX>
+  IndexAccessor<GenericDictionary, INDEX> Index() const {
+    return IndexAccessor<GenericDictionary, INDEX>(*this, indexes_.template Get<INDEX>());
+  }
+
   void Add(const T& object) {
     const auto now = current::time::Now();
     const auto key = sfinae::GetKey(object);
-    const auto map_iterator = map_.find(key);
-    const auto lm_iterator = last_modified_.find(key);
-    if (map_iterator != map_.end()) {
-      const T& previous_object = map_iterator->second;
-      assert(lm_iterator != last_modified_.end());
-      const auto previous_timestamp = lm_iterator->second;
-      journal_.LogMutation(UPDATE_EVENT(now, object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             last_modified_[key] = previous_timestamp;
-                             map_[key] = previous_object;
-                           });
+    indexes_.CheckNoConflict(key, object);
+    const auto iterator = map_.find(key);
+    if (iterator == map_.end()) {
+      journal_.LogMutation(UPDATE_EVENT(now, object), [this, key]() { DoForget(key); });
+      map_.emplace(key, Node(now, object));
+      ++size_;
+      indexes_.Insert(key, object);
     } else {
-      if (lm_iterator != last_modified_.end()) {
-        const auto previous_timestamp = lm_iterator->second;
+      Node& node = iterator->second;
+      const auto previous_timestamp = node.last_modified;
+      if (node.exists) {
+        Detach(key, node);
+        // The previous object is about to be overwritten, so it is moved into the journal, not copied.
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key, previous_timestamp]() {
-                               last_modified_[key] = previous_timestamp;
-                               map_.erase(key);
+                             std::move(node.value),
+                             [this, key, previous_timestamp](T&& previous_object) {
+                               DoUpdate(key, map_[key], previous_timestamp, std::move(previous_object));
                              });
       } else {
-        journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key]() {
-                               last_modified_.erase(key);
-                               map_.erase(key);
-                             });
+        journal_.LogMutation(
+            UPDATE_EVENT(now, object),
+            [this, key, previous_timestamp]() { DoErase(key, map_[key], previous_timestamp); });
       }
+      DoUpdate(key, node, now, object);
     }
-    last_modified_[key] = now;
-    map_[key] = object;
   }
 
   void Erase(sfinae::CF<key_t> key) {
     const auto now = current::time::Now();
-    const auto map_iterator = map_.find(key);
-    if (map_iterator != map_.end()) {
-      const T& previous_object = map_iterator->second;
-      const auto lm_iterator = last_modified_.find(key);
-      assert(lm_iterator != last_modified_.end());
-      const auto previous_timestamp = lm_iterator->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             last_modified_[key] = previous_timestamp;
-                             map_[key] = previous_object;
+    const auto iterator = map_.find(key);
+    if (iterator != map_.end() && iterator->second.exists) {
+      Node& node = iterator->second;
+      const auto previous_timestamp = node.last_modified;
+      Detach(key, node);
+      journal_.LogMutation(DELETE_EVENT(now, node.value),
+                           std::move(node.value),
+                           [this, key, previous_timestamp](T&& previous_object) {
+                             DoUpdate(key, map_[key], previous_timestamp, std::move(previous_object));
                            });
-      last_modified_[key] = now;
-      map_.erase(key);
+      DoErase(key, node, now);
+    }
+  }
+
+  // Calls `f` with the events which recreate the contents of this container, deletion timestamps included,
+  // if applied to an empty one. Used to save storage checkpoints.
+  template <typename F>
+  void ExportCheckpointEvents(F&& f) const {
+    for (const auto& element : map_) {
+      if (element.second.exists) {
+        f(UPDATE_EVENT(element.second.last_modified, element.second.value));
+      } else {
+        DELETE_EVENT event;
+        event.us = element.second.last_modified;
+        event.key = element.first;
+        f(event);
+      }
     }
   }
 
   void operator()(const UPDATE_EVENT& e) {
     const auto key = sfinae::GetKey(e.data);
-    last_modified_[key] = e.us;
-    map_[key] = e.data;
-  }
-  void operator()(const DELETE_EVENT& e) {
-    last_modified_[e.key] = e.us;
-    map_.erase(e.key);
+    DoUpdate(key, map_[key], e.us, e.data);
   }
+  void operator()(const DELETE_EVENT& e) { DoErase(e.key, map_[e.key], e.us); }
 
+  // Iterates over the entries which exist, skipping the tombstones.
   struct Iterator final {
     using iterator_t = typename map_t::const_iterator;
     iterator_t iterator;
-    explicit Iterator(iterator_t iterator) : iterator(std::move(iterator)) {}
-    void operator++() { ++iterator; }
+    iterator_t end;
+    Iterator(iterator_t iterator, iterator_t end) : iterator(std::move(iterator)), end(std::move(end)) {
+      SkipTombstones();
+    }
+    void operator++() {
+      ++iterator;
+      SkipTombstones();
+    }
     bool operator==(const Iterator& rhs) const { return iterator == rhs.iterator; }
     bool operator!=(const Iterator& rhs) const { return !operator==(rhs); }
     sfinae::CF<key_t> key() const { return iterator->first; }
-    const T& operator*() const { return iterator->second; }
-    const T* operator->() const { return &iterator->second; }
+    const T& operator*() const { return iterator->second.value; }
+    const T* operator->() const { return &iterator->second.value; }
+
+   private:
+    void SkipTombstones() {
+      while (iterator != end && !iterator->second.exists) {
+        ++iterator;
+      }
+    }
   };
 
-  Iterator begin() const { return Iterator(map_.cbegin()); }
-  Iterator end() const { return Iterator(map_.cend()); }
+  Iterator begin() const { return Iterator(map_.cbegin(), map_.cend()); }
+  Iterator end() const { return Iterator(map_.cend(), map_.cend()); }
+
+  // The iterator to the entry following the one with the key `key`, for cursor-based pagination via REST.
+  // The erased entries are kept as tombstones, so the cursor remains valid after its entry is deleted.
+  // The ordered dictionaries resume from any key, as the entries are sorted. The unordered ones can only resume
+  // from the key which has been in the dictionary, and return `nullptr` for any other one.
+  Optional<Iterator> After(sfinae::CF<key_t> key) const {
+    const Optional<typename map_t::const_iterator> iterator = PositionAfter(map_, key, 0);
+    if (Exists(iterator)) {
+      return Iterator(Value(iterator), map_.cend());
+    } else {
+      return nullptr;
+    }
+  }
 
  private:
+  template <typename M>
+  static auto PositionAfter(const M& map, sfinae::CF<key_t> key, int)
+      -> decltype(map.upper_bound(key), Optional<typename M::const_iterator>()) {
+    return map.upper_bound(key);
+  }
+
+  template <typename M>
+  static Optional<typename M::const_iterator> PositionAfter(const M& map, sfinae::CF<key_t> key, char) {
+    auto iterator = map.find(key);
+    if (iterator != map.end()) {
+      return ++iterator;
+    } else {
+      return nullptr;
+    }
+  }
+
+  // Marks the entry as not existing, and removes it from the secondary indexes, keeping its value intact.
+  // Must be called before the value is moved away.
+  void Detach(sfinae::CF<key_t> key, Node& node) {
+    if (node.exists) {
+      indexes_.Erase(key, node.value);
+      node.exists = false;
+      --size_;
+    }
+  }
+
+  template <typename X>
+  void DoUpdate(sfinae::CF<key_t> key, Node& node, std::chrono::microseconds us, X&& object) {
+    Detach(key, node);
+    node.exists = true;
+    ++size_;
+    node.last_modified = us;
+    node.value = std::forward<X>(object);
+    indexes_.Insert(key, node.value);
+  }
+
+  void DoErase(sfinae::CF<key_t> key, Node& node, std::chrono::microseconds us) {
+    Detach(key, node);
+    node.value = T();
+    node.last_modified = us;
+  }
+
+  // Removes the node altogether, as if the key has never been there. Only used to roll back.
+  void DoForget(sfinae::CF<key_t> key) {
+    const auto iterator = map_.find(key);
+    if (iterator != map_.end()) {
+      Detach(key, iterator->second);
+      map_.erase(iterator);
+    }
+  }
+
   map_t map_;
-  std::unordered_map<key_t, std::chrono::microseconds, CurrentHashFunction<key_t>> last_modified_;
+  size_t size_ = 0u;
+  SecondaryIndexes<T, key_t, MAP, INDEXES> indexes_;
   MutationJournal& journal_;
 };
 
-template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT>
-using UnorderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Unordered>;
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = index::Indexes<>>
+using UnorderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Unordered, INDEXES>;
 
-template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT>
-using OrderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Ordered>;
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = index::Indexes<>>
+using OrderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Ordered, INDEXES>;
+
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = index::Indexes<>>
+using FlatUnorderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, FlatUnordered, INDEXES>;
+
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = index::Indexes<>>
+using FlatOrderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, FlatOrdered, INDEXES>;
 
 }  // namespace container
 
-template <typename T, typename E1, typename E2>  // Entry, update event, delete event.
-struct StorageFieldTypeSelector<container::UnorderedDictionary<T, E1, E2>> {
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::UnorderedDictionary<T, E1, E2, I>> {
   static const char* HumanReadableName() { return "UnorderedDictionary"; }
 };
 
-template <typename T, typename E1, typename E2>  // Entry, update event, delete event.
-struct StorageFieldTypeSelector<container::OrderedDictionary<T, E1, E2>> {
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::OrderedDictionary<T, E1, E2, I>> {
   static const char* HumanReadableName() { return "OrderedDictionary"; }
 };
 
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::FlatUnorderedDictionary<T, E1, E2, I>> {
+  static const char* HumanReadableName() { return "FlatUnorderedDictionary"; }
+};
+
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::FlatOrderedDictionary<T, E1, E2, I>> {
+  static const char* HumanReadableName() { return "FlatOrderedDictionary"; }
+};
+
 }  // namespace storage
 }  // namespace current
 
 using current::storage::container::UnorderedDictionary;
 using current::storage::container::OrderedDictionary;
+using current::storage::container::FlatUnorderedDictionary;
+using current::storage::container::FlatOrderedDictionary;
 
 #endif  // CURRENT_STORAGE_CONTAINER_DICTIONARY_H
@@ -0,0 +1,437 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Cache-friendly, "flat" maps to back the storage fields, as drop-in replacements for the node-based
+// `std::unordered_map` and `std::map` in the subset of their interface the containers use.
+//
+// * `FlatHashMap` is an open-addressing hash map with linear probing. All the elements are kept in one array
+//   of raw slots and constructed in place, so the empty slots hold no objects, and neither the key
+//   nor the value has to be default-constructible.
+// * `FlatOrderedMap` is a two-level B-tree: a sorted index of the first keys of the sorted "leaf" arrays,
+//   each holding up to `kMaxLeafSize` elements. Lookups are two binary searches over contiguous memory,
+//   and ordered scans walk the leaves sequentially.
+//
+// Unlike with the node-based maps, inserting into or erasing from a flat map invalidates the iterators
+// and the references to its elements. The storage only mutates its fields within read-write transactions,
+// so the references obtained within read-only transactions stay valid.
+
+#ifndef CURRENT_STORAGE_CONTAINER_FLAT_MAP_H
+#define CURRENT_STORAGE_CONTAINER_FLAT_MAP_H
+
+#include "../../port.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../../Bricks/util/comparators.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+template <typename KEY, typename VALUE, typename HASH = CurrentHashFunction<KEY>>
+class FlatHashMap final {
+ public:
+  using key_type = KEY;
+  using mapped_type = VALUE;
+  using value_type = std::pair<KEY, VALUE>;
+
+  // The maximum load factor is `kMaxLoadNumerator / kMaxLoadDenominator`.
+  enum { kMinCapacity = 16, kMaxLoadNumerator = 3, kMaxLoadDenominator = 4 };
+
+  template <typename MAP, typename VALUE_TYPE>
+  class IteratorImpl final {
+   public:
+    IteratorImpl(MAP* map, size_t index) : map_(map), index_(index) { SkipEmptySlots(); }
+    VALUE_TYPE& operator*() const { return map_->Slot(index_); }
+    VALUE_TYPE* operator->() const { return &map_->Slot(index_); }
+    IteratorImpl& operator++() {
+      ++index_;
+      SkipEmptySlots();
+      return *this;
+    }
+    bool operator==(const IteratorImpl& rhs) const { return index_ == rhs.index_; }
+    bool operator!=(const IteratorImpl& rhs) const { return index_ != rhs.index_; }
+
+   private:
+    friend class FlatHashMap;
+    void SkipEmptySlots() {
+      while (index_ < map_->occupied_.size() && !map_->occupied_[index_]) {
+        ++index_;
+      }
+    }
+    MAP* map_;
+    size_t index_;
+  };
+  using iterator = IteratorImpl<FlatHashMap, value_type>;
+  using const_iterator = IteratorImpl<const FlatHashMap, const value_type>;
+
+  FlatHashMap() = default;
+  FlatHashMap(const FlatHashMap& rhs) : slots_(new slot_t[rhs.occupied_.size()]), occupied_(rhs.occupied_) {
+    for (size_t i = 0u; i < occupied_.size(); ++i) {
+      if (occupied_[i]) {
+        new (&slots_[i]) value_type(rhs.Slot(i));
+      }
+    }
+    size_ = rhs.size_;
+  }
+  FlatHashMap(FlatHashMap&& rhs) { swap(rhs); }
+  FlatHashMap& operator=(FlatHashMap rhs) {
+    swap(rhs);
+    return *this;
+  }
+  ~FlatHashMap() { DestroySlots(); }
+
+  void swap(FlatHashMap& rhs) {
+    std::swap(slots_, rhs.slots_);
+    std::swap(occupied_, rhs.occupied_);
+    std::swap(size_, rhs.size_);
+  }
+
+  bool empty() const { return size_ == 0u; }
+  size_t size() const { return size_; }
+
+  iterator begin() { return iterator(this, 0u); }
+  iterator end() { return iterator(this, occupied_.size()); }
+  const_iterator begin() const { return cbegin(); }
+  const_iterator end() const { return cend(); }
+  const_iterator cbegin() const { return const_iterator(this, 0u); }
+  const_iterator cend() const { return const_iterator(this, occupied_.size()); }
+
+  iterator find(const KEY& key) { return iterator(this, FindIndex(key)); }
+  const_iterator find(const KEY& key) const { return const_iterator(this, FindIndex(key)); }
+
+  template <typename K, typename V>
+  std::pair<iterator, bool> emplace(K&& key, V&& value) {
+    const size_t existing = FindIndex(key);
+    if (existing != occupied_.size()) {
+      return std::make_pair(iterator(this, existing), false);
+    }
+    GrowIfNeeded();
+    const size_t index = InsertNew(value_type(std::forward<K>(key), std::forward<V>(value)));
+    return std::make_pair(iterator(this, index), true);
+  }
+
+  VALUE& operator[](const KEY& key) { return emplace(key, VALUE()).first->second; }
+
+  void erase(const_iterator iterator) { EraseIndex(iterator.index_); }
+  void erase(iterator iterator) { EraseIndex(iterator.index_); }
+  size_t erase(const KEY& key) {
+    const size_t index = FindIndex(key);
+    if (index != occupied_.size()) {
+      EraseIndex(index);
+      return 1u;
+    } else {
+      return 0u;
+    }
+  }
+
+  void clear() {
+    DestroySlots();
+    slots_.reset();
+    occupied_.clear();
+    size_ = 0u;
+  }
+
+ private:
+  using slot_t = typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type;
+
+  value_type& Slot(size_t index) { return *reinterpret_cast<value_type*>(&slots_[index]); }
+  const value_type& Slot(size_t index) const { return *reinterpret_cast<const value_type*>(&slots_[index]); }
+
+  void DestroySlots() {
+    for (size_t i = 0u; i < occupied_.size(); ++i) {
+      if (occupied_[i]) {
+        Slot(i).~value_type();
+      }
+    }
+  }
+
+  // Spreads the bits of the hash, as `std::hash<>` of integers is the identity function.
+  static size_t Mix(size_t hash) {
+    uint64_t x = static_cast<uint64_t>(hash);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+  }
+
+  size_t IdealIndex(const KEY& key) const { return Mix(HASH()(key)) & (occupied_.size() - 1u); }
+
+  // Returns `occupied_.size()` if not found.
+  size_t FindIndex(const KEY& key) const {
+    if (!size_) {
+      return occupied_.size();
+    }
+    const size_t mask = occupied_.size() - 1u;
+    for (size_t index = IdealIndex(key); occupied_[index]; index = (index + 1u) & mask) {
+      if (Slot(index).first == key) {
+        return index;
+      }
+    }
+    return occupied_.size();
+  }
+
+  // Requires the key not to be present, and the capacity to be sufficient.
+  size_t InsertNew(value_type&& element) {
+    const size_t mask = occupied_.size() - 1u;
+    size_t index = IdealIndex(element.first);
+    while (occupied_[index]) {
+      index = (index + 1u) & mask;
+    }
+    new (&slots_[index]) value_type(std::move(element));
+    occupied_[index] = 1u;
+    ++size_;
+    return index;
+  }
+
+  void GrowIfNeeded() {
+    if ((size_ + 1u) * kMaxLoadDenominator > occupied_.size() * kMaxLoadNumerator) {
+      const size_t capacity = occupied_.empty() ? static_cast<size_t>(kMinCapacity) : occupied_.size() * 2u;
+      std::unique_ptr<slot_t[]> slots(new slot_t[capacity]);
+      std::vector<uint8_t> occupied(capacity, 0u);
+      slots.swap(slots_);
+      occupied.swap(occupied_);
+      size_ = 0u;
+      for (size_t i = 0u; i < occupied.size(); ++i) {
+        if (occupied[i]) {
+          value_type& element = *reinterpret_cast<value_type*>(&slots[i]);
+          InsertNew(std::move(element));
+          element.~value_type();
+        }
+      }
+    }
+  }
+
+  // Backward-shift deletion: moves the subsequent elements of the probe sequence into the freed slot,
+  // so that no "deleted" markers are needed.
+  void EraseIndex(size_t index) {
+    Slot(index).~value_type();
+    const size_t mask = occupied_.size() - 1u;
+    size_t next = index;
+    while (true) {
+      next = (next + 1u) & mask;
+      if (!occupied_[next]) {
+        break;
+      }
+      const size_t ideal = IdealIndex(Slot(next).first);
+      // The element at `next` can be moved into `index` if its ideal slot is not within `(index, next]`.
+      const bool stays = (index <= next) ? (index < ideal && ideal <= next) : (index < ideal || ideal <= next);
+      if (!stays) {
+        new (&slots_[index]) value_type(std::move(Slot(next)));
+        Slot(next).~value_type();
+        index = next;
+      }
+    }
+    occupied_[index] = 0u;
+    --size_;
+  }
+
+  // The element in the slot is only constructed if the slot is occupied.
+  std::unique_ptr<slot_t[]> slots_;
+  std::vector<uint8_t> occupied_;
+  size_t size_ = 0u;
+};
+
+template <typename KEY, typename VALUE, typename LESS = CurrentComparator<KEY>>
+class FlatOrderedMap final {
+ public:
+  using key_type = KEY;
+  using mapped_type = VALUE;
+  using value_type = std::pair<KEY, VALUE>;
+
+  // A full leaf is split in two halves.
+  enum { kMaxLeafSize = 256 };
+
+  template <typename MAP, typename VALUE_TYPE>
+  class IteratorImpl final {
+   public:
+    IteratorImpl(MAP* map, size_t leaf, size_t index) : map_(map), leaf_(leaf), index_(index) {}
+    VALUE_TYPE& operator*() const { return map_->leaves_[leaf_][index_]; }
+    VALUE_TYPE* operator->() const { return &map_->leaves_[leaf_][index_]; }
+    IteratorImpl& operator++() {
+      if (++index_ == map_->leaves_[leaf_].size()) {
+        ++leaf_;
+        index_ = 0u;
+      }
+      return *this;
+    }
+    bool operator==(const IteratorImpl& rhs) const { return leaf_ == rhs.leaf_ && index_ == rhs.index_; }
+    bool operator!=(const IteratorImpl& rhs) const { return !operator==(rhs); }
+
+   private:
+    friend class FlatOrderedMap;
+    MAP* map_;
+    size_t leaf_;
+    size_t index_;
+  };
+  using iterator = IteratorImpl<FlatOrderedMap, value_type>;
+  using const_iterator = IteratorImpl<const FlatOrderedMap, const value_type>;
+
+  bool empty() const { return size_ == 0u; }
+  size_t size() const { return size_; }
+
+  iterator begin() { return iterator(this, 0u, 0u); }
+  iterator end() { return iterator(this, leaves_.size(), 0u); }
+  const_iterator begin() const { return cbegin(); }
+  const_iterator end() const { return cend(); }
+  const_iterator cbegin() const { return const_iterator(this, 0u, 0u); }
+  const_iterator cend() const { return const_iterator(this, leaves_.size(), 0u); }
+
+  iterator find(const KEY& key) {
+    const std::pair<size_t, size_t> position = FindPosition(key);
+    return iterator(this, position.first, position.second);
+  }
+  const_iterator find(const KEY& key) const {
+    const std::pair<size_t, size_t> position = FindPosition(key);
+    return const_iterator(this, position.first, position.second);
+  }
+
+  // The first element with the key greater than `key`, which does not have to be in the map.
+  const_iterator upper_bound(const KEY& key) const {
+    if (leaves_.empty()) {
+      return cend();
+    }
+    const size_t leaf = LeafFor(key);
+    const std::vector<value_type>& elements = leaves_[leaf];
+    const size_t index = static_cast<size_t>(
+        std::upper_bound(elements.begin(),
+                         elements.end(),
+                         key,
+                         [](const KEY& key, const value_type& element) { return LESS()(key, element.first); }) -
+        elements.begin());
+    return index < elements.size() ? const_iterator(this, leaf, index) : const_iterator(this, leaf + 1u, 0u);
+  }
+
+  template <typename K, typename V>
+  std::pair<iterator, bool> emplace(K&& key, V&& value) {
+    if (leaves_.empty()) {
+      leaves_.emplace_back();
+      leaves_.back().reserve(kMaxLeafSize + 1u);
+      first_keys_.push_back(key);
+    }
+    size_t leaf = LeafFor(key);
+    size_t index = IndexInLeaf(leaf, key);
+    std::vector<value_type>& elements = leaves_[leaf];
+    if (index < elements.size() && !LESS()(key, elements[index].first)) {
+      return std::make_pair(iterator(this, leaf, index), false);
+    }
+    elements.insert(elements.begin() + index, value_type(std::forward<K>(key), std::forward<V>(value)));
+    if (index == 0u) {
+      first_keys_[leaf] = elements.front().first;
+    }
+    ++size_;
+    if (elements.size() > static_cast<size_t>(kMaxLeafSize)) {
+      const size_t half = elements.size() / 2u;
+      std::vector<value_type> upper;
+      upper.reserve(kMaxLeafSize + 1u);
+      std::move(elements.begin() + half, elements.end(), std::back_inserter(upper));
+      elements.erase(elements.begin() + half, elements.end());
+      first_keys_.insert(first_keys_.begin() + leaf + 1u, upper.front().first);
+      leaves_.insert(leaves_.begin() + leaf + 1u, std::move(upper));
+      if (index >= half) {
+        ++leaf;
+        index -= half;
+      }
+    }
+    return std::make_pair(iterator(this, leaf, index), true);
+  }
+
+  VALUE& operator[](const KEY& key) { return emplace(key, VALUE()).first->second; }
+
+  void erase(const_iterator iterator) { ErasePosition(iterator.leaf_, iterator.index_); }
+  void erase(iterator iterator) { ErasePosition(iterator.leaf_, iterator.index_); }
+  size_t erase(const KEY& key) {
+    const std::pair<size_t, size_t> position = FindPosition(key);
+    if (position.first != leaves_.size()) {
+      ErasePosition(position.first, position.second);
+      return 1u;
+    } else {
+      return 0u;
+    }
+  }
+
+  void clear() {
+    first_keys_.clear();
+    leaves_.clear();
+    size_ = 0u;
+  }
+
+ private:
+  // The leaf to look for, or to insert, `key` into: the last one with the first key not greater than `key`.
+  size_t LeafFor(const KEY& key) const {
+    const auto cit = std::upper_bound(first_keys_.begin(), first_keys_.end(), key, LESS());
+    return cit == first_keys_.begin() ? 0u : static_cast<size_t>(cit - first_keys_.begin()) - 1u;
+  }
+
+  size_t IndexInLeaf(size_t leaf, const KEY& key) const {
+    const std::vector<value_type>& elements = leaves_[leaf];
+    return static_cast<size_t>(
+        std::lower_bound(elements.begin(),
+                         elements.end(),
+                         key,
+                         [](const value_type& element, const KEY& key) { return LESS()(element.first, key); }) -
+        elements.begin());
+  }
+
+  // Returns `{leaves_.size(), 0}` if not found.
+  std::pair<size_t, size_t> FindPosition(const KEY& key) const {
+    if (!leaves_.empty()) {
+      const size_t leaf = LeafFor(key);
+      const size_t index = IndexInLeaf(leaf, key);
+      const std::vector<value_type>& elements = leaves_[leaf];
+      if (index < elements.size() && !LESS()(key, elements[index].first)) {
+        return std::make_pair(leaf, index);
+      }
+    }
+    return std::make_pair(leaves_.size(), static_cast<size_t>(0u));
+  }
+
+  void ErasePosition(size_t leaf, size_t index) {
+    std::vector<value_type>& elements = leaves_[leaf];
+    elements.erase(elements.begin() + index);
+    if (elements.empty()) {
+      first_keys_.erase(first_keys_.begin() + leaf);
+      leaves_.erase(leaves_.begin() + leaf);
+    } else if (index == 0u) {
+      first_keys_[leaf] = elements.front().first;
+    }
+    --size_;
+  }
+
+  std::vector<KEY> first_keys_;
+  std::vector<std::vector<value_type>> leaves_;
+  size_t size_ = 0u;
+};
+
+}  // namespace container
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_CONTAINER_FLAT_MAP_H
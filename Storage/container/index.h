@@ -0,0 +1,342 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+// Secondary indexes over the dictionaries: lookups of the entries by something other than their primary keys,
+// such as "the user by their email" or "all the orders of a customer".
+//
+// An index is declared as a type, with the `CURRENT_STORAGE_INDEX` and `CURRENT_STORAGE_FIELD_INDEX` macros:
+// * `Unique` or `NonUnique`, whether several entries may share the same value of the index key.
+// * `Ordered` or `Unordered`, the map to key the index by; the ordered ones can be iterated over in key order.
+// * The index key is either a field of the entry, or a function of the entry.
+//
+// The indexes are maintained by the dictionary itself, on `Add()`, `Erase()`, rollbacks, and replay.
+// Adding an entry which would violate a unique index throws `StorageUniqueIndexViolationException`,
+// which, as any other exception, rolls back the transaction.
+
+#ifndef CURRENT_STORAGE_CONTAINER_INDEX_H
+#define CURRENT_STORAGE_CONTAINER_INDEX_H
+
+#include "../../port.h"
+
+#include <string>
+#include <utility>
+
+#include "common.h"
+#include "sfinae.h"
+
+#include "../exceptions.h"
+
+#include "../../Bricks/template/decay.h"
+#include "../../TypeSystem/optional.h"
+
+namespace current {
+namespace storage {
+namespace index {
+
+template <template <typename...> class MAP, typename ENTRY, typename KEY>
+struct Unique {
+  using entry_t = ENTRY;
+  using index_key_t = KEY;
+  template <typename VALUE>
+  using map_t = MAP<KEY, VALUE>;
+  enum { unique = true };
+};
+
+template <template <typename...> class MAP, typename ENTRY, typename KEY>
+struct NonUnique {
+  using entry_t = ENTRY;
+  using index_key_t = KEY;
+  template <typename VALUE>
+  using map_t = MAP<KEY, VALUE>;
+  enum { unique = false };
+};
+
+// The list of the indexes of a storage field, see `CURRENT_STORAGE_FIELD_ENTRY_WITH_INDEXES`.
+template <typename... INDEXES>
+struct Indexes {};
+
+// `IndexesOf<FIELD>` is the `Indexes<...>` of the storage field, empty for the fields which can not have any.
+template <typename FIELD>
+struct IndexesOfImpl {
+  template <typename T>
+  static typename T::indexes_t Select(int);
+  template <typename T>
+  static Indexes<> Select(...);
+  using type = decltype(Select<FIELD>(0));
+};
+
+template <typename FIELD>
+using IndexesOf = typename IndexesOfImpl<FIELD>::type;
+
+}  // namespace current::storage::index
+
+namespace container {
+
+template <typename T,
+          typename KEY,
+          template <typename...> class PK_MAP,
+          typename INDEX,
+          bool UNIQUE = INDEX::unique>
+class SecondaryIndex;
+
+// Unique index: the index key maps into the primary key of the only entry with it.
+template <typename T, typename KEY, template <typename...> class PK_MAP, typename INDEX>
+class SecondaryIndex<T, KEY, PK_MAP, INDEX, true> {
+ public:
+  using index_key_t = typename INDEX::index_key_t;
+  using map_t = typename INDEX::template map_t<KEY>;
+
+  const KEY* Find(sfinae::CF<index_key_t> index_key) const {
+    const auto iterator = map_.find(index_key);
+    return iterator != map_.end() ? &iterator->second : nullptr;
+  }
+
+  const map_t& Map() const { return map_; }
+
+ protected:
+  void CheckNoConflict(sfinae::CF<KEY> key, const T& entry) const {
+    const auto iterator = map_.find(INDEX::Key(entry));
+    if (iterator != map_.end() && !(iterator->second == key)) {
+      CURRENT_THROW(StorageUniqueIndexViolationException(INDEX::Name()));
+    }
+  }
+  void Insert(sfinae::CF<KEY> key, const T& entry) { map_.emplace(INDEX::Key(entry), key); }
+  // The replayed stream may have been written without this index, and have several entries with the same index
+  // key, of which the index keeps the first one. Erasing any other one must keep it.
+  void Erase(sfinae::CF<KEY> key, const T& entry) {
+    const auto iterator = map_.find(INDEX::Key(entry));
+    if (iterator != map_.end() && iterator->second == key) {
+      map_.erase(iterator);
+    }
+  }
+
+ private:
+  map_t map_;
+};
+
+// Non-unique index: the index key maps into the set of the primary keys of the entries with it.
+// The set is keyed the same way the dictionary itself is, so that it works for any dictionary key type.
+template <typename T, typename KEY, template <typename...> class PK_MAP, typename INDEX>
+class SecondaryIndex<T, KEY, PK_MAP, INDEX, false> {
+ public:
+  using index_key_t = typename INDEX::index_key_t;
+  using keys_t = PK_MAP<KEY, bool>;
+  using map_t = typename INDEX::template map_t<keys_t>;
+
+  const keys_t* Find(sfinae::CF<index_key_t> index_key) const {
+    const auto iterator = map_.find(index_key);
+    return iterator != map_.end() ? &iterator->second : nullptr;
+  }
+
+  const map_t& Map() const { return map_; }
+
+ protected:
+  void CheckNoConflict(sfinae::CF<KEY>, const T&) const {}
+  void Insert(sfinae::CF<KEY> key, const T& entry) { map_[INDEX::Key(entry)].emplace(key, true); }
+  void Erase(sfinae::CF<KEY> key, const T& entry) {
+    const auto iterator = map_.find(INDEX::Key(entry));
+    if (iterator != map_.end()) {
+      iterator->second.erase(key);
+      if (iterator->second.empty()) {
+        map_.erase(iterator);
+      }
+    }
+  }
+
+ private:
+  map_t map_;
+};
+
+// All the indexes of a dictionary. Each index is a base class, to be accessed by the type of its declaration.
+template <typename T, typename KEY, template <typename...> class PK_MAP, typename INDEXES>
+class SecondaryIndexes;
+
+template <typename T, typename KEY, template <typename...> class PK_MAP>
+class SecondaryIndexes<T, KEY, PK_MAP, index::Indexes<>> {
+ public:
+  void CheckNoConflict(sfinae::CF<KEY>, const T&) const {}
+  void Insert(sfinae::CF<KEY>, const T&) {}
+  void Erase(sfinae::CF<KEY>, const T&) {}
+};
+
+template <typename T, typename KEY, template <typename...> class PK_MAP, typename INDEX, typename... INDEXES>
+class SecondaryIndexes<T, KEY, PK_MAP, index::Indexes<INDEX, INDEXES...>>
+    : public SecondaryIndex<T, KEY, PK_MAP, INDEX>,
+      public SecondaryIndexes<T, KEY, PK_MAP, index::Indexes<INDEXES...>> {
+ private:
+  using this_index_t = SecondaryIndex<T, KEY, PK_MAP, INDEX>;
+  using other_indexes_t = SecondaryIndexes<T, KEY, PK_MAP, index::Indexes<INDEXES...>>;
+
+ public:
+  template <typename DECLARATION>
+  const SecondaryIndex<T, KEY, PK_MAP, DECLARATION>& Get() const {
+    return *this;
+  }
+
+  // Throws if adding `entry` under `key` would violate any of the unique indexes.
+  void CheckNoConflict(sfinae::CF<KEY> key, const T& entry) const {
+    this_index_t::CheckNoConflict(key, entry);
+    other_indexes_t::CheckNoConflict(key, entry);
+  }
+  void Insert(sfinae::CF<KEY> key, const T& entry) {
+    this_index_t::Insert(key, entry);
+    other_indexes_t::Insert(key, entry);
+  }
+  void Erase(sfinae::CF<KEY> key, const T& entry) {
+    this_index_t::Erase(key, entry);
+    other_indexes_t::Erase(key, entry);
+  }
+};
+
+// The user-facing accessor to the index, returned by `field.Index<DECLARATION>()`.
+template <typename DICTIONARY, typename INDEX, bool UNIQUE = INDEX::unique>
+class IndexAccessor;
+
+template <typename DICTIONARY, typename INDEX>
+class IndexAccessor<DICTIONARY, INDEX, true> {
+ public:
+  using entry_t = typename DICTIONARY::entry_t;
+  using key_t = typename DICTIONARY::key_t;
+  using index_key_t = typename INDEX::index_key_t;
+  using index_t = typename DICTIONARY::template index_t<INDEX>;
+
+  IndexAccessor(const DICTIONARY& dictionary, const index_t& index) : dictionary_(dictionary), index_(index) {}
+
+  bool Has(sfinae::CF<index_key_t> index_key) const { return index_.Find(index_key) != nullptr; }
+
+  ImmutableOptional<entry_t> operator[](sfinae::CF<index_key_t> index_key) const {
+    const key_t* key = index_.Find(index_key);
+    if (key) {
+      return dictionary_[*key];
+    } else {
+      return nullptr;
+    }
+  }
+
+  size_t Size() const { return index_.Map().size(); }
+
+  // Iterates over the entries in the order of the index, for the ordered indexes.
+  struct Iterator final {
+    using iterator_t = typename index_t::map_t::const_iterator;
+    const DICTIONARY* dictionary;
+    iterator_t iterator;
+    Iterator(const DICTIONARY* dictionary, iterator_t iterator)
+        : dictionary(dictionary), iterator(std::move(iterator)) {}
+    void operator++() { ++iterator; }
+    bool operator==(const Iterator& rhs) const { return iterator == rhs.iterator; }
+    bool operator!=(const Iterator& rhs) const { return !operator==(rhs); }
+    sfinae::CF<index_key_t> index_key() const { return iterator->first; }
+    sfinae::CF<key_t> key() const { return iterator->second; }
+    const entry_t& operator*() const { return Value((*dictionary)[iterator->second]); }
+    const entry_t* operator->() const { return &operator*(); }
+  };
+
+  Iterator begin() const { return Iterator(&dictionary_, index_.Map().cbegin()); }
+  Iterator end() const { return Iterator(&dictionary_, index_.Map().cend()); }
+
+ private:
+  const DICTIONARY& dictionary_;
+  const index_t& index_;
+};
+
+template <typename DICTIONARY, typename INDEX>
+class IndexAccessor<DICTIONARY, INDEX, false> {
+ public:
+  using entry_t = typename DICTIONARY::entry_t;
+  using key_t = typename DICTIONARY::key_t;
+  using index_key_t = typename INDEX::index_key_t;
+  using index_t = typename DICTIONARY::template index_t<INDEX>;
+  using keys_t = typename index_t::keys_t;
+
+  // The entries sharing the same index key, in the order of their primary keys for the ordered dictionaries.
+  struct Entries final {
+    struct Iterator final {
+      using iterator_t = typename keys_t::const_iterator;
+      const DICTIONARY* dictionary;
+      iterator_t iterator;
+      Iterator(const DICTIONARY* dictionary, iterator_t iterator)
+          : dictionary(dictionary), iterator(std::move(iterator)) {}
+      void operator++() { ++iterator; }
+      bool operator==(const Iterator& rhs) const { return iterator == rhs.iterator; }
+      bool operator!=(const Iterator& rhs) const { return !operator==(rhs); }
+      sfinae::CF<key_t> key() const { return iterator->first; }
+      const entry_t& operator*() const { return Value((*dictionary)[iterator->first]); }
+      const entry_t* operator->() const { return &operator*(); }
+    };
+
+    const DICTIONARY& dictionary;
+    const keys_t& keys;
+
+    bool Empty() const { return keys.empty(); }
+    size_t Size() const { return keys.size(); }
+    Iterator begin() const { return Iterator(&dictionary, keys.cbegin()); }
+    Iterator end() const { return Iterator(&dictionary, keys.cend()); }
+  };
+
+  IndexAccessor(const DICTIONARY& dictionary, const index_t& index) : dictionary_(dictionary), index_(index) {}
+
+  bool Has(sfinae::CF<index_key_t> index_key) const { return index_.Find(index_key) != nullptr; }
+
+  Entries operator[](sfinae::CF<index_key_t> index_key) const {
+    static const keys_t empty_keys;
+    const keys_t* keys = index_.Find(index_key);
+    return Entries{dictionary_, keys ? *keys : empty_keys};
+  }
+
+  // The number of distinct index keys.
+  size_t Size() const { return index_.Map().size(); }
+
+ private:
+  const DICTIONARY& dictionary_;
+  const index_t& index_;
+};
+
+}  // namespace current::storage::container
+}  // namespace current::storage
+}  // namespace current
+
+// Declares the index `index_name` over `entry_type`, keyed by the `key_type` result of the function body which
+// follows.
+// `uniqueness` is `Unique` or `NonUnique`, `map` is `Ordered` or `Unordered`. Example:
+//
+//   CURRENT_STORAGE_INDEX(NonUnique, Ordered, UserByDomain, User, std::string) {
+//     return entry.email.substr(entry.email.find('@') + 1);
+//   }
+#define CURRENT_STORAGE_INDEX(uniqueness, map, index_name, entry_type, key_type)                           \
+  struct index_name final                                                                                  \
+      : ::current::storage::index::uniqueness<::current::storage::container::map, entry_type, key_type> { \
+    static const char* Name() { return #index_name; }                                                      \
+    static key_type Key(const entry_type& entry);                                                          \
+  };                                                                                                       \
+  inline key_type index_name::Key(const entry_type& entry)
+
+// Declares the index `index_name` over `entry_type`, keyed by its field `field`.
+#define CURRENT_STORAGE_FIELD_INDEX(uniqueness, map, index_name, entry_type, field)                           \
+  CURRENT_STORAGE_INDEX(                                                                                      \
+      uniqueness, map, index_name, entry_type, ::current::decay<decltype(std::declval<entry_type>().field)>) { \
+    return entry.field;                                                                                       \
+  }
+
+#endif  // CURRENT_STORAGE_CONTAINER_INDEX_H
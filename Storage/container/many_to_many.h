@@ -70,12 +70,12 @@ class GenericManyToMany {
     const auto map_cit = map_.find(key);
     const auto lm_cit = last_modified_.find(key);
     if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
       assert(lm_cit != last_modified_.end());
       const auto previous_timestamp = lm_cit->second;
       journal_.LogMutation(UPDATE_EVENT(now, object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
+                           std::move(map_cit->second),
+                           [this, key, previous_timestamp](std::unique_ptr<T>&& previous_object) {
+                             DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
                            });
     } else {
       if (lm_cit != last_modified_.end()) {
@@ -99,13 +99,13 @@ class GenericManyToMany {
     const auto now = current::time::Now();
     const auto map_cit = map_.find(key);
     if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
       const auto lm_cit = last_modified_.find(key);
       assert(lm_cit != last_modified_.end());
       const auto previous_timestamp = lm_cit->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
+      journal_.LogMutation(DELETE_EVENT(now, *(map_cit->second)),
+                           std::move(map_cit->second),
+                           [this, key, previous_timestamp](std::unique_ptr<T>&& previous_object) {
+                             DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
                            });
       DoEraseWithLastModified(now, key);
     }
@@ -137,6 +137,23 @@ class GenericManyToMany {
     return LastModified(std::make_pair(row, col));
   }
 
+  // Calls `f` with the events which recreate the contents of this container, deletion timestamps included,
+  // if applied to an empty one. Used to save storage checkpoints.
+  template <typename F>
+  void ExportCheckpointEvents(F&& f) const {
+    for (const auto& last_modified : last_modified_) {
+      const auto map_iterator = map_.find(last_modified.first);
+      if (map_iterator != map_.end()) {
+        f(UPDATE_EVENT(last_modified.second, *map_iterator->second));
+      } else {
+        DELETE_EVENT event;
+        event.us = last_modified.second;
+        event.key = last_modified.first;
+        f(event);
+      }
+    }
+  }
+
   void operator()(const UPDATE_EVENT& e) {
     const auto row = sfinae::GetRow(e.data);
     const auto col = sfinae::GetCol(e.data);
@@ -207,11 +224,26 @@ class GenericManyToMany {
   iterator_t begin() const { return iterator_t(map_.begin()); }
   iterator_t end() const { return iterator_t(map_.end()); }
 
+  // For REST pagination, the iterator to the element following the one with the key `key`. The elements are
+  // not ordered, so `nullptr` is returned unless the element with this key is there.
+  Optional<iterator_t> After(const key_t& key) const {
+    auto iterator = map_.find(key);
+    if (iterator != map_.end()) {
+      return iterator_t(++iterator);
+    } else {
+      return nullptr;
+    }
+  }
+
  private:
   void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, const T& object) {
+    DoUpdateWithLastModified(us, key, std::make_unique<T>(object));
+  }
+
+  void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, std::unique_ptr<T>&& object) {
     last_modified_[key] = us;
     auto& placeholder = map_[key];
-    placeholder = std::make_unique<T>(object);
+    placeholder = std::move(object);
     forward_[key.first][key.second] = placeholder.get();
     transposed_[key.second][key.first] = placeholder.get();
   }
@@ -70,12 +70,12 @@ class GenericOneToOne {
     const auto map_cit = map_.find(key);
     const auto lm_cit = last_modified_.find(key);
     if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
       assert(lm_cit != last_modified_.end());
       const auto previous_timestamp = lm_cit->second;
       journal_.LogMutation(UPDATE_EVENT(now, object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
+                           std::move(map_cit->second),
+                           [this, key, previous_timestamp](std::unique_ptr<T>&& previous_object) {
+                             DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
                            });
     } else {
       const auto cit_row = forward_.find(row);
@@ -94,16 +94,18 @@ class GenericOneToOne {
         assert(lm_same_col_cit != last_modified_.end());
         const auto timestamp_same_col = lm_same_col_cit->second;
         journal_.LogMutation(DELETE_EVENT(now, conflicting_object_same_row),
-                             [this, key_same_row, conflicting_object_same_row, timestamp_same_row]() {
+                             std::move(map_[key_same_row]),
+                             [this, key_same_row, timestamp_same_row](std::unique_ptr<T>&& previous_object) {
                                DoUpdateWithLastModified(
-                                   timestamp_same_row, key_same_row, conflicting_object_same_row);
+                                   timestamp_same_row, key_same_row, std::move(previous_object));
                              });
         DoEraseWithLastModified(now, key_same_row);
         now = current::time::Now();
         journal_.LogMutation(DELETE_EVENT(now, conflicting_object_same_col),
-                             [this, key_same_col, conflicting_object_same_col, timestamp_same_col]() {
+                             std::move(map_[key_same_col]),
+                             [this, key_same_col, timestamp_same_col](std::unique_ptr<T>&& previous_object) {
                                DoUpdateWithLastModified(
-                                   timestamp_same_col, key_same_col, conflicting_object_same_col);
+                                   timestamp_same_col, key_same_col, std::move(previous_object));
                              });
         DoEraseWithLastModified(now, key_same_col);
         now = current::time::Now();
@@ -114,12 +116,14 @@ class GenericOneToOne {
         const auto conflicting_object_lm_cit = last_modified_.find(conflicting_object_key);
         assert(conflicting_object_lm_cit != last_modified_.end());
         const auto conflicting_object_timestamp = conflicting_object_lm_cit->second;
-        journal_.LogMutation(
-            DELETE_EVENT(now, conflicting_object),
-            [this, conflicting_object_key, conflicting_object, conflicting_object_timestamp]() {
-              DoUpdateWithLastModified(
-                  conflicting_object_timestamp, conflicting_object_key, conflicting_object);
-            });
+        journal_.LogMutation(DELETE_EVENT(now, conflicting_object),
+                             std::move(map_[conflicting_object_key]),
+                             [this, conflicting_object_key, conflicting_object_timestamp](
+                                 std::unique_ptr<T>&& previous_object) {
+                               DoUpdateWithLastModified(conflicting_object_timestamp,
+                                                        conflicting_object_key,
+                                                        std::move(previous_object));
+                             });
         DoEraseWithLastModified(now, conflicting_object_key);
         now = current::time::Now();
       }
@@ -145,13 +149,13 @@ class GenericOneToOne {
     const auto now = current::time::Now();
     const auto map_cit = map_.find(key);
     if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
       const auto lm_cit = last_modified_.find(key);
       assert(lm_cit != last_modified_.end());
       const auto previous_timestamp = lm_cit->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
+      journal_.LogMutation(DELETE_EVENT(now, *(map_cit->second)),
+                           std::move(map_cit->second),
+                           [this, key, previous_timestamp](std::unique_ptr<T>&& previous_object) {
+                             DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
                            });
       DoEraseWithLastModified(now, key);
     }
@@ -168,8 +172,9 @@ class GenericOneToOne {
       assert(lm_cit != last_modified_.end());
       const auto previous_timestamp = lm_cit->second;
       journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
+                           std::move(map_[key]),
+                           [this, key, previous_timestamp](std::unique_ptr<T>&& previous_object) {
+                             DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
                            });
       DoEraseWithLastModified(now, key);
     }
@@ -185,8 +190,9 @@ class GenericOneToOne {
       assert(lm_cit != last_modified_.end());
       const auto previous_timestamp = lm_cit->second;
       journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
+                           std::move(map_[key]),
+                           [this, key, previous_timestamp](std::unique_ptr<T>&& previous_object) {
+                             DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
                            });
       DoEraseWithLastModified(now, key);
     }
@@ -240,6 +246,23 @@ class GenericOneToOne {
     return DoesNotConflict(std::make_pair(row, col));
   }
 
+  // Calls `f` with the events which recreate the contents of this container, deletion timestamps included,
+  // if applied to an empty one. Used to save storage checkpoints.
+  template <typename F>
+  void ExportCheckpointEvents(F&& f) const {
+    for (const auto& last_modified : last_modified_) {
+      const auto map_iterator = map_.find(last_modified.first);
+      if (map_iterator != map_.end()) {
+        f(UPDATE_EVENT(last_modified.second, *map_iterator->second));
+      } else {
+        DELETE_EVENT event;
+        event.us = last_modified.second;
+        event.key = last_modified.first;
+        f(event);
+      }
+    }
+  }
+
   void operator()(const UPDATE_EVENT& e) {
     const auto row = sfinae::GetRow(e.data);
     const auto col = sfinae::GetCol(e.data);
@@ -260,11 +283,26 @@ class GenericOneToOne {
   iterator_t begin() const { return iterator_t(map_.begin()); }
   iterator_t end() const { return iterator_t(map_.end()); }
 
+  // For REST pagination, the iterator to the element following the one with the key `key`. The elements are
+  // not ordered, so `nullptr` is returned unless the element with this key is there.
+  Optional<iterator_t> After(const key_t& key) const {
+    auto iterator = map_.find(key);
+    if (iterator != map_.end()) {
+      return iterator_t(++iterator);
+    } else {
+      return nullptr;
+    }
+  }
+
  private:
   void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, const T& object) {
+    DoUpdateWithLastModified(us, key, std::make_unique<T>(object));
+  }
+
+  void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, std::unique_ptr<T>&& object) {
     last_modified_[key] = us;
     auto& placeholder = map_[key];
-    placeholder = std::make_unique<T>(object);
+    placeholder = std::move(object);
     forward_[key.first] = placeholder.get();
     transposed_[key.second] = placeholder.get();
   }
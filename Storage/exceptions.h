@@ -64,6 +64,28 @@ struct ReadWriteTransactionInFollowerStorageException : StorageException {
   using StorageException::StorageException;
 };
 
+struct StorageCheckpointsNotConfiguredException : StorageException {
+  using StorageException::StorageException;
+};
+
+struct StorageCheckpointIsAheadOfStreamException : StorageException {
+  using StorageException::StorageException;
+};
+
+struct StorageCheckpointIsCorruptedException : StorageException {
+  explicit StorageCheckpointIsCorruptedException(const std::string& file_name)
+      : StorageException("Corrupted storage checkpoint: `" + file_name + "`.") {}
+};
+
+struct StorageUniqueIndexViolationException : StorageException {
+  explicit StorageUniqueIndexViolationException(const std::string& index_name)
+      : StorageException("Unique index `" + index_name + "` violated.") {}
+};
+
+struct StorageCompactMatrixOverflowException : StorageException {
+  StorageCompactMatrixOverflowException() : StorageException("Too many cells to compact into a matrix.") {}
+};
+
 struct StorageInGracefulShutdownException : InGracefulShutdownException {
   using InGracefulShutdownException::InGracefulShutdownException;
 };
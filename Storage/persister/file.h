@@ -63,23 +63,32 @@ class JSONFilePersister<TypeList<TS...>, NoCustomPersisterParam> {
       for (auto&& entry : journal.commit_log) {
         os << JSON(variant_t(std::move(entry))) << '\n';
       }
+      mutations_ += journal.commit_log.size();
     }
     journal.Clear();
   }
 
+  // Must be called under the storage mutex. The file has no transaction boundaries, so, unlike the index of
+  // the stream persisters, it counts the mutations. Hence no `StreamIndex()` for the followers to wait for.
+  uint64_t AppliedStreamIndex() const { return mutations_; }
+
   void InternalExposeStream() {}  // No-op to make it compile.
 
  private:
   std::string filename_;
+  uint64_t mutations_ = 0u;
 
   template <typename F>
   void Replay(F&& f) {
     std::ifstream is(filename_);
+    uint64_t mutations = 0u;
     if (is.good()) {
       for (std::string line; std::getline(is, line);) {
         f(std::move(ParseJSON<variant_t>(line)));
+        ++mutations;
       }
     }
+    mutations_ = mutations;
   }
 };
 
@@ -26,18 +26,35 @@ SOFTWARE.
 #ifndef CURRENT_STORAGE_PERSISTER_SHERLOCK_H
 #define CURRENT_STORAGE_PERSISTER_SHERLOCK_H
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "common.h"
 #include "../base.h"
+#include "../checkpoint.h"
 #include "../exceptions.h"
 #include "../transaction.h"
 #include "../../Sherlock/sherlock.h"
 
 #include "../../Bricks/sync/locks.h"
+#include "../../Bricks/util/singleton.h"
+#include "../../Bricks/waitable_atomic/waitable_atomic.h"
 
 namespace current {
 namespace storage {
 namespace persister {
 
+// The threads which parse the persisted entries ahead of them being replayed. By default, their number follows
+// the number of cores, and a single-core machine replays the entries sequentially. A non-zero `parser_threads`
+// forces the pipelined replay with that many threads, for the tests to exercise it regardless of the hardware.
+struct PipelinedReplayParameters {
+  std::atomic<unsigned> parser_threads{0u};
+};
+
 template <typename TYPELIST, template <typename> class UNDERLYING_PERSISTER, typename STREAM_RECORD_TYPE>
 class SherlockStreamPersisterImpl;
 
@@ -56,49 +73,90 @@ class SherlockStreamPersisterImpl<TypeList<TS...>, UNDERLYING_PERSISTER, STREAM_
   struct SherlockSubscriberImpl {
     using EntryResponse = current::ss::EntryResponse;
     using TerminationResponse = current::ss::TerminationResponse;
-    using replay_function_t = std::function<void(const transaction_t&)>;
+    using replay_function_t = std::function<void(const transaction_t&, uint64_t next_index, bool more_pending)>;
+    using end_batch_function_t = std::function<void()>;
     replay_function_t replay_f_;
-    uint64_t next_replay_index_ = 0u;
+    end_batch_function_t end_batch_f_;
 
-    SherlockSubscriberImpl(replay_function_t f) : replay_f_(f) {}
+    SherlockSubscriberImpl(replay_function_t replay_f, end_batch_function_t end_batch_f)
+        : replay_f_(replay_f), end_batch_f_(end_batch_f) {}
 
-    EntryResponse operator()(const transaction_t& transaction, idxts_t current, idxts_t) {
-      replay_f_(transaction);
-      next_replay_index_ = current.index + 1u;
+    EntryResponse operator()(const transaction_t& transaction, idxts_t current, idxts_t last) {
+      replay_f_(transaction, current.index + 1u, current.index < last.index);
       return EntryResponse::More;
     }
 
-    EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return EntryResponse::More; }
-    TerminationResponse Terminate() const { return TerminationResponse::Terminate; }
+    // Called if the last entry of the stream is not a transaction.
+    EntryResponse EntryResponseIfNoMorePassTypeFilter() const {
+      end_batch_f_();
+      return EntryResponse::More;
+    }
+    TerminationResponse Terminate() const {
+      end_batch_f_();
+      return TerminationResponse::Terminate;
+    }
   };
   using SherlockSubscriber = current::ss::StreamSubscriber<SherlockSubscriberImpl, transaction_t>;
 
+  using checkpoint_t = StorageCheckpoint<variant_t>;
+
   template <typename... ARGS>
+  struct FirstArgumentIsStorageCheckpoints : std::false_type {};
+  template <typename ARG, typename... ARGS>
+  struct FirstArgumentIsStorageCheckpoints<ARG, ARGS...>
+      : std::is_same<typename std::decay<ARG>::type, StorageCheckpoints> {};
+
+  template <typename... ARGS, class = std::enable_if_t<!FirstArgumentIsStorageCheckpoints<ARGS...>::value>>
   explicit SherlockStreamPersisterImpl(std::mutex& storage_mutex, fields_update_function_t f, ARGS&&... args)
+      : SherlockStreamPersisterImpl(storage_mutex, f, StorageCheckpoints(), std::forward<ARGS>(args)...) {}
+
+  // TODO(dkorolev): `ScopeOwnedBySomeoneElse<>` ?
+  explicit SherlockStreamPersisterImpl(std::mutex& storage_mutex,
+                                       fields_update_function_t f,
+                                       sherlock_t& stream_owned_by_someone_else)
+      : SherlockStreamPersisterImpl(storage_mutex, f, StorageCheckpoints(), stream_owned_by_someone_else) {}
+
+  template <typename... ARGS>
+  explicit SherlockStreamPersisterImpl(std::mutex& storage_mutex,
+                                       fields_update_function_t f,
+                                       const StorageCheckpoints& checkpoints,
+                                       ARGS&&... args)
       : storage_mutex_ref_(storage_mutex),
         fields_update_f_(f),
+        checkpoints_(checkpoints),
         stream_owned_if_any_(std::make_unique<sherlock::Stream<sherlock_entry_t, UNDERLYING_PERSISTER>>(
             std::forward<ARGS>(args)...)),
         stream_used_(*stream_owned_if_any_.get()),
         authority_(PersisterDataAuthority::Own) {
     // Do not use lock since we are in ctor.
-    SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>();
+    LoadLatestCheckpoint();
+    SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>(next_index_);
+    stream_index_.SetValue(next_index_);
   }
 
-  // TODO(dkorolev): `ScopeOwnedBySomeoneElse<>` ?
   explicit SherlockStreamPersisterImpl(std::mutex& storage_mutex,
                                        fields_update_function_t f,
+                                       const StorageCheckpoints& checkpoints,
                                        sherlock_t& stream_owned_by_someone_else)
-      : storage_mutex_ref_(storage_mutex), fields_update_f_(f), stream_used_(stream_owned_by_someone_else) {
+      : storage_mutex_ref_(storage_mutex),
+        fields_update_f_(f),
+        checkpoints_(checkpoints),
+        stream_used_(stream_owned_by_someone_else) {
     authority_ = (stream_used_.DataAuthority() == current::sherlock::StreamDataAuthority::Own)
                      ? PersisterDataAuthority::Own
                      : PersisterDataAuthority::External;
     subscriber_ = std::make_unique<SherlockSubscriber>(
-        [this](const transaction_t& transaction) { ApplyMutations(transaction); });
+        [this](const transaction_t& transaction, uint64_t next_index, bool more_pending) {
+          FollowerApplyMutations(transaction, next_index, more_pending);
+        },
+        [this]() { EndFollowerBatch(); });
+    // Do not use lock since we are in ctor.
+    LoadLatestCheckpoint();
     if (authority_ == PersisterDataAuthority::Own) {
-      // Do not use lock since we are in ctor.
-      SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>();
+      SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>(next_index_);
+      stream_index_.SetValue(next_index_);
     } else {
+      stream_index_.SetValue(next_index_);
       SubscribeToStream();
     }
   }
@@ -122,11 +180,30 @@ class SherlockStreamPersisterImpl<TypeList<TS...>, UNDERLYING_PERSISTER, STREAM_
         transaction.mutations.emplace_back(std::move(entry));
       }
       std::swap(transaction.meta, journal.transaction_meta);
-      stream_used_.Publish(std::move(transaction));
+      next_index_ = stream_used_.Publish(std::move(transaction)).index + 1u;
+      stream_index_.SetValue(next_index_);
     }
     journal.Clear();
   }
 
+  // The number of the stream entries reflected by the fields of the storage. Taken on the master right after
+  // a read-write transaction, it is the "read your writes" token: once a follower has reached it, the reads
+  // from the follower reflect that transaction.
+  uint64_t StreamIndex() const { return stream_index_.GetValue(); }
+
+  // Must be called under the storage mutex. Unlike `StreamIndex()`, is exact within a follower's batch too.
+  uint64_t AppliedStreamIndex() const { return next_index_; }
+
+  void WaitForStreamIndex(uint64_t index) const {
+    stream_index_.Wait([index](uint64_t value) { return value >= index; });
+  }
+
+  // Returns whether the index has been reached within the timeout.
+  bool WaitForStreamIndex(uint64_t index, std::chrono::microseconds timeout) const {
+    stream_index_.WaitFor([index](uint64_t value) { return value >= index; }, timeout);
+    return stream_index_.GetValue() >= index;
+  }
+
   void ExposeRawLogViaHTTP(uint16_t port, const std::string& route) {
     handlers_scope_ +=
         HTTP(port).Register(route, URLPathArgs::CountMask::None | URLPathArgs::CountMask::One, stream_used_);
@@ -134,12 +211,43 @@ class SherlockStreamPersisterImpl<TypeList<TS...>, UNDERLYING_PERSISTER, STREAM_
 
   sherlock_t& InternalExposeStream() { return stream_used_; }
 
+  // Must be called under the storage mutex. Returns the index of the first stream entry not yet reflected
+  // by the fields of the storage, for the checkpoint of the fields to be tagged with it.
+  uint64_t CheckpointIndex() const {
+    if (!checkpoints_.Enabled()) {
+      CURRENT_THROW(StorageCheckpointsNotConfiguredException());
+    }
+    return next_index_;
+  }
+
+  // Called without the storage mutex held, so that the transactions are not blocked while the file is written.
+  void SaveCheckpoint(const checkpoint_t& checkpoint) {
+    std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+    SaveStorageCheckpoint(checkpoints_, checkpoint);
+  }
+
+  template <typename F>
+  void ExposeCheckpointsViaHTTP(uint16_t port, const std::string& route, F&& checkpoint_f) {
+    handlers_scope_ += HTTP(port).Register(route, [checkpoint_f](Request r) {
+      if (r.method != "POST") {
+        r(current::net::DefaultMethodNotAllowedMessage(), HTTPResponseCode.MethodNotAllowed);
+      } else {
+        try {
+          r(StorageCheckpointCreated(checkpoint_f()));
+        } catch (const current::Exception& e) {
+          r(e.What(), HTTPResponseCode.InternalServerError);
+        }
+      }
+    });
+  }
+
   template <current::locks::MutexLockStatus MLS>
   void AcquireDataAuthority() {
     current::locks::SmartMutexLockGuard<MLS> lock(storage_mutex_ref_);
     if (stream_used_.DataAuthority() == current::sherlock::StreamDataAuthority::Own) {
       TerminateStreamSubscription();
-      SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>(subscriber_->next_replay_index_);
+      SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>(next_index_);
+      stream_index_.SetValue(next_index_);
       subscriber_ = nullptr;
     } else {
       CURRENT_THROW(UnderlyingStreamHasExternalDataAuthorityException());
@@ -147,28 +255,207 @@ class SherlockStreamPersisterImpl<TypeList<TS...>, UNDERLYING_PERSISTER, STREAM_
   }
 
  private:
+  // Pipelined replay only pays off if iterating over the persister parses the entries, as the file-based one
+  // does. The in-memory persister returns references to the already existing entries.
+  using persisted_record_t = typename std::decay<
+      decltype(*std::declval<typename sherlock_t::persistence_layer_t>().Iterate().begin())>::type;
+  constexpr static bool kPersisterParsesEntries =
+      !std::is_reference<decltype(std::declval<persisted_record_t>().entry)>::value;
+
+  // Pipelined replay parameters: the number of entries parsed as one chunk, the number of chunks parsed ahead
+  // of the ones being applied, and the maximum number of threads parsing the chunks.
+  constexpr static uint64_t kReplayChunkSize = 1024u;
+  constexpr static uint64_t kReplayMaxChunksAhead = 16u;
+  constexpr static unsigned kReplayMaxParserThreads = 4u;
+
+  // The maximum number of transactions the follower applies per acquisition of the storage mutex.
+  constexpr static uint64_t kFollowerMaxTransactionsPerLock = 256u;
+
   template <current::locks::MutexLockStatus MLS>
   void SyncReplayStream(uint64_t from_idx = 0u) {
+    const uint64_t size = stream_used_.InternalExposePersister().Size();
+    const unsigned parser_threads = ReplayParserThreads();
+    if (kPersisterParsesEntries && size > from_idx + kReplayChunkSize && parser_threads) {
+      PipelinedReplayStream<MLS>(from_idx, size, parser_threads);
+      from_idx = size;
+    }
     for (const auto& stream_record : stream_used_.InternalExposePersister().Iterate(from_idx)) {
       if (Exists<transaction_t>(stream_record.entry)) {
         const transaction_t& transaction = Value<transaction_t>(stream_record.entry);
-        ApplyMutations<MLS>(transaction);
+        ApplyMutations<MLS>(transaction, stream_record.idx_ts.index + 1u);
+      } else {
+        next_index_ = stream_record.idx_ts.index + 1u;
+      }
+    }
+  }
+
+  // Zero if the entries are to be replayed sequentially.
+  static unsigned ReplayParserThreads() {
+    const unsigned forced = current::Singleton<PipelinedReplayParameters>().parser_threads;
+    if (forced) {
+      return forced;
+    }
+    const unsigned hardware_threads = std::thread::hardware_concurrency();
+    if (hardware_threads <= 1u) {
+      return 0u;
+    }
+    return (hardware_threads - 1u < kReplayMaxParserThreads) ? hardware_threads - 1u : kReplayMaxParserThreads;
+  }
+
+  // Replays the entries `[from_idx, till_idx)`, split into chunks. The chunks are read and parsed by the pool
+  // of `threads_count` threads, while the calling thread applies the already parsed transactions, in order.
+  template <current::locks::MutexLockStatus MLS>
+  void PipelinedReplayStream(uint64_t from_idx, uint64_t till_idx, unsigned threads_count) {
+    struct Chunk {
+      bool ready = false;
+      std::vector<std::pair<uint64_t, transaction_t>> transactions;  // The next index, and the transaction.
+      std::exception_ptr exception;
+    };
+    const auto& persister = stream_used_.InternalExposePersister();
+    const uint64_t chunks_count = (till_idx - from_idx + kReplayChunkSize - 1u) / kReplayChunkSize;
+    std::vector<Chunk> chunks(chunks_count);
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+    uint64_t next_chunk_to_parse = 0u;
+    uint64_t next_chunk_to_apply = 0u;
+    bool done = false;
+
+    const auto parser = [&]() {
+      while (true) {
+        uint64_t chunk_index;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          condition_variable.wait(lock, [&]() {
+            return done || next_chunk_to_parse >= chunks_count ||
+                   next_chunk_to_parse < next_chunk_to_apply + kReplayMaxChunksAhead;
+          });
+          if (done || next_chunk_to_parse >= chunks_count) {
+            return;
+          }
+          chunk_index = next_chunk_to_parse++;
+        }
+        std::vector<std::pair<uint64_t, transaction_t>> transactions;
+        std::exception_ptr exception;
+        try {
+          const uint64_t begin = from_idx + chunk_index * kReplayChunkSize;
+          const uint64_t end = std::min(begin + kReplayChunkSize, till_idx);
+          transactions.reserve(static_cast<size_t>(end - begin));
+          for (auto&& stream_record : persister.Iterate(begin, end)) {
+            if (Exists<transaction_t>(stream_record.entry)) {
+              transactions.emplace_back(stream_record.idx_ts.index + 1u,
+                                        std::move(Value<transaction_t>(stream_record.entry)));
+            }
+          }
+        } catch (...) {  // The exception is rethrown by the applying thread.
+          exception = std::current_exception();
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          Chunk& chunk = chunks[chunk_index];
+          chunk.transactions = std::move(transactions);
+          chunk.exception = exception;
+          chunk.ready = true;
+        }
+        condition_variable.notify_all();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0u; i < threads_count; ++i) {
+      threads.emplace_back(parser);
+    }
+
+    std::exception_ptr exception;
+    for (uint64_t i = 0u; i < chunks_count && !exception; ++i) {
+      std::vector<std::pair<uint64_t, transaction_t>> transactions;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition_variable.wait(lock, [&]() { return chunks[i].ready; });
+        transactions = std::move(chunks[i].transactions);
+        exception = chunks[i].exception;
+        ++next_chunk_to_apply;
       }
+      condition_variable.notify_all();
+      if (!exception) {
+        try {
+          for (const auto& transaction : transactions) {
+            ApplyMutations<MLS>(transaction.second, transaction.first);
+          }
+        } catch (...) {  // The exception is rethrown once the parsing threads are joined.
+          exception = std::current_exception();
+        }
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    condition_variable.notify_all();
+    for (std::thread& thread : threads) {
+      thread.join();
     }
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    next_index_ = till_idx;
   }
 
   template <current::locks::MutexLockStatus MLS = current::locks::MutexLockStatus::NeedToLock>
-  void ApplyMutations(const transaction_t& transaction) {
+  void ApplyMutations(const transaction_t& transaction, uint64_t next_index) {
     current::locks::SmartMutexLockGuard<MLS> lock(storage_mutex_ref_);
     for (const auto& mutation : transaction.mutations) {
       fields_update_f_(mutation);
     }
+    next_index_ = next_index;
+  }
+
+  // The follower applies the transactions from the stream in batches, holding the storage mutex for up to
+  // `kFollowerMaxTransactionsPerLock` transactions in a row, while the next ones are already in the stream.
+  // The mutex is released as soon as the follower has caught up, so that the reads never wait for the
+  // transactions which are yet to be published. Called from the thread of the stream subscriber only.
+  void FollowerApplyMutations(const transaction_t& transaction, uint64_t next_index, bool more_pending) {
+    if (!follower_lock_.owns_lock()) {
+      follower_lock_.lock();
+    }
+    for (const auto& mutation : transaction.mutations) {
+      fields_update_f_(mutation);
+    }
+    next_index_ = next_index;
+    ++follower_batch_size_;
+    if (!more_pending || follower_batch_size_ >= kFollowerMaxTransactionsPerLock) {
+      EndFollowerBatch();
+    }
+  }
+
+  void EndFollowerBatch() {
+    if (follower_lock_.owns_lock()) {
+      const uint64_t next_index = next_index_;
+      follower_batch_size_ = 0u;
+      follower_lock_.unlock();
+      stream_index_.SetValue(next_index);
+    }
+  }
+
+  // Applies the most recent checkpoint, if any, and sets `next_index_` to the index to replay the stream from.
+  void LoadLatestCheckpoint() {
+    checkpoint_t checkpoint;
+    if (checkpoints_.Enabled() && LoadLatestStorageCheckpoint(checkpoints_, checkpoint)) {
+      if (authority_ == PersisterDataAuthority::Own &&
+          checkpoint.next_index > stream_used_.InternalExposePersister().Size()) {
+        CURRENT_THROW(StorageCheckpointIsAheadOfStreamException());
+      }
+      for (const auto& mutation : checkpoint.mutations) {
+        fields_update_f_(mutation);
+      }
+      next_index_ = checkpoint.next_index;
+    }
   }
 
   void SubscribeToStream() {
     assert(!subscriber_scope_);
     assert(subscriber_);
-    subscriber_scope_ = std::move(stream_used_.template Subscribe<transaction_t>(*subscriber_));
+    subscriber_scope_ = std::move(stream_used_.template Subscribe<transaction_t>(*subscriber_, next_index_));
   }
 
   void TerminateStreamSubscription() { subscriber_scope_ = nullptr; }
@@ -176,6 +463,16 @@ class SherlockStreamPersisterImpl<TypeList<TS...>, UNDERLYING_PERSISTER, STREAM_
  private:
   std::mutex& storage_mutex_ref_;
   fields_update_function_t fields_update_f_;
+  const StorageCheckpoints checkpoints_;
+  std::mutex checkpoints_mutex_;
+  // The index of the first stream entry not yet reflected by the fields of the storage.
+  // Guarded by the storage mutex.
+  uint64_t next_index_ = 0u;
+  // The value of `next_index_` as of the last committed or applied batch, to wait on without the storage mutex.
+  WaitableAtomic<uint64_t> stream_index_{0u};
+  // Held by the thread of the stream subscriber while it applies a batch of transactions.
+  std::unique_lock<std::mutex> follower_lock_{storage_mutex_ref_, std::defer_lock};
+  uint64_t follower_batch_size_ = 0u;
   // `stream_{used/owned}_` are two variables to support both owning and non-owning Storage usage patterns.
   std::unique_ptr<sherlock::Stream<transaction_t, UNDERLYING_PERSISTER>> stream_owned_if_any_;
   sherlock_t& stream_used_;
@@ -193,11 +490,36 @@ template <typename TYPELIST, typename STREAM_RECORD_TYPE = NoCustomPersisterPara
 using SherlockStreamPersister =
     SherlockStreamPersisterImpl<TYPELIST, current::persistence::File, STREAM_RECORD_TYPE>;
 
+// Same as `SherlockStreamPersister`, but the journal is stored in the binary format, see `Blocks/Persistence`.
+template <typename TYPELIST, typename STREAM_RECORD_TYPE = NoCustomPersisterParam>
+using SherlockBinaryStreamPersister =
+    SherlockStreamPersisterImpl<TYPELIST, current::persistence::BinaryFile, STREAM_RECORD_TYPE>;
+
+// Converts the journal of `SherlockStreamPersister` into one to be opened by `SherlockBinaryStreamPersister`,
+// and vice versa. The storage is the instantiated one, e.g. `ConvertJournalToBinary<MyStorage<...>>(...)`.
+// Returns the number of transactions converted.
+template <typename STORAGE>
+uint64_t ConvertJournalToBinary(const std::string& json_filename, const std::string& binary_filename) {
+  return current::persistence::ConvertPersistedFile<typename STORAGE::persister_t::sherlock_entry_t,
+                                                    current::persistence::JSONFileFormat,
+                                                    current::persistence::BinaryFileFormat>(json_filename,
+                                                                                            binary_filename);
+}
+
+template <typename STORAGE>
+uint64_t ConvertJournalToJSON(const std::string& binary_filename, const std::string& json_filename) {
+  return current::persistence::ConvertPersistedFile<typename STORAGE::persister_t::sherlock_entry_t,
+                                                    current::persistence::BinaryFileFormat,
+                                                    current::persistence::JSONFileFormat>(binary_filename,
+                                                                                          json_filename);
+}
+
 }  // namespace persister
 }  // namespace storage
 }  // namespace current
 
 using current::storage::persister::SherlockInMemoryStreamPersister;
 using current::storage::persister::SherlockStreamPersister;
+using current::storage::persister::SherlockBinaryStreamPersister;
 
 #endif  // CURRENT_STORAGE_PERSISTER_SHERLOCK_H
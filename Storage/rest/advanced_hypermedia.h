@@ -107,6 +107,43 @@ struct AdvancedHypermedia : Hypermedia {
       WithOptionalKeyFromURL(std::move(request), std::forward<F>(next));
     }
 
+    // The line of the collection for `entry` in its `?stream`: the brief record, as in the `data` of the
+    // collection page, or, for `?export`, the entry itself.
+    template <class INPUT>
+    std::string CollectionLine(const INPUT& input, const ENTRY& entry) const {
+      if (input.export_requested) {
+        return JSON<JSONFormat::Minimalistic>(entry) + '\n';
+      } else {
+        return JSON(FormatAsAdvancedHypermediaRecord<brief_entry_t>(entry, input, false)) + '\n';
+      }
+    }
+    template <class INPUT>
+    bool CanStream(const INPUT& input, Response& error) const {
+      if (input.export_requested && !ExportAllowed(input)) {
+        error = ErrorExportNotAllowed();
+        return false;
+      } else {
+        return true;
+      }
+    }
+
+    // The `?export` of the whole collection is slow. Only available off the followers, unless
+    // `CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER` is defined.
+    template <class INPUT>
+    static bool ExportAllowed(const INPUT& input) {
+#ifndef CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
+      return input.role == StorageRole::Follower;
+#else
+      static_cast<void>(input);
+      return true;
+#endif  // CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
+    }
+    static Response ErrorExportNotAllowed() {
+      return ErrorResponse(
+          HypermediaRESTError("NotFollowerMode", "Can only request full export from a Follower storage."),
+          HTTPResponseCode.Forbidden);
+    }
+
     template <class INPUT>
     Response Run(const INPUT& input) const {
       if (!input.url_key.empty()) {
@@ -175,26 +212,18 @@ struct AdvancedHypermedia : Hypermedia {
                 GenPageURL(query_i + query_n * 2 > i ? i - query_n : query_i + query_n, query_n);
           }
           return Response(response, HTTPResponseCode.OK);
+        } else if (!ExportAllowed(input)) {
+          return ErrorExportNotAllowed();
         } else {
-#ifndef CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
           // Export requested via `?export`, dump all the records.
-          // Slow. Only available off the followers.
-          if (input.role != StorageRole::Follower) {
-            return ErrorResponse(
-                HypermediaRESTError("NotFollowerMode", "Can only request full export from a Follower storage."),
-                HTTPResponseCode.Forbidden);
-          } else
-#endif  // CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
-          {
-            // Sadly, the `Response` must be returned.
-            // Have to create it in memory for now. -- D.K.
-            // TODO(dkorolev): Migrate to a better way.
-            std::ostringstream result;
-            for (const auto& element : PerStorageFieldType<PARTICULAR_FIELD>::Iterate(input.field)) {
-              result << JSON<JSONFormat::Minimalistic>(element) << '\n';
-            }
-            return result.str();
+          // Sadly, the `Response` must be returned.
+          // Have to create it in memory for now. -- D.K.
+          // TODO(dkorolev): Migrate to a better way.
+          std::ostringstream result;
+          for (const auto& element : PerStorageFieldType<PARTICULAR_FIELD>::Iterate(input.field)) {
+            result << CollectionLine(input, element);
           }
+          return result.str();
         }
       }
     }
@@ -29,6 +29,8 @@ SOFTWARE.
 #ifndef CURRENT_STORAGE_REST_BASIC_H
 #define CURRENT_STORAGE_REST_BASIC_H
 
+#include "pagination.h"
+#include "read_your_writes.h"
 #include "sfinae.h"
 
 #include "../storage.h"
@@ -74,9 +76,30 @@ struct Basic {
 
   template <typename PARTICULAR_FIELD, typename ENTRY, typename KEY>
   struct RESTfulDataHandlerGenerator<GET, PARTICULAR_FIELD, ENTRY, KEY> {
+    RESTfulPagination pagination;
+
     template <typename F>
     void Enter(Request request, F&& next) {
-      WithOptionalKeyFromURL(std::move(request), std::forward<F>(next));
+      if (pagination.ParseFromQuery(request.url.query)) {
+        WithOptionalKeyFromURL(std::move(request), std::forward<F>(next));
+      } else {
+        request(ErrorBadRequest("Invalid `limit`."));
+      }
+    }
+    // The line of the collection for `entry`, on its page and in its `?stream`: the key of the entry, or,
+    // for `?export`, the entry itself.
+    template <class INPUT>
+    std::string CollectionLine(const INPUT& input, const ENTRY& entry) const {
+      if (input.export_requested) {
+        return JSON<JSONFormat::Minimalistic>(entry) + '\n';
+      } else {
+        return current::ToString(PerStorageFieldType<PARTICULAR_FIELD>::ExtractOrComposeKey(entry)) + '\n';
+      }
+    }
+    // Returns `false`, setting the `error` response, if the collection can not be streamed.
+    template <class INPUT>
+    bool CanStream(const INPUT&, Response&) const {
+      return true;
     }
     template <class INPUT>
     Response Run(const INPUT& input) const {
@@ -88,11 +111,30 @@ struct Basic {
         } else {
           return Response("Nope.\n", HTTPResponseCode.NotFound);
         }
+      } else if (pagination.requested) {
+        std::string result;
+        std::string last_key;
+        const PageResult page = ForEachInPage(input.field,
+                                              pagination.cursor,
+                                              pagination.limit,
+                                              last_key,
+                                              [this, &input, &result](const ENTRY& entry) {
+                                                result += CollectionLine(input, entry);
+                                              });
+        if (page == PageResult::InvalidCursor) {
+          return ErrorBadRequest("Invalid `cursor`.");
+        }
+        Response response(result);
+        if (page == PageResult::HasMore) {
+          const std::string url =
+              input.restful_url_prefix + '/' + input.data_url_component + '/' + input.field_name;
+          response.SetHeader("Link", pagination.NextPageLink(url, last_key));
+        }
+        return response;
       } else {
         std::ostringstream result;
         for (const auto& element : PerStorageFieldType<PARTICULAR_FIELD>::Iterate(input.field)) {
-          result << current::ToString(PerStorageFieldType<PARTICULAR_FIELD>::ExtractOrComposeKey(element))
-                 << '\n';
+          result << CollectionLine(input, element);
         }
         return result.str();
       }
@@ -173,6 +215,28 @@ struct Basic {
     }
   };
 
+  // For `GET /data/$FIELD.$INDEX/$INDEX_KEY`. `RunUnique()` is given the entry the unique index maps the key
+  // into, if any, and `RunNonUnique()` the possibly empty range of the entries the non-unique one maps it into.
+  template <typename PARTICULAR_FIELD, typename ENTRY>
+  struct RESTfulIndexHandlerGenerator {
+    template <class INPUT>
+    Response RunUnique(const INPUT&, const ImmutableOptional<ENTRY>& result) const {
+      if (Exists(result)) {
+        return Value(result);
+      } else {
+        return Response("Nope.\n", HTTPResponseCode.NotFound);
+      }
+    }
+    template <class INPUT, typename ENTRIES>
+    Response RunNonUnique(const INPUT&, const ENTRIES& entries) const {
+      std::vector<ENTRY> result;
+      for (const auto& entry : entries) {
+        result.push_back(entry);
+      }
+      return result;
+    }
+  };
+
   template <typename STORAGE, typename ENTRY>
   struct RESTfulSchemaHandlerGenerator {
     using storage_t = STORAGE;
@@ -206,11 +270,30 @@ struct Basic {
     }
   };
 
+  static Response ErrorBadRequest(const std::string& message) {
+    return Response(message + '\n', HTTPResponseCode.BadRequest);
+  }
+
   // LCOV_EXCL_START
   static Response ErrorMethodNotAllowed(const std::string& method) {
     return Response("Method " + method + " not allowed.\n", HTTPResponseCode.MethodNotAllowed);
   }
   // LCOV_EXCL_STOP
+
+  static Response ErrorStorageIndexNotReached(uint64_t current_index) {
+    Response response("The storage is at index " + current::ToString(current_index) + ", retry later.\n",
+                      HTTPResponseCode.ServiceUnavailable);
+    response.SetHeader("Retry-After", current::ToString(kRESTStorageMinIndexRetryAfterSeconds));
+    return response;
+  }
+
+  static Response ErrorStorageIndexInvalid(const std::string& value) {
+    return Response("Invalid storage index `" + value + "`.\n", HTTPResponseCode.BadRequest);
+  }
+
+  static Response ErrorStorageIndexNotSupported() {
+    return Response("This storage has no followers, and no index to wait for.\n", HTTPResponseCode.BadRequest);
+  }
 };
 
 }  // namespace rest
@@ -0,0 +1,149 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Conditional GET for the data exposed via REST.
+//
+// The `200 OK` responses to `GET /data/$FIELD/$KEY` carry the `ETag` and the `Last-Modified` of the entry,
+// both derived from the timestamp of its last modification. The `200 OK` responses to `GET /data/$FIELD`
+// carry the `ETag` derived from the `DataVersion()` of the storage, the position in the stream its contents
+// correspond to, which changes with every committed transaction, be it made locally or replicated.
+//
+// If the `If-None-Match` header of the request lists the `ETag`, or, if there is no `If-None-Match`, the
+// `If-Modified-Since` header is not earlier than the `Last-Modified`, the response is `304 Not Modified`,
+// with the validators and no body. The validators are computed within the same read-only transaction as the
+// response itself, so they always describe the very data that would have been returned.
+
+#ifndef CURRENT_STORAGE_REST_CONDITIONAL_GET_H
+#define CURRENT_STORAGE_REST_CONDITIONAL_GET_H
+
+#include <chrono>
+
+#include "../storage.h"
+
+#include "../../Blocks/HTTP/api.h"
+#include "../../Bricks/net/http/headers/headers.h"
+#include "../../Bricks/strings/strings.h"
+#include "../../Bricks/time/chrono.h"
+#include "../../TypeSystem/optional.h"
+
+namespace current {
+namespace storage {
+namespace rest {
+
+namespace impl {
+
+template <typename FIELD, typename KEY>
+constexpr bool HasLastModified(char) {
+  return false;
+}
+
+template <typename FIELD, typename KEY>
+constexpr auto HasLastModified(int)
+    -> decltype(std::declval<const FIELD&>().LastModified(std::declval<KEY>()), bool()) {
+  return true;
+}
+
+template <typename KEY, typename FIELD>
+ENABLE_IF<HasLastModified<FIELD, KEY>(0), Optional<std::chrono::microseconds>> EntryLastModified(
+    const FIELD& field, const std::string& url_key) {
+  const auto last_modified = field.LastModified(current::FromString<KEY>(url_key));
+  if (Exists(last_modified)) {
+    return Value(last_modified);
+  } else {
+    return nullptr;
+  }
+}
+
+template <typename KEY, typename FIELD>
+ENABLE_IF<!HasLastModified<FIELD, KEY>(0), Optional<std::chrono::microseconds>> EntryLastModified(
+    const FIELD&, const std::string&) {
+  return nullptr;
+}
+
+}  // namespace impl
+
+// The `If-None-Match` and `If-Modified-Since` headers of a GET request.
+struct RESTfulConditionalGET {
+  current::net::http::Headers conditional_headers;
+
+  // Keeps only the conditional headers, as the request itself may be gone by the time they are applied.
+  void ParseFromHeaders(const current::net::http::Headers& headers) {
+    for (const char* header : {"If-None-Match", "If-Modified-Since"}) {
+      if (headers.Has(header)) {
+        conditional_headers.Set(header, headers.Get(header));
+      }
+    }
+  }
+
+  static std::string EntryETag(std::chrono::microseconds last_modified) {
+    return '"' + current::ToString(last_modified.count()) + '"';
+  }
+
+  static std::string CollectionETag(uint64_t data_version) {
+    return "\"v" + current::ToString(data_version) + '"';
+  }
+
+  // For the `200 OK` response, sets the validators and, if they match the request, turns it into `304`.
+  void Apply(Response& response,
+             const std::string& etag,
+             const Optional<std::chrono::microseconds>& last_modified) const {
+    if (response.code != HTTPResponseCode.OK) {
+      return;
+    }
+    response.SetHeader("ETag", etag);
+    if (Exists(last_modified) && !response.headers.Has("Last-Modified")) {
+      response.SetHeader("Last-Modified", FormatDateTimeAsIMFFix(Value(last_modified)));
+    }
+    if (NotModified(etag, last_modified)) {
+      response.code = HTTPResponseCode.NotModified;
+      response.body.clear();
+    }
+  }
+
+  // For `GET /data/$FIELD/$KEY`.
+  template <typename KEY, typename FIELD>
+  void ApplyToEntry(Response& response, const FIELD& field, const std::string& url_key) const {
+    if (response.code == HTTPResponseCode.OK) {
+      const auto last_modified = impl::EntryLastModified<KEY>(field, url_key);
+      if (Exists(last_modified)) {
+        Apply(response, EntryETag(Value(last_modified)), last_modified);
+      }
+    }
+  }
+
+ private:
+  bool NotModified(const std::string& etag, const Optional<std::chrono::microseconds>& last_modified) const {
+    if (Exists(last_modified)) {
+      return current::net::http::NotModified(conditional_headers, etag, Value(last_modified));
+    } else {
+      return current::net::http::NotModified(conditional_headers, etag);
+    }
+  }
+};
+
+}  // namespace rest
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_REST_CONDITIONAL_GET_H
@@ -258,9 +258,36 @@ struct Hypermedia {
 
   template <typename PARTICULAR_FIELD, typename ENTRY, typename KEY>
   struct RESTfulDataHandlerGenerator<GET, PARTICULAR_FIELD, ENTRY, KEY> {
+    RESTfulPagination pagination;
+
     template <typename F>
     void Enter(Request request, F&& next) {
-      WithOptionalKeyFromURL(std::move(request), std::forward<F>(next));
+      if (pagination.ParseFromQuery(request.url.query)) {
+        WithOptionalKeyFromURL(std::move(request), std::forward<F>(next));
+      } else {
+        request(
+            ErrorResponseObject(HypermediaRESTError("InvalidLimit", "The `limit` must be a positive number.")),
+            HTTPResponseCode.BadRequest);
+      }
+    }
+    template <class INPUT>
+    static std::string EntryURL(const INPUT& input, const ENTRY& entry) {
+      return input.restful_url_prefix + '/' + input.data_url_component + '/' + input.field_name + '/' +
+             current::ToString(PerStorageFieldType<PARTICULAR_FIELD>::ExtractOrComposeKey(entry));
+    }
+    // The line of the collection for `entry` in its `?stream`: the URL of the entry, as in the `data` of the
+    // collection page, or, for `?export`, the entry itself.
+    template <class INPUT>
+    std::string CollectionLine(const INPUT& input, const ENTRY& entry) const {
+      if (input.export_requested) {
+        return JSON<JSONFormat::Minimalistic>(entry) + '\n';
+      } else {
+        return EntryURL(input, entry) + '\n';
+      }
+    }
+    template <class INPUT>
+    bool CanStream(const INPUT&, Response&) const {
+      return true;
     }
     template <class INPUT>
     Response Run(const INPUT& input) const {
@@ -284,10 +311,28 @@ struct Hypermedia {
       } else {
         HypermediaRESTContainerResponse response;
         response.url = input.restful_url_prefix + '/' + input.data_url_component + '/' + input.field_name;
+        if (pagination.requested) {
+          std::string last_key;
+          const PageResult page = ForEachInPage(input.field,
+                                                pagination.cursor,
+                                                pagination.limit,
+                                                last_key,
+                                                [&input, &response](const ENTRY& entry) {
+                                                  response.data.emplace_back(EntryURL(input, entry));
+                                                });
+          if (page == PageResult::InvalidCursor) {
+            return ErrorResponse(
+                HypermediaRESTError("InvalidCursor", "The `cursor` does not point into the collection."),
+                HTTPResponseCode.BadRequest);
+          }
+          Response paginated_response(response);
+          if (page == PageResult::HasMore) {
+            paginated_response.SetHeader("Link", pagination.NextPageLink(response.url, last_key));
+          }
+          return paginated_response;
+        }
         for (const auto& element : PerStorageFieldType<PARTICULAR_FIELD>::Iterate(input.field)) {
-          response.data.emplace_back(
-              response.url + '/' +
-              current::ToString(PerStorageFieldType<PARTICULAR_FIELD>::ExtractOrComposeKey(element)));
+          response.data.emplace_back(EntryURL(input, element));
         }
         return Response(response);
       }
@@ -441,6 +486,37 @@ struct Hypermedia {
     }
   };
 
+  template <typename PARTICULAR_FIELD, typename ENTRY>
+  struct RESTfulIndexHandlerGenerator {
+    template <class INPUT>
+    Response RunUnique(const INPUT& input, const ImmutableOptional<ENTRY>& result) const {
+      if (Exists(result)) {
+        const std::string url =
+            input.restful_url_prefix + '/' + input.data_url_component + '/' + input.field_name + '/' +
+            current::ToString(PerStorageFieldType<PARTICULAR_FIELD>::ExtractOrComposeKey(Value(result)));
+        return Response(HypermediaRESTRecordResponse<ENTRY>(url, Value(result)));
+      } else {
+        return ErrorResponse(
+            ResourceNotFoundError("The requested resource not found.",
+                                  {{"index", input.index_name}, {"index_key", input.index_key}}),
+            HTTPResponseCode.NotFound);
+      }
+    }
+    template <class INPUT, typename ENTRIES>
+    Response RunNonUnique(const INPUT& input, const ENTRIES& entries) const {
+      const std::string collection_url =
+          input.restful_url_prefix + '/' + input.data_url_component + '/' + input.field_name;
+      HypermediaRESTContainerResponse response;
+      response.url = collection_url + '.' + input.index_name + '/' + input.index_key;
+      for (const auto& entry : entries) {
+        response.data.emplace_back(
+            collection_url + '/' +
+            current::ToString(PerStorageFieldType<PARTICULAR_FIELD>::ExtractOrComposeKey(entry)));
+      }
+      return Response(response);
+    }
+  };
+
   template <typename STORAGE, typename ENTRY>
   using RESTfulSchemaHandlerGenerator = Basic::template RESTfulSchemaHandlerGenerator<STORAGE, ENTRY>;
 
@@ -448,6 +524,30 @@ struct Hypermedia {
     return ErrorResponse(MethodNotAllowedError("Supported methods: GET, PUT, POST, DELETE.", method),
                          HTTPResponseCode.MethodNotAllowed);
   }
+
+  static Response ErrorStorageIndexNotReached(uint64_t current_index) {
+    Response response =
+        ErrorResponse(HypermediaRESTError("StorageIndexNotReached",
+                                          "The storage has not reached the requested index, retry later.",
+                                          {{"current_index", current::ToString(current_index)}}),
+                      HTTPResponseCode.ServiceUnavailable);
+    response.SetHeader("Retry-After", current::ToString(kRESTStorageMinIndexRetryAfterSeconds));
+    return response;
+  }
+
+  static Response ErrorStorageIndexInvalid(const std::string& value) {
+    return ErrorResponse(InvalidHeaderError("The storage index must be a non-negative integer.",
+                                            kRESTStorageMinIndexHeader,
+                                            value),
+                         HTTPResponseCode.BadRequest);
+  }
+
+  static Response ErrorStorageIndexNotSupported() {
+    return ErrorResponse(
+        HypermediaRESTError("StorageIndexNotSupported",
+                            "This storage has no followers, and no index to wait for."),
+        HTTPResponseCode.BadRequest);
+  }
 };
 
 }  // namespace rest
@@ -0,0 +1,149 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+// Cursor-based pagination over the collections exposed via REST.
+//
+// `GET /data/$FIELD?limit=N` returns at most `N` entries and, if there are more, the `Link: <...>; rel="next"`
+// header with the URL of the next page. The next page is `?limit=N&cursor=KEY`, where `KEY` is the key of the
+// last entry returned. The cursor is looked up by the key, so that fetching a page does not iterate over
+// the pages before it. The ordered containers resume from any cursor, the unordered ones only from the key of
+// an entry which is, or, for the dictionaries, which has been, there; otherwise, the request fails with a 400.
+//
+// `GET /data/$FIELD?stream` responds with all the entries of the collection, one line per entry, in chunks.
+// The lines are formatted by the REST implementation as its collection page would list the entries, and, with
+// `?stream&export`, are the entries themselves, as JSON.
+// Each chunk of `kRESTStreamChunkSize` entries is serialized within its own read-only transaction, and is sent
+// outside it. Thus, the collection is never serialized in memory as a whole, and the storage is not blocked
+// while the response is being sent. Should the stream be unable to resume after a chunk, as the unordered
+// container has lost the entry it stopped at, the response is cut short, without its final empty chunk, so that
+// the client can tell it is incomplete.
+//
+// Each page, and each chunk, is consistent. Across them, with ordered containers, an entry present throughout
+// the paging is returned exactly once. With unordered ones, the insertions made between the pages may rehash
+// the container, in which case some entries may be skipped or returned twice.
+
+#ifndef CURRENT_STORAGE_REST_PAGINATION_H
+#define CURRENT_STORAGE_REST_PAGINATION_H
+
+#include "../storage.h"
+
+#include "../../Blocks/URL/url.h"
+#include "../../TypeSystem/optional.h"
+
+namespace current {
+namespace storage {
+namespace rest {
+
+constexpr size_t kRESTStreamChunkSize = 1000u;
+
+// The `?limit=&cursor=` parameters of a GET request for a collection.
+struct RESTfulPagination {
+  bool requested = false;
+  size_t limit = 0u;
+  Optional<std::string> cursor;
+
+  // Returns `false` if the parameters are malformed.
+  template <typename QUERY>
+  bool ParseFromQuery(const QUERY& query) {
+    if (query.has("limit")) {
+      requested = true;
+      limit = current::FromString<size_t>(query["limit"]);
+      if (!limit) {
+        return false;
+      }
+    }
+    if (query.has("cursor")) {
+      cursor = query["cursor"];
+    }
+    return true;
+  }
+
+  // The value of the `Link` header pointing to the page after `last_key`.
+  std::string NextPageLink(const std::string& collection_url, const std::string& last_key) const {
+    return '<' + collection_url + "?limit=" + current::ToString(limit) + "&cursor=" +
+           current::url::URL::EncodeURIComponent(last_key) + ">; rel=\"next\"";
+  }
+};
+
+// The outcome of `ForEachInPage()`.
+enum class PageResult : int { LastPage = 0, HasMore = 1, InvalidCursor = 2 };
+
+namespace impl {
+
+template <typename ITERATOR, typename F>
+PageResult ForEachFrom(ITERATOR it, ITERATOR end, size_t limit, F&& f) {
+  for (size_t i = 0u; i < limit && it != end; ++i, ++it) {
+    f(*it);
+  }
+  return it != end ? PageResult::HasMore : PageResult::LastPage;
+}
+
+}  // namespace impl
+
+// Calls `f(entry)` for at most `limit` entries of `field`, starting right after the one with the key `*cursor`,
+// or from the first one if `cursor` is `nullptr`. The page is positioned by the `After()` lookup of
+// the container, not by skipping the entries before it. The cursor an unordered container can not resume from
+// is reported as an `InvalidCursor`, without calling `f`: an empty last page would make the collection look
+// complete.
+template <typename FIELD, typename F>
+PageResult ForEachAfter(const FIELD& field, const typename FIELD::key_t* cursor, size_t limit, F&& f) {
+  if (cursor) {
+    const auto begin = field.After(*cursor);
+    if (Exists(begin)) {
+      return impl::ForEachFrom(Value(begin), field.end(), limit, std::forward<F>(f));
+    } else {
+      return PageResult::InvalidCursor;
+    }
+  } else {
+    return impl::ForEachFrom(field.begin(), field.end(), limit, std::forward<F>(f));
+  }
+}
+
+// The same for the `?cursor=` of a REST request. Sets `last_key` to the key of the last entry passed to `f`.
+// The cursor which does not parse back into the very same key is an `InvalidCursor` as well.
+template <typename FIELD, typename F>
+PageResult ForEachInPage(
+    const FIELD& field, const Optional<std::string>& cursor, size_t limit, std::string& last_key, F&& f) {
+  using entry_t = current::decay<decltype(*field.begin())>;
+  const auto g = [&last_key, &f](const entry_t& entry) {
+    last_key = current::ToString(PerStorageFieldType<FIELD>::ExtractOrComposeKey(entry));
+    f(entry);
+  };
+  if (Exists(cursor)) {
+    const auto key = current::FromString<typename FIELD::key_t>(Value(cursor));
+    if (current::ToString(key) != Value(cursor)) {
+      return PageResult::InvalidCursor;
+    }
+    return ForEachAfter(field, &key, limit, g);
+  } else {
+    return ForEachAfter(field, nullptr, limit, g);
+  }
+}
+
+}  // namespace rest
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_REST_PAGINATION_H
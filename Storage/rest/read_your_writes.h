@@ -0,0 +1,146 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+
+// The "read your writes" consistency for the storages replicated to the followers.
+//
+// The responses to the POST, PUT, and DELETE requests to the master carry the `X-Current-Storage-Index` header,
+// the `StreamIndex()` of the storage as of the moment the change was persisted. The GET requests with this
+// value passed as the `X-Current-Storage-Min-Index` header are only served once the storage has reached it.
+// Thus, the reads can be spread across the followers, and each client still sees its own writes.
+//
+// A storage which is behind does not hold the request, and the worker thread serving it, for long: if it does
+// not catch up within `kRESTStorageMinIndexTimeout`, the response is `503` with `Retry-After`, for the client
+// to retry, possibly with another follower or with the master.
+//
+// The storages persisted into a plain JSON file have no followers, and no transaction boundaries to count
+// the stream entries by. Their responses carry no index, and the requests carrying one are rejected with `400`.
+
+#ifndef CURRENT_STORAGE_REST_READ_YOUR_WRITES_H
+#define CURRENT_STORAGE_REST_READ_YOUR_WRITES_H
+
+#include <chrono>
+
+#include "../storage.h"
+
+#include "../../Blocks/HTTP/api.h"
+#include "../../Bricks/net/http/headers/headers.h"
+
+namespace current {
+namespace storage {
+namespace rest {
+
+constexpr const char* kRESTStorageIndexHeader = "X-Current-Storage-Index";
+constexpr const char* kRESTStorageMinIndexHeader = "X-Current-Storage-Min-Index";
+constexpr std::chrono::microseconds kRESTStorageMinIndexTimeout = std::chrono::milliseconds(100);
+constexpr int kRESTStorageMinIndexRetryAfterSeconds = 1;
+
+namespace impl {
+
+template <typename PERSISTER>
+constexpr bool HasStreamIndex(char) {
+  return false;
+}
+
+template <typename PERSISTER>
+constexpr auto HasStreamIndex(int) -> decltype(std::declval<const PERSISTER&>().StreamIndex(), bool()) {
+  return true;
+}
+
+template <typename STORAGE>
+using storage_has_stream_index_t =
+    std::integral_constant<bool, HasStreamIndex<typename STORAGE::persister_t>(0)>;
+
+template <class REST_IMPL, typename STORAGE>
+bool WaitForStorageIndexOrRespond(const STORAGE& storage, Request& request, std::true_type) {
+  const std::string& value = request.headers.Get(kRESTStorageMinIndexHeader);
+  const uint64_t index = current::FromString<uint64_t>(value);
+  if (current::ToString(index) != value) {
+    request(REST_IMPL::ErrorStorageIndexInvalid(value));
+    return false;
+  }
+  if (storage.WaitForStreamIndex(index, kRESTStorageMinIndexTimeout)) {
+    return true;
+  } else {
+    request(REST_IMPL::ErrorStorageIndexNotReached(storage.StreamIndex()));
+    return false;
+  }
+}
+
+template <class REST_IMPL, typename STORAGE>
+bool WaitForStorageIndexOrRespond(const STORAGE&, Request& request, std::false_type) {
+  request(REST_IMPL::ErrorStorageIndexNotSupported());
+  return false;
+}
+
+template <typename STORAGE>
+void SetStorageIndexHeader(const STORAGE& storage, Response& response, std::true_type) {
+  response.SetHeader(kRESTStorageIndexHeader, current::ToString(storage.StreamIndex()));
+}
+
+template <typename STORAGE>
+void SetStorageIndexHeader(const STORAGE&, Response&, std::false_type) {}
+
+}  // namespace impl
+
+// Waits, briefly, until the storage has reached the index requested via the header, if any. Returns `false`
+// if the request has been responded to with an error instead, as the index is not a number, as it has not
+// been reached in time, or as the storage has no stream index.
+template <class REST_IMPL, typename STORAGE>
+bool WaitForRequestedStorageIndex(const STORAGE& storage, Request& request) {
+  if (request.headers.Has(kRESTStorageMinIndexHeader)) {
+    return impl::WaitForStorageIndexOrRespond<REST_IMPL>(
+        storage, request, impl::storage_has_stream_index_t<STORAGE>());
+  } else {
+    return true;
+  }
+}
+
+// Passed as the second step of the read-write transaction, called once its result has been persisted,
+// to add the index of the storage to the response.
+template <typename STORAGE>
+struct RESTfulWriteResponder {
+  const STORAGE& storage;
+  Request request;
+
+  RESTfulWriteResponder(const STORAGE& storage, Request request)
+      : storage(storage), request(std::move(request)) {}
+  RESTfulWriteResponder(RESTfulWriteResponder&&) = default;
+
+  void operator()(Response response) {
+    impl::SetStorageIndexHeader(storage, response, impl::storage_has_stream_index_t<STORAGE>());
+    request(std::move(response));
+  }
+};
+
+template <typename STORAGE>
+RESTfulWriteResponder<STORAGE> RespondWithStorageIndex(const STORAGE& storage, Request request) {
+  return RESTfulWriteResponder<STORAGE>(storage, std::move(request));
+}
+
+}  // namespace rest
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_REST_READ_YOUR_WRITES_H
@@ -0,0 +1,231 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2016 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Read-only snapshots of the storage, to serve reads without ever taking the storage mutex.
+//
+// `ReadOnlySnapshots<STORAGE> snapshots(storage);` keeps two replicas of the fields of a Sherlock-persisted
+// storage, "front" and "back", RCU-style. The front replica is published via an atomic `std::shared_ptr<>`,
+// and `snapshots.Acquire()` / `snapshots.ReadOnlyTransaction(f)` read it without any locking. The replicas
+// follow the stream of the storage in a dedicated thread, the same way the following storage does:
+// the transactions are applied to the back replica as soon as no reader holds it anymore, after which
+// the replicas are swapped.
+//
+// Thus, readers never block writers, and writers never block readers. A long-running reader only delays
+// the moment the snapshot gets fresher. Each snapshot is consistent, as transactions are applied as a whole.
+//
+// The price is the memory: each replica is a full copy of the storage. The `Snapshot`-s acquired may outlive
+// `ReadOnlySnapshots`, which does not wait for them to be released when destructed.
+
+#ifndef CURRENT_STORAGE_SNAPSHOT_H
+#define CURRENT_STORAGE_SNAPSHOT_H
+
+#include "../port.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "base.h"
+
+#include "../Sherlock/sherlock.h"
+
+#include "../Bricks/waitable_atomic/waitable_atomic.h"
+
+namespace current {
+namespace storage {
+
+template <typename STORAGE>
+class ReadOnlySnapshots final {
+ public:
+  using storage_t = STORAGE;
+  using fields_t = typename std::remove_reference<typename storage_t::fields_by_ref_t>::type;
+  using transaction_t = typename storage_t::transaction_t;
+
+  // The number of transactions applied at most before the snapshot is refreshed while catching up.
+  constexpr static size_t kMaxTransactionsPerRefresh = 1000u;
+
+  struct Replica {
+    fields_t fields;
+    uint64_t transactions_count = 0u;
+  };
+
+  // An acquired snapshot. Reading from it is safe, lock-free, and reflects the state of the storage
+  // after exactly `TransactionsCount()` transactions.
+  class Snapshot final {
+   public:
+    explicit Snapshot(std::shared_ptr<const Replica> replica) : replica_(std::move(replica)) {}
+    const fields_t& operator*() const { return replica_->fields; }
+    const fields_t* operator->() const { return &replica_->fields; }
+    uint64_t TransactionsCount() const { return replica_->transactions_count; }
+
+   private:
+    std::shared_ptr<const Replica> replica_;
+  };
+
+  explicit ReadOnlySnapshots(storage_t& storage)
+      : replicas_(std::make_shared<Replicas>()), transactions_count_(0u), subscriber_(*this) {
+    Publish(0u);
+    subscriber_scope_ = storage.InternalExposeStream().template Subscribe<transaction_t>(subscriber_);
+  }
+
+  // The subscriber thread may be waiting for the back replica to be released by a reader; it is woken up
+  // to terminate instead.
+  ~ReadOnlySnapshots() {
+    {
+      std::lock_guard<std::mutex> lock(replicas_->mutex);
+      replicas_->terminating = true;
+    }
+    replicas_->condition_variable.notify_all();
+    subscriber_scope_ = nullptr;
+    std::atomic_store(&published_, std::shared_ptr<const Replica>());
+  }
+
+  // Thread-safe. Never blocks.
+  Snapshot Acquire() const { return Snapshot(std::atomic_load(&published_)); }
+
+  template <typename F>
+  using f_result_t = typename std::result_of<F(const fields_t&)>::type;
+
+  template <typename F>
+  f_result_t<F> ReadOnlyTransaction(F&& f) const {
+    const Snapshot snapshot = Acquire();
+    return f(*snapshot);
+  }
+
+  // The number of transactions reflected by the most recently published snapshot.
+  uint64_t TransactionsCount() const { return transactions_count_.GetValue(); }
+
+  void WaitForTransactionsCount(uint64_t count) const {
+    transactions_count_.Wait([count](uint64_t value) { return value >= count; });
+  }
+
+ private:
+  struct SubscriberImpl {
+    using EntryResponse = current::ss::EntryResponse;
+    using TerminationResponse = current::ss::TerminationResponse;
+
+    ReadOnlySnapshots& self;
+    explicit SubscriberImpl(ReadOnlySnapshots& self) : self(self) {}
+
+    EntryResponse operator()(const transaction_t& transaction, idxts_t current, idxts_t last) {
+      self.pending_.push_back(transaction);
+      if (current.index == last.index || self.pending_.size() >= kMaxTransactionsPerRefresh) {
+        if (!self.Refresh()) {
+          return EntryResponse::Done;
+        }
+      }
+      return EntryResponse::More;
+    }
+
+    EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return EntryResponse::More; }
+    TerminationResponse Terminate() const { return TerminationResponse::Terminate; }
+  };
+  using subscriber_t = current::ss::StreamSubscriber<SubscriberImpl, transaction_t>;
+
+  // Called from the subscriber thread only: brings the back replica up to date and makes it the front one.
+  // Returns `false` if `ReadOnlySnapshots` is being destructed.
+  bool Refresh() {
+    const size_t back = 1u - front_;
+    {
+      std::unique_lock<std::mutex> lock(replicas_->mutex);
+      Replicas& replicas = *replicas_;
+      replicas.condition_variable.wait(lock, [&replicas, back]() {
+        return replicas.released[back] || replicas.terminating;
+      });
+      if (replicas.terminating) {
+        return false;
+      }
+    }
+    Replica& replica = replicas_->replicas[back];
+    // The back replica is behind by the transactions applied to the front one the last time, plus `pending_`.
+    const size_t behind = static_cast<size_t>(replica.transactions_count - pending_begin_);
+    for (size_t i = behind; i < pending_.size(); ++i) {
+      for (const auto& mutation : pending_[i].mutations) {
+        mutation.Call(replica.fields);
+      }
+    }
+    replica.transactions_count = pending_begin_ + pending_.size();
+    Publish(back);
+    // Only keep the transactions the new back replica, the former front one, is yet to apply.
+    while (pending_begin_ < replicas_->replicas[1u - back].transactions_count) {
+      pending_.pop_front();
+      ++pending_begin_;
+    }
+    transactions_count_.SetValue(replica.transactions_count);
+    return true;
+  }
+
+  void Publish(size_t index) {
+    {
+      std::lock_guard<std::mutex> lock(replicas_->mutex);
+      replicas_->released[index] = false;
+    }
+    front_ = index;
+    // The deleter is invoked once the replica is neither published nor held by any reader. It keeps
+    // the replicas alive, as the last reader may release the snapshot after `ReadOnlySnapshots` is destructed.
+    const std::shared_ptr<Replicas> replicas = replicas_;
+    const auto deleter = [replicas, index](const Replica*) {
+      {
+        std::lock_guard<std::mutex> lock(replicas->mutex);
+        replicas->released[index] = true;
+      }
+      replicas->condition_variable.notify_all();
+    };
+    std::atomic_store(&published_, std::shared_ptr<const Replica>(&replicas->replicas[index], deleter));
+  }
+
+  // The replicas, and the state of them being held by the readers, shared with the acquired snapshots.
+  struct Replicas {
+    Replica replicas[2];
+    std::mutex mutex;
+    std::condition_variable condition_variable;
+    bool released[2] = {true, true};
+    bool terminating = false;
+  };
+  const std::shared_ptr<Replicas> replicas_;
+  size_t front_ = 0u;
+
+  std::shared_ptr<const Replica> published_;
+  WaitableAtomic<uint64_t> transactions_count_;
+
+  // The transactions not yet applied to both replicas, `pending_begin_` being the index of the first one.
+  std::deque<transaction_t> pending_;
+  uint64_t pending_begin_ = 0u;
+
+  subscriber_t subscriber_;
+  current::sherlock::SubscriberScope subscriber_scope_;
+
+  ReadOnlySnapshots(const ReadOnlySnapshots&) = delete;
+  ReadOnlySnapshots(ReadOnlySnapshots&&) = delete;
+  ReadOnlySnapshots& operator=(const ReadOnlySnapshots&) = delete;
+  ReadOnlySnapshots& operator=(ReadOnlySnapshots&&) = delete;
+};
+
+}  // namespace storage
+}  // namespace current
+
+using current::storage::ReadOnlySnapshots;
+
+#endif  // CURRENT_STORAGE_SNAPSHOT_H
@@ -46,10 +46,12 @@ SOFTWARE.
 #include <atomic>
 
 #include "base.h"
+#include "checkpoint.h"
 #include "transaction.h"
 #include "transaction_policy.h"
 #include "transaction_result.h"
 
+#include "container/compact_many_to_many.h"
 #include "container/dictionary.h"
 #include "container/many_to_many.h"
 #include "container/one_to_one.h"
@@ -69,7 +71,7 @@ SOFTWARE.
 namespace current {
 namespace storage {
 
-#define CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(dictionary_type, entry_type, entry_name)        \
+#define CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(dictionary_type, entry_type, entry_name, indexes) \
   CURRENT_STRUCT(entry_name##Updated) {                                                             \
     CURRENT_FIELD(us, std::chrono::microseconds);                                                   \
     CURRENT_FIELD(data, entry_type);                                                                \
@@ -86,7 +88,7 @@ namespace storage {
   };                                                                                                \
   struct entry_name {                                                                               \
     template <typename T, typename E1, typename E2>                                                 \
-    using field_t = dictionary_type<T, E1, E2>;                                                     \
+    using field_t = dictionary_type<T, E1, E2, indexes>;                                            \
     using entry_t = entry_type;                                                                     \
     using key_t = ::current::storage::sfinae::ENTRY_KEY_TYPE<entry_type>;                           \
     using update_event_t = entry_name##Updated;                                                     \
@@ -96,10 +98,20 @@ namespace storage {
   }
 
 #define CURRENT_STORAGE_FIELD_ENTRY_UnorderedDictionary(entry_type, entry_name) \
-  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(UnorderedDictionary, entry_type, entry_name)
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                  \
+      UnorderedDictionary, entry_type, entry_name, ::current::storage::index::Indexes<>)
 
 #define CURRENT_STORAGE_FIELD_ENTRY_OrderedDictionary(entry_type, entry_name) \
-  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(OrderedDictionary, entry_type, entry_name)
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                \
+      OrderedDictionary, entry_type, entry_name, ::current::storage::index::Indexes<>)
+
+#define CURRENT_STORAGE_FIELD_ENTRY_FlatUnorderedDictionary(entry_type, entry_name) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                      \
+      FlatUnorderedDictionary, entry_type, entry_name, ::current::storage::index::Indexes<>)
+
+#define CURRENT_STORAGE_FIELD_ENTRY_FlatOrderedDictionary(entry_type, entry_name) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                    \
+      FlatOrderedDictionary, entry_type, entry_name, ::current::storage::index::Indexes<>)
 
 #define CURRENT_STORAGE_FIELD_ENTRY_Matrix_IMPL(matrix_type, entry_type, entry_name)                \
   CURRENT_STRUCT(entry_name##Updated) {                                                             \
@@ -145,6 +157,9 @@ namespace storage {
 #define CURRENT_STORAGE_FIELD_ENTRY_OrderedManyToUnorderedMany(entry_type, entry_name) \
   CURRENT_STORAGE_FIELD_ENTRY_Matrix_IMPL(OrderedManyToUnorderedMany, entry_type, entry_name)
 
+#define CURRENT_STORAGE_FIELD_ENTRY_CompactManyToMany(entry_type, entry_name) \
+  CURRENT_STORAGE_FIELD_ENTRY_Matrix_IMPL(CompactManyToMany, entry_type, entry_name)
+
 #define CURRENT_STORAGE_FIELD_ENTRY_UnorderedOneToUnorderedOne(entry_type, entry_name) \
   CURRENT_STORAGE_FIELD_ENTRY_Matrix_IMPL(UnorderedOneToUnorderedOne, entry_type, entry_name)
 
@@ -172,6 +187,11 @@ namespace storage {
 #define CURRENT_STORAGE_FIELD_ENTRY(container, entry_type, entry_name) \
   CURRENT_STORAGE_FIELD_ENTRY_##container(entry_type, entry_name)
 
+// A dictionary entry with secondary indexes, see `CURRENT_STORAGE_INDEX` and `CURRENT_STORAGE_FIELD_INDEX`.
+#define CURRENT_STORAGE_FIELD_ENTRY_WITH_INDEXES(dictionary_type, entry_type, entry_name, ...) \
+  using entry_name##Indexes = ::current::storage::index::Indexes<__VA_ARGS__>;                  \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(dictionary_type, entry_type, entry_name, entry_name##Indexes)
+
 #define CURRENT_STORAGE_FIELDS_HELPERS(name)                                                                   \
   template <typename T>                                                                                        \
   struct CURRENT_STORAGE_FIELDS_HELPER;                                                                        \
@@ -250,7 +270,7 @@ class GenericStorageImpl {
     if (role_ == StorageRole::Follower) {
       CURRENT_THROW(ReadWriteTransactionInFollowerStorageException());
     }
-    return transaction_policy_.Transaction([&f, this]() { return f(fields_); });
+    return DoReadWriteTransaction(std::forward<F>(f), defers_transactions_t());
   }
 
   template <typename F1, typename F2>
@@ -259,7 +279,7 @@ class GenericStorageImpl {
     if (role_ == StorageRole::Follower) {
       CURRENT_THROW(ReadWriteTransactionInFollowerStorageException());
     }
-    return transaction_policy_.Transaction([&f1, this]() { return f1(fields_); }, std::forward<F2>(f2));
+    return DoReadWriteTransaction(std::forward<F1>(f1), std::forward<F2>(f2), defers_transactions_t());
   }
 
   template <typename F>
@@ -277,6 +297,27 @@ class GenericStorageImpl {
 
   void ExposeRawLogViaHTTP(int port, const std::string& route) { persister_.ExposeRawLogViaHTTP(port, route); }
 
+  // Saves the state of all the fields as a checkpoint, for the storage to only replay the stream after it
+  // when started the next time. Requires the storage to be constructed with `StorageCheckpoints` as its first
+  // argument. The fields are only copied under the mutex, the file is written with no transactions blocked.
+  // Returns the index of the first stream entry not reflected by the checkpoint.
+  uint64_t Checkpoint() {
+    StorageCheckpoint<fields_variant_t> checkpoint;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      checkpoint.next_index = persister_.CheckpointIndex();
+      CheckpointEventsCollector collector{checkpoint.mutations};
+      ExportCheckpointEvents<FIELDS_COUNT>(collector);
+    }
+    persister_.SaveCheckpoint(checkpoint);
+    return checkpoint.next_index;
+  }
+
+  // Registers the endpoint to create a checkpoint by a POST request.
+  void ExposeCheckpointsViaHTTP(int port, const std::string& route) {
+    persister_.ExposeCheckpointsViaHTTP(port, route, [this]() { return Checkpoint(); });
+  }
+
   typename std::result_of<decltype(&persister_t::InternalExposeStream)(persister_t)>::type
   InternalExposeStream() {
     return persister_.InternalExposeStream();
@@ -290,6 +331,25 @@ class GenericStorageImpl {
     transactions_count_.Wait([count](uint64_t value) { return value >= count; });
   }
 
+  // The number of the stream entries reflected by the fields of the storage. Taken on the master after
+  // a read-write transaction, it is the "read your writes" token for the followers, see `WaitForStreamIndex()`.
+  // Unlike `TransactionsCount()`, which counts the mutations applied, it is the same on the master and on
+  // the followers, regardless of the checkpoints they have started from.
+  uint64_t StreamIndex() const { return persister_.StreamIndex(); }
+
+  void WaitForStreamIndex(uint64_t index) const { persister_.WaitForStreamIndex(index); }
+
+  // Returns whether the index has been reached within the timeout.
+  bool WaitForStreamIndex(uint64_t index, std::chrono::microseconds timeout) const {
+    return persister_.WaitForStreamIndex(index, timeout);
+  }
+
+  // The position in the stream which the committed contents of the storage correspond to. A function of the
+  // contents: the same on the master and on its followers, and after a restart, with or without a checkpoint,
+  // while the rolled back transactions do not change it. Used to derive the ETags of the collections exposed
+  // via REST. Must be called from within a transaction, and does not reflect its uncommitted mutations.
+  uint64_t DataVersion() const { return persister_.AppliedStreamIndex(); }
+
   void FlipToMaster() {
     std::lock_guard<std::mutex> lock(mutex_);
     if (role_ == StorageRole::Follower) {
@@ -301,6 +361,64 @@ class GenericStorageImpl {
   }
 
   void GracefulShutdown() { transaction_policy_.GracefulShutdown(); }
+
+ private:
+  // The synchronous policy runs the read-write transaction before returning, so it is passed `f` by reference.
+  // The policy which runs it later, from another thread, is passed an `OwningReadWriteTransaction`.
+  using defers_transactions_t =
+      std::integral_constant<bool, TRANSACTION_POLICY<persister_t>::kDefersReadWriteTransactions>;
+
+  // Owns the moved `f`. A functor rather than a lambda, as C++11 lambdas can not capture by move.
+  template <typename F>
+  struct OwningReadWriteTransaction {
+    F f;
+    FIELDS& fields;
+    f_result_t<F> operator()() { return f(fields); }
+  };
+
+  template <typename F>
+  ::current::Future<::current::storage::TransactionResult<f_result_t<F>>, ::current::StrictFuture::Strict>
+  DoReadWriteTransaction(F&& f, std::false_type) {
+    return transaction_policy_.Transaction([&f, this]() { return f(fields_); });
+  }
+
+  template <typename F>
+  ::current::Future<::current::storage::TransactionResult<f_result_t<F>>, ::current::StrictFuture::Strict>
+  DoReadWriteTransaction(F&& f, std::true_type) {
+    return transaction_policy_.Transaction(
+        OwningReadWriteTransaction<typename std::decay<F>::type>{std::forward<F>(f), fields_});
+  }
+
+  template <typename F1, typename F2>
+  ::current::Future<::current::storage::TransactionResult<void>, ::current::StrictFuture::Strict>
+  DoReadWriteTransaction(F1&& f1, F2&& f2, std::false_type) {
+    return transaction_policy_.Transaction([&f1, this]() { return f1(fields_); }, std::forward<F2>(f2));
+  }
+
+  template <typename F1, typename F2>
+  ::current::Future<::current::storage::TransactionResult<void>, ::current::StrictFuture::Strict>
+  DoReadWriteTransaction(F1&& f1, F2&& f2, std::true_type) {
+    return transaction_policy_.Transaction(
+        OwningReadWriteTransaction<typename std::decay<F1>::type>{std::forward<F1>(f1), fields_},
+        std::forward<F2>(f2));
+  }
+
+  struct CheckpointEventsCollector {
+    std::vector<fields_variant_t>& mutations;
+    template <typename E>
+    void operator()(const E& event) {
+      mutations.emplace_back(event);
+    }
+  };
+
+  template <int N>
+  std::enable_if_t<(N > 0)> ExportCheckpointEvents(CheckpointEventsCollector& collector) const {
+    ExportCheckpointEvents<N - 1>(collector);
+    fields_(ImmutableFieldByIndex<N - 1>()).ExportCheckpointEvents(collector);
+  }
+
+  template <int N>
+  std::enable_if_t<N == 0> ExportCheckpointEvents(CheckpointEventsCollector&) const {}
 };
 
 #define CURRENT_STORAGE_IMPLEMENTATION(name)                                                                   \
@@ -25,6 +25,7 @@ SOFTWARE.
 
 #define CURRENT_MOCK_TIME
 
+#include <random>
 #include <set>
 
 #include "docu/docu_2_code.cc"
@@ -33,6 +34,8 @@ SOFTWARE.
 #include "storage.h"
 #include "api.h"
 #include "persister/sherlock.h"
+#include "checkpoint.h"
+#include "snapshot.h"
 
 #include "rest/hypermedia.h"
 
@@ -141,6 +144,21 @@ CURRENT_STORAGE(TestStorage) {
   CURRENT_STORAGE_FIELD(oone_to_umany, CellOrderedOneToUnorderedMany);
 };
 
+CURRENT_STORAGE_FIELD_ENTRY(FlatUnorderedDictionary, Record, FlatUnorderedRecordDictionary);
+CURRENT_STORAGE_FIELD_ENTRY(FlatOrderedDictionary, Record, FlatOrderedRecordDictionary);
+
+CURRENT_STORAGE(FlatTestStorage) {
+  CURRENT_STORAGE_FIELD(flat_unordered, FlatUnorderedRecordDictionary);
+  CURRENT_STORAGE_FIELD(flat_ordered, FlatOrderedRecordDictionary);
+};
+
+CURRENT_STORAGE_FIELD_ENTRY(CompactManyToMany, Cell, CellCompactManyToMany);
+
+CURRENT_STORAGE(CompactTestStorage) {
+  CURRENT_STORAGE_FIELD(compact, CellCompactManyToMany);
+  CURRENT_STORAGE_FIELD(ordered, CellOrderedManyToOrderedMany);
+};
+
 }  // namespace transactional_storage_test
 
 TEST(TransactionalStorage, SmokeTest) {
@@ -1363,6 +1381,128 @@ TEST(TransactionalStorage, LastModifiedInDictionaryContainer) {
   }
 }
 
+TEST(TransactionalStorage, DictionaryTombstones) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  const auto keys = [](ImmutableFields<Storage> fields) {
+    std::vector<std::string> result;
+    for (const auto& record : fields.d) {
+      result.push_back(record.lhs);
+    }
+    return current::strings::Join(result, ',');
+  };
+  const auto last_modified = [](ImmutableFields<Storage> fields, const std::string& key) -> int64_t {
+    const auto t = fields.d.LastModified(key);
+    return Exists(t) ? Value(t).count() : -1;
+  };
+
+  current::time::SetNow(std::chrono::microseconds(100));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.d.Add(Record{"a", 1});
+    fields.d.Add(Record{"b", 2});
+    fields.d.Add(Record{"c", 3});
+  }).Wait();
+
+  // Erase, then roll back: the entry, its timestamp and the size are restored.
+  current::time::SetNow(std::chrono::microseconds(200));
+  EXPECT_FALSE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.d.Erase("b");
+    EXPECT_FALSE(Exists(fields.d["b"]));
+    EXPECT_EQ(2u, fields.d.Size());
+    EXPECT_EQ(200, Value(fields.d.LastModified("b")).count());
+    CURRENT_STORAGE_THROW_ROLLBACK();
+  }).Go()));
+  storage.ReadOnlyTransaction([&keys, &last_modified](ImmutableFields<Storage> fields) {
+    ASSERT_TRUE(Exists(fields.d["b"]));
+    EXPECT_EQ(2, Value(fields.d["b"]).rhs);
+    EXPECT_EQ(100, last_modified(fields, "b"));
+    EXPECT_EQ(3u, fields.d.Size());
+    EXPECT_EQ("a,b,c", keys(fields));
+  }).Wait();
+
+  // Erase for real: the tombstone keeps the deletion timestamp, and is skipped by the size and the iteration.
+  current::time::SetNow(std::chrono::microseconds(300));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.d.Erase("b"); }).Wait();
+  storage.ReadOnlyTransaction([&keys, &last_modified](ImmutableFields<Storage> fields) {
+    EXPECT_FALSE(Exists(fields.d["b"]));
+    EXPECT_EQ(300, last_modified(fields, "b"));
+    EXPECT_EQ(2u, fields.d.Size());
+    EXPECT_FALSE(fields.d.Empty());
+    EXPECT_EQ("a,c", keys(fields));
+  }).Wait();
+
+  // Add over the tombstone, then roll back: the tombstone is back, with its deletion timestamp.
+  current::time::SetNow(std::chrono::microseconds(400));
+  EXPECT_FALSE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.d.Add(Record{"b", 20});
+    ASSERT_TRUE(Exists(fields.d["b"]));
+    EXPECT_EQ(20, Value(fields.d["b"]).rhs);
+    EXPECT_EQ(3u, fields.d.Size());
+    EXPECT_EQ(400, Value(fields.d.LastModified("b")).count());
+    CURRENT_STORAGE_THROW_ROLLBACK();
+  }).Go()));
+  storage.ReadOnlyTransaction([&keys, &last_modified](ImmutableFields<Storage> fields) {
+    EXPECT_FALSE(Exists(fields.d["b"]));
+    EXPECT_EQ(300, last_modified(fields, "b"));
+    EXPECT_EQ(2u, fields.d.Size());
+    EXPECT_EQ("a,c", keys(fields));
+  }).Wait();
+
+  // Add over the tombstone for real.
+  current::time::SetNow(std::chrono::microseconds(500));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.d.Add(Record{"b", 20}); }).Wait();
+  storage.ReadOnlyTransaction([&keys, &last_modified](ImmutableFields<Storage> fields) {
+    ASSERT_TRUE(Exists(fields.d["b"]));
+    EXPECT_EQ(20, Value(fields.d["b"]).rhs);
+    EXPECT_EQ(500, last_modified(fields, "b"));
+    EXPECT_EQ(3u, fields.d.Size());
+    EXPECT_EQ("a,b,c", keys(fields));
+  }).Wait();
+
+  // Erase everything: the dictionary is empty, while the tombstones keep the timestamps.
+  current::time::SetNow(std::chrono::microseconds(600));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.d.Erase("a");
+    fields.d.Erase("b");
+    fields.d.Erase("c");
+  }).Wait();
+  storage.ReadOnlyTransaction([&keys, &last_modified](ImmutableFields<Storage> fields) {
+    EXPECT_TRUE(fields.d.Empty());
+    EXPECT_EQ(0u, fields.d.Size());
+    EXPECT_EQ("", keys(fields));
+    EXPECT_EQ(600, last_modified(fields, "a"));
+    EXPECT_EQ(-1, last_modified(fields, "z"));
+  }).Wait();
+
+  // Re-add, erase and re-add within one transaction, then roll it back.
+  current::time::SetNow(std::chrono::microseconds(700));
+  EXPECT_FALSE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.d.Add(Record{"a", 10});
+    fields.d.Erase("a");
+    EXPECT_TRUE(fields.d.Empty());
+    fields.d.Add(Record{"a", 11});
+    EXPECT_EQ(1u, fields.d.Size());
+    EXPECT_EQ(11, Value(fields.d["a"]).rhs);
+    CURRENT_STORAGE_THROW_ROLLBACK();
+  }).Go()));
+  storage.ReadOnlyTransaction([&keys, &last_modified](ImmutableFields<Storage> fields) {
+    EXPECT_TRUE(fields.d.Empty());
+    EXPECT_EQ("", keys(fields));
+    EXPECT_EQ(600, last_modified(fields, "a"));
+  }).Wait();
+
+  // Erasing a tombstone is a no-op, and does not touch its timestamp.
+  current::time::SetNow(std::chrono::microseconds(800));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.d.Erase("a"); }).Wait();
+  storage.ReadOnlyTransaction([&last_modified](ImmutableFields<Storage> fields) {
+    EXPECT_EQ(600, last_modified(fields, "a"));
+  }).Wait();
+}
+
 TEST(TransactionalStorage, LastModifiedInMatrixContainers) {
   current::time::ResetToZero();
 
@@ -2054,6 +2194,12 @@ TEST(TransactionalStorage, RESTfulAPITest) {
     EXPECT_EQ(201, static_cast<int>(post_user1_response.code));
     const auto user1_key = post_user1_response.body;
     EXPECT_EQ(200, static_cast<int>(HTTP(GET(base_url + "/api/data/user/" + user1_key)).code));
+
+    // The storage persisted into a file has no stream index to read one's writes by.
+    EXPECT_FALSE(post_user1_response.headers.Has("X-Current-Storage-Index"));
+    EXPECT_EQ(400,
+              static_cast<int>(HTTP(GET(base_url + "/api/data/user/" + user1_key)
+                                        .SetHeader("X-Current-Storage-Min-Index", "1")).code));
     EXPECT_EQ("MZ", ParseJSON<SimpleUser>(HTTP(GET(base_url + "/api/data/user/" + user1_key)).body).name);
 
     // Test the alias too.
@@ -2524,3 +2670,1474 @@ TEST(TransactionalStorage, FollowingStorageFlipsToMaster) {
     EXPECT_TRUE(WasCommitted(result));
   }
 }
+
+TEST(TransactionalStorage, ReadOnlySnapshots) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Add(Record{"one", 1});
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+
+  ReadOnlySnapshots<Storage> snapshots(storage);
+  snapshots.WaitForTransactionsCount(1u);
+
+  auto snapshot = snapshots.Acquire();
+  EXPECT_EQ(1u, snapshot.TransactionsCount());
+  EXPECT_EQ(1u, snapshot->d.Size());
+  ASSERT_TRUE(Exists(snapshot->d["one"]));
+  EXPECT_EQ(1, Value(snapshot->d["one"]).rhs);
+
+  // Writes are not blocked by the held snapshot, and do not alter it.
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Add(Record{"one", 101});
+      fields.d.Add(Record{"two", 2});
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+  snapshots.WaitForTransactionsCount(2u);
+  EXPECT_EQ(1u, snapshot.TransactionsCount());
+  EXPECT_EQ(1u, snapshot->d.Size());
+  EXPECT_EQ(1, Value(snapshot->d["one"]).rhs);
+
+  // The most recent snapshot reflects the new transaction.
+  snapshots.ReadOnlyTransaction([](const typename ReadOnlySnapshots<Storage>::fields_t& fields) {
+    EXPECT_EQ(2u, fields.d.Size());
+    EXPECT_EQ(101, Value(fields.d["one"]).rhs);
+    EXPECT_EQ(2, Value(fields.d["two"]).rhs);
+  });
+
+  // While `snapshot` is still held, the further transactions are queued, and applied once it is released.
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Erase("two");
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Add(Record{"three", 3});
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+  EXPECT_EQ(2u, snapshots.TransactionsCount());
+  EXPECT_EQ(1u, snapshot->d.Size());
+
+  {
+    const auto moved_away = std::move(snapshot);
+  }
+  snapshots.WaitForTransactionsCount(4u);
+  snapshots.ReadOnlyTransaction([](const typename ReadOnlySnapshots<Storage>::fields_t& fields) {
+    EXPECT_EQ(2u, fields.d.Size());
+    EXPECT_EQ(101, Value(fields.d["one"]).rhs);
+    EXPECT_FALSE(Exists(fields.d["two"]));
+    EXPECT_EQ(3, Value(fields.d["three"]).rhs);
+  });
+
+  // The snapshots may be destructed while their subscriber waits for a held snapshot to be released,
+  // and the held snapshot stays valid.
+  {
+    std::unique_ptr<ReadOnlySnapshots<Storage>> more_snapshots =
+        std::make_unique<ReadOnlySnapshots<Storage>>(storage);
+    more_snapshots->WaitForTransactionsCount(4u);
+    auto held_snapshot = more_snapshots->Acquire();
+    for (int i = 0; i < 2; ++i) {
+      const auto result = storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+        fields.d.Add(Record{"more", i});
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+    more_snapshots->WaitForTransactionsCount(5u);
+    more_snapshots = nullptr;
+    EXPECT_EQ(4u, held_snapshot.TransactionsCount());
+    EXPECT_EQ(2u, held_snapshot->d.Size());
+    EXPECT_FALSE(Exists(held_snapshot->d["more"]));
+  }
+}
+
+namespace transactional_storage_test {
+
+// A read-write transaction which can only be moved. A functor, as C++11 lambdas can not capture by move.
+template <typename STORAGE>
+struct MoveOnlyTransaction {
+  std::unique_ptr<int> value;
+  std::string key;
+  MoveOnlyTransaction(std::unique_ptr<int> value, const std::string& key) : value(std::move(value)), key(key) {}
+  int operator()(MutableFields<STORAGE> fields) const {
+    fields.d.Add(Record{key, *value});
+    return *value;
+  }
+};
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, AsynchronousTransactionPolicyGroupCommits) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage =
+      TestStorage<SherlockInMemoryStreamPersister, current::storage::transaction_policy::Asynchronous>;
+  using current::storage::TransactionResult;
+  using void_future_t = current::Future<TransactionResult<void>, current::StrictFuture::Strict>;
+  using int_future_t = current::Future<TransactionResult<int>, current::StrictFuture::Strict>;
+
+  const size_t N = 1000u;
+  std::vector<void_future_t> futures;
+  std::vector<int_future_t> rolled_back_futures;
+
+  Storage storage;
+
+  // The first transaction holds the writer thread until all the others are enqueued, so that, as there are
+  // fewer than `kMaxTransactionsPerBatch` of them, they are all run and persisted as a single batch.
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released(release.get_future());
+  auto blocker = storage.ReadWriteTransaction([&started, released](MutableFields<Storage>) {
+    started.set_value();
+    released.wait();
+  });
+  started.get_future().wait();
+
+  for (size_t i = 0u; i < N; ++i) {
+    futures.push_back(storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+      fields.d.Add(Record{current::ToString(i), static_cast<int>(i)});
+    }));
+    if (i % 100u == 0u) {
+      rolled_back_futures.push_back(storage.ReadWriteTransaction([](MutableFields<Storage> fields) -> int {
+        fields.d.Add(Record{"rolled_back", 0});
+        CURRENT_STORAGE_THROW_ROLLBACK_WITH_VALUE(int, 42);
+      }));
+    }
+  }
+
+  release.set_value();
+  EXPECT_TRUE(WasCommitted(blocker.Go()));
+
+  // All the futures resolve once the batches containing the respective transactions are persisted.
+  for (auto& future : futures) {
+    EXPECT_TRUE(WasCommitted(future.Go()));
+  }
+  for (auto& future : rolled_back_futures) {
+    const auto result = future.Go();
+    EXPECT_FALSE(WasCommitted(result));
+    EXPECT_EQ(42, Value(result));
+  }
+
+  {
+    const auto result = storage.ReadOnlyTransaction([N](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(N, fields.d.Size());
+      EXPECT_FALSE(Exists(fields.d["rolled_back"]));
+      EXPECT_EQ(123, Value(fields.d["123"]).rhs);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+
+  // The transactions are group-committed: a single stream entry, with all the mutations.
+  // The blocking transaction has mutated nothing, so its batch is not persisted at all.
+  const auto& persister = storage.InternalExposeStream().InternalExposePersister();
+  EXPECT_EQ(1u, persister.Size());
+  size_t mutations = 0u;
+  for (const auto& e : persister.Iterate(0u, static_cast<uint64_t>(-1))) {
+    mutations += e.entry.mutations.size();
+  }
+  EXPECT_EQ(N, mutations);
+
+  // Two-step transactions call `f2` once the result of `f1` is persisted.
+  {
+    int f2_result = 0;
+    auto future = storage.ReadWriteTransaction(
+        [](MutableFields<Storage> fields) {
+          fields.d.Add(Record{"two_step", 2});
+          return 2;
+        },
+        [&f2_result](int value) { f2_result = value; });
+    EXPECT_TRUE(WasCommitted(future.Go()));
+    EXPECT_EQ(2, f2_result);
+  }
+
+  // The transactions are moved into the enqueued transactions, so they do not have to be copyable.
+  {
+    MoveOnlyTransaction<Storage> f(std::unique_ptr<int>(new int(3)), "three");
+    const auto result = storage.ReadWriteTransaction(std::move(f)).Go();
+    EXPECT_EQ(3, Value(result));
+  }
+  {
+    // And the synchronous policy runs them in place, without even moving them.
+    using SynchronousStorage = TestStorage<SherlockInMemoryStreamPersister>;
+    SynchronousStorage synchronous_storage;
+    MoveOnlyTransaction<SynchronousStorage> f(std::unique_ptr<int>(new int(4)), "four");
+    EXPECT_EQ(4, Value(synchronous_storage.ReadWriteTransaction(f).Go()));
+  }
+
+  // The replayed storage matches the original one.
+  Storage replayed(storage.InternalExposeStream());
+  replayed.ReadOnlyTransaction([N](ImmutableFields<Storage> fields) {
+    EXPECT_EQ(N + 2u, fields.d.Size());
+    EXPECT_EQ(999, Value(fields.d["999"]).rhs);
+  }).Wait();
+}
+
+TEST(TransactionalStorage, PipelinedReplay) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "pipelined_replay");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  // Enough transactions for the replay to be split into several chunks, parsed ahead of being applied.
+  const int N = 10000;
+  {
+    Storage storage(persistence_file_name);
+    for (int i = 0; i < N; ++i) {
+      storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+        fields.d.Add(Record{current::ToString(i % 1000), i});
+        if (i % 3 == 0) {
+          fields.umany_to_umany.Add(Cell{i % 11, current::ToString(i % 7), i});
+        }
+      }).Wait();
+    }
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.d.Erase("42"); }).Wait();
+  }
+
+  {
+    // Forced, for the pipelined replay to run on a single-core machine too.
+    auto& parameters = current::Singleton<current::storage::persister::PipelinedReplayParameters>();
+    parameters.parser_threads = 2u;
+    Storage replayed(persistence_file_name);
+    parameters.parser_threads = 0u;
+    EXPECT_EQ(static_cast<uint64_t>(N + 1), replayed.InternalExposeStream().InternalExposePersister().Size());
+    replayed.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(999u, fields.d.Size());
+      EXPECT_FALSE(Exists(fields.d["42"]));
+      EXPECT_EQ(9999, Value(fields.d["999"]).rhs);
+      EXPECT_EQ(9000, Value(fields.d["0"]).rhs);
+      EXPECT_EQ(77u, fields.umany_to_umany.Size());
+    }).Wait();
+  }
+}
+
+TEST(TransactionalStorage, Checkpoints) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "checkpointed_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+  const std::string checkpoints_dir =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "checkpoints");
+  current::FileSystem::RmDir(checkpoints_dir,
+                             current::FileSystem::RmDirParameters::Silent,
+                             current::FileSystem::RmDirRecursive::Yes);
+
+  const auto add = [](Storage& storage, const std::string& key, int value) {
+    storage.ReadWriteTransaction([key, value](MutableFields<Storage> fields) {
+      fields.d.Add(Record{key, value});
+    }).Wait();
+  };
+
+  {
+    Storage storage(StorageCheckpoints(checkpoints_dir), persistence_file_name);
+    // A storage constructed without `StorageCheckpoints` can not create checkpoints.
+    EXPECT_THROW(Storage(persistence_file_name).Checkpoint(),
+                 current::storage::StorageCheckpointsNotConfiguredException);
+
+    add(storage, "a", 1);
+    add(storage, "a", 2);
+    add(storage, "a", 3);
+    add(storage, "b", 1);
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Erase("b");
+      fields.umany_to_umany.Add(Cell{1, "one", 1});
+    }).Wait();
+    EXPECT_EQ(5u, storage.Checkpoint());
+    add(storage, "c", 1);
+
+    // Checkpoints can be created via HTTP.
+    storage.ExposeCheckpointsViaHTTP(FLAGS_transactional_storage_test_port, "/checkpoint");
+    const auto url =
+        current::strings::Printf("http://localhost:%d/checkpoint", FLAGS_transactional_storage_test_port);
+    EXPECT_EQ(405, static_cast<int>(HTTP(GET(url)).code));
+    const auto response = HTTP(POST(url, ""));
+    EXPECT_EQ(200, static_cast<int>(response.code));
+    EXPECT_EQ(6u, ParseJSON<current::storage::StorageCheckpointCreated>(response.body).next_index);
+
+    add(storage, "d", 1);
+  }
+
+  const auto verify = [](const Storage& storage) {
+    storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(3u, fields.d.Size());
+      EXPECT_EQ(3, Value(fields.d["a"]).rhs);
+      EXPECT_FALSE(Exists(fields.d["b"]));
+      EXPECT_TRUE(Exists(fields.d.LastModified("b")));
+      EXPECT_TRUE(Exists(fields.d["c"]));
+      EXPECT_TRUE(Exists(fields.d["d"]));
+      EXPECT_EQ(1u, fields.umany_to_umany.Size());
+    }).Wait();
+  };
+
+  {
+    // Only the four events of the last checkpoint and the one mutation after it are applied.
+    Storage storage(StorageCheckpoints(checkpoints_dir), persistence_file_name);
+    verify(storage);
+    EXPECT_EQ(5u, storage.TransactionsCount());
+  }
+  {
+    // Without checkpoints, the whole stream is replayed, with the same result.
+    Storage storage(persistence_file_name);
+    verify(storage);
+    EXPECT_EQ(8u, storage.TransactionsCount());
+  }
+
+  {
+    // Scheduled checkpoints, with only the two most recent checkpoint files kept.
+    Storage storage(StorageCheckpoints(checkpoints_dir), persistence_file_name);
+    add(storage, "e", 1);
+    ScheduledStorageCheckpoints<Storage> scheduled_checkpoints(storage, std::chrono::milliseconds(1));
+    while (current::storage::impl::ListStorageCheckpoints(checkpoints_dir).back() != 8u) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  EXPECT_EQ((std::vector<uint64_t>{6u, 8u}), current::storage::impl::ListStorageCheckpoints(checkpoints_dir));
+
+  const auto checkpoint_file_name = [&checkpoints_dir](uint64_t next_index) {
+    return current::FileSystem::JoinPath(checkpoints_dir,
+                                         current::storage::impl::StorageCheckpointFileName(next_index));
+  };
+  const auto verify_e = [](const Storage& storage) {
+    storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(4u, fields.d.Size());
+      EXPECT_EQ(3, Value(fields.d["a"]).rhs);
+      EXPECT_FALSE(Exists(fields.d["b"]));
+      EXPECT_TRUE(Exists(fields.d["e"]));
+      EXPECT_EQ(1u, fields.umany_to_umany.Size());
+    }).Wait();
+  };
+  {
+    // A truncated checkpoint is skipped in favor of the older one, with the two events after it replayed.
+    const std::string contents = current::FileSystem::ReadFileAsString(checkpoint_file_name(8u));
+    current::FileSystem::WriteStringToFile(contents.substr(0u, contents.length() / 2u),
+                                           checkpoint_file_name(8u).c_str());
+    Storage storage(StorageCheckpoints(checkpoints_dir), persistence_file_name);
+    verify_e(storage);
+    EXPECT_EQ(6u, storage.TransactionsCount());
+  }
+  {
+    // With no checkpoint to load, the whole stream is replayed.
+    current::FileSystem::WriteStringToFile("garbage", checkpoint_file_name(6u).c_str());
+    Storage storage(StorageCheckpoints(checkpoints_dir), persistence_file_name);
+    verify_e(storage);
+    EXPECT_EQ(9u, storage.TransactionsCount());
+  }
+
+  current::FileSystem::RmDir(checkpoints_dir,
+                             current::FileSystem::RmDirParameters::Silent,
+                             current::FileSystem::RmDirRecursive::Yes);
+}
+
+TEST(TransactionalStorage, RollbackOfLargeTransactions) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    for (int i = 0; i < 1000; ++i) {
+      fields.d.Add(Record{current::ToString(i), i});
+      fields.oone_to_oone.Add(Cell{i, current::ToString(i), i});
+    }
+  }).Wait();
+
+  // Enough mutations to span multiple blocks of the rollback arena, rolled back twice, to reuse its memory.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      for (int i = 0; i < 1000; ++i) {
+        fields.d.Add(Record{current::ToString(i), -i});
+        fields.d.Erase(current::ToString(i + 500));
+        fields.oone_to_oone.Add(Cell{i, current::ToString(i + 1), -i});
+      }
+      CURRENT_STORAGE_THROW_ROLLBACK();
+    }).Go();
+    EXPECT_FALSE(WasCommitted(result));
+  }
+
+  storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+    ASSERT_EQ(1000u, fields.d.Size());
+    ASSERT_EQ(1000u, fields.oone_to_oone.Size());
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(i, Value(fields.d[current::ToString(i)]).rhs);
+      EXPECT_EQ(i, Value(fields.oone_to_oone.Get(i, current::ToString(i))).phew);
+    }
+  }).Wait();
+}
+
+TEST(TransactionalStorage, FlatDictionaries) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = FlatTestStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "flat_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  // The golden data, as `std::map` and `std::set`.
+  std::map<std::string, int32_t> golden;
+  std::set<std::string> golden_erased;
+
+  const auto verify = [&golden, &golden_erased](const Storage& storage) {
+    storage.ReadOnlyTransaction([&golden, &golden_erased](ImmutableFields<Storage> fields) {
+      ASSERT_EQ(golden.size(), fields.flat_unordered.Size());
+      ASSERT_EQ(golden.size(), fields.flat_ordered.Size());
+      for (const auto& element : golden) {
+        ASSERT_TRUE(Exists(fields.flat_unordered[element.first])) << element.first;
+        EXPECT_EQ(element.second, Value(fields.flat_unordered[element.first]).rhs);
+        ASSERT_TRUE(Exists(fields.flat_ordered[element.first])) << element.first;
+        EXPECT_EQ(element.second, Value(fields.flat_ordered[element.first]).rhs);
+      }
+      for (const auto& key : golden_erased) {
+        EXPECT_FALSE(Exists(fields.flat_unordered[key]));
+        EXPECT_TRUE(Exists(fields.flat_unordered.LastModified(key)));
+      }
+      // The ordered flat dictionary is iterated over in the order of the keys, the unordered one in any order.
+      std::vector<std::string> ordered_keys;
+      for (const auto& record : fields.flat_ordered) {
+        ordered_keys.push_back(record.lhs);
+      }
+      std::vector<std::string> unordered_keys;
+      for (const auto& record : fields.flat_unordered) {
+        unordered_keys.push_back(record.lhs);
+      }
+      std::sort(unordered_keys.begin(), unordered_keys.end());
+      std::vector<std::string> golden_keys;
+      for (const auto& element : golden) {
+        golden_keys.push_back(element.first);
+      }
+      EXPECT_EQ(golden_keys, ordered_keys);
+      EXPECT_EQ(golden_keys, unordered_keys);
+      // The ordered flat dictionary resumes the pagination after any key.
+      for (const std::string probe : {"", "1", "1000x", "5", "999", "a"}) {
+        const auto after = fields.flat_ordered.After(probe);
+        ASSERT_TRUE(Exists(after));
+        const auto golden_after = golden.upper_bound(probe);
+        if (golden_after != golden.end()) {
+          ASSERT_TRUE(Value(after) != fields.flat_ordered.end());
+          EXPECT_EQ(golden_after->first, (*Value(after)).lhs);
+        } else {
+          EXPECT_TRUE(Value(after) == fields.flat_ordered.end());
+        }
+      }
+    }).Wait();
+  };
+
+  {
+    Storage storage(persistence_file_name);
+    std::mt19937 random(42);
+    // Enough entries for the hash map to grow a few times, and for the ordered one to split its leaves.
+    for (int transaction = 0; transaction < 50; ++transaction) {
+      std::vector<std::pair<std::string, int32_t>> mutations;
+      for (int i = 0; i < 100; ++i) {
+        mutations.emplace_back(current::ToString(random() % 2000), static_cast<int32_t>(random() % 3));
+      }
+      storage.ReadWriteTransaction([&mutations](MutableFields<Storage> fields) {
+        for (const auto& mutation : mutations) {
+          if (mutation.second) {
+            fields.flat_unordered.Add(Record{mutation.first, mutation.second});
+            fields.flat_ordered.Add(Record{mutation.first, mutation.second});
+          } else {
+            fields.flat_unordered.Erase(mutation.first);
+            fields.flat_ordered.Erase(mutation.first);
+          }
+        }
+      }).Wait();
+      for (const auto& mutation : mutations) {
+        if (mutation.second) {
+          golden[mutation.first] = mutation.second;
+          golden_erased.erase(mutation.first);
+        } else if (golden.erase(mutation.first)) {
+          golden_erased.insert(mutation.first);
+        }
+      }
+    }
+    verify(storage);
+
+    // A rolled back transaction leaves no trace, including the keys it has added and then erased.
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      for (int i = 0; i < 3000; ++i) {
+        fields.flat_unordered.Add(Record{"new" + current::ToString(i), i});
+        fields.flat_ordered.Add(Record{"new" + current::ToString(i), i});
+        fields.flat_unordered.Erase(current::ToString(i));
+        fields.flat_ordered.Erase(current::ToString(i));
+      }
+      CURRENT_STORAGE_THROW_ROLLBACK();
+    }).Go();
+    EXPECT_FALSE(WasCommitted(result));
+    verify(storage);
+  }
+  {
+    // The flat dictionaries are persisted and replayed just as the node-based ones.
+    Storage storage(persistence_file_name);
+    verify(storage);
+  }
+}
+
+namespace transactional_storage_test {
+
+// Counts its live instances, and has no default constructor.
+struct FlatMapCountedValue {
+  static int& Instances() {
+    static int instances = 0;
+    return instances;
+  }
+  explicit FlatMapCountedValue(int value) : value(value) { ++Instances(); }
+  FlatMapCountedValue(const FlatMapCountedValue& rhs) : value(rhs.value) { ++Instances(); }
+  ~FlatMapCountedValue() { --Instances(); }
+  int value;
+};
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, FlatDictionaryEntriesMoveOnAdd) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+
+  // The entries of the node-based dictionaries stay where they are as other keys are added.
+  TestStorage<SherlockInMemoryStreamPersister> node_storage;
+  node_storage.ReadWriteTransaction([](MutableFields<TestStorage<SherlockInMemoryStreamPersister>> fields) {
+    fields.d.Add(Record{"key", 42});
+    const Record* entry = &Value(fields.d["key"]);
+    for (int i = 0; i < 100; ++i) {
+      fields.d.Add(Record{current::ToString(i), i});
+    }
+    EXPECT_EQ(entry, &Value(fields.d["key"]));
+  }).Wait();
+
+  // The entries of the flat ones are moved as the hash map grows: the reference obtained by `operator[]` is
+  // invalidated by adding a new key, and the entry must be copied to be used after that.
+  FlatTestStorage<SherlockInMemoryStreamPersister> flat_storage;
+  flat_storage.ReadWriteTransaction([](MutableFields<FlatTestStorage<SherlockInMemoryStreamPersister>> fields) {
+    fields.flat_unordered.Add(Record{"key", 42});
+    const Record* entry = &Value(fields.flat_unordered["key"]);
+    const Record copy = Value(fields.flat_unordered["key"]);
+    // Overwriting or erasing the existing keys does not move the entries.
+    fields.flat_unordered.Add(Record{"key", 43});
+    fields.flat_unordered.Erase("key");
+    fields.flat_unordered.Add(Record{"key", 42});
+    EXPECT_EQ(entry, &Value(fields.flat_unordered["key"]));
+    for (int i = 0; i < 100; ++i) {
+      fields.flat_unordered.Add(Record{current::ToString(i), i});
+    }
+    EXPECT_NE(entry, &Value(fields.flat_unordered["key"]));
+    EXPECT_EQ(42, copy.rhs);
+    EXPECT_EQ(42, Value(fields.flat_unordered["key"]).rhs);
+  }).Wait();
+}
+
+TEST(TransactionalStorage, FlatHashMapConstructsOnlyTheOccupiedSlots) {
+  using transactional_storage_test::FlatMapCountedValue;
+  using map_t = current::storage::container::FlatHashMap<int, FlatMapCountedValue>;
+
+  EXPECT_EQ(0, FlatMapCountedValue::Instances());
+  {
+    map_t map;
+    for (int i = 0; i < 1000; ++i) {
+      map.emplace(i, FlatMapCountedValue(i * 10));
+    }
+    EXPECT_EQ(1000u, map.size());
+    EXPECT_EQ(1000, FlatMapCountedValue::Instances());
+    for (int i = 0; i < 1000; i += 2) {
+      EXPECT_EQ(1u, map.erase(i));
+    }
+    EXPECT_EQ(500u, map.size());
+    EXPECT_EQ(500, FlatMapCountedValue::Instances());
+    for (int i = 0; i < 1000; ++i) {
+      const auto cit = static_cast<const map_t&>(map).find(i);
+      if (i % 2) {
+        ASSERT_TRUE(cit != map.cend());
+        EXPECT_EQ(i * 10, cit->second.value);
+      } else {
+        EXPECT_TRUE(cit == map.cend());
+      }
+    }
+    {
+      const map_t copy(map);
+      EXPECT_EQ(500u, copy.size());
+      EXPECT_EQ(1000, FlatMapCountedValue::Instances());
+      map_t moved(std::move(map));
+      EXPECT_EQ(500u, moved.size());
+      EXPECT_TRUE(map.empty());
+      EXPECT_EQ(1000, FlatMapCountedValue::Instances());
+      moved.clear();
+      EXPECT_EQ(500, FlatMapCountedValue::Instances());
+    }
+    EXPECT_EQ(0, FlatMapCountedValue::Instances());
+  }
+  EXPECT_EQ(0, FlatMapCountedValue::Instances());
+}
+
+namespace transactional_storage_test {
+
+CURRENT_STRUCT(IndexedUser) {
+  CURRENT_FIELD(key, std::string);
+  CURRENT_FIELD(email, std::string);
+  CURRENT_FIELD(age, uint32_t);
+  CURRENT_CONSTRUCTOR(IndexedUser)(
+      const std::string& key = "", const std::string& email = "", uint32_t age = 0u)
+      : key(key), email(email), age(age) {}
+};
+
+CURRENT_STORAGE_FIELD_INDEX(Unique, Ordered, IndexedUserByEmail, IndexedUser, email);
+CURRENT_STORAGE_FIELD_INDEX(NonUnique, Ordered, IndexedUserByAge, IndexedUser, age);
+CURRENT_STORAGE_INDEX(NonUnique, Unordered, IndexedUserByDomain, IndexedUser, std::string) {
+  return entry.email.substr(entry.email.find('@') + 1);
+}
+
+CURRENT_STORAGE_FIELD_ENTRY_WITH_INDEXES(OrderedDictionary,
+                                         IndexedUser,
+                                         IndexedUserDictionary,
+                                         IndexedUserByEmail,
+                                         IndexedUserByAge,
+                                         IndexedUserByDomain);
+CURRENT_STORAGE_FIELD_ENTRY_WITH_INDEXES(
+    FlatUnorderedDictionary, IndexedUser, FlatIndexedUserDictionary, IndexedUserByEmail, IndexedUserByDomain);
+
+CURRENT_STORAGE(IndexedStorage) {
+  CURRENT_STORAGE_FIELD(user, IndexedUserDictionary);
+  CURRENT_STORAGE_FIELD(flat_user, FlatIndexedUserDictionary);
+};
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, SecondaryIndexes) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = IndexedStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "indexed_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  // Dumps the contents of the indexes, to compare them against the expected ones.
+  const auto dump = [](const Storage& storage) {
+    return Value(storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      std::string result;
+      for (const auto& user : fields.user.Index<IndexedUserByEmail>()) {
+        result += user.email + ':' + user.key + ' ';
+      }
+      for (uint32_t age = 20u; age <= 40u; ++age) {
+        if (fields.user.Index<IndexedUserByAge>().Has(age)) {
+          result += current::ToString(age) + ':';
+          for (const auto& user : fields.user.Index<IndexedUserByAge>()[age]) {
+            result += user.key + ',';
+          }
+          result += ' ';
+        }
+      }
+      for (const std::string domain : {"x.com", "y.com"}) {
+        const auto flat_users = fields.flat_user.Index<IndexedUserByDomain>()[domain];
+        EXPECT_EQ(fields.user.Index<IndexedUserByDomain>()[domain].Size(), flat_users.Size());
+        result += domain + ':' + current::ToString(flat_users.Size()) + ' ';
+      }
+      EXPECT_EQ(fields.user.Index<IndexedUserByEmail>().Size(),
+                fields.flat_user.Index<IndexedUserByEmail>().Size());
+      return result;
+    }).Go());
+  };
+
+  const std::string golden_updated =
+      "a@x.com:alice b@x.com:bob c@x.com:carol 25:bob, 26:carol, 30:alice, x.com:3 y.com:0 ";
+  const std::string golden_final =
+      "a@x.com:dave b@x.com:bob c@x.com:carol 25:bob, 26:carol, 40:dave, x.com:3 y.com:0 ";
+
+  const auto add = [](MutableFields<Storage> fields, const IndexedUser& user) {
+    fields.user.Add(user);
+    fields.flat_user.Add(user);
+  };
+
+  {
+    Storage storage(persistence_file_name);
+    storage.ReadWriteTransaction([&add](MutableFields<Storage> fields) {
+      add(fields, IndexedUser("alice", "a@x.com", 30u));
+      add(fields, IndexedUser("bob", "b@y.com", 30u));
+      add(fields, IndexedUser("carol", "c@x.com", 25u));
+    }).Wait();
+    EXPECT_EQ("a@x.com:alice b@y.com:bob c@x.com:carol 25:carol, 30:alice,bob, x.com:2 y.com:1 ",
+              dump(storage));
+
+    storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      ASSERT_TRUE(Exists(fields.user.Index<IndexedUserByEmail>()["b@y.com"]));
+      EXPECT_EQ("bob", Value(fields.user.Index<IndexedUserByEmail>()["b@y.com"]).key);
+      EXPECT_EQ("bob", Value(fields.flat_user.Index<IndexedUserByEmail>()["b@y.com"]).key);
+      EXPECT_FALSE(Exists(fields.user.Index<IndexedUserByEmail>()["d@y.com"]));
+      EXPECT_TRUE(fields.user.Index<IndexedUserByAge>()[42u].Empty());
+    }).Wait();
+
+    // Updating the entry updates all its index keys, and it may keep its own unique ones.
+    storage.ReadWriteTransaction([&add](MutableFields<Storage> fields) {
+      add(fields, IndexedUser("bob", "b@x.com", 25u));
+      add(fields, IndexedUser("carol", "c@x.com", 26u));
+    }).Wait();
+    EXPECT_EQ(golden_updated, dump(storage));
+
+    // Violating a unique index throws, and rolls back the whole transaction.
+    {
+      auto result = storage.ReadWriteTransaction([&add](MutableFields<Storage> fields) {
+        add(fields, IndexedUser("dave", "d@y.com", 40u));
+        add(fields, IndexedUser("erin", "a@x.com", 40u));
+      });
+      result.Wait();
+      EXPECT_THROW(result.Go(), current::storage::StorageUniqueIndexViolationException);
+    }
+    EXPECT_EQ(golden_updated, dump(storage));
+
+    // The rolled back updates and deletions restore the indexes.
+    {
+      const auto result = storage.ReadWriteTransaction([&add](MutableFields<Storage> fields) {
+        fields.user.Erase("alice");
+        fields.flat_user.Erase("alice");
+        add(fields, IndexedUser("bob", "a@x.com", 31u));
+        add(fields, IndexedUser("frank", "b@x.com", 25u));
+        fields.user.Erase("frank");
+        fields.flat_user.Erase("frank");
+        CURRENT_STORAGE_THROW_ROLLBACK();
+      }).Go();
+      EXPECT_FALSE(WasCommitted(result));
+    }
+    EXPECT_EQ(golden_updated, dump(storage));
+
+    // The erased entries are gone from the indexes, and their index keys can be reused.
+    storage.ReadWriteTransaction([&add](MutableFields<Storage> fields) {
+      fields.user.Erase("alice");
+      fields.flat_user.Erase("alice");
+      add(fields, IndexedUser("dave", "a@x.com", 40u));
+    }).Wait();
+    EXPECT_EQ(golden_final, dump(storage));
+  }
+
+  {
+    // The indexes are rebuilt as the storage is replayed.
+    Storage storage(persistence_file_name);
+    EXPECT_EQ(golden_final, dump(storage));
+
+    // And are exposed via REST, as `/data/$FIELD.$INDEX/$INDEX_KEY`.
+    const auto base_url =
+        current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+    {
+      auto rest = RESTfulStorage<Storage>(
+          storage, FLAGS_transactional_storage_test_port, "/api", "http://example.current.ai/api");
+      EXPECT_EQ("{\"key\":\"carol\",\"email\":\"c@x.com\",\"age\":26}\n",
+                HTTP(GET(base_url + "/api/data/user.IndexedUserByEmail/c@x.com")).body);
+      EXPECT_EQ(404, static_cast<int>(HTTP(GET(base_url + "/api/data/user.IndexedUserByEmail/z@x.com")).code));
+      EXPECT_EQ("[{\"key\":\"bob\",\"email\":\"b@x.com\",\"age\":25}]\n",
+                HTTP(GET(base_url + "/api/data/user.IndexedUserByAge/25")).body);
+      EXPECT_EQ("[]\n", HTTP(GET(base_url + "/api/data/user.IndexedUserByAge/99")).body);
+      EXPECT_EQ(3u, ParseJSON<std::vector<IndexedUser>>(
+                        HTTP(GET(base_url + "/api/data/flat_user.IndexedUserByDomain/x.com")).body).size());
+      EXPECT_EQ(405, static_cast<int>(HTTP(DELETE(base_url + "/api/data/user.IndexedUserByAge/25")).code));
+    }
+    {
+      // The responses are those of the REST implementation the storage is exposed with.
+      using namespace current::storage::rest;
+      auto rest = RESTfulStorage<Storage, Hypermedia>(
+          storage, FLAGS_transactional_storage_test_port, "/api", "http://example.current.ai/api");
+      const auto entry = HTTP(GET(base_url + "/api/data/user.IndexedUserByEmail/c@x.com"));
+      EXPECT_EQ(200, static_cast<int>(entry.code));
+      const auto record = ParseJSON<HypermediaRESTRecordResponse<IndexedUser>>(entry.body);
+      EXPECT_EQ("http://example.current.ai/api/data/user/carol", record.url);
+      EXPECT_EQ("carol", record.data.key);
+
+      const auto missing = HTTP(GET(base_url + "/api/data/user.IndexedUserByEmail/z@x.com"));
+      EXPECT_EQ(404, static_cast<int>(missing.code));
+      const auto error = ParseJSON<HypermediaRESTGenericResponse>(missing.body);
+      EXPECT_FALSE(error.success);
+      ASSERT_TRUE(Exists(error.error));
+      EXPECT_EQ("ResourceNotFound", Value(error.error).name);
+
+      const auto entries = ParseJSON<HypermediaRESTContainerResponse>(
+          HTTP(GET(base_url + "/api/data/user.IndexedUserByAge/25")).body);
+      EXPECT_EQ("http://example.current.ai/api/data/user.IndexedUserByAge/25", entries.url);
+      EXPECT_EQ("http://example.current.ai/api/data/user/bob", current::strings::Join(entries.data, ' '));
+
+      const auto not_allowed = HTTP(DELETE(base_url + "/api/data/user.IndexedUserByAge/25"));
+      EXPECT_EQ(405, static_cast<int>(not_allowed.code));
+      const auto not_allowed_error = ParseJSON<HypermediaRESTGenericResponse>(not_allowed.body);
+      ASSERT_TRUE(Exists(not_allowed_error.error));
+      EXPECT_EQ("MethodNotAllowed", Value(not_allowed_error.error).name);
+    }
+  }
+}
+
+namespace transactional_storage_test {
+namespace unindexed {
+
+// The same storage as `IndexedStorage`, with no indexes, to write a stream which violates them.
+CURRENT_STORAGE_FIELD_ENTRY(OrderedDictionary, IndexedUser, IndexedUserDictionary);
+CURRENT_STORAGE_FIELD_ENTRY(FlatUnorderedDictionary, IndexedUser, FlatIndexedUserDictionary);
+
+CURRENT_STORAGE(IndexedStorage) {
+  CURRENT_STORAGE_FIELD(user, IndexedUserDictionary);
+  CURRENT_STORAGE_FIELD(flat_user, FlatIndexedUserDictionary);
+};
+
+}  // namespace transactional_storage_test::unindexed
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, UniqueIndexReplayedWithDuplicateKeys) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "duplicate_index_keys_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  {
+    using Storage = unindexed::IndexedStorage<SherlockStreamPersister>;
+    Storage storage(persistence_file_name);
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      for (const auto& user : {IndexedUser("alice", "a@x.com", 30u), IndexedUser("bob", "a@x.com", 25u)}) {
+        fields.user.Add(user);
+        fields.flat_user.Add(user);
+      }
+    }).Wait();
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.user.Erase("bob");
+      fields.flat_user.Erase("bob");
+    }).Wait();
+  }
+
+  {
+    // Erasing the entry which did not make it into the unique index keeps the one which did.
+    using Storage = IndexedStorage<SherlockStreamPersister>;
+    Storage storage(persistence_file_name);
+    storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      ASSERT_TRUE(Exists(fields.user.Index<IndexedUserByEmail>()["a@x.com"]));
+      EXPECT_EQ("alice", Value(fields.user.Index<IndexedUserByEmail>()["a@x.com"]).key);
+      ASSERT_TRUE(Exists(fields.flat_user.Index<IndexedUserByEmail>()["a@x.com"]));
+      EXPECT_EQ("alice", Value(fields.flat_user.Index<IndexedUserByEmail>()["a@x.com"]).key);
+      EXPECT_EQ(1u, fields.user.Index<IndexedUserByEmail>().Size());
+    }).Wait();
+  }
+}
+
+namespace transactional_storage_test {
+
+// Dumps the matrix row by row and col by col, with the keys, to compare different matrix containers.
+inline std::pair<int32_t, std::string> RowCol(const Cell& cell) {
+  return std::make_pair(current::storage::sfinae::GetRow(cell), current::storage::sfinae::GetCol(cell));
+}
+
+template <typename MATRIX>
+std::string DumpMatrix(const MATRIX& matrix) {
+  std::string result = current::ToString(matrix.Size()) + " cells\n";
+  const auto rows = matrix.Rows();
+  result += current::ToString(rows.Size()) + " rows\n";
+  for (auto it = rows.begin(); it != rows.end(); ++it) {
+    result += current::ToString(it.key()) + ':';
+    for (const auto& cell : *it) {
+      result += ' ' + current::storage::sfinae::GetCol(cell) + '=' + current::ToString(cell.phew);
+    }
+    result += '\n';
+  }
+  const auto cols = matrix.Cols();
+  result += current::ToString(cols.Size()) + " cols\n";
+  for (auto it = cols.begin(); it != cols.end(); ++it) {
+    result += it.key() + ':';
+    for (const auto& cell : *it) {
+      result += ' ' + current::ToString(current::storage::sfinae::GetRow(cell));
+    }
+    result += '\n';
+  }
+  return result;
+}
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, CompactManyToMany) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = CompactTestStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "compact_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  // The compact matrix should behave exactly as the node-based ordered one.
+  const auto verify = [](const Storage& storage) {
+    storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      ASSERT_EQ(DumpMatrix(fields.ordered), DumpMatrix(fields.compact));
+      size_t total = 0u;
+      for (const auto& cell : fields.compact) {
+        EXPECT_EQ(cell.phew, Value(fields.ordered[RowCol(cell)]).phew);
+        ++total;
+      }
+      EXPECT_EQ(fields.ordered.Size(), total);
+      for (int32_t row = 0; row < 40; ++row) {
+        EXPECT_EQ(fields.ordered.Row(row).Size(), fields.compact.Row(row).Size());
+        EXPECT_EQ(fields.ordered.Rows().Has(row), fields.compact.Rows().Has(row));
+        for (int32_t col = 0; col < 40; ++col) {
+          const std::string col_key = current::ToString(col);
+          EXPECT_EQ(Exists(fields.ordered.Get(row, col_key)), Exists(fields.compact.Get(row, col_key)));
+          EXPECT_EQ(Exists(fields.ordered.LastModified(row, col_key)),
+                    Exists(fields.compact.LastModified(row, col_key)));
+          EXPECT_EQ(fields.ordered.Col(col_key).Has(row), fields.compact.Col(col_key).Has(row));
+        }
+      }
+    }).Wait();
+  };
+
+  const auto random_mutations = [](std::mt19937& random, size_t count) {
+    std::vector<Cell> mutations;
+    for (size_t i = 0; i < count; ++i) {
+      mutations.emplace_back(random() % 40, current::ToString(random() % 40), random() % 4);
+    }
+    return mutations;
+  };
+
+  {
+    Storage storage(persistence_file_name);
+    std::mt19937 random(42);
+    // Enough mutations for the delta to be merged into the compacted cells several times.
+    for (int transaction = 0; transaction < 20; ++transaction) {
+      const auto mutations = random_mutations(random, 500);
+      storage.ReadWriteTransaction([&mutations](MutableFields<Storage> fields) {
+        for (const auto& mutation : mutations) {
+          if (mutation.phew) {
+            fields.compact.Add(mutation);
+            fields.ordered.Add(mutation);
+          } else {
+            fields.compact.Erase(RowCol(mutation));
+            fields.ordered.Erase(RowCol(mutation));
+          }
+        }
+      }).Wait();
+      verify(storage);
+    }
+
+    // A rolled back transaction leaves no trace, even if it has grown the delta enough to be merged.
+    const auto mutations = random_mutations(random, 3000);
+    const auto result = storage.ReadWriteTransaction([&mutations](MutableFields<Storage> fields) {
+      for (const auto& mutation : mutations) {
+        if (mutation.phew) {
+          fields.compact.Add(Cell(RowCol(mutation).first + 100, RowCol(mutation).second, mutation.phew));
+          fields.compact.Add(mutation);
+        } else {
+          fields.compact.Erase(RowCol(mutation));
+        }
+      }
+      CURRENT_STORAGE_THROW_ROLLBACK();
+    }).Go();
+    EXPECT_FALSE(WasCommitted(result));
+    verify(storage);
+
+    // The delta is not merged in the middle of a transaction, so its iterators stay valid.
+    const auto more_mutations = random_mutations(random, 3000);
+    storage.ReadWriteTransaction([&more_mutations](MutableFields<Storage> fields) {
+      const auto row = fields.compact.Row(0);
+      std::vector<std::string> before;
+      for (auto it = row.begin(); it != row.end(); ++it) {
+        before.push_back(it.key());
+      }
+      ASSERT_FALSE(before.empty());
+      auto it = row.begin();
+      for (const auto& mutation : more_mutations) {
+        fields.compact.Add(Cell(RowCol(mutation).first + 100, RowCol(mutation).second, 1));
+      }
+      std::vector<std::string> after;
+      for (; it != row.end(); ++it) {
+        after.push_back(it.key());
+      }
+      EXPECT_EQ(before, after);
+      for (const auto& mutation : more_mutations) {
+        fields.compact.Erase(RowCol(mutation).first + 100, RowCol(mutation).second);
+      }
+    }).Wait();
+    verify(storage);
+  }
+  {
+    // The compact matrix is persisted and replayed just as the node-based ones.
+    Storage storage(persistence_file_name);
+    verify(storage);
+  }
+}
+
+TEST(TransactionalStorage, RESTfulPagination) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    for (int i = 0; i < 2500; ++i) {
+      fields.user.Add(SimpleUser(current::strings::Printf("%04d", i), "User " + current::ToString(i)));
+    }
+    fields.like.Add(SimpleLike("dima", "beer"));
+    fields.like.Add(SimpleLike("max", "beer"));
+    fields.like.Add(SimpleLike("max", "wine"));
+  }).Wait();
+
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+
+  {
+    auto rest = RESTfulStorage<Storage>(
+        storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+
+    // Page through the dictionary by the cursor.
+    const auto first_page = HTTP(GET(base_url + "/api/data/user?limit=3"));
+    EXPECT_EQ(200, static_cast<int>(first_page.code));
+    EXPECT_EQ("0000\n0001\n0002\n", first_page.body);
+    ASSERT_TRUE(first_page.headers.Has("Link"));
+    EXPECT_EQ("<http://unittest.current.ai/data/user?limit=3&cursor=0002>; rel=\"next\"",
+              first_page.headers.Get("Link"));
+    EXPECT_EQ("0003\n0004\n0005\n", HTTP(GET(base_url + "/api/data/user?limit=3&cursor=0002")).body);
+
+    const auto last_page = HTTP(GET(base_url + "/api/data/user?limit=3&cursor=2496"));
+    EXPECT_EQ("2497\n2498\n2499\n", last_page.body);
+    EXPECT_FALSE(last_page.headers.Has("Link"));
+
+    // The cursor stays valid after its entry is deleted.
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.user.Erase("0002"); }).Wait();
+    EXPECT_EQ("0003\n0004\n0005\n", HTTP(GET(base_url + "/api/data/user?limit=3&cursor=0002")).body);
+
+    const auto invalid_limit = HTTP(GET(base_url + "/api/data/user?limit=0"));
+    EXPECT_EQ(400, static_cast<int>(invalid_limit.code));
+    EXPECT_EQ("Invalid `limit`.\n", invalid_limit.body);
+
+    // With `?export`, the page lists the entries themselves.
+    const auto exported_page = HTTP(GET(base_url + "/api/data/user?limit=2&cursor=0003&export"));
+    const auto exported_lines = current::strings::Split<current::strings::ByLines>(exported_page.body);
+    ASSERT_EQ(2u, exported_lines.size());
+    EXPECT_EQ("0004", ParseJSON<SimpleUser>(exported_lines[0]).key);
+    EXPECT_EQ("User 5", ParseJSON<SimpleUser>(exported_lines[1]).name);
+
+    // The ordered dictionary resumes from any cursor, the unordered one only from a key it has had.
+    EXPECT_EQ("0003\n0004\n", HTTP(GET(base_url + "/api/data/user?limit=2&cursor=0002x")).body);
+    EXPECT_EQ("", HTTP(GET(base_url + "/api/data/user?limit=2&cursor=zzz")).body);
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.post.Add(SimplePost("p1", "Post one"));
+    }).Wait();
+    EXPECT_EQ(200, static_cast<int>(HTTP(GET(base_url + "/api/data/post?limit=2&cursor=p1")).code));
+    const auto invalid_cursor = HTTP(GET(base_url + "/api/data/post?limit=2&cursor=p2"));
+    EXPECT_EQ(400, static_cast<int>(invalid_cursor.code));
+    EXPECT_EQ("Invalid `cursor`.\n", invalid_cursor.body);
+
+    // Matrices are paginated too, by their composite keys.
+    const auto likes =
+        current::strings::Split<current::strings::ByLines>(HTTP(GET(base_url + "/api/data/like")).body);
+    ASSERT_EQ(3u, likes.size());
+    const auto likes_page = HTTP(GET(base_url + "/api/data/like?limit=2"));
+    EXPECT_EQ(likes[0] + '\n' + likes[1] + '\n', likes_page.body);
+    EXPECT_EQ(likes[2] + '\n', HTTP(GET(base_url + "/api/data/like?limit=2&cursor=" + likes[1])).body);
+    EXPECT_EQ(400, static_cast<int>(HTTP(GET(base_url + "/api/data/like?limit=2&cursor=nobody-beer")).code));
+    EXPECT_EQ(400, static_cast<int>(HTTP(GET(base_url + "/api/data/like?limit=2&cursor=max")).code));
+
+    // The whole collection can be streamed, in chunks, with the same lines as on its page.
+    const auto stream = HTTP(GET(base_url + "/api/data/user?stream"));
+    EXPECT_EQ(200, static_cast<int>(stream.code));
+    EXPECT_EQ(HTTP(GET(base_url + "/api/data/user")).body, stream.body);
+    const auto streamed_likes = HTTP(GET(base_url + "/api/data/like?stream")).body;
+    EXPECT_EQ(current::strings::Join(likes, '\n') + '\n', streamed_likes);
+
+    // And exported, as JSON lines.
+    const auto export_stream = HTTP(GET(base_url + "/api/data/user?stream&export"));
+    EXPECT_EQ(200, static_cast<int>(export_stream.code));
+    const auto lines = current::strings::Split<current::strings::ByLines>(export_stream.body);
+    ASSERT_EQ(2499u, lines.size());
+    EXPECT_EQ("0000", ParseJSON<SimpleUser>(lines.front()).key);
+    EXPECT_EQ("0003", ParseJSON<SimpleUser>(lines[2]).key);
+    EXPECT_EQ("2499", ParseJSON<SimpleUser>(lines.back()).key);
+  }
+
+  {
+    auto rest = RESTfulStorage<Storage, current::storage::rest::Hypermedia>(
+        storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+    const auto page = HTTP(GET(base_url + "/api/data/user?limit=2&cursor=0001"));
+    EXPECT_EQ(
+        "{\"success\":true,\"message\":null,\"error\":null,\"url\":\"http://unittest.current.ai/data/user\","
+        "\"data\":[\"http://unittest.current.ai/data/user/0003\","
+        "\"http://unittest.current.ai/data/user/0004\"]}\n",
+        page.body);
+    EXPECT_EQ("<http://unittest.current.ai/data/user?limit=2&cursor=0004>; rel=\"next\"",
+              page.headers.Get("Link"));
+    const auto invalid_cursor = HTTP(GET(base_url + "/api/data/post?limit=2&cursor=p2"));
+    EXPECT_EQ(400, static_cast<int>(invalid_cursor.code));
+    EXPECT_NE(std::string::npos, invalid_cursor.body.find("\"InvalidCursor\""));
+
+    const auto stream = HTTP(GET(base_url + "/api/data/user?stream")).body;
+    const auto lines = current::strings::Split<current::strings::ByLines>(stream);
+    ASSERT_EQ(2499u, lines.size());
+    EXPECT_EQ("http://unittest.current.ai/data/user/0000", lines.front());
+    EXPECT_EQ("http://unittest.current.ai/data/user/2499", lines.back());
+  }
+
+  {
+    auto rest = RESTfulStorage<Storage, current::storage::rest::AdvancedHypermedia>(
+        storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+    const auto stream = HTTP(GET(base_url + "/api/data/user?stream")).body;
+    const auto lines = current::strings::Split<current::strings::ByLines>(stream);
+    ASSERT_EQ(2499u, lines.size());
+    using record_t = current::storage::rest::AdvancedHypermediaRESTRecordResponse<SimpleUser>;
+    EXPECT_EQ("http://unittest.current.ai/data/user/0000", ParseJSON<record_t>(lines.front()).url);
+    EXPECT_EQ("User 2499", ParseJSON<record_t>(lines.back()).data.name);
+
+    // As the non-streamed export, the streamed one is only available off the followers.
+    const auto export_stream = HTTP(GET(base_url + "/api/data/user?stream&export"));
+    EXPECT_EQ(403, static_cast<int>(export_stream.code));
+    EXPECT_NE(std::string::npos, export_stream.body.find("\"NotFollowerMode\""));
+  }
+}
+
+TEST(TransactionalStorage, PaginationCursors) {
+  using namespace transactional_storage_test;
+  using current::storage::rest::ForEachAfter;
+  using current::storage::rest::PageResult;
+  using Storage = CompactTestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    // Enough cells for some of them to be compacted.
+    for (int row = 0; row < 500; row = (row < 8 ? row + 2 : std::max(row + 1, 100))) {
+      for (const char* col : {"a", "c", "e"}) {
+        fields.compact.Add(Cell(row, col, row));
+      }
+    }
+  }).Wait();
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.compact.Erase(4, "c");
+    fields.compact.Add(Cell(2, "b", 2));
+  }).Wait();
+
+  storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+    const auto page = [&fields](int32_t row, const std::string& col, size_t limit) {
+      const auto cursor = std::make_pair(row, col);
+      std::vector<std::string> keys;
+      const auto result = ForEachAfter(fields.compact, &cursor, limit, [&keys](const Cell& cell) {
+        keys.push_back(current::ToString(cell.row()) + '-' + cell.col());
+      });
+      return current::strings::Join(keys, ',') + (result == PageResult::HasMore ? ",..." : "");
+    };
+    // The compact matrix is ordered by `(row, col)`, so it resumes from any key, present or not.
+    EXPECT_EQ("2-b,2-c,...", page(2, "a", 2));
+    EXPECT_EQ("2-c,2-e,...", page(2, "bb", 2));
+    EXPECT_EQ("4-a,4-e,6-a,...", page(2, "e", 3));
+    EXPECT_EQ("4-e,...", page(4, "c", 1));
+    EXPECT_EQ("6-a,...", page(5, "a", 1));
+    EXPECT_EQ("0-a,...", page(-1, "z", 1));
+    EXPECT_EQ("8-e,100-a,...", page(8, "c", 2));
+    EXPECT_EQ("499-e", page(499, "c", 2));
+    EXPECT_EQ("", page(499, "e", 2));
+  }).Wait();
+}
+
+TEST(TransactionalStorage, RESTfulConditionalGET) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  current::time::SetNow(std::chrono::microseconds(10 * 1000 * 1000 + 42));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.user.Add(SimpleUser("max", "MZ")); })
+      .Wait();
+
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  auto rest = RESTfulStorage<Storage>(
+      storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+
+  const auto code = [&base_url](const std::string& path, const std::string& header, const std::string& value) {
+    return static_cast<int>(HTTP(GET(base_url + path).SetHeader(header, value)).code);
+  };
+
+  // Per-entry validators.
+  const auto entry = HTTP(GET(base_url + "/api/data/user/max"));
+  EXPECT_EQ(200, static_cast<int>(entry.code));
+  ASSERT_TRUE(entry.headers.Has("ETag"));
+  EXPECT_EQ("\"10000042\"", entry.headers.Get("ETag"));
+  EXPECT_EQ("Thu, 01 Jan 1970 00:00:10 GMT", entry.headers.Get("Last-Modified"));
+
+  const auto not_modified =
+      HTTP(GET(base_url + "/api/data/user/max").SetHeader("If-None-Match", "\"10000042\""));
+  EXPECT_EQ(304, static_cast<int>(not_modified.code));
+  EXPECT_EQ("", not_modified.body);
+  EXPECT_EQ("\"10000042\"", not_modified.headers.Get("ETag"));
+  EXPECT_EQ(304, code("/api/data/user/max", "If-None-Match", "\"1\", W/\"10000042\""));
+  EXPECT_EQ(304, code("/api/data/user/max", "If-None-Match", "*"));
+  EXPECT_EQ(200, code("/api/data/user/max", "If-None-Match", "\"1\""));
+
+  EXPECT_EQ(304, code("/api/data/user/max", "If-Modified-Since", "Thu, 01 Jan 1970 00:00:10 GMT"));
+  EXPECT_EQ(200, code("/api/data/user/max", "If-Modified-Since", "Thu, 01 Jan 1970 00:00:09 GMT"));
+  EXPECT_EQ(200, code("/api/data/user/max", "If-Modified-Since", "Not a date."));
+
+  // `If-None-Match` takes precedence over `If-Modified-Since`.
+  EXPECT_EQ(200,
+            static_cast<int>(HTTP(GET(base_url + "/api/data/user/max")
+                                      .SetHeader("If-None-Match", "\"1\"")
+                                      .SetHeader("If-Modified-Since", "Thu, 01 Jan 1970 00:00:10 GMT")).code));
+
+  const auto missing = HTTP(GET(base_url + "/api/data/user/dima").SetHeader("If-None-Match", "*"));
+  EXPECT_EQ(404, static_cast<int>(missing.code));
+  EXPECT_FALSE(missing.headers.Has("ETag"));
+
+  // The validator of the collection changes with every transaction.
+  const auto collection = HTTP(GET(base_url + "/api/data/user"));
+  EXPECT_EQ(200, static_cast<int>(collection.code));
+  const std::string collection_etag = collection.headers.Get("ETag");
+  EXPECT_EQ(304, code("/api/data/user", "If-None-Match", collection_etag));
+
+  current::time::SetNow(std::chrono::microseconds(20 * 1000 * 1000));
+  storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.user.Add(SimpleUser("dima", "DK")); })
+      .Wait();
+  const auto modified = HTTP(GET(base_url + "/api/data/user").SetHeader("If-None-Match", collection_etag));
+  EXPECT_EQ(200, static_cast<int>(modified.code));
+  EXPECT_NE(collection_etag, modified.headers.Get("ETag"));
+  EXPECT_EQ(2u, current::strings::Split<current::strings::ByLines>(modified.body).size());
+
+  // The entry itself has not changed.
+  EXPECT_EQ(304, code("/api/data/user/max", "If-None-Match", "\"10000042\""));
+}
+
+TEST(TransactionalStorage, RESTfulCollectionETagIsAFunctionOfContents) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "etag_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  const auto collection_etag = [&base_url]() {
+    return HTTP(GET(base_url + "/api/data/user")).headers.Get("ETag");
+  };
+
+  std::string etag;
+  {
+    Storage storage(persistence_file_name);
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.user.Add(SimpleUser("max", "MZ"));
+    }).Wait();
+    auto rest = RESTfulStorage<Storage>(
+        storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+    etag = collection_etag();
+
+    // The rolled back transaction does not change the contents, and thus the validator.
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.user.Add(SimpleUser("dima", "DK"));
+      CURRENT_STORAGE_THROW_ROLLBACK();
+    }).Wait();
+    EXPECT_EQ(etag, collection_etag());
+    EXPECT_EQ(304,
+              static_cast<int>(HTTP(GET(base_url + "/api/data/user").SetHeader("If-None-Match", etag)).code));
+
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.user.Add(SimpleUser("dima", "DK"));
+    }).Wait();
+    EXPECT_NE(etag, collection_etag());
+    etag = collection_etag();
+  }
+
+  // After a restart, the same contents have the same validator.
+  {
+    Storage storage(persistence_file_name);
+    auto rest = RESTfulStorage<Storage>(
+        storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+    EXPECT_EQ(etag, collection_etag());
+    EXPECT_EQ(304,
+              static_cast<int>(HTTP(GET(base_url + "/api/data/user").SetHeader("If-None-Match", etag)).code));
+    storage.ReadWriteTransaction([](MutableFields<Storage> fields) { fields.user.Erase("dima"); }).Wait();
+    EXPECT_EQ(200,
+              static_cast<int>(HTTP(GET(base_url + "/api/data/user").SetHeader("If-None-Match", etag)).code));
+  }
+}
+
+TEST(TransactionalStorage, FollowerReadYourWrites) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockInMemoryStreamPersister>;
+  using transaction_t = typename Storage::transaction_t;
+  using sherlock_t = current::sherlock::Stream<transaction_t, current::persistence::Memory>;
+
+  struct StreamReplicatorImpl {
+    using EntryResponse = current::ss::EntryResponse;
+    using TerminationResponse = current::ss::TerminationResponse;
+    using publisher_t = typename sherlock_t::publisher_t;
+
+    StreamReplicatorImpl(sherlock_t& stream) : stream_(stream) { stream.MovePublisherTo(*this); }
+    ~StreamReplicatorImpl() { stream_.AcquirePublisher(std::move(publisher_)); }
+
+    void AcceptPublisher(std::unique_ptr<publisher_t> publisher) { publisher_ = std::move(publisher); }
+
+    EntryResponse operator()(const transaction_t& transaction, idxts_t current, idxts_t) {
+      publisher_->Publish(transaction, current.us);
+      return EntryResponse::More;
+    }
+
+    EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return EntryResponse::More; }
+    TerminationResponse Terminate() const { return TerminationResponse::Terminate; }
+
+   private:
+    sherlock_t& stream_;
+    std::unique_ptr<publisher_t> publisher_;
+  };
+  using StreamReplicator = current::ss::StreamSubscriber<StreamReplicatorImpl, transaction_t>;
+
+  sherlock_t follower_stream;
+  auto replicator = std::make_unique<StreamReplicator>(follower_stream);
+
+  Storage master_storage;
+  Storage follower_storage(follower_stream);
+  EXPECT_EQ(0u, follower_storage.StreamIndex());
+
+  // Many small transactions, for the follower to apply them in batches.
+  for (int i = 0; i < 1000; ++i) {
+    current::time::SetNow(std::chrono::microseconds(1000 + i));
+    master_storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+      fields.user.Add(SimpleUser(current::strings::Printf("%04d", i), "User"));
+    }).Wait();
+  }
+  EXPECT_EQ(1000u, master_storage.StreamIndex());
+
+  // The follower does not have the data yet.
+  EXPECT_FALSE(follower_storage.WaitForStreamIndex(1u, std::chrono::milliseconds(1)));
+
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  auto master_rest = RESTfulStorage<Storage>(
+      master_storage, FLAGS_transactional_storage_test_port, "/master", "http://unittest.current.ai");
+  auto follower_rest = RESTfulStorage<Storage>(
+      follower_storage, FLAGS_transactional_storage_test_port, "/follower", "http://unittest.current.ai");
+
+  const auto replicator_scope =
+      master_storage.InternalExposeStream().template Subscribe<transaction_t>(*replicator);
+
+  // The write to the master returns the token.
+  current::time::SetNow(std::chrono::microseconds(10000));
+  const auto post = HTTP(POST(base_url + "/master/data/user", SimpleUser("max", "MZ")));
+  EXPECT_EQ(201, static_cast<int>(post.code));
+  ASSERT_TRUE(post.headers.Has("X-Current-Storage-Index"));
+  const std::string token = post.headers.Get("X-Current-Storage-Index");
+  EXPECT_EQ("1001", token);
+
+  // The read from the follower with the token reflects the write. Until the follower catches up, the request
+  // fails fast, to be retried.
+  const auto get_with_token = [&]() {
+    return HTTP(
+        GET(base_url + "/follower/data/user/" + post.body).SetHeader("X-Current-Storage-Min-Index", token));
+  };
+  auto get = get_with_token();
+  while (static_cast<int>(get.code) == 503) {
+    EXPECT_TRUE(get.headers.Has("Retry-After"));
+    get = get_with_token();
+  }
+  EXPECT_EQ(200, static_cast<int>(get.code));
+  EXPECT_EQ("MZ", ParseJSON<SimpleUser>(get.body).name);
+  EXPECT_GE(follower_storage.StreamIndex(), 1001u);
+
+  // The index not reached in time is reported right away, without holding the request for long.
+  {
+    const auto far_future = HTTP(
+        GET(base_url + "/follower/data/user/" + post.body).SetHeader("X-Current-Storage-Min-Index", "999999"));
+    EXPECT_EQ(503, static_cast<int>(far_future.code));
+    ASSERT_TRUE(far_future.headers.Has("Retry-After"));
+    EXPECT_EQ("1", far_future.headers.Get("Retry-After"));
+  }
+
+  // The malformed index is rejected, rather than taken as zero.
+  for (const std::string& malformed : {"", "abc", "-1", "12x", "1.5"}) {
+    EXPECT_EQ(400,
+              static_cast<int>(HTTP(GET(base_url + "/follower/data/user/" + post.body)
+                                        .SetHeader("X-Current-Storage-Min-Index", malformed)).code))
+        << malformed;
+  }
+
+  follower_storage.WaitForStreamIndex(1001u);
+  EXPECT_EQ(1001u, follower_storage.TransactionsCount());
+  EXPECT_EQ(1001u,
+            Value(follower_storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+              return fields.user.Size();
+            }).Go()));
+}
+
+TEST(TransactionalStorage, BinaryJournal) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using JSONStorage = TestStorage<SherlockStreamPersister>;
+  using BinaryStorage = TestStorage<SherlockBinaryStreamPersister>;
+
+  const std::string json_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "binary_journal_json");
+  const std::string binary_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "binary_journal_binary");
+  const auto json_file_remover = current::FileSystem::ScopedRmFile(json_file_name);
+  const auto binary_file_remover = current::FileSystem::ScopedRmFile(binary_file_name);
+
+  const int N = 1000;
+  {
+    JSONStorage storage(json_file_name);
+    for (int i = 0; i < N; ++i) {
+      storage.ReadWriteTransaction([i](MutableFields<JSONStorage> fields) {
+        fields.d.Add(Record{current::ToString(i % 100), i});
+        fields.umany_to_umany.Add(Cell{i % 11, current::ToString(i % 7), i});
+      }).Wait();
+    }
+    storage.ReadWriteTransaction([](MutableFields<JSONStorage> fields) { fields.d.Erase("42"); }).Wait();
+  }
+
+  EXPECT_EQ(static_cast<uint64_t>(N + 1),
+            current::storage::persister::ConvertJournalToBinary<JSONStorage>(json_file_name, binary_file_name));
+  EXPECT_LT(current::FileSystem::ReadFileAsString(binary_file_name).length(),
+            current::FileSystem::ReadFileAsString(json_file_name).length());
+
+  const auto verify = [](ImmutableFields<BinaryStorage> fields) {
+    EXPECT_EQ(99u, fields.d.Size());
+    EXPECT_FALSE(Exists(fields.d["42"]));
+    EXPECT_EQ(999, Value(fields.d["99"]).rhs);
+    EXPECT_EQ(77u, fields.umany_to_umany.Size());
+  };
+
+  {
+    BinaryStorage storage(binary_file_name);
+    EXPECT_EQ(static_cast<uint64_t>(N + 1), storage.InternalExposeStream().InternalExposePersister().Size());
+    storage.ReadOnlyTransaction(verify).Wait();
+    storage.ReadWriteTransaction([](MutableFields<BinaryStorage> fields) { fields.d.Add(Record{"42", 42}); })
+        .Wait();
+  }
+
+  {
+    // The binary journal, appended to, is replayed, and is converted back into the same text journal.
+    BinaryStorage storage(binary_file_name);
+    EXPECT_EQ(static_cast<uint64_t>(N + 2), storage.InternalExposeStream().InternalExposePersister().Size());
+    storage.ReadOnlyTransaction([](ImmutableFields<BinaryStorage> fields) {
+      EXPECT_EQ(100u, fields.d.Size());
+      EXPECT_EQ(42, Value(fields.d["42"]).rhs);
+    }).Wait();
+  }
+
+  const std::string json_again_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "binary_journal_json_again");
+  const auto json_again_file_remover = current::FileSystem::ScopedRmFile(json_again_file_name);
+  EXPECT_EQ(static_cast<uint64_t>(N + 2),
+            current::storage::persister::ConvertJournalToJSON<BinaryStorage>(binary_file_name,
+                                                                            json_again_file_name));
+  const std::string json = current::FileSystem::ReadFileAsString(json_file_name);
+  EXPECT_EQ(json, current::FileSystem::ReadFileAsString(json_again_file_name).substr(0, json.length()));
+}
@@ -25,7 +25,12 @@ SOFTWARE.
 #ifndef CURRENT_STORAGE_TRANSACTION_POLICY_H
 #define CURRENT_STORAGE_TRANSACTION_POLICY_H
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include "base.h"
 #include "exceptions.h"
@@ -45,6 +50,9 @@ class Synchronous final {
  public:
   using transaction_t = typename PERSISTER::transaction_t;
 
+  // Each transaction is run before `Transaction()` returns.
+  constexpr static bool kDefersReadWriteTransactions = false;
+
   Synchronous(std::mutex& storage_mutex, PERSISTER& persister, MutationJournal& journal)
       : storage_mutex_ref_(storage_mutex), persister_(persister), journal_(journal) {}
 
@@ -315,6 +323,330 @@ class Synchronous final {
   bool destructing_ = false;
 };
 
+// The `Asynchronous` transaction policy runs read-write transactions in a dedicated writer thread.
+//
+// `ReadWriteTransaction()` enqueues the transaction and returns immediately. The writer thread drains the queue
+// in batches: it runs each transaction of the batch under the storage mutex, and group-commits the mutations
+// of all the committed transactions of the batch as a single entry published into the persister. The futures
+// are fulfilled only after the batch has been persisted, so a resolved future means a durable transaction.
+//
+// The meta of the persisted entry spans the whole batch: `begin_us` of its first transaction, `end_us` of its
+// last one, and the union of their meta fields, the later transactions taking precedence.
+//
+// The lambdas passed to `ReadWriteTransaction()` outlive the call. They are moved into the enqueued
+// transaction, or copied if passed as lvalues.
+// Read-only transactions are run synchronously, under the storage mutex, in the thread of the caller.
+template <class PERSISTER>
+class Asynchronous final {
+ public:
+  using transaction_t = typename PERSISTER::transaction_t;
+
+  // The read-write transactions are run later, from the writer thread.
+  constexpr static bool kDefersReadWriteTransactions = true;
+
+  // The maximum number of transactions to group-commit into a single persisted entry.
+  constexpr static size_t kMaxTransactionsPerBatch = 1024u;
+
+  Asynchronous(std::mutex& storage_mutex, PERSISTER& persister, MutationJournal& journal)
+      : storage_mutex_ref_(storage_mutex),
+        persister_(persister),
+        journal_(journal),
+        read_only_transactions_(storage_mutex, persister, journal),
+        writer_thread_([this]() { WriterThread(); }) {}
+
+  // Transactions enqueued before the destruction are run and persisted.
+  ~Asynchronous() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      destructing_ = true;
+    }
+    queue_condition_variable_.notify_one();
+    writer_thread_.join();
+  }
+
+  template <typename F>
+  using f_result_t = typename std::result_of<F()>::type;
+
+  // Read-write transaction.
+  template <typename F>
+  Future<TransactionResult<f_result_t<F>>, StrictFuture::Strict> Transaction(F&& f) {
+    using result_t = f_result_t<F>;
+    std::unique_ptr<ReadWriteTransaction<typename std::decay<F>::type, result_t>> transaction =
+        std::make_unique<ReadWriteTransaction<typename std::decay<F>::type, result_t>>(std::forward<F>(f));
+    Future<TransactionResult<result_t>, StrictFuture::Strict> future(transaction->promise.get_future());
+    Enqueue(std::move(transaction));
+    return future;
+  }
+
+  // Read-write two-step transaction. Just as with `Synchronous`, `f2` is called once the result of `f1`
+  // is persisted, from the writer thread.
+  template <typename F1, typename F2, class = std::enable_if_t<!std::is_void<f_result_t<F1>>::value>>
+  Future<TransactionResult<void>, StrictFuture::Strict> Transaction(F1&& f1, F2&& f2) {
+    using two_step_t = TwoStepReadWriteTransaction<typename std::decay<F1>::type,
+                                                   typename std::decay<F2>::type,
+                                                   f_result_t<F1>>;
+    std::unique_ptr<two_step_t> transaction =
+        std::make_unique<two_step_t>(std::forward<F1>(f1), std::forward<F2>(f2));
+    Future<TransactionResult<void>, StrictFuture::Strict> future(transaction->promise.get_future());
+    Enqueue(std::move(transaction));
+    return future;
+  }
+
+  // Read-only transactions.
+  template <typename... FS>
+  auto Transaction(FS&&... fs) const -> decltype(std::declval<const Synchronous<PERSISTER>&>().Transaction(
+      std::forward<FS>(fs)...)) {
+    return read_only_transactions_.Transaction(std::forward<FS>(fs)...);
+  }
+
+  void GracefulShutdown() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      graceful_shutdown_ = true;
+    }
+    read_only_transactions_.GracefulShutdown();
+  }
+
+ private:
+  struct EnqueuedTransaction {
+    virtual ~EnqueuedTransaction() = default;
+    // Called from the writer thread, under the storage mutex. Returns `true` if the transaction is to be
+    // committed, otherwise the journal is rolled back, and the promise is fulfilled.
+    virtual bool Run(MutationJournal& journal) = 0;
+    // Called from the writer thread, once the batch containing the transaction has been persisted.
+    virtual void Committed() = 0;
+    // Called if the transaction was not run, as the storage is shutting down.
+    virtual void Rejected() = 0;
+  };
+
+  template <typename PROMISE>
+  static void SetCurrentException(PROMISE& promise) {
+    // LCOV_EXCL_START
+    try {
+      promise.set_exception(std::current_exception());
+    } catch (const std::exception& e) {
+      std::cerr << "`promise.set_exception()` failed in Asynchronous::Transaction: " << e.what() << std::endl;
+      std::exit(-1);
+    }
+    // LCOV_EXCL_STOP
+  }
+
+  template <typename F, typename RESULT>
+  struct ReadWriteTransaction final : EnqueuedTransaction {
+    F f;
+    // Set once `f` has returned, so that `RESULT` does not have to be default-constructible.
+    std::unique_ptr<RESULT> f_result;
+    std::promise<TransactionResult<RESULT>> promise;
+
+    template <typename FF>
+    explicit ReadWriteTransaction(FF&& f) : f(std::forward<FF>(f)) {}
+
+    bool Run(MutationJournal& journal) override {
+      try {
+        journal.BeforeTransaction();
+        f_result = std::make_unique<RESULT>(f());
+        journal.AfterTransaction();
+        return true;
+      } catch (StorageRollbackExceptionWithValue<RESULT> e) {
+        journal.Rollback();
+        promise.set_value(TransactionResult<RESULT>::RolledBack(std::move(e.value)));
+      } catch (StorageRollbackExceptionWithNoValue) {
+        journal.Rollback();
+        promise.set_value(TransactionResult<RESULT>::RolledBack(OptionalResultMissing()));
+      } catch (...) {  // The exception is captured with `std::current_exception()`.
+        journal.Rollback();
+        SetCurrentException(promise);
+      }
+      return false;
+    }
+
+    void Committed() override { promise.set_value(TransactionResult<RESULT>::Committed(std::move(*f_result))); }
+
+    void Rejected() override {
+      promise.set_exception(std::make_exception_ptr(StorageInGracefulShutdownException()));
+    }
+  };
+
+  template <typename F>
+  struct ReadWriteTransaction<F, void> final : EnqueuedTransaction {
+    F f;
+    std::promise<TransactionResult<void>> promise;
+
+    template <typename FF>
+    explicit ReadWriteTransaction(FF&& f) : f(std::forward<FF>(f)) {}
+
+    bool Run(MutationJournal& journal) override {
+      try {
+        journal.BeforeTransaction();
+        f();
+        journal.AfterTransaction();
+        return true;
+      } catch (StorageRollbackExceptionWithNoValue) {
+        journal.Rollback();
+        promise.set_value(TransactionResult<void>::RolledBack(OptionalResultExists()));
+      } catch (...) {  // The exception is captured with `std::current_exception()`.
+        journal.Rollback();
+        SetCurrentException(promise);
+      }
+      return false;
+    }
+
+    void Committed() override { promise.set_value(TransactionResult<void>::Committed(OptionalResultExists())); }
+
+    void Rejected() override {
+      promise.set_exception(std::make_exception_ptr(StorageInGracefulShutdownException()));
+    }
+  };
+
+  template <typename F1, typename F2, typename RESULT>
+  struct TwoStepReadWriteTransaction final : EnqueuedTransaction {
+    F1 f1;
+    F2 f2;
+    // Set once `f1` has returned, as in `ReadWriteTransaction` above.
+    std::unique_ptr<RESULT> f1_result;
+    std::promise<TransactionResult<void>> promise;
+
+    template <typename FF1, typename FF2>
+    TwoStepReadWriteTransaction(FF1&& f1, FF2&& f2) : f1(std::forward<FF1>(f1)), f2(std::forward<FF2>(f2)) {}
+
+    bool Run(MutationJournal& journal) override {
+      try {
+        journal.BeforeTransaction();
+        f1_result = std::make_unique<RESULT>(f1());
+        journal.AfterTransaction();
+        return true;
+      } catch (StorageRollbackExceptionWithValue<RESULT> e) {
+        // Transaction was rolled back, but returned a value, which we try to pass again to `f2`.
+        journal.Rollback();
+        try {
+          f2(std::move(e.value));
+          promise.set_value(TransactionResult<void>::RolledBack(OptionalResultMissing()));
+        } catch (...) {  // The exception is captured with `std::current_exception()`.
+          SetCurrentException(promise);
+        }
+      } catch (StorageRollbackExceptionWithNoValue) {
+        // Transaction was rolled back and returned nothing we can pass to `f2`.
+        journal.Rollback();
+        promise.set_value(TransactionResult<void>::RolledBack(OptionalResultMissing()));
+      } catch (...) {  // The exception is captured with `std::current_exception()`.
+        journal.Rollback();
+        SetCurrentException(promise);
+      }
+      return false;
+    }
+
+    void Committed() override {
+      try {
+        f2(std::move(*f1_result));
+        promise.set_value(TransactionResult<void>::Committed(OptionalResultExists()));
+      } catch (...) {  // The exception is captured with `std::current_exception()`.
+        SetCurrentException(promise);
+      }
+    }
+
+    void Rejected() override {
+      promise.set_exception(std::make_exception_ptr(StorageInGracefulShutdownException()));
+    }
+  };
+
+  void Enqueue(std::unique_ptr<EnqueuedTransaction> transaction) {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      if (!destructing_ && !graceful_shutdown_) {
+        queue_.push_back(std::move(transaction));
+      }
+    }
+    if (transaction) {
+      transaction->Rejected();
+    } else {
+      queue_condition_variable_.notify_one();
+    }
+  }
+
+  void WriterThread() {
+    std::vector<std::unique_ptr<EnqueuedTransaction>> batch;
+    std::vector<EnqueuedTransaction*> committed;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_condition_variable_.wait(lock, [this]() { return destructing_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        while (!queue_.empty() && batch.size() < kMaxTransactionsPerBatch) {
+          batch.push_back(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+        for (auto& transaction : batch) {
+          journal_.AssertEmpty();
+          if (transaction->Run(journal_)) {
+            AppendJournalToBatch();
+            committed.push_back(transaction.get());
+          }
+        }
+        PersistBatch();
+      }
+      for (EnqueuedTransaction* transaction : committed) {
+        transaction->Committed();
+      }
+      committed.clear();
+      batch.clear();
+    }
+  }
+
+  // Moves the mutations of the just completed transaction into `batch_journal_`.
+  // Called under the storage mutex.
+  void AppendJournalToBatch() {
+    if (!journal_.commit_log.empty()) {
+      TransactionMeta& meta = batch_journal_.transaction_meta;
+      if (batch_journal_.commit_log.empty()) {
+        meta.begin_us = journal_.transaction_meta.begin_us;
+      }
+      meta.end_us = journal_.transaction_meta.end_us;
+      for (auto& field : journal_.transaction_meta.fields) {
+        meta.fields[field.first] = std::move(field.second);
+      }
+      for (auto& entry : journal_.commit_log) {
+        batch_journal_.commit_log.push_back(std::move(entry));
+      }
+    }
+    journal_.Clear();
+  }
+
+  void PersistBatch() {
+    try {
+      persister_.PersistJournal(batch_journal_);
+    } catch (const persistence::InconsistentTimestampException& e) {
+      std::cerr << "PersistJournal() failed with InconsistentTimestampException: " << e.what() << std::endl;
+#ifdef CURRENT_MOCK_TIME
+      std::cerr << "Binary is compiled with `CURRENT_MOCK_TIME`. Probably `SetNow()` wasn't properly called."
+                << std::endl;
+#endif
+      std::exit(-1);
+    } catch (const std::exception& e) {
+      std::cerr << "PersistJournal() failed with exception: " << e.what() << std::endl;
+      std::exit(-1);
+    }
+  }
+
+  std::mutex& storage_mutex_ref_;
+  PERSISTER& persister_;
+  MutationJournal& journal_;
+  MutationJournal batch_journal_;
+  Synchronous<PERSISTER> read_only_transactions_;
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_condition_variable_;
+  std::deque<std::unique_ptr<EnqueuedTransaction>> queue_;
+  bool destructing_ = false;
+  bool graceful_shutdown_ = false;
+
+  std::thread writer_thread_;
+};
+
 }  // namespace transaction_policy
 }  // namespace storage
 }  // namespace current
@@ -28,6 +28,7 @@ SOFTWARE.
 
 #include "../../port.h"
 
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -204,6 +204,42 @@ TEST(Serialization, Binary) {
   }
 }
 
+TEST(Serialization, VariantAsBinary) {
+  using namespace serialization_test;
+
+  std::ostringstream os;
+  SaveIntoBinary(os, ContainsVariant());
+  {
+    ContainsVariant object;
+    object.variant = std::make_unique<Serializable>(42);
+    SaveIntoBinary(os, object);
+  }
+  {
+    ComplexSerializable complex_object;
+    complex_object.j = 43;
+    complex_object.q = "bar";
+    complex_object.v.push_back("one");
+    ContainsVariant object;
+    object.variant = std::move(complex_object);
+    SaveIntoBinary(os, object);
+  }
+
+  std::istringstream is(os.str());
+  EXPECT_FALSE(Exists(LoadFromBinary<ContainsVariant>(is).variant));
+  {
+    const ContainsVariant object = LoadFromBinary<ContainsVariant>(is);
+    ASSERT_TRUE(Exists<Serializable>(object.variant));
+    EXPECT_EQ(42ull, Value<Serializable>(object.variant).i);
+  }
+  {
+    const ContainsVariant object = LoadFromBinary<ContainsVariant>(is);
+    ASSERT_TRUE(Exists<ComplexSerializable>(object.variant));
+    EXPECT_EQ(43ull, Value<ComplexSerializable>(object.variant).j);
+    EXPECT_EQ("bar", Value<ComplexSerializable>(object.variant).q);
+    ASSERT_EQ(1u, Value<ComplexSerializable>(object.variant).v.size());
+  }
+}
+
 TEST(Serialization, JSON) {
   using namespace serialization_test;
 
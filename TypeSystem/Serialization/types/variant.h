@@ -410,10 +410,115 @@ struct LoadFromJSONImpl<T, J, ENABLE_IF<IS_VARIANT(T)>> {
 }  // namespace load
 }  // namespace json
 
+// Binary format for `Variant` objects: the `bool` whether the object exists, and, if it does,
+// the TypeID of the actual type, followed by the object itself.
 namespace binary {
+namespace save {
+
+template <typename T>
+struct SaveIntoBinaryImpl<T, ENABLE_IF<IS_VARIANT(T)>> {
+  class SaveVariant {
+   public:
+    explicit SaveVariant(std::ostream& ostream) : ostream_(ostream) {}
+
+    template <typename X>
+    ENABLE_IF<IS_CURRENT_STRUCT_OR_VARIANT(X)> operator()(const X& object) {
+      using namespace ::current::reflection;
+      SaveIntoBinaryImpl<TypeID>::Save(ostream_, Value<ReflectedTypeBase>(Reflector().ReflectType<X>()).type_id);
+      SaveIntoBinaryImpl<X>::Save(ostream_, object);
+    }
+
+   private:
+    std::ostream& ostream_;
+  };
+
+  static void Save(std::ostream& ostream, const T& value) {
+    const bool exists = Exists(value);
+    SaveIntoBinaryImpl<bool>::Save(ostream, exists);
+    if (exists) {
+      SaveVariant impl(ostream);
+      value.Call(impl);
+    }
+  }
+};
+
+}  // namespace save
+
+namespace load {
+
+using current::ThreadLocalSingleton;
+
+template <typename VARIANT>
+struct LoadVariantBinary {
+  class Impl {
+   public:
+    Impl() {
+      current::metaprogramming::combine<current::metaprogramming::map<Registerer, typename VARIANT::typelist_t>>
+          bulk_deserializers_registerer;
+      bulk_deserializers_registerer.DispatchToAll(std::ref(deserializers_));
+    }
+
+    void DoLoadVariant(std::istream& istream, VARIANT& destination) const {
+      using namespace ::current::reflection;
+      TypeID type_id;
+      LoadFromBinaryImpl<TypeID>::Load(istream, type_id);
+      const auto cit = deserializers_.find(type_id);
+      if (cit != deserializers_.end()) {
+        cit->second->Deserialize(istream, destination);
+      } else {
+        // LCOV_EXCL_START
+        throw BinaryLoadFromStreamException("TypeID " + current::ToString(type_id) + " not in the variant type list.");
+        // LCOV_EXCL_STOP
+      }
+    }
+
+   private:
+    struct GenericDeserializer {
+      virtual ~GenericDeserializer() = default;
+      virtual void Deserialize(std::istream& istream, VARIANT& destination) = 0;
+    };
+
+    template <typename X>
+    struct TypedDeserializer : GenericDeserializer {
+      void Deserialize(std::istream& istream, VARIANT& destination) override {
+        destination = std::make_unique<X>();
+        LoadFromBinaryImpl<X>::Load(istream, Value<X>(destination));
+      }
+    };
 
-// TODO(mzhurovich): Implement it.
+    using deserializers_map_t =
+        std::unordered_map<::current::reflection::TypeID,
+                           std::unique_ptr<GenericDeserializer>,
+                           ::current::CurrentHashFunction<::current::reflection::TypeID>>;
+    deserializers_map_t deserializers_;
 
+    template <typename X>
+    struct Registerer {
+      void DispatchToAll(deserializers_map_t& deserializers) {
+        using namespace ::current::reflection;
+        deserializers[Value<ReflectedTypeBase>(Reflector().ReflectType<X>()).type_id] =
+            std::make_unique<TypedDeserializer<X>>();
+      }
+    };
+  };
+
+  static const Impl& Instance() { return ThreadLocalSingleton<Impl>(); }
+};
+
+template <typename T>
+struct LoadFromBinaryImpl<T, ENABLE_IF<IS_VARIANT(T)>> {
+  static void Load(std::istream& istream, T& destination) {
+    bool exists;
+    LoadFromBinaryImpl<bool>::Load(istream, exists);
+    if (exists) {
+      LoadVariantBinary<T>::Instance().DoLoadVariant(istream, destination);
+    } else {
+      destination = nullptr;
+    }
+  }
+};
+
+}  // namespace load
 }  // namespace binary
 }  // namespace serialization
 }  // namespace current